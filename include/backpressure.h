@@ -0,0 +1,79 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#if !defined(_BACKPRESSURE_H_)
+#define _BACKPRESSURE_H_
+
+#include <stdint.h>
+
+#define MAX_BACKPRESSURE_POOLS          4
+#define MAX_BACKPRESSURE_SOURCES        16
+
+// pool occupancy that starts each step of the drop ladder
+#define BACKPRESSURE_NONREF_PERCENT     75
+#define BACKPRESSURE_GOP_PERCENT        90
+
+#define BACKPRESSURE_LEVEL_NONE         0
+#define BACKPRESSURE_LEVEL_NONREF       1
+#define BACKPRESSURE_LEVEL_GOP          2
+
+// what to do with a video frame
+#define BACKPRESSURE_KEEP               0
+#define BACKPRESSURE_DROP               1
+// keep it, it is the first frame after dropped gops so it starts a discontinuity
+#define BACKPRESSURE_RESUME             2
+
+// counted actions
+#define BACKPRESSURE_NONREF_DROPPED     0
+#define BACKPRESSURE_GOP_DROPPED        1
+#define BACKPRESSURE_GOP_FRAMES_DROPPED 2
+#define BACKPRESSURE_VIDEO_DROPPED      3
+#define BACKPRESSURE_AUDIO_DROPPED      4
+#define BACKPRESSURE_SYNC_DROPPED       5
+#define BACKPRESSURE_UPLOAD_SKIPPED     6
+#define BACKPRESSURE_DISCONTINUITY      7
+#define BACKPRESSURE_SIGNAL_DROPPED     8
+#define MAX_BACKPRESSURE_ACTIONS        9
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+    void *backpressure_create(void);
+    int backpressure_destroy(void *backpressure);
+    // pools whose occupancy drives the drop ladder
+    int backpressure_watch_pool(void *backpressure, void *pool);
+    int backpressure_level(void *backpressure);
+    // decides on each video frame of a source before any buffer is taken for it,
+    // only the thread delivering that source may call it
+    int backpressure_video_frame(void *backpressure, int source, int64_t bitrate, int sync_frame, int reference);
+    // a video frame of the source could not be buffered, the rest of its gop is dropped too
+    int backpressure_video_lost(void *backpressure, int source);
+    void backpressure_count(void *backpressure, int action);
+    int backpressure_counts(void *backpressure, int64_t *counts);
+    const char *backpressure_action_name(int action);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // _BACKPRESSURE_H_
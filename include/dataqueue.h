@@ -28,6 +28,8 @@
 #include <unistd.h>
 
 #define MAX_SMALLBUF_SIZE 256
+#define SPSC_QUEUE_ENTRIES 1024
+#define QUEUE_WAIT_TIMEOUT 100
 
 typedef struct _dataqueue_message_struct_ {
         int             buffer_type;
@@ -62,10 +64,15 @@ extern "C" {
 #endif
 
     void *dataqueue_create();
+    // lock-free ring for queues with exactly one producer and one consumer thread,
+    // spills into the locked list when full
+    void *dataqueue_create_spsc(int entries);
     int dataqueue_destroy(void *queue);
     int dataqueue_get_size(void *queue);
     int dataqueue_put_front(void *queue, dataqueue_message_struct *message);
     dataqueue_message_struct *dataqueue_take_back(void *queue);
+    // sleeps until a message arrives or timeout_ms passes (-1 waits forever)
+    dataqueue_message_struct *dataqueue_take_back_wait(void *queue, int timeout_ms);
 
 #if defined(__cplusplus)
 }
@@ -50,6 +50,8 @@
 #define SIGNAL_ENCODE_ERROR          0x15
 #define SIGNAL_PARSE_ERROR           0x16
 #define SIGNAL_MALFORMED_DATA        0x17
+#define SIGNAL_BACKPRESSURE          0x18
+#define SIGNAL_SYNC_RECOVERY         0x19
 
 #define SIGNAL_DIRECT_ERROR_AVSYNC   0xe0
 #define SIGNAL_DIRECT_ERROR_MSGPOOL  0xe1
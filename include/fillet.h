@@ -36,6 +36,7 @@
 #include <sys/stat.h>
 #include <sys/poll.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <math.h>
@@ -43,7 +44,10 @@
 #include "fgetopt.h"
 #include "dataqueue.h"
 #include "mempool.h"
+#include "backpressure.h"
+#include "framesync.h"
 #include "udpsource.h"
+#include "nalscan.h"
 #include "tsdecode.h"
 #include "mp4core.h"
 
@@ -53,11 +57,18 @@
 #define MAX_VIDEO_SOURCES          8
 #define MAX_FRAME_DATA_SYNC_AUDIO  2048
 #define MAX_FRAME_DATA_SYNC_VIDEO  1024
+#define MAX_SYNC_VIDEO_QUEUES      MAX_MUX_SOURCES
+#define MAX_SYNC_AUDIO_QUEUES      (MAX_MUX_SOURCES*MAX_AUDIO_STREAMS)
 #define MAX_MUX_SOURCES            10
 #define MAX_TRANS_OUTPUTS          MAX_VIDEO_SOURCES
 #define MAX_VIDEO_MUX_BUFFER       1024*1024*4
 #define MAX_AUDIO_MUX_BUFFER       1024*64
-#define MAX_VIDEO_PES_BUFFER       1024*1024*4
+// a ts frame is a list of packed ts headers interleaved with pieces of the pes header and the frame
+#define MAX_MUX_PACKETS            (MAX_VIDEO_MUX_BUFFER/188)
+#define MIN_MUX_PACKETS            64
+#define MUX_HEADER_BUFFER_SIZE(p)  ((p)*4+188*3)
+#define MUX_IOV_COUNT(p)           ((p)*2+4)
+#define MAX_PES_HEADER             32
 #define MAX_TEXT_BUFFER            1024*1024
 #define MAX_WINDOW_SIZE            25
 #define MIN_WINDOW_SIZE            3
@@ -65,9 +76,19 @@
 #define MAX_SEGMENT_LENGTH         10
 #define MIN_SEGMENT_LENGTH         1
 #define DEFAULT_SEGMENT_LENGTH     5
+// how long the sync stage holds a frame for later frames of other sources, in ms
+#define MAX_SYNC_LATENCY           1000
+#define MIN_SYNC_LATENCY           0
+#define DEFAULT_SYNC_LATENCY       300
+// how often pat/pmt are repeated inside a ts segment, in ms- 0 repeats them on every frame
+#define MAX_PSI_INTERVAL           1000
+#define MIN_PSI_INTERVAL           0
+#define DEFAULT_PSI_INTERVAL       100
 #define MAX_ROLLOVER_SIZE          128
 #define MIN_ROLLOVER_SIZE          32
 #define OVERFLOW_DTS               8589100000
+// an encoder timestamp that moves back or more than this far (90khz) came from a sync recovery
+#define SINK_DISCONTINUITY_GAP     90000
 #define MAX_SESSIONS               5
 #define MAX_SOURCES                8
 #define TBD                        0xff
@@ -83,6 +104,14 @@
 #define MAX_AUDIO_RAW_BUFFERS             2048
 #define MAX_AUDIO_RAW_BUFFER_SIZE         0
 
+// compressed frame slabs, bitrates in kbps
+#define DEFAULT_SLAB_VIDEO_BITRATE        12000
+#define DEFAULT_SLAB_AUDIO_BITRATE        384
+#define SLAB_FRAME_RATE                   24
+#define MAX_SLAB_BUFFER_SIZE              (4*1024*1024)
+#define POOL_REPORT_INTERVAL              60
+#define POOL_MAGAZINE_SIZE                32
+
 #define FRAME_TYPE_VIDEO           0x01
 #define FRAME_TYPE_AUDIO           0x02
 
@@ -92,6 +121,8 @@
 #define MSG_STOP                   0xa2
 #define MSG_RESTART                0xa3
 #define MSG_RESPAWN                0xa4
+// nothing to do, the main loop only has to look at its flags again
+#define MSG_WAKEUP                 0xa5
 #define MSG_PING                   0xb1
 #define MSG_STATUS                 0xb2
 
@@ -185,8 +216,12 @@ typedef struct _config_options_struct_ {
     int              segment_length;
     int              rollover_size;
     int              identity;
+    int              sync_latency;
+    int              psi_interval;
 
     int              enable_ts_output;
+    // the default audio substream is carried inside each video ts segment
+    int              enable_muxed_ts;
     int              enable_fmp4_output;
     int              enable_youtube_output;
     int              audio_source_index;
@@ -194,6 +229,7 @@ typedef struct _config_options_struct_ {
     int              enable_scte35;
     int              enable_stereo;
     int              enable_webvtt;
+    int              enable_reactor;
 
     int              stream_select;
 #if defined(ENABLE_TRANSCODE)
@@ -203,29 +239,42 @@ typedef struct _config_options_struct_ {
 #endif // ENABLE_TRANSCODE
 } config_options_struct;
 
-typedef struct _packet_struct_ {
-    int64_t                  pts;
-    int64_t                  dts;
-    int                      sync;
-    int                      disflag;
-    int                      count;
-} packet_struct;
-
 typedef struct _stream_struct_ {
     int                      sources;
+    // ts headers of the current frame back to back, the first one carries the pcr
     uint8_t                  *muxbuffer;
-    uint8_t                  *pesbuffer;
+    uint8_t                  pesheader[MAX_PES_HEADER];
+    int                      pesheader_size;
+    struct iovec             *muxiov;
+    int                      muxiov_count;
+    // packets a frame can take before muxbuffer and muxiov have to grow, 0 until the first frame
+    int                      mux_packets;
     char                     *textbuffer;
-    packet_struct            *packettable;
     int                      packet_count;
     int64_t                  file_sequence_number;
     int64_t                  media_sequence_number;
     int64_t                  fragments_published;
     int64_t                  discontinuity_adjustment;
     int64_t                  last_segment_time;
-    FILE                     *output_ts_file;
+    void                     *output_ts_writer;
+    // the worker that writes the ts and fMP4 segments of this stream, see mux_worker_thread()
+    void                     *mux_worker;
+    // a segment has been handed to the worker and not yet closed, only the mux pump thread uses it
+    int                      ts_segment_open;
+    // a close or reset the worker could not be given yet, its writer is still open until it goes out
+    char                     ts_close_pending[MAX_STR_SIZE];
+    int                      ts_reset_pending;
+    // frames of only this rendition were dropped under backpressure, its playlists alone get the
+    // discontinuity- the segment being built is flagged when it ends
+    int                      rendition_discontinuity;
+    uint8_t                  segment_discontinuity[MAX_ROLLOVER_SIZE];
+    // the init segment, and the media segments while the fragment handle stays on the mux pump thread
     FILE                     *output_fmp4_file;
-    FILE                     *output_webvtt_file;
+    // an fMP4 segment has been handed to the worker, its close was set aside when it was opened
+    int                      fmp4_segment_open;
+    void                     *fmp4_close_msg;
+    // fmp4 belongs to the worker once handed over, the mux pump thread only keeps the pointer
+    int                      fmp4_handed_over;
 
     void                     *source_queue;
     int                      cnt;
@@ -233,6 +282,14 @@ typedef struct _stream_struct_ {
 
     int                      pat_cnt;
     int                      pmt_cnt;
+    // pat/pmt are built once, only the continuity counter changes between copies
+    uint8_t                  pat_packet[188];
+    uint8_t                  pmt_packet[188];
+    int                      psi_codec_type;
+    int                      psi_audio_codec_type;
+    int                      psi_version;
+    int                      psi_due;
+    int64_t                  last_psi_time;
 
     fragment_file_struct     *fmp4;
 } stream_struct;
@@ -242,6 +299,9 @@ typedef struct _hlsmux_struct_ {
 
     stream_struct            audio[MAX_VIDEO_SOURCES][MAX_AUDIO_STREAMS];
     stream_struct            video[MAX_VIDEO_SOURCES];
+    // packetizer state for the default audio inside each video rendition (enable_muxed_ts)
+    stream_struct            muxed_audio[MAX_VIDEO_SOURCES];
+    int                      muxed_audio_codec_type;
 
     pthread_t                hlsmux_thread_id;
 } hlsmux_struct;
@@ -265,6 +325,9 @@ typedef struct _sorted_frame_struct_
     int64_t                splice_duration_remaining;
     int64_t                time_received;
     char                   lang_tag[4];
+    // first frame of its source after frames were dropped under backpressure
+    int                    discontinuity;
+    nal_index_struct       nal_index;
 } sorted_frame_struct;
 
 typedef struct _audio_stream_struct_
@@ -298,6 +361,8 @@ typedef struct _video_stream_struct_
     int64_t                overflow_dts;
     int64_t                video_bitrate;
     int64_t                total_video_bytes;
+    // highest hevc temporal sub-layer from the last sps, -1 until one has been seen
+    int                    max_temporal_id;
     struct timespec        video_clock_start;
     void                   *video_queue;
 } video_stream_struct;
@@ -310,6 +375,9 @@ typedef struct _source_stream_struct_
     int                    udp_source_socket;
     char                   udp_source_ipaddr[UDP_MAX_IFNAME];
     pthread_t              udp_source_thread_id;
+
+    int64_t                udp_datagrams_received;
+    int64_t                udp_read_calls;
 } source_stream_struct;
 
 typedef struct _input_struct_ {
@@ -349,8 +417,9 @@ typedef struct _fillet_app_struct_
     void                          *video_frame_pool;
     void                          *audio_frame_pool;
 
-    sorted_frame_struct           *video_frame_data[MAX_FRAME_DATA_SYNC_VIDEO];
-    sorted_frame_struct           *audio_frame_data[MAX_FRAME_DATA_SYNC_AUDIO];
+    // frames waiting for the sync thread, merged across sources on full_time
+    void                          *video_frame_sync;
+    void                          *audio_frame_sync;
 
     void                          *event_queue;
     void                          *webdav_queue;
@@ -375,6 +444,8 @@ typedef struct _fillet_app_struct_
     int                           source_interruptions;
     int                           sync_thread_restart_count;
 
+    tsdemux_callbacks_struct      demux_callbacks;
+
     int                           video_receive_time_set;
     struct timespec               video_receive_time;
 
@@ -401,6 +472,8 @@ typedef struct _fillet_app_struct_
     void                          *raw_video_pool;
     void                          *raw_audio_pool;
 
+    void                          *backpressure;
+
 #if defined(ENABLE_TRANSCODE)
     preparevideo_internal_struct  *preparevideo;
     transvideo_internal_struct    *transvideo;
@@ -0,0 +1,49 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#if !defined(_FRAMESYNC_H_)
+#define _FRAMESYNC_H_
+
+#include <stdint.h>
+
+// starting ring size for each queue, rings double up to the capacity
+#define FRAMESYNC_RING_SIZE  64
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+    // queue_count sorted rings merged on their keys, capacity is the total over all queues
+    void *framesync_create(int queue_count, int capacity);
+    int framesync_destroy(void *sync);
+    // returns the new total, -1 when full or the queue is out of range
+    int framesync_add(void *sync, int queue, int64_t key, void *item);
+    // lowest key over all queues, equal keys come out in the order they were added
+    void *framesync_peek(void *sync, int64_t *key);
+    void *framesync_take(void *sync, int64_t *key);
+    int framesync_count(void *sync);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // _FRAMESYNC_H_
@@ -25,8 +25,20 @@
 
 #include "fillet.h"
 
+// what the muxer is holding right now, the streams only allocate once they carry something
+typedef struct _hlsmux_memory_struct_ {
+    int64_t                  streams;
+    int64_t                  mux_buffers;
+    int                      mux_streams;
+    int64_t                  segment_writers;
+    int                      segment_writer_count;
+    int64_t                  fmp4;
+    int                      fmp4_count;
+} hlsmux_memory_struct;
+
 void *hlsmux_create(fillet_app_struct *core);
 void hlsmux_destroy(void *hlsmux);
 int reset_dash_availability_time(fillet_app_struct *core);
+int hlsmux_memory(void *hlsmux, hlsmux_memory_struct *usage);
 
 #endif // _HLSMUX_H_
@@ -23,16 +23,53 @@
 #if !defined(_MEMORY_POOL_H_)
 #define _MEMORY_POOL_H_
 
+#include <stdint.h>
+
+#define MAX_MEMORY_CLASSES   8
+#define MAX_MEMORY_MAGAZINE  64
+#define MAX_CACHED_POOLS     16
+
+// a class with buffer_size 0 mallocs each buffer on take and frees it on return
+typedef struct _memory_class_struct
+{
+    int                        buffer_count;
+    int                        buffer_size;
+} memory_class_struct;
+
+typedef struct _memory_stats_struct
+{
+    int                        buffer_size;
+    int                        buffer_count;
+    int                        unused;
+    int                        peak;
+    int64_t                    takes;
+    // takes served here because every better fitting class was empty
+    int64_t                    fallbacks;
+    // takes that found no class with room
+    int64_t                    failures;
+} memory_stats_struct;
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
     void *memory_create(int buffer_count, int buffer_size);
+    // size classes, take picks the smallest class with room for the requested size
+    void *memory_create_slab(memory_class_struct *classes, int class_count);
     int memory_destroy(void *pool);
     void *memory_take(void *pool, int owner);
     int memory_return(void *pool, void *buffer);
+    // another holder for a taken buffer, each holder hands it back with memory_return()
+    // and the contents must be treated as read only while it is shared
+    int memory_ref(void *pool, void *buffer);
     int memory_reset(void *pool);
     int memory_unused(void *pool);
+    // memory_unused() without taking the pool lock, for callers that only need a rough level
+    int memory_unused_estimate(void *pool);
+    int memory_class_count(void *pool);
+    int memory_stats(void *pool, int class_index, memory_stats_struct *stats);
+    // per thread magazines of up to magazine_size buffers in front of the pool lock
+    int memory_cache_enable(void *pool, int magazine_size);
 
 #if defined(__cplusplus)
 }
@@ -47,10 +47,20 @@
 #define VIDEO_FRAGMENT      0x01
 #define AUDIO_FRAGMENT      0x00
 
+// fragments point at the frame as it came off the pipeline, mdat is written
+// straight from it and the reference is dropped once the fragment is out
 typedef struct _fragment_struct_
 {
     uint8_t                 *fragment_buffer;
+    // pool holding a reference on fragment_buffer, NULL when the fragment owns a copy
+    void                    *fragment_pool;
+    // sample size as written to mdat
     int                     fragment_buffer_size;
+    // audio payload past the adts header
+    int                     fragment_offset;
+    // video nal units in the track nal list, written length prefixed
+    int                     first_nal;
+    int                     nal_count;
     int                     fragment_duration;
     double                  fragment_timestamp;
     int64_t                 fragment_composition_time;
@@ -64,6 +74,9 @@ typedef struct _track_struct_ {
 
     fragment_struct        fragments[MAX_FRAGMENTS];
     int                    fragment_count;
+    nal_unit_struct        *nal_units;
+    int                    nal_unit_count;
+    int                    nal_unit_capacity;
     int64_t                fragment_start_timestamp;
     int64_t                sidx_buffer_offset;
 } track_struct;
@@ -112,18 +125,23 @@ typedef struct _fragment_file_struct_
     uint8_t                *buffer;
 } fragment_file_struct;
 
+// buffer_pool is the pool the buffer was taken from, the fragment keeps a
+// reference until it is written, NULL copies the data instead
 int fmp4_audio_fragment_add(fragment_file_struct *fmp4,
                             uint8_t *fragment_buffer,
                             int fragment_buffer_size,
+                            void *buffer_pool,
                             double fragment_timestamp,
                             int fragment_duration);
 
 int fmp4_video_fragment_add(fragment_file_struct *fmp4,
                             uint8_t *fragment_buffer,
                             int fragment_buffer_size,
+                            void *buffer_pool,
                             double fragment_timestamp,
                             int fragment_duration,
-                            int64_t fragment_composition_time);
+                            int64_t fragment_composition_time,
+                            nal_index_struct *nal_index);
 
 fragment_file_struct *fmp4_file_create_youtube(int video_media_type, int audio_media_type, int timescale, int lang_code, int frag_duration);
 fragment_file_struct *fmp4_file_create(int media_type, int timescale, int lang_code, int frag_duration);
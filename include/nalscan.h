@@ -0,0 +1,68 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#if !defined(_NALSCAN_H_)
+#define _NALSCAN_H_
+
+#include <stdint.h>
+
+#define MAX_NAL_UNITS        32
+
+typedef struct _nal_unit_struct_ {
+    int32_t        offset;            // nal header byte
+    int32_t        size;              // header and payload, up to the next start code
+    uint8_t        type;
+    uint8_t        start_code_size;
+} nal_unit_struct;
+
+typedef struct _nal_index_struct_ {
+    int            count;
+    // more units than MAX_NAL_UNITS, the rest starts after the last entry
+    int            truncated;
+    nal_unit_struct nal[MAX_NAL_UNITS];
+} nal_index_struct;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif // cplusplus
+
+    // offset of the first 00 00 01 that starts at or after offset and ends before size, -1 if none
+    int find_start_code(uint8_t *buffer, int offset, int size);
+    // offset of the next nal header byte, start_code_pos gets the first byte of its 3 or 4 byte start code
+    int find_next_nal(uint8_t *buffer, int offset, int size, int *start_code_pos);
+    // name of the scanner picked at runtime (avx2, sse2 or scalar)
+    const char *start_code_scanner_name(void);
+    // one pass over an annex-b access unit, returns the number of indexed nal units
+    int build_nal_index(uint8_t *buffer, int size, int is_hevc, nal_index_struct *index);
+    // first indexed nal unit of the given type, NULL if the index has none
+    nal_unit_struct *find_nal_unit(nal_index_struct *index, int type);
+    // hevc sps_max_sub_layers_minus1 from an sps in the index, -1 when there is none
+    int nal_index_max_temporal_id(uint8_t *buffer, nal_index_struct *index);
+    // 0 when every indexed slice is a non-reference picture, 1 otherwise or when there is no slice to look at,
+    // hevc _N pictures only count as non-reference on max_temporal_id (-1 while it is unknown keeps them)
+    int nal_index_is_reference(uint8_t *buffer, nal_index_struct *index, int is_hevc, int max_temporal_id);
+
+#if defined(__cplusplus)
+}
+#endif // cplusplus
+
+#endif // _NALSCAN_H_
@@ -0,0 +1,58 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#if !defined(_SEGWRITER_H_)
+#define _SEGWRITER_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+// packets are gathered into these page aligned chunks and handed to one writev once all of them are full
+#define SEGMENT_WRITER_CHUNK_SIZE   (64*1024)
+#define SEGMENT_WRITER_CHUNKS       4
+
+typedef struct _segment_writer_stats_struct
+{
+    int64_t                    write_calls;
+    int64_t                    bytes_written;
+} segment_writer_stats_struct;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+    void *segment_writer_create(void);
+    int segment_writer_destroy(void *writer);
+    int segment_writer_open(void *writer, const char *filename);
+    int segment_writer_is_open(void *writer);
+    // copies the data, it only reaches the file once the chunks fill up or on a flush/close
+    int segment_writer_write(void *writer, uint8_t *data, int size);
+    int segment_writer_writev(void *writer, const struct iovec *iov, int iov_count);
+    int segment_writer_flush(void *writer);
+    // stats covers everything written since the open
+    int segment_writer_close(void *writer, segment_writer_stats_struct *stats);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // _SEGWRITER_H_
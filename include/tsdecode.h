@@ -25,9 +25,8 @@
 
 #define RECEIVE_TIMEOUT      1000
 #define MAX_PMT_PIDS         256
-#define MAX_ACTUAL_PIDS      65535
 #define MAX_PIDS             1024
-#define MAX_DATA_STREAMS     16384
+#define MAX_PID_INDEX        8192
 #define MAX_BUFFER_SIZE      4096*1024
 #define MAX_TABLE_SIZE       1024
 #define MAX_ERROR_SIZE       1024
@@ -99,9 +98,16 @@ typedef struct _packet_table_struct_ {
      int            input_percent;
      int            valid;
      int64_t        report_count;
-     struct timeval last_seen;
+     int64_t        last_seen;
 } packet_table_struct;
 
+typedef struct _pid_index_struct_ {
+     int            packet_table_index;
+     int            pmt_index;
+     int            stream_index;
+     int            batch_packets;
+} pid_index_struct;
+
 typedef struct _error_struct_ {
      int64_t        packet_number;
      int            pid;
@@ -130,8 +136,8 @@ typedef struct _data_engine_struct_ {
      int            seqtype;
      int            chromatype;
      int64_t        video_frame_count;
-     struct timeval start_data_time;
-     struct timeval end_data_time;
+     int64_t        start_data_time;
+     int64_t        end_data_time;
 } data_engine_struct;
 
 typedef struct _tvct_table_struct_ {
@@ -142,8 +148,8 @@ typedef struct _tvct_table_struct_ {
      int64_t max_tvct_time;
      int64_t min_tvct_time;
      int64_t avg_tvct_time;
-     struct timeval start_tvct_time;
-     struct timeval end_tvct_time;
+     int64_t start_tvct_time;
+     int64_t end_tvct_time;
 } tvct_table_struct;
 
 typedef struct _lang_struct_ {
@@ -167,14 +173,12 @@ typedef struct _pmt_table_struct_ {
 
      int descriptor_id[MAX_STREAMS];
      int descriptor_size[MAX_STREAMS];
-     int descriptor_data[MAX_STREAMS][MAX_TABLE_SIZE];
      int descriptor_count;
 
      int stream_pid[MAX_STREAMS];
      int stream_type[MAX_STREAMS];
      int decoded_stream_type[MAX_STREAMS];
      lang_struct decoded_language_tag[MAX_STREAMS];
-     int stream_data[MAX_STREAMS][MAX_TABLE_SIZE];
      int stream_count;
 
      int64_t first_pts[MAX_STREAMS];
@@ -187,10 +191,11 @@ typedef struct _pmt_table_struct_ {
      int64_t max_pmt_time;
      int64_t min_pmt_time;
      int64_t avg_pmt_time;
-     struct timeval start_pmt_time;
-     struct timeval end_pmt_time;
+     int64_t start_pmt_time;
+     int64_t end_pmt_time;
 
-     data_engine_struct data_engine[MAX_DATA_STREAMS];
+     data_engine_struct *data_engine;
+     int data_engine_count;
 } pmt_table_struct;
 
 typedef struct _pat_table_struct_ {
@@ -202,8 +207,8 @@ typedef struct _pat_table_struct_ {
      int current_pat_section;
      int previous_pat_section;
 
-     struct timeval start_pat_time;
-     struct timeval end_pat_time;
+     int64_t start_pat_time;
+     int64_t end_pat_time;
      int64_t max_pat_time;
      int64_t min_pat_time;
      int64_t avg_pat_time;
@@ -212,55 +217,23 @@ typedef struct _pat_table_struct_ {
      int pmt_table_pid[MAX_PMT_PIDS];
 } pat_table_struct;
 
-typedef struct _transport_data_struct_ {
-     pat_table_struct master_pat_table;
-     pmt_table_struct master_pmt_table[MAX_PMT_PIDS];
-     packet_table_struct master_packet_table[MAX_PIDS];
-
-     int64_t received_ts_packets;
-     struct timeval pid_start_time;
-     struct timeval pid_stop_time;
-     int64_t initial_pcr_base[MAX_ACTUAL_PIDS];
-     int64_t initial_pcr_ext;
-     struct timeval pcr_start_time;
-     struct timeval pcr_stop_time;
-     struct timeval pcr_update_start_time;
-     int tvct_decoded;
-     int tvct_version[MAX_PMT_PIDS];
-     unsigned long last_tvct_crc[MAX_PMT_PIDS];
-     unsigned char tvct_data[MAX_TABLE_SIZE];
-     int tvct_data_size;
-     int tvct_table_acquired;
-     int tvct_table_expected;
-     int pmt_position;
-     int pmt_data_size;
-     int pmt_table_acquired;
-     int pmt_table_expected;
-     int pmt_pid_count;
-     int pmt_pid_index[MAX_PMT_PIDS];
-     int pmt_decoded[MAX_PMT_PIDS];
-     int pmt_version[MAX_PMT_PIDS];
-     unsigned long last_pmt_crc[MAX_PMT_PIDS];
-     unsigned char pmt_data[MAX_TABLE_SIZE];
-     int pat_program_count;
-     int pat_version_number;
-     int pat_position;
-     int pat_transport_stream_id;
-     int eit0_present;
-     int eit1_present;
-     int eit2_present;
-     int eit3_present;
-     int first_frame_intra;
-     int source;
-} transport_data_struct;
+typedef struct _tsdemux_callbacks_struct_ {
+     int (*frame_callback)(uint8_t *sample, int sample_size, int sample_type, uint32_t sample_flags, int64_t pts, int64_t dts, int64_t last_pcr, int source, int sub_source, char *lang_tag, nal_index_struct *nal_index, void *context);
+     int (*message_callback)(int p1, int64_t p2, int64_t p3, int64_t p4, int64_t p5, int source, void *context);
+} tsdemux_callbacks_struct;
+
+// demux state, only tsdecode.c sees inside it
+typedef struct _transport_data_struct_ transport_data_struct;
 
 #if defined(__cplusplus)
 extern "C" {
 #endif // cplusplus
 
-    void register_frame_callback(int (*cbfn)(uint8_t *sample, int sample_size, int sample_type, uint32_t sample_flags, int64_t pts, int64_t dts, int64_t last_pcr, int source, int sub_source, char *lang_tag, void *context), void *context);
-    void register_message_callback(int (*cbfn)(int p1,int64_t p2,int64_t p3,int64_t p4, int64_t p5, int source, void* context), void*context);
-    int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_data_struct *tsdata, int stream_select);
+    void *tsdemux_create(tsdemux_callbacks_struct *callbacks, void *context, int source, int stream_select);
+    int tsdemux_feed(void *demux, uint8_t *transport_packet_data, int packet_count, int64_t receive_time);
+    void tsdemux_destroy(void *demux);
+    int64_t tsdemux_state_size(void);
+    int64_t demux_clock_now(void);
 
 #if defined(__cplusplus)
 }
@@ -24,5 +24,6 @@
 #define _TS_RECEIVE_H_
 
 void *udp_source_thread(void *context);
+void *udp_reactor_thread(void *context);
 
 #endif // _TS_RECEIVE_H_
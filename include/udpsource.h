@@ -32,6 +32,8 @@
 #define UDP_MAX_SOCKETS     32
 #define UDP_MAX_IFNAME      32
 #define UDP_MAX_SOCKET_SIZE 1024*1024
+#define UDP_MAX_BATCH       64
+#define UDP_MAX_DATAGRAM    2048
 
 #if defined(__cplusplus)
 extern "C" {
@@ -46,6 +48,11 @@ extern "C" {
                         int flags,
                         int ttl);
     int socket_udp_read(int udp_socket, uint8_t *buf, int size);
+    int socket_udp_read_batch(int udp_socket,
+                              uint8_t *buf,
+                              int slot_size,
+                              int max_datagrams,
+                              int *datagrams);
     int socket_udp_ready(int udp_socket, int timeout, fd_set *sockset);
 
 #if defined(__cplusplus)
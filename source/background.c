@@ -44,13 +44,15 @@
 #define MAX_CONNECTIONS    8
 #define MAX_REQUEST_SIZE   65535
 #define MAX_RESPONSE_SIZE  MAX_REQUEST_SIZE
+// the main loop sleeps here between its housekeeping passes, events wake it right away
+#define EVENT_WAIT_TIMEOUT 100
 
 int wait_for_event(fillet_app_struct *core)
 {
     dataqueue_message_struct *msg;
     int msgid = -1;
 
-    msg = (dataqueue_message_struct*)dataqueue_take_back(core->event_queue);
+    msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->event_queue, EVENT_WAIT_TIMEOUT);
     if (msg) {
         msgid = msg->flags;
         memory_return(core->fillet_msg_pool, msg);
@@ -80,6 +82,7 @@ int build_response_repackage(fillet_app_struct *core, char *response_buffer, int
     for (source = 0; source < core->cd->active_sources; source++) {
         char scratch[MAX_STR_SIZE];
         int sub_source = 0;
+        double datagrams_per_read;
 
         audio_stream_struct *astream = (audio_stream_struct*)core->source_stream[source].audio_stream[sub_source];
         video_stream_struct *vstream = (video_stream_struct*)core->source_stream[source].video_stream;
@@ -96,7 +99,17 @@ int build_response_repackage(fillet_app_struct *core, char *response_buffer, int
         strncat(input_streams, scratch, MAX_LIST_SIZE-1);
         snprintf(scratch,MAX_STR_SIZE-1,"                \"video-current-duration\": %ld,\n", vstream->last_full_time);
         strncat(input_streams, scratch, MAX_LIST_SIZE-1);
-        snprintf(scratch,MAX_STR_SIZE-1,"                \"video-received-frames\": %ld\n", vstream->current_receive_count);
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"video-received-frames\": %ld,\n", vstream->current_receive_count);
+        strncat(input_streams, scratch, MAX_LIST_SIZE-1);
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"udp-datagrams\": %ld,\n", core->source_stream[source].udp_datagrams_received);
+        strncat(input_streams, scratch, MAX_LIST_SIZE-1);
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"udp-read-calls\": %ld,\n", core->source_stream[source].udp_read_calls);
+        strncat(input_streams, scratch, MAX_LIST_SIZE-1);
+        datagrams_per_read = 0;
+        if (core->source_stream[source].udp_read_calls > 0) {
+            datagrams_per_read = (double)core->source_stream[source].udp_datagrams_received / (double)core->source_stream[source].udp_read_calls;
+        }
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"udp-datagrams-per-read\": %.2f\n", datagrams_per_read);
         strncat(input_streams, scratch, MAX_LIST_SIZE-1);
         if (source == core->cd->active_sources - 1) {
             snprintf(scratch,MAX_STR_SIZE-1,"            }\n");
@@ -217,6 +230,7 @@ int build_response_transcode(fillet_app_struct *core, char *response_buffer, int
     for (source = 0; source < core->cd->active_sources; source++) {
         char scratch[MAX_STR_SIZE];
         int sub_source = 0;
+        double datagrams_per_read;
 
         audio_stream_struct *astream = (audio_stream_struct*)core->source_stream[source].audio_stream[sub_source];
         video_stream_struct *vstream = (video_stream_struct*)core->source_stream[source].video_stream;
@@ -233,7 +247,17 @@ int build_response_transcode(fillet_app_struct *core, char *response_buffer, int
         strncat(input_streams, scratch, MAX_LIST_SIZE-1);
         snprintf(scratch,MAX_STR_SIZE-1,"                \"video-current-duration\": %ld,\n", vstream->last_full_time);
         strncat(input_streams, scratch, MAX_LIST_SIZE-1);
-        snprintf(scratch,MAX_STR_SIZE-1,"                \"video-received-frames\": %ld\n", vstream->current_receive_count);
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"video-received-frames\": %ld,\n", vstream->current_receive_count);
+        strncat(input_streams, scratch, MAX_LIST_SIZE-1);
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"udp-datagrams\": %ld,\n", core->source_stream[source].udp_datagrams_received);
+        strncat(input_streams, scratch, MAX_LIST_SIZE-1);
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"udp-read-calls\": %ld,\n", core->source_stream[source].udp_read_calls);
+        strncat(input_streams, scratch, MAX_LIST_SIZE-1);
+        datagrams_per_read = 0;
+        if (core->source_stream[source].udp_read_calls > 0) {
+            datagrams_per_read = (double)core->source_stream[source].udp_datagrams_received / (double)core->source_stream[source].udp_read_calls;
+        }
+        snprintf(scratch,MAX_STR_SIZE-1,"                \"udp-datagrams-per-read\": %.2f\n", datagrams_per_read);
         strncat(input_streams, scratch, MAX_LIST_SIZE-1);
         if (source == core->cd->active_sources - 1) {
             snprintf(scratch,MAX_STR_SIZE-1,"            }\n");
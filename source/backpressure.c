@@ -0,0 +1,231 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mempool.h"
+#include "backpressure.h"
+
+typedef struct _backpressure_source_struct
+{
+    int64_t                    bitrate;
+    // dropping until the next sync frame
+    int                        dropping;
+} backpressure_source_struct;
+
+typedef struct _backpressure_struct
+{
+    void                       *pool[MAX_BACKPRESSURE_POOLS];
+    int                        pool_capacity[MAX_BACKPRESSURE_POOLS];
+    int                        pool_count;
+    backpressure_source_struct source[MAX_BACKPRESSURE_SOURCES];
+    int64_t                    counts[MAX_BACKPRESSURE_ACTIONS];
+} backpressure_struct;
+
+static const char *action_names[MAX_BACKPRESSURE_ACTIONS] = {
+    "NONREF",
+    "GOPS",
+    "GOP-FRAMES",
+    "VIDEO",
+    "AUDIO",
+    "SYNC",
+    "UPLOADS",
+    "DISCONTINUITIES",
+    "SIGNALS"
+};
+
+void *backpressure_create(void)
+{
+    backpressure_struct *bp;
+
+    bp = (backpressure_struct*)malloc(sizeof(backpressure_struct));
+    if (!bp) {
+        return NULL;
+    }
+    memset(bp, 0, sizeof(backpressure_struct));
+    return (void*)bp;
+}
+
+int backpressure_destroy(void *backpressure)
+{
+    backpressure_struct *bp = (backpressure_struct*)backpressure;
+
+    if (!bp) {
+        return -1;
+    }
+    free(bp);
+    return 0;
+}
+
+int backpressure_watch_pool(void *backpressure, void *pool)
+{
+    backpressure_struct *bp = (backpressure_struct*)backpressure;
+    memory_stats_struct stats;
+    int capacity = 0;
+    int c;
+
+    if (!bp || !pool || bp->pool_count >= MAX_BACKPRESSURE_POOLS) {
+        return -1;
+    }
+    for (c = 0; c < memory_class_count(pool); c++) {
+        if (memory_stats(pool, c, &stats) == 0) {
+            capacity += stats.buffer_count;
+        }
+    }
+    if (capacity <= 0) {
+        return -1;
+    }
+    bp->pool[bp->pool_count] = pool;
+    bp->pool_capacity[bp->pool_count] = capacity;
+    bp->pool_count++;
+    return 0;
+}
+
+int backpressure_level(void *backpressure)
+{
+    backpressure_struct *bp = (backpressure_struct*)backpressure;
+    int worst = 0;
+    int p;
+
+    if (!bp) {
+        return BACKPRESSURE_LEVEL_NONE;
+    }
+    for (p = 0; p < bp->pool_count; p++) {
+        int capacity = bp->pool_capacity[p];
+        // this runs for every video frame, so it stays off the pool locks the magazines avoid
+        int used = capacity - memory_unused_estimate(bp->pool[p]);
+        int percent = (used * 100) / capacity;
+        if (percent > worst) {
+            worst = percent;
+        }
+    }
+    if (worst >= BACKPRESSURE_GOP_PERCENT) {
+        return BACKPRESSURE_LEVEL_GOP;
+    }
+    if (worst >= BACKPRESSURE_NONREF_PERCENT) {
+        return BACKPRESSURE_LEVEL_NONREF;
+    }
+    return BACKPRESSURE_LEVEL_NONE;
+}
+
+// another source is carrying a higher bitrate, so this one is a lower rendition
+static int lower_rendition(backpressure_struct *bp, int source)
+{
+    int s;
+
+    for (s = 0; s < MAX_BACKPRESSURE_SOURCES; s++) {
+        if (s != source && bp->source[s].bitrate > bp->source[source].bitrate) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int backpressure_video_frame(void *backpressure, int source, int64_t bitrate, int sync_frame, int reference)
+{
+    backpressure_struct *bp = (backpressure_struct*)backpressure;
+    backpressure_source_struct *state;
+    int level;
+
+    if (!bp || source < 0 || source >= MAX_BACKPRESSURE_SOURCES) {
+        return BACKPRESSURE_KEEP;
+    }
+    state = &bp->source[source];
+    state->bitrate = bitrate;
+
+    if (state->dropping && !sync_frame) {
+        backpressure_count(bp, BACKPRESSURE_GOP_FRAMES_DROPPED);
+        return BACKPRESSURE_DROP;
+    }
+
+    level = backpressure_level(bp);
+    if (level >= BACKPRESSURE_LEVEL_GOP && lower_rendition(bp, source)) {
+        // the rest of this gop, or the whole next one when we are at its sync frame
+        state->dropping = 1;
+        backpressure_count(bp, BACKPRESSURE_GOP_DROPPED);
+        backpressure_count(bp, BACKPRESSURE_GOP_FRAMES_DROPPED);
+        return BACKPRESSURE_DROP;
+    }
+
+    if (state->dropping) {
+        state->dropping = 0;
+        backpressure_count(bp, BACKPRESSURE_DISCONTINUITY);
+        return BACKPRESSURE_RESUME;
+    }
+
+    if (level >= BACKPRESSURE_LEVEL_NONREF && !reference && !sync_frame) {
+        backpressure_count(bp, BACKPRESSURE_NONREF_DROPPED);
+        return BACKPRESSURE_DROP;
+    }
+    return BACKPRESSURE_KEEP;
+}
+
+int backpressure_video_lost(void *backpressure, int source)
+{
+    backpressure_struct *bp = (backpressure_struct*)backpressure;
+
+    if (!bp || source < 0 || source >= MAX_BACKPRESSURE_SOURCES) {
+        return -1;
+    }
+    backpressure_count(bp, BACKPRESSURE_VIDEO_DROPPED);
+    if (!bp->source[source].dropping) {
+        bp->source[source].dropping = 1;
+        backpressure_count(bp, BACKPRESSURE_GOP_DROPPED);
+    }
+    return 0;
+}
+
+void backpressure_count(void *backpressure, int action)
+{
+    backpressure_struct *bp = (backpressure_struct*)backpressure;
+
+    if (!bp || action < 0 || action >= MAX_BACKPRESSURE_ACTIONS) {
+        return;
+    }
+    // the receivers, the sync thread and the muxer all count here
+    __atomic_add_fetch(&bp->counts[action], 1, __ATOMIC_RELAXED);
+}
+
+int backpressure_counts(void *backpressure, int64_t *counts)
+{
+    backpressure_struct *bp = (backpressure_struct*)backpressure;
+    int a;
+
+    if (!bp || !counts) {
+        return -1;
+    }
+    for (a = 0; a < MAX_BACKPRESSURE_ACTIONS; a++) {
+        counts[a] = __atomic_load_n(&bp->counts[a], __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+const char *backpressure_action_name(int action)
+{
+    if (action < 0 || action >= MAX_BACKPRESSURE_ACTIONS) {
+        return "UNKNOWN";
+    }
+    return action_names[action];
+}
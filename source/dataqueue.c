@@ -26,11 +26,14 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <malloc.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "dataqueue.h"
-#include "mempool.h"
 
-#define MAX_QUEUE_ENTRIES  16384
+#define CACHE_LINE_SIZE    64
 
 typedef struct _dataqueue_node_struct
 {
@@ -39,31 +42,97 @@ typedef struct _dataqueue_node_struct
     dataqueue_message_struct       *message;
 } dataqueue_node_struct;
 
+// single producer/single consumer ring, head is only written by the producer
+// and tail only by the consumer so neither side needs the lock
+typedef struct _ring_struct
+{
+    int64_t                        head __attribute__((aligned(CACHE_LINE_SIZE)));
+    int64_t                        cached_tail;
+    int64_t                        tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    int64_t                        cached_head;
+    int64_t                        capacity __attribute__((aligned(CACHE_LINE_SIZE)));
+    int64_t                        mask;
+    dataqueue_message_struct       **slots;
+} ring_struct;
+
 typedef struct _queue_struct
 {
     int                            count;
     dataqueue_node_struct          *tail;
     dataqueue_node_struct          *head;
     pthread_mutex_t                *reflock;
-    void                           *pool;
+    ring_struct                    *ring;
+    // consumers sleeping in wait_queue, producers only signal when non-zero
+    int                            waiters;
+    int                            wakeup_fd;
 } queue_struct;
 
-int dataqueue_count(void *queue)
+static int64_t wait_clock_ms(void)
 {
-    int count;
-    queue_struct *message_queue = (queue_struct *)queue;
+    struct timespec now;
 
-    if (!message_queue) {
-        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void wake_waiters(queue_struct *message_queue)
+{
+    // pairs with the fence in wait_queue, either the waiter sees the
+    // new entry or we see the waiter
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&message_queue->waiters, __ATOMIC_RELAXED) > 0) {
+        uint64_t one = 1;
+        if (write(message_queue->wakeup_fd, &one, sizeof(one)) < 0) {
+            // counter is saturated, the waiter has plenty to wake up for
+        }
     }
+}
 
-    if (message_queue->reflock) {
-        pthread_mutex_lock(message_queue->reflock);
-        count = message_queue->count;
-        pthread_mutex_unlock(message_queue->reflock);
-        return count;
+static int ring_depth(ring_struct *ring)
+{
+    int64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    int64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head < tail) {
+        return 0;
     }
-    return -1;
+    return (int)(head - tail);
+}
+
+static int ring_put(ring_struct *ring, dataqueue_message_struct *message)
+{
+    int64_t head = ring->head;
+
+    if (head - ring->cached_tail >= ring->capacity) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->cached_tail >= ring->capacity) {
+            return -1;
+        }
+    }
+    ring->slots[head & ring->mask] = message;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static dataqueue_message_struct *ring_take(ring_struct *ring)
+{
+    int64_t tail = ring->tail;
+    dataqueue_message_struct *message;
+
+    if (tail == ring->cached_head) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == ring->cached_head) {
+            return NULL;
+        }
+    }
+    message = ring->slots[tail & ring->mask];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return message;
+}
+
+int dataqueue_count(void *queue)
+{
+    return dataqueue_get_size(queue);
 }
 
 int dataqueue_reset(void *queue)
@@ -76,10 +145,15 @@ int dataqueue_reset(void *queue)
 
     if (message_queue->reflock) {
         pthread_mutex_lock(message_queue->reflock);
-        message_queue->count = 0;
+        if (message_queue->ring) {
+            // only valid once both sides have stopped
+            message_queue->ring->tail = message_queue->ring->head;
+            message_queue->ring->cached_tail = message_queue->ring->head;
+            message_queue->ring->cached_head = message_queue->ring->head;
+        }
+        __atomic_store_n(&message_queue->count, 0, __ATOMIC_RELEASE);
         message_queue->head = NULL;
         message_queue->tail = NULL;
-        memory_reset(message_queue->pool);
         pthread_mutex_unlock(message_queue->reflock);
         return 0;
     }
@@ -97,10 +171,50 @@ void *dataqueue_create(void)
 
     memset(message_queue, 0, sizeof(queue_struct));
 
-    message_queue->pool = memory_create(MAX_QUEUE_ENTRIES, sizeof(dataqueue_node_struct));
     message_queue->count = 0;
     message_queue->reflock = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
     pthread_mutex_init(message_queue->reflock, NULL);
+    message_queue->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (message_queue->wakeup_fd < 0) {
+        pthread_mutex_destroy(message_queue->reflock);
+        free(message_queue->reflock);
+        free(message_queue);
+        return NULL;
+    }
+
+    return message_queue;
+}
+
+void *dataqueue_create_spsc(int entries)
+{
+    queue_struct *message_queue;
+    ring_struct *ring;
+    int64_t capacity = 1;
+
+    while (capacity < entries) {
+        capacity <<= 1;
+    }
+
+    ring = (ring_struct*)memalign(CACHE_LINE_SIZE, sizeof(ring_struct));
+    if (!ring) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(ring_struct));
+    ring->slots = (dataqueue_message_struct**)malloc(capacity * sizeof(dataqueue_message_struct*));
+    if (!ring->slots) {
+        free(ring);
+        return NULL;
+    }
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+
+    message_queue = (queue_struct*)dataqueue_create();
+    if (!message_queue) {
+        free(ring->slots);
+        free(ring);
+        return NULL;
+    }
+    message_queue->ring = ring;
 
     return message_queue;
 }
@@ -115,7 +229,12 @@ int dataqueue_destroy(void *queue)
     pthread_mutex_destroy(message_queue->reflock);
     free(message_queue->reflock);
     message_queue->reflock = NULL;
-    memory_destroy(message_queue->pool);
+    close(message_queue->wakeup_fd);
+    if (message_queue->ring) {
+        free(message_queue->ring->slots);
+        free(message_queue->ring);
+        message_queue->ring = NULL;
+    }
     free(message_queue);
 
     return 0;
@@ -129,9 +248,10 @@ int dataqueue_get_size(void *queue)
     if (!message_queue) {
         return -1;
     }
-    pthread_mutex_lock(message_queue->reflock);
-    got_size = message_queue->count;
-    pthread_mutex_unlock(message_queue->reflock);
+    got_size = __atomic_load_n(&message_queue->count, __ATOMIC_ACQUIRE);
+    if (message_queue->ring) {
+        got_size += ring_depth(message_queue->ring);
+    }
 
     return got_size;
 }
@@ -140,9 +260,8 @@ int dataqueue_put_back(void *queue, dataqueue_message_struct *message)
 {
     queue_struct *message_queue = (queue_struct *)queue;
     dataqueue_node_struct *new_node;
-    //dataqueue_node_struct *new_node = (dataqueue_node_struct *)memory_take(message_queue->pool, 0xdeadface);
 
-    if (!message_queue) {
+    if (!message_queue || message_queue->ring) {
         return -1;
     }
 
@@ -165,8 +284,9 @@ int dataqueue_put_back(void *queue, dataqueue_message_struct *message)
         new_node->message = message;
         message_queue->head = message_queue->tail = new_node;
     }
-    message_queue->count++;
+    __atomic_add_fetch(&message_queue->count, 1, __ATOMIC_RELEASE);
     pthread_mutex_unlock(message_queue->reflock);
+    wake_waiters(message_queue);
 
     return 0;
 }
@@ -180,8 +300,17 @@ int dataqueue_put_front(void *queue, dataqueue_message_struct *message)
         return -1;
     }
 
+    if (message_queue->ring) {
+        // once the ring has spilled into the list, stay on the list until the
+        // consumer drains it so messages keep their order
+        if (__atomic_load_n(&message_queue->count, __ATOMIC_ACQUIRE) == 0 &&
+            ring_put(message_queue->ring, message) == 0) {
+            wake_waiters(message_queue);
+            return 0;
+        }
+    }
+
     new_node = (dataqueue_node_struct*)malloc(sizeof(dataqueue_node_struct));
-    //new_node = (dataqueue_node_struct *)memory_take(message_queue->pool, 0xdeadface);
     if (!new_node) {
         return -1;
     }
@@ -199,8 +328,9 @@ int dataqueue_put_front(void *queue, dataqueue_message_struct *message)
         new_node->message = message;
         message_queue->head = message_queue->tail = new_node;
     }
-    message_queue->count++;
+    __atomic_add_fetch(&message_queue->count, 1, __ATOMIC_RELEASE);
     pthread_mutex_unlock(message_queue->reflock);
+    wake_waiters(message_queue);
 
     return 0;
 }
@@ -215,6 +345,21 @@ dataqueue_message_struct *dataqueue_take_back(void *queue)
         return NULL;
     }
 
+    if (message_queue->ring) {
+        return_message = ring_take(message_queue->ring);
+        if (return_message) {
+            return return_message;
+        }
+        if (__atomic_load_n(&message_queue->count, __ATOMIC_ACQUIRE) == 0) {
+            return NULL;
+        }
+        // the producer may have refilled the ring before spilling, those are older
+        return_message = ring_take(message_queue->ring);
+        if (return_message) {
+            return return_message;
+        }
+    }
+
     pthread_mutex_lock(message_queue->reflock);
     if (message_queue->tail) {
         current_node = message_queue->tail;
@@ -225,9 +370,8 @@ dataqueue_message_struct *dataqueue_take_back(void *queue)
             message_queue->head = NULL;
         }
         current_node->prev = NULL;
-        message_queue->count--;
+        __atomic_sub_fetch(&message_queue->count, 1, __ATOMIC_RELEASE);
         return_message = current_node->message;
-        //memory_return(message_queue->pool, current_node);
         free(current_node);
         pthread_mutex_unlock(message_queue->reflock);
         return return_message;
@@ -243,7 +387,7 @@ dataqueue_message_struct *dataqueue_take_front(void *queue)
     dataqueue_node_struct *current_node = NULL;
     dataqueue_message_struct *return_message;
 
-    if (!message_queue) {
+    if (!message_queue || message_queue->ring) {
         return NULL;
     }
 
@@ -257,9 +401,8 @@ dataqueue_message_struct *dataqueue_take_front(void *queue)
             message_queue->tail = NULL;
         }
         current_node->next = NULL;
-        message_queue->count--;
+        __atomic_sub_fetch(&message_queue->count, 1, __ATOMIC_RELEASE);
         return_message = current_node->message;
-        //memory_return(message_queue->pool, current_node);
         free(current_node);
         pthread_mutex_unlock(message_queue->reflock);
         return return_message;
@@ -268,3 +411,61 @@ dataqueue_message_struct *dataqueue_take_front(void *queue)
 
     return NULL;
 }
+
+// sleeps until the queue has a message, 0 when it does and -1 on timeout
+static int wait_queue(queue_struct *message_queue, int timeout_ms)
+{
+    struct pollfd wait_fd;
+    int64_t deadline = 0;
+
+    wait_fd.fd = message_queue->wakeup_fd;
+    wait_fd.events = POLLIN;
+    if (timeout_ms >= 0) {
+        deadline = wait_clock_ms() + timeout_ms;
+    }
+
+    while (1) {
+        int poll_timeout = -1;
+        int slept = 0;
+
+        __atomic_add_fetch(&message_queue->waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (dataqueue_get_size(message_queue) == 0) {
+            if (timeout_ms >= 0) {
+                poll_timeout = (int)(deadline - wait_clock_ms());
+                if (poll_timeout < 0) {
+                    poll_timeout = 0;
+                }
+            }
+            if (poll_timeout != 0) {
+                poll(&wait_fd, 1, poll_timeout);
+                slept = 1;
+            }
+        }
+        __atomic_sub_fetch(&message_queue->waiters, 1, __ATOMIC_SEQ_CST);
+        if (slept) {
+            uint64_t wakeups;
+            if (read(wait_fd.fd, &wakeups, sizeof(wakeups)) < 0) {
+                // nothing pending
+            }
+        }
+        if (dataqueue_get_size(message_queue) > 0) {
+            return 0;
+        }
+        if (timeout_ms >= 0 && wait_clock_ms() >= deadline) {
+            return -1;
+        }
+    }
+}
+
+dataqueue_message_struct *dataqueue_take_back_wait(void *queue, int timeout_ms)
+{
+    dataqueue_message_struct *message = dataqueue_take_back(queue);
+
+    if (!message && queue) {
+        if (wait_queue((queue_struct*)queue, timeout_ms) == 0) {
+            message = dataqueue_take_back(queue);
+        }
+    }
+    return message;
+}
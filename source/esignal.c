@@ -37,6 +37,7 @@
 #include "fillet.h"
 #include "dataqueue.h"
 #include "esignal.h"
+#include "backpressure.h"
 #if defined(ENABLE_TRANSCODE)
 #include "curl.h"
 #endif
@@ -99,8 +100,9 @@ int send_signal(fillet_app_struct *core, int signal_type, const char *message)
         snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", message);
         dataqueue_put_front(core->signal_queue, msg);
     } else {
-        fprintf(stderr,"fatal error: unable to generate signal!\n");
-        exit(-1);
+        // out of messages - the signal is dropped rather than taking the packager down
+        backpressure_count(core->backpressure, BACKPRESSURE_SIGNAL_DROPPED);
+        return -1;
     }
     return 0;
 }
@@ -216,8 +218,7 @@ void *signal_thread(void *context)
     while (signal_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->signal_queue);
         while (!msg && signal_thread_running) {
-            usleep(100000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->signal_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->signal_queue, QUEUE_WAIT_TIMEOUT);
         }
         if (signal_thread_running) {
             time_t currenttime;
@@ -515,6 +516,36 @@ void *signal_thread(void *context)
                          msg->smallbuf);
                 signal_management_interface(core, response_buffer, strlen(response_buffer));
             }
+            if (buffer_type == SIGNAL_BACKPRESSURE) {
+                snprintf(response_buffer, MAX_SIGNAL_RESPONSE_SIZE-1,
+                         "{\n"
+                         "    \"time\": \"%s\",\n"
+                         "    \"host\": \"%s\",\n"
+                         "    \"id\": %ld,\n"
+                         "    \"status\": \"warning\",\n"
+                         "    \"message\": \"dropping frames under backpressure (%s)\"\n"
+                         "}\n",
+                         formattedtime,
+                         node_hostname,
+                         id,
+                         msg->smallbuf);
+                signal_management_interface(core, response_buffer, strlen(response_buffer));
+            }
+            if (buffer_type == SIGNAL_SYNC_RECOVERY) {
+                snprintf(response_buffer, MAX_SIGNAL_RESPONSE_SIZE-1,
+                         "{\n"
+                         "    \"time\": \"%s\",\n"
+                         "    \"host\": \"%s\",\n"
+                         "    \"id\": %ld,\n"
+                         "    \"status\": \"warning\",\n"
+                         "    \"message\": \"recovering a/v sync in place (%s)\"\n"
+                         "}\n",
+                         formattedtime,
+                         node_hostname,
+                         id,
+                         msg->smallbuf);
+                signal_management_interface(core, response_buffer, strlen(response_buffer));
+            }
         }
         memory_return(core->fillet_msg_pool, msg);
         msg = NULL;
@@ -61,12 +61,25 @@
 #define SOURCE_IP        1
 #define SOURCE_FILE      2
 
+#define SYNC_WAIT_TIMEOUT 100
+
+// time frames spent in the sync stage, sync_lock protects these
+typedef struct _sync_hold_struct_ {
+    int64_t total;
+    int64_t count;
+    int64_t max;
+} sync_hold_struct;
+
+static sync_hold_struct video_sync_hold[MAX_SYNC_VIDEO_QUEUES];
+static sync_hold_struct audio_sync_hold[MAX_SYNC_VIDEO_QUEUES];
+
 static int calculated_mux_rate = 0;
 static error_struct error_data[MAX_ERROR_SIZE];
 static int64_t error_count = 0;
 static int video_synchronizer_entries = 0;
 static int audio_synchronizer_entries = 0;
 static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_cond;
 static int quit_sync_thread = 0;
 static int sync_thread_running = 0;
 static pthread_t frame_sync_thread_id;
@@ -75,9 +88,11 @@ static int enable_transcode = 0;
 static int enable_scte35 = 0;
 static int enable_stereo = 0;
 static int enable_webvtt = 0;
+static int enable_reactor = 0;
 static int enable_fmp4 = 0;
 static int enable_youtube = 0;
 static int enable_ts = 0;
+static int enable_muxed_ts = 0;
 static int audio_streams = -1;
 
 static config_options_struct config_data;
@@ -95,11 +110,15 @@ static struct option long_options[] = {
      {"identity", required_argument, 0, 'u'},
      {"dash", no_argument, &enable_fmp4, 'd'},
      {"hls", no_argument, &enable_ts, 'h'},
+     {"muxed-ts", no_argument, &enable_muxed_ts, 'X'},
      {"google", no_argument, &enable_youtube, 'y'},
      {"manifest-dash", required_argument, 0, 'M'},
      {"manifest-hls", required_argument, 0, 'H'},
      {"manifest-fmp4", required_argument, 0, 'F'},
      {"webvtt", no_argument, &enable_webvtt, 'W'},
+     {"reactor", no_argument, &enable_reactor, 'R'},
+     {"sync-latency", required_argument, 0, 'L'},
+     {"psi-interval", required_argument, 0, 'I'},
      {"astreams", required_argument, 0, 'T'},
      {"cdnusername", required_argument, 0, '7'},
      {"cdnpassword", required_argument, 0, '8'},
@@ -147,21 +166,22 @@ static int create_transvideo_core(fillet_app_struct *core)
     core->encodevideo = (encodevideo_internal_struct*)malloc(sizeof(encodevideo_internal_struct));
     core->scalevideo = (scalevideo_internal_struct*)malloc(sizeof(scalevideo_internal_struct));
 
+    // every ingest thread feeds the decoders, the later hops are one thread to one thread
     core->transvideo->input_queue = (void*)dataqueue_create();
-    core->preparevideo->input_queue = (void*)dataqueue_create();
+    core->preparevideo->input_queue = (void*)dataqueue_create_spsc(SPSC_QUEUE_ENTRIES);
 
     for (i = 0; i < MAX_AUDIO_SOURCES; i++) {
         core->transaudio[i] = (transaudio_internal_struct*)malloc(sizeof(transaudio_internal_struct));
         core->transaudio[i]->input_queue = (void*)dataqueue_create();
         core->encodeaudio[i] = (encodeaudio_internal_struct*)malloc(sizeof(encodeaudio_internal_struct));
-        core->encodeaudio[i]->input_queue = (void*)dataqueue_create();
+        core->encodeaudio[i]->input_queue = (void*)dataqueue_create_spsc(SPSC_QUEUE_ENTRIES);
     }
 
     for (i = 0; i < MAX_TRANS_OUTPUTS; i++) {
-        core->encodevideo->input_queue[i] = (void*)dataqueue_create();
+        core->encodevideo->input_queue[i] = (void*)dataqueue_create_spsc(SPSC_QUEUE_ENTRIES);
     }
-    core->encodevideo->thumbnail_queue = (void*)dataqueue_create();
-    core->scalevideo->input_queue = (void*)dataqueue_create();
+    core->encodevideo->thumbnail_queue = (void*)dataqueue_create_spsc(SPSC_QUEUE_ENTRIES);
+    core->scalevideo->input_queue = (void*)dataqueue_create_spsc(SPSC_QUEUE_ENTRIES);
 
     start_video_transcode_threads(core);
     start_audio_transcode_threads(core);
@@ -269,14 +289,185 @@ static int destroy_fillet_core(fillet_app_struct *core)
     memory_destroy(core->compressed_audio_pool);
     memory_destroy(core->raw_video_pool);
     memory_destroy(core->raw_audio_pool);
+    backpressure_destroy(core->backpressure);
+    framesync_destroy(core->video_frame_sync);
+    framesync_destroy(core->audio_frame_sync);
 
     free(core);
 
     return 0;
 }
 
+static int slab_class_size(int64_t bytes, int minimum)
+{
+    int size = minimum;
+
+    while (size < bytes && size < MAX_SLAB_BUFFER_SIZE) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static void *create_compressed_pool(int max_buffers, int64_t frame_bytes, int streams, int is_video)
+{
+    memory_class_struct classes[4];
+    int class_count;
+    int fixed = 0;
+    int c;
+
+    if (is_video) {
+        // b/p frames, larger p frames and idr frames
+        classes[0].buffer_size = slab_class_size(frame_bytes / 2, 4096);
+        classes[0].buffer_count = 256 * streams;
+        classes[1].buffer_size = slab_class_size(frame_bytes * 2, 4096);
+        classes[1].buffer_count = 128 * streams;
+        classes[2].buffer_size = slab_class_size(frame_bytes * 10, 4096);
+        classes[2].buffer_count = 16 * streams;
+        class_count = 3;
+    } else {
+        // a single aac frame and ac3/eac3 frames or multi-frame pes
+        classes[0].buffer_size = slab_class_size(frame_bytes, 512);
+        classes[0].buffer_count = 512 * streams;
+        classes[1].buffer_size = slab_class_size(frame_bytes * 4, 4096);
+        classes[1].buffer_count = 128 * streams;
+        class_count = 2;
+    }
+    for (c = 0; c < class_count; c++) {
+        fixed += classes[c].buffer_count;
+    }
+    // the slabs never take more than half of the buffer limit, the rest is malloc backed
+    if (fixed > max_buffers / 2) {
+        for (c = 0; c < class_count; c++) {
+            classes[c].buffer_count = (int)((int64_t)classes[c].buffer_count * (max_buffers / 2) / fixed);
+            if (classes[c].buffer_count < 1) {
+                classes[c].buffer_count = 1;
+            }
+        }
+        fixed = 0;
+        for (c = 0; c < class_count; c++) {
+            fixed += classes[c].buffer_count;
+        }
+    }
+    classes[class_count].buffer_size = 0;
+    classes[class_count].buffer_count = max_buffers - fixed;
+    class_count++;
+
+    return memory_create_slab(classes, class_count);
+}
+
+static void report_pool_usage(fillet_app_struct *core, void *pool, const char *name)
+{
+    memory_stats_struct stats;
+    int c;
+
+    for (c = 0; c < memory_class_count(pool); c++) {
+        if (memory_stats(pool, c, &stats) < 0) {
+            continue;
+        }
+        syslog(LOG_INFO,"SESSION:%d (MAIN) STATUS: POOL %s[%d] SIZE:%d USED:%d/%d PEAK:%d TAKES:%ld FALLBACKS:%ld FAILED:%ld\n",
+               core->session_id, name, c, stats.buffer_size,
+               stats.buffer_count - stats.unused, stats.buffer_count, stats.peak,
+               stats.takes, stats.fallbacks, stats.failures);
+        fprintf(stderr,"SESSION:%d (MAIN) STATUS: POOL %s[%d] SIZE:%d USED:%d/%d PEAK:%d TAKES:%ld FALLBACKS:%ld FAILED:%ld\n",
+                core->session_id, name, c, stats.buffer_size,
+                stats.buffer_count - stats.unused, stats.buffer_count, stats.peak,
+                stats.takes, stats.fallbacks, stats.failures);
+    }
+}
+
+static int64_t pool_memory(void *pool)
+{
+    memory_stats_struct stats;
+    int64_t size = 0;
+    int c;
+
+    // malloc backed classes have no fixed size and only hold memory while their buffers are taken
+    for (c = 0; c < memory_class_count(pool); c++) {
+        if (memory_stats(pool, c, &stats) == 0) {
+            size += (int64_t)stats.buffer_size * stats.buffer_count;
+        }
+    }
+    return size;
+}
+
+static int64_t resident_memory(void)
+{
+    FILE *statm;
+    long total_pages = 0;
+    long resident_pages = 0;
+
+    statm = fopen("/proc/self/statm","r");
+    if (!statm) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld %ld", &total_pages, &resident_pages) != 2) {
+        resident_pages = 0;
+    }
+    fclose(statm);
+    return (int64_t)resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+// rss of the whole channel and what the pools and the muxer account for
+static void report_memory_usage(fillet_app_struct *core)
+{
+    hlsmux_memory_struct mux;
+    char summary[MAX_STR_SIZE];
+
+    if (hlsmux_memory(core->hlsmux, &mux) < 0) {
+        memset(&mux, 0, sizeof(mux));
+    }
+    snprintf(summary, MAX_STR_SIZE-1, "RSS:%ldKB MSG:%ldKB FRAME:%ldKB CV:%ldKB CA:%ldKB MUXSTATE:%ldKB MUXBUFFERS:%ldKB(%d) WRITERS:%ldKB(%d) FMP4:%ldKB(%d)",
+             resident_memory() / 1024,
+             pool_memory(core->fillet_msg_pool) / 1024,
+             pool_memory(core->frame_msg_pool) / 1024,
+             pool_memory(core->compressed_video_pool) / 1024,
+             pool_memory(core->compressed_audio_pool) / 1024,
+             mux.streams / 1024,
+             mux.mux_buffers / 1024, mux.mux_streams,
+             mux.segment_writers / 1024, mux.segment_writer_count,
+             mux.fmp4 / 1024, mux.fmp4_count);
+    syslog(LOG_INFO,"SESSION:%d (MAIN) STATUS: MEMORY %s\n", core->session_id, summary);
+    fprintf(stderr,"SESSION:%d (MAIN) STATUS: MEMORY %s\n", core->session_id, summary);
+}
+
+// reported holds the counts from the last report, nothing is logged unless something was dropped since
+static void report_backpressure(fillet_app_struct *core, int64_t *reported)
+{
+    int64_t counts[MAX_BACKPRESSURE_ACTIONS];
+    char summary[MAX_STR_SIZE];
+    int length = 0;
+    int changed = 0;
+    int a;
+
+    if (backpressure_counts(core->backpressure, counts) < 0) {
+        return;
+    }
+    for (a = 0; a < MAX_BACKPRESSURE_ACTIONS; a++) {
+        if (counts[a] != reported[a]) {
+            changed = 1;
+        }
+        length += snprintf(summary + length, MAX_STR_SIZE - length, "%s%s:%ld",
+                           a ? " " : "", backpressure_action_name(a), counts[a] - reported[a]);
+        if (length >= MAX_STR_SIZE) {
+            length = MAX_STR_SIZE - 1;
+        }
+        reported[a] = counts[a];
+    }
+    if (!changed) {
+        return;
+    }
+    syslog(LOG_INFO,"SESSION:%d (MAIN) STATUS: BACKPRESSURE LEVEL:%d DROPPED %s\n",
+           core->session_id, backpressure_level(core->backpressure), summary);
+    fprintf(stderr,"SESSION:%d (MAIN) STATUS: BACKPRESSURE LEVEL:%d DROPPED %s\n",
+            core->session_id, backpressure_level(core->backpressure), summary);
+    send_signal(core, SIGNAL_BACKPRESSURE, summary);
+}
+
 static fillet_app_struct *create_fillet_core(config_options_struct *cd, int num_sources)
 {
+    int64_t video_bitrate = DEFAULT_SLAB_VIDEO_BITRATE;
+    int64_t audio_bitrate = DEFAULT_SLAB_AUDIO_BITRATE;
+    int video_streams = num_sources;
     fillet_app_struct *core;
     int current_source;
 
@@ -287,11 +478,15 @@ static fillet_app_struct *create_fillet_core(config_options_struct *cd, int num_
 
     core->num_sources = num_sources;
     core->cd = cd;
+    // the transcode threads read this as soon as they start
+    core->sync_thread_restart_count = 0;
 #if defined(ENABLE_TRANSCODE)
     num_sources = MAX_TRANS_OUTPUTS;
 #endif // ENABLE_TRANSCODE
     core->source_stream = (source_stream_struct*)malloc(sizeof(source_stream_struct)*num_sources);
     core->event_queue = (void*)dataqueue_create();
+    core->video_frame_sync = framesync_create(MAX_SYNC_VIDEO_QUEUES, MAX_FRAME_DATA_SYNC_VIDEO);
+    core->audio_frame_sync = framesync_create(MAX_SYNC_AUDIO_QUEUES, MAX_FRAME_DATA_SYNC_AUDIO);
     core->webdav_queue = (void*)dataqueue_create();
     core->signal_queue = (void*)dataqueue_create();
 
@@ -308,15 +503,47 @@ static fillet_app_struct *create_fillet_core(config_options_struct *cd, int num_
     //this will limit memory usage for transcode so that it never turns into a
     //neverending malloc causing other instances of the app to fail
     //
-    //these should be mode over to preallocations to prevent heap fragmentation
-    //while running for longer periods of time
-    //heap fragmentation will add more kernel load- for now this is alright
-    //since we are aware of the tradeoffs regarding this choice
-    core->compressed_video_pool = memory_create(MAX_VIDEO_COMPRESSED_BUFFERS, 0);
-    core->compressed_audio_pool = memory_create(MAX_AUDIO_COMPRESSED_BUFFERS, 0);
+    //compressed frames come out of slabs sized from the bitrates, the source
+    //bitrate is not known yet so the defaults cover typical broadcast feeds
+#if defined(ENABLE_TRANSCODE)
+    {
+        int n;
+        for (n = 0; n < cd->num_outputs; n++) {
+            if ((int64_t)cd->transvideo_info[n].video_bitrate > video_bitrate) {
+                video_bitrate = cd->transvideo_info[n].video_bitrate;
+            }
+        }
+        for (n = 0; n < MAX_AUDIO_SOURCES; n++) {
+            if ((int64_t)cd->transaudio_info[n].audio_bitrate > audio_bitrate) {
+                audio_bitrate = cd->transaudio_info[n].audio_bitrate;
+            }
+        }
+        video_streams = cd->num_outputs + 1;
+    }
+#endif // ENABLE_TRANSCODE
+    core->compressed_video_pool = create_compressed_pool(MAX_VIDEO_COMPRESSED_BUFFERS,
+                                                         video_bitrate * 1000 / 8 / SLAB_FRAME_RATE,
+                                                         video_streams, 1);
+    core->compressed_audio_pool = create_compressed_pool(MAX_AUDIO_COMPRESSED_BUFFERS,
+                                                         audio_bitrate * 1000 / 8 * 1024 / 48000,
+                                                         video_streams, 0);
     core->raw_video_pool = memory_create(MAX_VIDEO_RAW_BUFFERS, 0);
     core->raw_audio_pool = memory_create(MAX_AUDIO_RAW_BUFFERS, 0);
 
+    // every stage takes and returns through these, keep most of it off the pool locks
+    memory_cache_enable(core->fillet_msg_pool, POOL_MAGAZINE_SIZE);
+    memory_cache_enable(core->frame_msg_pool, POOL_MAGAZINE_SIZE);
+    memory_cache_enable(core->compressed_video_pool, POOL_MAGAZINE_SIZE);
+    memory_cache_enable(core->compressed_audio_pool, POOL_MAGAZINE_SIZE);
+    memory_cache_enable(core->raw_video_pool, POOL_MAGAZINE_SIZE);
+    memory_cache_enable(core->raw_audio_pool, POOL_MAGAZINE_SIZE);
+
+    // running short on any of these drops frames instead of stopping the channel
+    core->backpressure = backpressure_create();
+    backpressure_watch_pool(core->backpressure, core->fillet_msg_pool);
+    backpressure_watch_pool(core->backpressure, core->frame_msg_pool);
+    backpressure_watch_pool(core->backpressure, core->compressed_video_pool);
+
     core->video_receive_time_set = 0;
     core->video_decode_time_set = 0;
     core->video_encode_time_set = 0;
@@ -346,6 +573,7 @@ static fillet_app_struct *create_fillet_core(config_options_struct *cd, int num_
         vstream = (video_stream_struct*)core->source_stream[current_source].video_stream;
         memset(vstream, 0, sizeof(video_stream_struct));
         vstream->last_timestamp_pts = -1;
+        vstream->max_temporal_id = -1;
         vstream->last_timestamp_dts = -1;
         vstream->video_queue = (void*)dataqueue_create();
     }
@@ -785,6 +1013,26 @@ static int parse_input_options(int argc, char **argv)
                   fprintf(stderr,"STATUS: Using window size: %d\n", config_data.window_size);
               }
               break;
+          case 'L':
+              if (optarg) {
+                  config_data.sync_latency = atoi(optarg);
+                  if (config_data.sync_latency < MIN_SYNC_LATENCY || config_data.sync_latency > MAX_SYNC_LATENCY) {
+                      fprintf(stderr,"ERROR: INVALID SYNC LATENCY: %d\n", config_data.sync_latency);
+                      return -1;
+                  }
+                  fprintf(stderr,"STATUS: Using sync latency: %d ms\n", config_data.sync_latency);
+              }
+              break;
+          case 'I':
+              if (optarg) {
+                  config_data.psi_interval = atoi(optarg);
+                  if (config_data.psi_interval < MIN_PSI_INTERVAL || config_data.psi_interval > MAX_PSI_INTERVAL) {
+                      fprintf(stderr,"ERROR: INVALID PSI INTERVAL: %d\n", config_data.psi_interval);
+                      return -1;
+                  }
+                  fprintf(stderr,"STATUS: Using psi interval: %d ms\n", config_data.psi_interval);
+              }
+              break;
           case 'r':
               if (optarg) {
                   config_data.rollover_size = atoi(optarg);
@@ -1099,12 +1347,11 @@ static int message_dispatch(int p1, int64_t p2, int64_t p3, int64_t p4, int64_t
      return 0;
 }
 
-int peek_frame(sorted_frame_struct **frame_data, int entries, int pos, int64_t *current_time, int *sync)
+int peek_frame(void *frame_sync, int64_t *current_time, int *sync)
 {
     sorted_frame_struct *get_frame;
 
-    pos = 0;
-    get_frame = (sorted_frame_struct*)frame_data[pos];
+    get_frame = (sorted_frame_struct*)framesync_peek(frame_sync, NULL);
     if (get_frame) {
         if (get_frame->frame_type == FRAME_TYPE_VIDEO) {
             *current_time = get_frame->full_time;
@@ -1118,18 +1365,12 @@ int peek_frame(sorted_frame_struct **frame_data, int entries, int pos, int64_t *
     return -1;
 }
 
-int use_frame(fillet_app_struct *core, sorted_frame_struct **frame_data, int entries, int pos, int64_t *current_time, int dump_sample, sorted_frame_struct **output_frame)
+int use_frame(fillet_app_struct *core, void *frame_sync, int64_t *current_time, int dump_sample, sorted_frame_struct **output_frame)
 {
-    int i;
     sorted_frame_struct *get_frame;
 
-    // start from the top
-    pos = 0;
-    get_frame = (sorted_frame_struct*)frame_data[pos];
-    for (i = pos; i < entries; i++) {
-        frame_data[i] = frame_data[i+1];
-    }
-
+    // earliest frame over all of the sources
+    get_frame = (sorted_frame_struct*)framesync_take(frame_sync, NULL);
     if (!get_frame) {
         fprintf(stderr,"warning: no frame returned in use_frame\n");
         return 0;
@@ -1142,6 +1383,19 @@ int use_frame(fillet_app_struct *core, sorted_frame_struct **frame_data, int ent
     }
 
     if (!dump_sample) {
+        sync_hold_struct *hold;
+        int64_t held = demux_clock_now() - get_frame->time_received;
+
+        if (get_frame->frame_type == FRAME_TYPE_VIDEO) {
+            hold = &video_sync_hold[get_frame->source];
+        } else {
+            hold = &audio_sync_hold[get_frame->source];
+        }
+        hold->total += held;
+        hold->count++;
+        if (held > hold->max) {
+            hold->max = held;
+        }
         *output_frame = get_frame;
     } else {
         *output_frame = NULL;
@@ -1150,61 +1404,168 @@ int use_frame(fillet_app_struct *core, sorted_frame_struct **frame_data, int ent
         get_frame = NULL;
     }
 
-    return entries - 1;
+    return framesync_count(frame_sync);
 }
 
-int add_frame(sorted_frame_struct **frame_data, int entries, sorted_frame_struct *new_frame, int capacity)
+// one queue per source, and per audio stream of a source
+static int sync_queue(sorted_frame_struct *frame)
+{
+    if (frame->frame_type == FRAME_TYPE_VIDEO) {
+        return frame->source;
+    }
+    return frame->source * MAX_AUDIO_STREAMS + frame->sub_stream;
+}
+
+int add_frame(void *frame_sync, sorted_frame_struct *new_frame)
 {
-    int i;
     int new_count;
 
-    if (entries >= capacity) {
-        return entries;
+    new_frame->time_received = demux_clock_now();
+    new_count = framesync_add(frame_sync, sync_queue(new_frame), new_frame->full_time, new_frame);
+    if (new_count < 0) {
+        return framesync_count(frame_sync);
     }
 
-    for (i = entries - 1; (i >= 0 && frame_data[i]->full_time > new_frame->full_time); i--) {
-        frame_data[i+1] = frame_data[i];
+    // callers hold sync_lock, wake frame_sync_thread if it is waiting on frames
+    pthread_cond_signal(&sync_cond);
+
+    return new_count;
+}
+
+static void init_sync_signal(void)
+{
+    pthread_condattr_t cond_attr;
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sync_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+}
+
+// the main loop restarts the sync thread, without this it only notices on its next event timeout
+static void wake_main_loop(fillet_app_struct *core)
+{
+    dataqueue_message_struct *msg;
+
+    msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
+    if (msg) {
+        memset(msg, 0, sizeof(dataqueue_message_struct));
+        msg->flags = MSG_WAKEUP;
+        dataqueue_put_front(core->event_queue, msg);
     }
-    frame_data[i+1] = (sorted_frame_struct*)new_frame;
+}
 
-    new_count = entries + 1;
+// sleep until add_frame files another frame or timeout_ms passes, the entry
+// counts are the ones the caller last looked at so a frame added since is not missed
+static void wait_for_sync_frames(int audio_entries, int video_entries, int timeout_ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
 
-    return new_count;
+    pthread_mutex_lock(&sync_lock);
+    if (!quit_sync_thread &&
+        audio_synchronizer_entries == audio_entries &&
+        video_synchronizer_entries == video_entries) {
+        pthread_cond_timedwait(&sync_cond, &sync_lock, &deadline);
+    }
+    pthread_mutex_unlock(&sync_lock);
 }
 
-int dump_frames(fillet_app_struct *core, sorted_frame_struct **frame_data, int max)
+int dump_frames(fillet_app_struct *core, void *frame_sync)
 {
-    int i;
+    sorted_frame_struct *frame;
+    int i = 0;
 
     fprintf(stderr,"-------------- dumping out frame data ------------\n");
-    for (i = 0; i < max; i++) {
-        if (frame_data[i]) {
-            if (frame_data[i]->frame_type == FRAME_TYPE_VIDEO) {
-                fprintf(stderr,"[I:%4d] VIDEO:  SOURCE:%d PTS:%ld\n",
-                        i,
-                        frame_data[i]->source,
-                        frame_data[i]->full_time);
-                memory_return(core->compressed_video_pool, frame_data[i]->buffer);
-                frame_data[i]->buffer = NULL;
-                memory_return(core->frame_msg_pool, frame_data[i]);
-                frame_data[i] = NULL;
-            } else {
-                fprintf(stderr,"[I:%4d] AUDIO:  SOURCE:%d PTS:%ld\n",
-                        i,
-                        frame_data[i]->source,
-                        frame_data[i]->full_time);
-                memory_return(core->compressed_audio_pool, frame_data[i]->buffer);
-                frame_data[i]->buffer = NULL;
-                memory_return(core->frame_msg_pool, frame_data[i]);
-                frame_data[i] = NULL;
-            }
+    while ((frame = (sorted_frame_struct*)framesync_take(frame_sync, NULL)) != NULL) {
+        if (frame->frame_type == FRAME_TYPE_VIDEO) {
+            fprintf(stderr,"[I:%4d] VIDEO:  SOURCE:%d PTS:%ld\n",
+                    i,
+                    frame->source,
+                    frame->full_time);
+            memory_return(core->compressed_video_pool, frame->buffer);
         } else {
-            //fprintf(stderr,"[I:%4d] NO FRAME DATA\n", i);
+            fprintf(stderr,"[I:%4d] AUDIO:  SOURCE:%d PTS:%ld\n",
+                    i,
+                    frame->source,
+                    frame->full_time);
+            memory_return(core->compressed_audio_pool, frame->buffer);
         }
+        frame->buffer = NULL;
+        memory_return(core->frame_msg_pool, frame);
+        i++;
     }
     return 0;
 }
 
+static void drop_sync_frame(fillet_app_struct *core, sorted_frame_struct *frame)
+{
+    if (frame->frame_type == FRAME_TYPE_VIDEO) {
+        memory_return(core->compressed_video_pool, frame->buffer);
+    } else {
+        memory_return(core->compressed_audio_pool, frame->buffer);
+    }
+    frame->buffer = NULL;
+    memory_return(core->frame_msg_pool, frame);
+    backpressure_count(core->backpressure, BACKPRESSURE_SYNC_DROPPED);
+}
+
+// microseconds until the earliest frame has been held for the sync latency,
+// 0 once it can go out and -1 with nothing waiting, callers hold sync_lock
+static int64_t sync_hold_remaining(void *frame_sync, int64_t now)
+{
+    sorted_frame_struct *frame = (sorted_frame_struct*)framesync_peek(frame_sync, NULL);
+    int64_t remaining;
+
+    if (!frame) {
+        return -1;
+    }
+    remaining = frame->time_received + (int64_t)config_data.sync_latency * 1000 - now;
+    if (remaining < 0) {
+        return 0;
+    }
+    return remaining;
+}
+
+static void report_sync_hold(fillet_app_struct *core)
+{
+    sync_hold_struct video_hold[MAX_SYNC_VIDEO_QUEUES];
+    sync_hold_struct audio_hold[MAX_SYNC_VIDEO_QUEUES];
+    int source;
+
+    pthread_mutex_lock(&sync_lock);
+    memcpy(video_hold, video_sync_hold, sizeof(video_hold));
+    memcpy(audio_hold, audio_sync_hold, sizeof(audio_hold));
+    memset(video_sync_hold, 0, sizeof(video_sync_hold));
+    memset(audio_sync_hold, 0, sizeof(audio_sync_hold));
+    pthread_mutex_unlock(&sync_lock);
+
+    for (source = 0; source < MAX_SYNC_VIDEO_QUEUES; source++) {
+        if (!video_hold[source].count && !audio_hold[source].count) {
+            continue;
+        }
+        syslog(LOG_INFO,"SESSION:%d (MAIN) STATUS: SYNC HOLD SOURCE:%d TARGET:%dms VIDEO AVG:%ldms MAX:%ldms AUDIO AVG:%ldms MAX:%ldms\n",
+               core->session_id, source, config_data.sync_latency,
+               video_hold[source].count ? video_hold[source].total / video_hold[source].count / 1000 : 0,
+               video_hold[source].max / 1000,
+               audio_hold[source].count ? audio_hold[source].total / audio_hold[source].count / 1000 : 0,
+               audio_hold[source].max / 1000);
+        fprintf(stderr,"SESSION:%d (MAIN) STATUS: SYNC HOLD SOURCE:%d TARGET:%dms VIDEO AVG:%ldms MAX:%ldms AUDIO AVG:%ldms MAX:%ldms\n",
+                core->session_id, source, config_data.sync_latency,
+                video_hold[source].count ? video_hold[source].total / video_hold[source].count / 1000 : 0,
+                video_hold[source].max / 1000,
+                audio_hold[source].count ? audio_hold[source].total / audio_hold[source].count / 1000 : 0,
+                audio_hold[source].max / 1000);
+    }
+}
+
 static void *frame_sync_thread(void *context)
 {
     fillet_app_struct *core = (fillet_app_struct*)context;
@@ -1219,6 +1580,8 @@ static void *frame_sync_thread(void *context)
     int print_entries = 0;
     int print_current_time = 0;
     int active_sources;
+    int64_t audio_remaining;
+    int64_t video_remaining;
 
     fprintf(stderr,"SESSION:%d (MAIN) STATUS: STARTING NEW SYNC THREAD\n", core->session_id);
     while (1) {
@@ -1227,19 +1590,21 @@ static void *frame_sync_thread(void *context)
 
         if (quit_sync_thread) {
             pthread_mutex_lock(&sync_lock);
-            dump_frames(core, core->video_frame_data, MAX_FRAME_DATA_SYNC_VIDEO);
-            dump_frames(core, core->audio_frame_data, MAX_FRAME_DATA_SYNC_AUDIO);
+            dump_frames(core, core->video_frame_sync);
+            dump_frames(core, core->audio_frame_sync);
             pthread_mutex_unlock(&sync_lock);
             video_synchronizer_entries = 0;
             audio_synchronizer_entries = 0;
             fprintf(stderr,"SESSION:%d (MAIN) STATUS: LEAVING SYNC THREAD - DISCONTINUITY\n", core->session_id);
             sync_thread_running = 0;
+            wake_main_loop(core);
 
             if (enable_transcode) {
-                fprintf(stderr,"SESSION:%d (MAIN) STATUS: RESTARTING APPLICATION\n", core->session_id);
-                // setup Docker container do a restart
-                send_direct_error(core, SIGNAL_SERVICE_RESTART, "Unrecoverable Discontinuity Detected - Restarting Service");
-                exit(0);
+                // the encoders stay up, the decoders flush and re-anchor once the main loop
+                // bumps the restart count and the outputs pick up again at the next idr
+                fprintf(stderr,"SESSION:%d (MAIN) STATUS: RECOVERING SYNC IN PLACE\n", core->session_id);
+                syslog(LOG_INFO,"SESSION:%d (MAIN) STATUS: RECOVERING SYNC IN PLACE\n", core->session_id);
+                send_signal(core, SIGNAL_SYNC_RECOVERY, "Discontinuity Detected - Resynchronizing");
             }
 
             return NULL;
@@ -1267,12 +1632,19 @@ static void *frame_sync_thread(void *context)
         active_sources = config_data.active_sources;
 #endif
 
-        if (audio_synchronizer_entries > active_sources && video_synchronizer_entries > active_sources) {
+        // each side is released once its earliest frame has waited out the sync latency,
+        // by then a later source has had that long to deliver anything that sorts in front
+        pthread_mutex_lock(&sync_lock);
+        audio_remaining = sync_hold_remaining(core->audio_frame_sync, demux_clock_now());
+        video_remaining = sync_hold_remaining(core->video_frame_sync, demux_clock_now());
+        pthread_mutex_unlock(&sync_lock);
+
+        if (audio_remaining == 0 && video_remaining == 0) {
             output_frame = NULL;
 
             pthread_mutex_lock(&sync_lock);
-            peek_frame(core->audio_frame_data, audio_synchronizer_entries, 0, &current_audio_time, &audio_sync);
-            peek_frame(core->video_frame_data, video_synchronizer_entries, 0, &current_video_time, &video_sync);
+            peek_frame(core->audio_frame_sync, &current_audio_time, &audio_sync);
+            peek_frame(core->video_frame_sync, &current_video_time, &video_sync);
             pthread_mutex_unlock(&sync_lock);
 
             if (enable_verbose) {
@@ -1288,9 +1660,13 @@ static void *frame_sync_thread(void *context)
 
             if (current_audio_time <= current_video_time) {
                 no_grab = 0;
-                while (current_audio_time < current_video_time && audio_synchronizer_entries > active_sources && !quit_sync_thread) {
+                while (current_audio_time < current_video_time && !quit_sync_thread) {
                     pthread_mutex_lock(&sync_lock);
-                    audio_synchronizer_entries = use_frame(core, core->audio_frame_data, audio_synchronizer_entries, 0, &current_audio_time, first_grab, &output_frame);
+                    if (sync_hold_remaining(core->audio_frame_sync, demux_clock_now()) != 0) {
+                        pthread_mutex_unlock(&sync_lock);
+                        break;
+                    }
+                    audio_synchronizer_entries = use_frame(core, core->audio_frame_sync, &current_audio_time, first_grab, &output_frame);
                     pthread_mutex_unlock(&sync_lock);
                     if (output_frame) {
                         dataqueue_message_struct *msg;
@@ -1302,13 +1678,16 @@ static void *frame_sync_thread(void *context)
                             dataqueue_put_front(core->hlsmux->input_queue, msg);
                             output_frame = NULL;
                         } else {
-                            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                                    core->session_id);
-                            send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Audio Message Buffers - Check CPU LOAD!");
-                            exit(0);
+                            // the muxer restarts at the next sync frame of every source
+                            drop_sync_frame(core, output_frame);
+                            output_frame = NULL;
+                            if (!source_discontinuity) {
+                                backpressure_count(core->backpressure, BACKPRESSURE_DISCONTINUITY);
+                                source_discontinuity = 1;
+                            }
                         }
                     } else {
-                        usleep(1000);
+                        wait_for_sync_frames(audio_synchronizer_entries, video_synchronizer_entries, 1);
                     }
                 }
             } else {
@@ -1334,7 +1713,7 @@ static void *frame_sync_thread(void *context)
 
             if (!first_grab) {
                 pthread_mutex_lock(&sync_lock);
-                video_synchronizer_entries = use_frame(core, core->video_frame_data, video_synchronizer_entries, 0, &current_video_time, first_grab, &output_frame);
+                video_synchronizer_entries = use_frame(core, core->video_frame_sync, &current_video_time, first_grab, &output_frame);
                 pthread_mutex_unlock(&sync_lock);
 
                 if (output_frame) {
@@ -1347,17 +1726,29 @@ static void *frame_sync_thread(void *context)
                         dataqueue_put_front(core->hlsmux->input_queue, msg);
                         output_frame = NULL;
                     } else {
-                        fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                                core->session_id);
-                        send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Video Message Buffers - Check CPU LOAD!");
-                        exit(0);
+                        // the muxer restarts at the next sync frame of every source
+                        drop_sync_frame(core, output_frame);
+                        output_frame = NULL;
+                        if (!source_discontinuity) {
+                            backpressure_count(core->backpressure, BACKPRESSURE_DISCONTINUITY);
+                            source_discontinuity = 1;
+                        }
                     }
                 } else {
-                    usleep(1000);
+                    wait_for_sync_frames(audio_synchronizer_entries, video_synchronizer_entries, 1);
                 }
             }
         } else {
-            usleep(5000);
+            int timeout_ms = SYNC_WAIT_TIMEOUT;
+
+            // nothing waiting on one side means sleeping until a frame arrives
+            if (audio_remaining > 0 || video_remaining > 0) {
+                if (audio_remaining >= 0 && video_remaining >= 0) {
+                    int64_t remaining = audio_remaining > video_remaining ? audio_remaining : video_remaining;
+                    timeout_ms = (int)((remaining + 999) / 1000);
+                }
+            }
+            wait_for_sync_frames(audio_synchronizer_entries, video_synchronizer_entries, timeout_ms);
         }
     }
 
@@ -1373,10 +1764,9 @@ int audio_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
 
     new_frame = (sorted_frame_struct*)memory_take(core->frame_msg_pool, sizeof(sorted_frame_struct));
     if (!new_frame) {
-        fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain frame message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                core->session_id);
-        send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Audio Message Buffers - Check CPU LOAD!");
-        exit(0);
+        memory_return(core->compressed_audio_pool, new_buffer);
+        backpressure_count(core->backpressure, BACKPRESSURE_AUDIO_DROPPED);
+        return 0;
     }
 
     new_frame->buffer = new_buffer;
@@ -1387,6 +1777,11 @@ int audio_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
     //new_frame->duration = 1920; // single aac frame
     // duration should be 1920 for single aac frame
     new_frame->duration = new_frame->full_time - astream->last_full_time;
+    new_frame->discontinuity = 0;
+    if (astream->last_full_time > 0 &&
+        (new_frame->duration <= 0 || new_frame->duration > SINK_DISCONTINUITY_GAP)) {
+        new_frame->discontinuity = 1;
+    }
     new_frame->first_timestamp = 0;
     new_frame->source = 0;
     new_frame->sub_stream = sub_stream;
@@ -1394,12 +1789,14 @@ int audio_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
 
     new_frame->frame_type = FRAME_TYPE_AUDIO;
     new_frame->media_type = MEDIA_TYPE_AAC;
+    new_frame->nal_index.count = 0;
+    new_frame->nal_index.truncated = 0;
     new_frame->time_received = 0;
     memset(new_frame->lang_tag,0,sizeof(new_frame->lang_tag));
 
 
     pthread_mutex_lock(&sync_lock);
-    audio_synchronizer_entries = add_frame(core->audio_frame_data, audio_synchronizer_entries, new_frame, MAX_FRAME_DATA_SYNC_AUDIO);
+    audio_synchronizer_entries = add_frame(core->audio_frame_sync, new_frame);
     if (audio_synchronizer_entries >= MAX_FRAME_DATA_SYNC_AUDIO) {
         restart_sync_thread = 1;
     }
@@ -1408,17 +1805,14 @@ int audio_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
     if (restart_sync_thread) {
         fprintf(stderr,"GETTING SYNC LOCK\n");
         pthread_mutex_lock(&sync_lock);
-        dump_frames(core, core->video_frame_data, MAX_FRAME_DATA_SYNC_VIDEO);
-        dump_frames(core, core->audio_frame_data, MAX_FRAME_DATA_SYNC_AUDIO);
+        dump_frames(core, core->video_frame_sync);
+        dump_frames(core, core->audio_frame_sync);
         pthread_mutex_unlock(&sync_lock);
         fprintf(stderr,"DONE WITH SYNC LOCK\n");
         video_synchronizer_entries = 0;
         audio_synchronizer_entries = 0;
         quit_sync_thread = 1;
-#if defined(ENABLE_TRANSCODE)
-        stop_video_transcode_threads(core);
-        stop_audio_transcode_threads(core);
-#endif // ENABLE_TRANSCODE
+        pthread_cond_signal(&sync_cond);
         fprintf(stderr,"WAITING FOR SYNC THREAD TO STOP\n");
         pthread_join(frame_sync_thread_id, NULL);
         fprintf(stderr,"DONE WAITING FOR SYNC THREAD TO STOP\n");
@@ -1438,16 +1832,16 @@ int video_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
 
     new_frame = (sorted_frame_struct*)memory_take(core->frame_msg_pool, sizeof(sorted_frame_struct));
     if (!new_frame) {
-        fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain frame message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                core->session_id);
-        send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Video Message Buffers - Check CPU LOAD!");
-        exit(0);
+        memory_return(core->compressed_video_pool, new_buffer);
+        backpressure_count(core->backpressure, BACKPRESSURE_VIDEO_DROPPED);
+        return 0;
     }
     new_frame->buffer = new_buffer;
     new_frame->buffer_size = sample_size;
     new_frame->pts = pts;
     new_frame->dts = dts;
     new_frame->full_time = dts;// + vstream->overflow_dts;
+    new_frame->discontinuity = 0;
 
     if (splice_point > 0 || splice_duration > 0 || splice_duration_remaining > 0) {
         syslog(LOG_INFO,"SCTE35: VIDEO SINK CALLBACK:  SPLICE:%d  DURATION:%ld  REMAINING:%ld (%ld seconds)\n",
@@ -1468,6 +1862,10 @@ int video_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
     }*/
 
     new_frame->duration = new_frame->full_time - vstream->last_full_time;
+    if (vstream->last_full_time > 0 &&
+        (new_frame->duration <= 0 || new_frame->duration > SINK_DISCONTINUITY_GAP)) {
+        new_frame->discontinuity = 1;
+    }
     new_frame->first_timestamp = vstream->first_timestamp;
     new_frame->source = source;
     new_frame->sub_stream = 0;
@@ -1482,33 +1880,26 @@ int video_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
 
     new_frame->frame_type = FRAME_TYPE_VIDEO;
     if (config_data.transvideo_info[0].video_codec == STREAM_TYPE_HEVC) {
-        for (i = 0; i < sample_size - 3; i++) {
-            if (new_buffer[i] == 0x00 &&
-                new_buffer[i+1] == 0x00 &&
-                new_buffer[i+2] == 0x01) {
-                int nal_type = (new_buffer[i+3] & 0x7f) >> 1;
-                if (nal_type == 19 ||
-                    nal_type == 20) {   // IDR
-                    fprintf(stderr,"\n\nHEVC SYNC FRAME FOUND\n\n");
-                    sync_frame = 1;
-                    break;
-                }
+        build_nal_index(new_buffer, sample_size, 1, &new_frame->nal_index);
+        for (i = 0; i < new_frame->nal_index.count; i++) {
+            int nal_type = new_frame->nal_index.nal[i].type;
+            if (nal_type == 19 ||
+                nal_type == 20) {   // IDR
+                fprintf(stderr,"\n\nHEVC SYNC FRAME FOUND\n\n");
+                sync_frame = 1;
+                break;
             }
         }
         new_frame->media_type = MEDIA_TYPE_HEVC;
     } else {
-        for (i = 0; i < sample_size - 4; i++) {
-            if (new_buffer[i] == 0x00 &&
-                new_buffer[i+1] == 0x00 &&
-                new_buffer[i+2] == 0x00 &&
-                new_buffer[i+3] == 0x01) {
-                int nal_type = new_buffer[i+4] & 0x1f;
-                if (nal_type == 7 ||
-                    nal_type == 8 ||
-                    nal_type == 5) {   // IDR
-                    sync_frame = 1;
-                    break;
-                }
+        build_nal_index(new_buffer, sample_size, 0, &new_frame->nal_index);
+        for (i = 0; i < new_frame->nal_index.count; i++) {
+            int nal_type = new_frame->nal_index.nal[i].type;
+            if (nal_type == 7 ||
+                nal_type == 8 ||
+                nal_type == 5) {   // IDR
+                sync_frame = 1;
+                break;
             }
         }
         new_frame->media_type = MEDIA_TYPE_H264;
@@ -1527,7 +1918,7 @@ int video_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
     //    }
 
     pthread_mutex_lock(&sync_lock);
-    video_synchronizer_entries = add_frame(core->video_frame_data, video_synchronizer_entries, new_frame, MAX_FRAME_DATA_SYNC_VIDEO);
+    video_synchronizer_entries = add_frame(core->video_frame_sync, new_frame);
     if (video_synchronizer_entries >= MAX_FRAME_DATA_SYNC_VIDEO) {
         restart_sync_thread = 1;
     }
@@ -1536,15 +1927,14 @@ int video_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
     if (restart_sync_thread) {
         fprintf(stderr,"GETTING SYNC LOCK\n");
         pthread_mutex_lock(&sync_lock);
-        dump_frames(core, core->video_frame_data, MAX_FRAME_DATA_SYNC_VIDEO);
-        dump_frames(core, core->audio_frame_data, MAX_FRAME_DATA_SYNC_AUDIO);
+        dump_frames(core, core->video_frame_sync);
+        dump_frames(core, core->audio_frame_sync);
         pthread_mutex_unlock(&sync_lock);
         fprintf(stderr,"DONE WITH SYNC LOCK\n");
         video_synchronizer_entries = 0;
         audio_synchronizer_entries = 0;
         quit_sync_thread = 1;
-        stop_video_transcode_threads(core);
-        stop_audio_transcode_threads(core);
+        pthread_cond_signal(&sync_cond);
         fprintf(stderr,"WAITING FOR SYNC THREAD TO STOP\n");
         pthread_join(frame_sync_thread_id, NULL);
         fprintf(stderr,"DONE WAITING FOR SYNC THREAD TO STOP\n");
@@ -1553,7 +1943,7 @@ int video_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int
 }
 #endif // ENABLE_TRANSCODE
 
-static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint32_t sample_flags, int64_t pts, int64_t dts, int64_t last_pcr, int source, int sub_source, char *lang_tag, void *context)
+static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint32_t sample_flags, int64_t pts, int64_t dts, int64_t last_pcr, int source, int sub_source, char *lang_tag, nal_index_struct *nal_index, void *context)
 {
     fillet_app_struct *core = (fillet_app_struct*)context;
     int restart_sync_thread = 0;
@@ -1613,6 +2003,8 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
         struct timespec current_time;
         int64_t br;
         int64_t diff;
+        int pressure;
+        int reference;
 
         if (enable_verbose || sample_flags) {
             fprintf(stderr,"STATUS: RECEIVE_FRAME (H264/HEVC :%2d): TYPE:%2d PTS:%15ld DTS:%15ld KEY:%d\n",
@@ -1624,10 +2016,10 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
         }
 
         if (vstream->total_video_bytes == 0) {
-            clock_gettime(CLOCK_REALTIME, &vstream->video_clock_start);
+            clock_gettime(CLOCK_MONOTONIC, &vstream->video_clock_start);
         }
         vstream->total_video_bytes += sample_size;
-        clock_gettime(CLOCK_REALTIME, &current_time);
+        clock_gettime(CLOCK_MONOTONIC, &current_time);
 
         diff = time_difference(&current_time, &vstream->video_clock_start) / 1000;
         if (diff > 0) {
@@ -1693,24 +2085,36 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
             return 0;
         }
 
+        // a dropped frame leaves last_full_time alone, the next kept frame carries its duration
+        if (sample_type == STREAM_TYPE_HEVC) {
+            int max_temporal_id = nal_index_max_temporal_id(sample, nal_index);
+
+            if (max_temporal_id >= 0) {
+                vstream->max_temporal_id = max_temporal_id;
+            }
+        }
+        reference = nal_index_is_reference(sample, nal_index, sample_type == STREAM_TYPE_HEVC, vstream->max_temporal_id);
+        pressure = backpressure_video_frame(core->backpressure, source, vstream->video_bitrate, sample_flags, reference);
+        if (pressure == BACKPRESSURE_DROP) {
+            return 0;
+        }
+
         new_buffer = (uint8_t*)memory_take(core->compressed_video_pool, sample_size);
         if (!new_buffer) {
-            fprintf(stderr,"SESSION:%d (MAIN) STATUS: unable to obtain compressed video buffer! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            send_direct_error(core, SIGNAL_DIRECT_ERROR_NALPOOL, "Out of Video NAL Buffers - Check CPU LOAD!");
-            exit(0);
+            backpressure_video_lost(core->backpressure, source);
+            return 0;
         }
         memcpy(new_buffer, sample, sample_size);
 
         new_frame = (sorted_frame_struct*)memory_take(core->frame_msg_pool, sizeof(sorted_frame_struct));
         if (!new_frame) {
-            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain frame message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Video Message Buffers - Check CPU LOAD!");
-            exit(0);
+            memory_return(core->compressed_video_pool, new_buffer);
+            backpressure_video_lost(core->backpressure, source);
+            return 0;
         }
         new_frame->buffer = new_buffer;
         new_frame->buffer_size = sample_size;
+        new_frame->discontinuity = (pressure == BACKPRESSURE_RESUME);
 
         new_frame->pts = pts;
         new_frame->dts = dts;
@@ -1798,6 +2202,13 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
         } else if (sample_type == STREAM_TYPE_HEVC) {
             new_frame->media_type = MEDIA_TYPE_HEVC;
         }
+        // offsets are relative to the frame, so the demuxer index holds for the copy
+        if (nal_index) {
+            memcpy(&new_frame->nal_index, nal_index, sizeof(nal_index_struct));
+        } else {
+            new_frame->nal_index.count = 0;
+            new_frame->nal_index.truncated = 0;
+        }
         new_frame->time_received = 0;
         if (lang_tag) {
             new_frame->lang_tag[0] = lang_tag[0];
@@ -1819,16 +2230,18 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
                 dataqueue_put_front(core->transvideo->input_queue, decode_msg);
                 decode_msg = NULL;
             } else {
-                fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                        core->session_id);
-                send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Video Message Buffers - Check CPU LOAD!");
-                exit(0);
+                memory_return(core->compressed_video_pool, new_frame->buffer);
+                new_frame->buffer = NULL;
+                memory_return(core->frame_msg_pool, new_frame);
+                new_frame = NULL;
+                backpressure_video_lost(core->backpressure, source);
+                return 0;
             }
 #endif // ENABLE_TRANSCODE
         } else {
             if (sync_thread_running && !quit_sync_thread) {
                 pthread_mutex_lock(&sync_lock);
-                video_synchronizer_entries = add_frame(core->video_frame_data, video_synchronizer_entries, new_frame, MAX_FRAME_DATA_SYNC_VIDEO);
+                video_synchronizer_entries = add_frame(core->video_frame_sync, new_frame);
                 if (video_synchronizer_entries >= MAX_FRAME_DATA_SYNC_VIDEO) {
                     restart_sync_thread = 1;
                 }
@@ -1882,10 +2295,10 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
         }
 
         if (astream->total_audio_bytes == 0) {
-            clock_gettime(CLOCK_REALTIME, &astream->audio_clock_start);
+            clock_gettime(CLOCK_MONOTONIC, &astream->audio_clock_start);
         }
         astream->total_audio_bytes += sample_size;
-        clock_gettime(CLOCK_REALTIME, &current_time);
+        clock_gettime(CLOCK_MONOTONIC, &current_time);
 
         diff = time_difference(&current_time, &astream->audio_clock_start) / 1000;
         if (diff > 0) {
@@ -1895,10 +2308,8 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
 
         new_buffer = (uint8_t*)memory_take(core->compressed_audio_pool, sample_size);
         if (!new_buffer) {
-            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain compressed audio buffer! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            send_direct_error(core, SIGNAL_DIRECT_ERROR_NALPOOL, "Out of Compressed Audio Buffers - Check CPU LOAD!");
-            exit(0);
+            backpressure_count(core->backpressure, BACKPRESSURE_AUDIO_DROPPED);
+            return 0;
         }
         memcpy(new_buffer, sample, sample_size);
 
@@ -1937,16 +2348,16 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
 
         new_frame = (sorted_frame_struct*)memory_take(core->frame_msg_pool, sizeof(sorted_frame_struct));
         if (!new_frame) {
-            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain frame message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Audio Message Buffers - Check CPU LOAD!");
-            exit(0);
+            memory_return(core->compressed_audio_pool, new_buffer);
+            backpressure_count(core->backpressure, BACKPRESSURE_AUDIO_DROPPED);
+            return 0;
         }
         new_frame->buffer = new_buffer;
         new_frame->buffer_size = sample_size;
         new_frame->pts = pts;
         new_frame->dts = dts;
         new_frame->full_time = pts + astream->overflow_pts;
+        new_frame->discontinuity = 0;
         new_frame->duration = new_frame->full_time - astream->last_full_time;
 #if defined(ENABLE_TRANSCODE)
         if (!enable_transcode) {            // gets set in audio_sink_frame_callback
@@ -1967,6 +2378,8 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
         } else if (sample_type == STREAM_TYPE_MPEG) {
             new_frame->media_type = MEDIA_TYPE_MPEG;
         }
+        new_frame->nal_index.count = 0;
+        new_frame->nal_index.truncated = 0;
         new_frame->time_received = 0;
         if (lang_tag) {
             new_frame->lang_tag[0] = lang_tag[0];
@@ -1987,16 +2400,18 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
                 dataqueue_put_front(core->transaudio[sub_source]->input_queue, decode_msg);
                 decode_msg = NULL;
             } else {
-                fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                        core->session_id);
-                send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Audio Message Buffers - Check CPU LOAD!");
-                exit(0);
+                memory_return(core->compressed_audio_pool, new_frame->buffer);
+                new_frame->buffer = NULL;
+                memory_return(core->frame_msg_pool, new_frame);
+                new_frame = NULL;
+                backpressure_count(core->backpressure, BACKPRESSURE_AUDIO_DROPPED);
+                return 0;
             }
 #endif // ENABLE_TRANSCODE
         } else {
             if (sync_thread_running && !quit_sync_thread) {
                 pthread_mutex_lock(&sync_lock);
-                audio_synchronizer_entries = add_frame(core->audio_frame_data, audio_synchronizer_entries, new_frame, MAX_FRAME_DATA_SYNC_AUDIO);
+                audio_synchronizer_entries = add_frame(core->audio_frame_sync, new_frame);
                 if (audio_synchronizer_entries >= MAX_FRAME_DATA_SYNC_AUDIO) {
                     restart_sync_thread = 1;
                 }
@@ -2015,17 +2430,14 @@ static int receive_frame(uint8_t *sample, int sample_size, int sample_type, uint
     if (restart_sync_thread) {
         fprintf(stderr,"GETTING SYNC LOCK\n");
         pthread_mutex_lock(&sync_lock);
-        dump_frames(core, core->video_frame_data, MAX_FRAME_DATA_SYNC_VIDEO);
-        dump_frames(core, core->audio_frame_data, MAX_FRAME_DATA_SYNC_AUDIO);
+        dump_frames(core, core->video_frame_sync);
+        dump_frames(core, core->audio_frame_sync);
         pthread_mutex_unlock(&sync_lock);
         fprintf(stderr,"DONE WITH SYNC LOCK\n");
         video_synchronizer_entries = 0;
         audio_synchronizer_entries = 0;
         quit_sync_thread = 1;
-#if defined(ENABLE_TRANSCODE)
-        stop_video_transcode_threads(core);
-        stop_audio_transcode_threads(core);
-#endif // ENABLE_TRANSCODE
+        pthread_cond_signal(&sync_cond);
         fprintf(stderr,"WAITING FOR SYNC THREAD TO STOP: %d\n", sync_thread_running);
         pthread_join(frame_sync_thread_id, NULL);
         fprintf(stderr,"DONE WAITING FOR SYNC THREAD TO STOP\n");
@@ -2041,12 +2453,17 @@ int main(int argc, char **argv)
      pthread_t client_thread_id;
      int c;
      int loop_count = 0;
+     time_t last_pool_report = time(NULL);
+     int64_t reported_backpressure[MAX_BACKPRESSURE_ACTIONS] = {0};
 
      socket_udp_global_init();
+     init_sync_signal();
 
      signal(SIGSEGV, crash_handler);
 
      config_data.window_size = DEFAULT_WINDOW_SIZE;
+     config_data.sync_latency = DEFAULT_SYNC_LATENCY;
+     config_data.psi_interval = DEFAULT_PSI_INTERVAL;
      config_data.segment_length = DEFAULT_SEGMENT_LENGTH;
      config_data.rollover_size = MAX_ROLLOVER_SIZE;
      config_data.active_sources = 0;
@@ -2088,6 +2505,7 @@ int main(int argc, char **argv)
          fprintf(stderr,"       --ip            [IP:PORT,IP:PORT,etc.] (THIS MUST MATCH NUMBER OF SOURCES)\n");
          fprintf(stderr,"       --interface     [SOURCE INTERFACE - lo,eth0,eth1,eth2,eth3]\n");
          fprintf(stderr,"                       If multicast, make sure route is in place\n\n");
+         fprintf(stderr,"       --reactor       [RECEIVE ALL SOURCES ON A SINGLE EPOLL THREAD INSTEAD OF ONE THREAD PER SOURCE]\n");
          fprintf(stderr,"\n");
          fprintf(stderr,"INPUT OPTIONS (when --type file)\n");
          fprintf(stderr,"       --input         [INPUT FILENAME (FULL PATH)]\n");
@@ -2099,7 +2517,10 @@ int main(int argc, char **argv)
          fprintf(stderr,"       --segment       [SEGMENT LENGTH IN SECONDS]\n");
          fprintf(stderr,"       --manifest      [MANIFEST DIRECTORY \"/var/www/hls/\"]\n");
          fprintf(stderr,"       --identity      [RUNTIME IDENTITY - any number, but must be unique across multiple instances of fillet]\n");
+         fprintf(stderr,"       --sync-latency  [MS EACH FRAME IS HELD TO LINE UP WITH THE OTHER SOURCES - default: %d, max: %d]\n", DEFAULT_SYNC_LATENCY, MAX_SYNC_LATENCY);
+         fprintf(stderr,"       --psi-interval  [MS BETWEEN PAT/PMT REPEATS IN HLS SEGMENTS, 0 FOR EVERY FRAME - default: %d, max: %d]\n", DEFAULT_PSI_INTERVAL, MAX_PSI_INTERVAL);
          fprintf(stderr,"       --hls           [ENABLE TRADITIONAL HLS TRANSPORT STREAM OUTPUT - NO ARGUMENT REQUIRED]\n");
+         fprintf(stderr,"       --muxed-ts      [CARRY THE DEFAULT AUDIO INSIDE EACH HLS VIDEO SEGMENT INSTEAD OF SEPARATE AUDIO SEGMENTS]\n");
          fprintf(stderr,"       --dash          [ENABLE FRAGMENTED MP4 STREAM OUTPUT (INCLUDES DASH+HLS FMP4) - NO ARGUMENT REQUIRED]\n");
          fprintf(stderr,"       --manifest-dash [NAME OF THE DASH MANIFEST FILE - default: masterdash.mpd]\n");
          fprintf(stderr,"       --manifest-hls  [NAME OF THE HLS MANIFEST FILE - default: master.m3u8]\n");
@@ -2146,6 +2567,7 @@ int main(int argc, char **argv)
      }
 
      config_data.enable_ts_output = !!enable_ts;
+     config_data.enable_muxed_ts = enable_ts && enable_muxed_ts;
      config_data.enable_fmp4_output = !!enable_fmp4;
 
 #if defined(ENABLE_TRANSCODE)
@@ -2169,17 +2591,17 @@ int main(int argc, char **argv)
      // basic command line mode for testing purposes
      core->session_id = 1;
      core->transcode_enabled = !!enable_transcode;
-     core->sync_thread_restart_count = 0;
      core->cd->enable_scte35 = !!enable_scte35;
      core->cd->enable_stereo = !!enable_stereo;
      core->cd->enable_webvtt = !!enable_webvtt;
+     core->cd->enable_reactor = !!enable_reactor;
 
      if (core->cd->source_type == SOURCE_TYPE_FILE) {
 
 
      } else {  // SOURCE_TYPE_STREAM
-         register_message_callback(message_dispatch, (void*)core);
-         register_frame_callback(receive_frame, (void*)core);
+         core->demux_callbacks.message_callback = message_dispatch;
+         core->demux_callbacks.frame_callback = receive_frame;
 
          start_signal_thread(core);
 
@@ -2207,8 +2629,12 @@ int main(int argc, char **argv)
          sync_thread_running = 1;
          pthread_create(&frame_sync_thread_id, NULL, frame_sync_thread, (void*)core);
          core->source_running = 1;
-         for (i = 0; i < config_data.active_sources; i++) {
-             pthread_create(&core->source_stream[i].udp_source_thread_id, NULL, udp_source_thread, (void*)core);
+         if (core->cd->enable_reactor) {
+             pthread_create(&core->source_stream[0].udp_source_thread_id, NULL, udp_reactor_thread, (void*)core);
+         } else {
+             for (i = 0; i < config_data.active_sources; i++) {
+                 pthread_create(&core->source_stream[i].udp_source_thread_id, NULL, udp_source_thread, (void*)core);
+             }
          }
 
 #if defined(ENABLE_TRANSCODE)
@@ -2216,6 +2642,8 @@ int main(int argc, char **argv)
 #else
          pthread_create(&client_thread_id, NULL, client_thread, (void*)core);
 #endif
+         // the same report repeats with the pool usage once the mux streams have started allocating
+         report_memory_usage(core);
          while (core->source_running) {
              if (quit_sync_thread) {
                  while (sync_thread_running) {
@@ -2237,13 +2665,13 @@ int main(int argc, char **argv)
                  // my goal is to make this as resilient as possible to source stream issues
                  // and to just keep packaging so a proper output stream is available
                  // can't stand having signal interruptions
+                 //
+                 // with transcoding the decode/encode threads are left running, the decoders
+                 // watch the restart count, drop their backlog and start a new timeline
+                 // from the next sync frame so the encoders only have to put in an idr
                  fprintf(stderr,"STATUS: RESTARTING FRAME SYNC THREAD\n");
                  sync_thread_running = 1;
-                 core->sync_thread_restart_count++;
-#if defined(ENABLE_TRANSCODE)
-                 start_video_transcode_threads(core);
-                 start_audio_transcode_threads(core);
-#endif // ENABLE_TRANSCODE
+                 __atomic_add_fetch(&core->sync_thread_restart_count, 1, __ATOMIC_RELEASE);
                  pthread_create(&frame_sync_thread_id, NULL, frame_sync_thread, (void*)core);
              }
 
@@ -2252,7 +2680,7 @@ int main(int argc, char **argv)
 #define WAIT_THRESHOLD_WARNING 3
 #define WAIT_THRESHOLD_ERROR   10
 #define WAIT_THRESHOLD_FAIL    30
-#define LEVEL_CHECK_THRESHOLD  500
+#define LEVEL_CHECK_THRESHOLD  5   // passes of the main loop, it wakes at least every 100ms
              if (core->transcode_enabled) {
                  if (loop_count >= LEVEL_CHECK_THRESHOLD) {
                      char signal_msg[MAX_STR_SIZE];
@@ -2359,7 +2787,14 @@ int main(int argc, char **argv)
 
              int msgid;
 
-             usleep(1000);
+             if (time(NULL) - last_pool_report >= POOL_REPORT_INTERVAL) {
+                 last_pool_report = time(NULL);
+                 report_pool_usage(core, core->compressed_video_pool, "CV");
+                 report_pool_usage(core, core->compressed_audio_pool, "CA");
+                 report_memory_usage(core);
+                 report_backpressure(core, reported_backpressure);
+                 report_sync_hold(core);
+             }
 
              msgid = wait_for_event(core);
              if (msgid == -1) {
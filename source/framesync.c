@@ -0,0 +1,278 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "framesync.h"
+
+typedef struct _framesync_entry_struct
+{
+    int64_t                    key;
+    // breaks ties between queues in the order the entries were added
+    uint64_t                   sequence;
+    void                       *item;
+} framesync_entry_struct;
+
+typedef struct _framesync_queue_struct
+{
+    framesync_entry_struct     *ring;
+    int                        size;
+    int                        head;
+    int                        count;
+    // slot in the heap, -1 while the queue is empty
+    int                        heap_position;
+} framesync_queue_struct;
+
+// binary min-heap of the non-empty queues ordered on their first entry
+typedef struct _framesync_struct
+{
+    framesync_queue_struct     *queue;
+    int                        queue_count;
+    int                        *heap;
+    int                        heap_count;
+    int                        capacity;
+    int                        count;
+    uint64_t                   sequence;
+} framesync_struct;
+
+static framesync_entry_struct *queue_entry(framesync_queue_struct *queue, int pos)
+{
+    return &queue->ring[(queue->head + pos) & (queue->size - 1)];
+}
+
+static int heap_less(framesync_struct *sync, int a, int b)
+{
+    framesync_entry_struct *first_a = queue_entry(&sync->queue[sync->heap[a]], 0);
+    framesync_entry_struct *first_b = queue_entry(&sync->queue[sync->heap[b]], 0);
+
+    if (first_a->key != first_b->key) {
+        return first_a->key < first_b->key;
+    }
+    return first_a->sequence < first_b->sequence;
+}
+
+static void heap_swap(framesync_struct *sync, int a, int b)
+{
+    int queue = sync->heap[a];
+
+    sync->heap[a] = sync->heap[b];
+    sync->heap[b] = queue;
+    sync->queue[sync->heap[a]].heap_position = a;
+    sync->queue[sync->heap[b]].heap_position = b;
+}
+
+static void heap_up(framesync_struct *sync, int pos)
+{
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (!heap_less(sync, pos, parent)) {
+            break;
+        }
+        heap_swap(sync, pos, parent);
+        pos = parent;
+    }
+}
+
+static void heap_down(framesync_struct *sync, int pos)
+{
+    while (1) {
+        int child = pos * 2 + 1;
+        if (child >= sync->heap_count) {
+            break;
+        }
+        if (child + 1 < sync->heap_count && heap_less(sync, child + 1, child)) {
+            child++;
+        }
+        if (!heap_less(sync, child, pos)) {
+            break;
+        }
+        heap_swap(sync, pos, child);
+        pos = child;
+    }
+}
+
+static int queue_grow(framesync_queue_struct *queue)
+{
+    framesync_entry_struct *ring;
+    int size = queue->size ? queue->size * 2 : FRAMESYNC_RING_SIZE;
+    int i;
+
+    ring = (framesync_entry_struct*)malloc(sizeof(framesync_entry_struct) * size);
+    if (!ring) {
+        return -1;
+    }
+    for (i = 0; i < queue->count; i++) {
+        ring[i] = *queue_entry(queue, i);
+    }
+    free(queue->ring);
+    queue->ring = ring;
+    queue->size = size;
+    queue->head = 0;
+    return 0;
+}
+
+void *framesync_create(int queue_count, int capacity)
+{
+    framesync_struct *sync;
+    int q;
+
+    if (queue_count <= 0 || capacity <= 0) {
+        return NULL;
+    }
+    sync = (framesync_struct*)malloc(sizeof(framesync_struct));
+    if (!sync) {
+        return NULL;
+    }
+    memset(sync, 0, sizeof(framesync_struct));
+    sync->queue = (framesync_queue_struct*)malloc(sizeof(framesync_queue_struct) * queue_count);
+    sync->heap = (int*)malloc(sizeof(int) * queue_count);
+    if (!sync->queue || !sync->heap) {
+        free(sync->queue);
+        free(sync->heap);
+        free(sync);
+        return NULL;
+    }
+    memset(sync->queue, 0, sizeof(framesync_queue_struct) * queue_count);
+    for (q = 0; q < queue_count; q++) {
+        sync->queue[q].heap_position = -1;
+    }
+    sync->queue_count = queue_count;
+    sync->capacity = capacity;
+    return (void*)sync;
+}
+
+int framesync_destroy(void *framesync)
+{
+    framesync_struct *sync = (framesync_struct*)framesync;
+    int q;
+
+    if (!sync) {
+        return -1;
+    }
+    for (q = 0; q < sync->queue_count; q++) {
+        free(sync->queue[q].ring);
+    }
+    free(sync->queue);
+    free(sync->heap);
+    free(sync);
+    return 0;
+}
+
+int framesync_add(void *framesync, int queue_index, int64_t key, void *item)
+{
+    framesync_struct *sync = (framesync_struct*)framesync;
+    framesync_queue_struct *queue;
+    int pos;
+
+    if (!sync || queue_index < 0 || queue_index >= sync->queue_count || sync->count >= sync->capacity) {
+        return -1;
+    }
+    queue = &sync->queue[queue_index];
+    if (queue->count == queue->size && queue_grow(queue) < 0) {
+        return -1;
+    }
+
+    // each source delivers in order, so this normally lands at the end without moving anything
+    pos = queue->count;
+    while (pos > 0 && queue_entry(queue, pos - 1)->key > key) {
+        *queue_entry(queue, pos) = *queue_entry(queue, pos - 1);
+        pos--;
+    }
+    queue_entry(queue, pos)->key = key;
+    queue_entry(queue, pos)->sequence = sync->sequence++;
+    queue_entry(queue, pos)->item = item;
+    queue->count++;
+
+    if (queue->heap_position < 0) {
+        queue->heap_position = sync->heap_count;
+        sync->heap[sync->heap_count++] = queue_index;
+        heap_up(sync, queue->heap_position);
+    } else if (pos == 0) {
+        heap_up(sync, queue->heap_position);
+    }
+
+    sync->count++;
+    return sync->count;
+}
+
+void *framesync_peek(void *framesync, int64_t *key)
+{
+    framesync_struct *sync = (framesync_struct*)framesync;
+    framesync_entry_struct *first;
+
+    if (!sync || sync->heap_count == 0) {
+        return NULL;
+    }
+    first = queue_entry(&sync->queue[sync->heap[0]], 0);
+    if (key) {
+        *key = first->key;
+    }
+    return first->item;
+}
+
+void *framesync_take(void *framesync, int64_t *key)
+{
+    framesync_struct *sync = (framesync_struct*)framesync;
+    framesync_queue_struct *queue;
+    framesync_entry_struct *first;
+    void *item;
+
+    if (!sync || sync->heap_count == 0) {
+        return NULL;
+    }
+    queue = &sync->queue[sync->heap[0]];
+    first = queue_entry(queue, 0);
+    item = first->item;
+    if (key) {
+        *key = first->key;
+    }
+    queue->head = (queue->head + 1) & (queue->size - 1);
+    queue->count--;
+
+    if (queue->count == 0) {
+        queue->heap_position = -1;
+        sync->heap_count--;
+        if (sync->heap_count > 0) {
+            sync->heap[0] = sync->heap[sync->heap_count];
+            sync->queue[sync->heap[0]].heap_position = 0;
+        }
+    }
+    if (sync->heap_count > 0) {
+        heap_down(sync, 0);
+    }
+
+    sync->count--;
+    return item;
+}
+
+int framesync_count(void *framesync)
+{
+    framesync_struct *sync = (framesync_struct*)framesync;
+
+    if (!sync) {
+        return 0;
+    }
+    return sync->count;
+}
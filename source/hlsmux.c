@@ -30,9 +30,11 @@
 #include "tsdecode.h"
 #include "crc.h"
 #include "mp4core.h"
+#include "nalscan.h"
 #include "hlsmux.h"
 #include "webdav.h"
 #include "esignal.h"
+#include "segwriter.h"
 
 #define MAX_STREAM_NAME       256
 #define MAX_TEXT_SIZE         512
@@ -183,271 +185,165 @@ uint32_t getse(decode_struct *d)
     return r;
 }
 
-static int get_hevc_sps(source_context_struct *sdata, uint8_t *buffer, int buffer_size)
+// parameter sets come from the nal index the frame was delivered with
+static int save_parameter_set(sorted_frame_struct *frame, int nal_type, uint8_t *param_set, int *param_set_size)
 {
-    int i;
-    uint8_t *sps_buffer = buffer;
-    int sps_size = 0;
-    int parsing_sps = 0;
-
-    for (i = 0; i < buffer_size - 3; i++) {
-        if (buffer[i+0] == 0x00 &&
-            buffer[i+1] == 0x00 &&
-            buffer[i+2] == 0x01) {
-            int nal_type = (buffer[i+3] & 0x7f) >> 1;
-            if (parsing_sps) {
-                sps_size = buffer + i - sps_buffer;
-                sdata->hevc_sps_size = sps_size;
-                memcpy(sdata->hevc_sps, sps_buffer, sps_size);
-                return 0;
-            }
-            if (nal_type == 33) {
-                sps_buffer = buffer + i + 3;
-                parsing_sps = 1;
-            }
-        }
+    nal_unit_struct *unit = find_nal_unit(&frame->nal_index, nal_type);
+
+    if (!unit || unit->size > MAX_PRIVATE_DATA_SIZE) {
+        return 0;
     }
+    memcpy(param_set, frame->buffer + unit->offset, unit->size);
+    *param_set_size = unit->size;
     return 0;
 }
 
-static int get_hevc_pps(source_context_struct *sdata, uint8_t *buffer, int buffer_size)
+static int get_hevc_sps(source_context_struct *sdata, sorted_frame_struct *frame)
 {
-    int i;
-    uint8_t *pps_buffer = buffer;
-    int pps_size = 0;
-    int parsing_pps = 0;
-
-    for (i = 0; i < buffer_size - 3; i++) {
-        if (buffer[i+0] == 0x00 &&
-            buffer[i+1] == 0x00 &&
-            buffer[i+2] == 0x01) {
-            int nal_type = (buffer[i+3] & 0x7f) >> 1;
-            if (parsing_pps) {
-                pps_size = buffer + i - pps_buffer;
-                sdata->hevc_pps_size = pps_size;
-                memcpy(sdata->hevc_pps, pps_buffer, pps_size);
-                return 0;
-            }
-            if (nal_type == 34) {
-                pps_buffer = buffer + i + 3;
-                parsing_pps = 1;
-            }
-        }
-    }
-    return 0;
+    return save_parameter_set(frame, 33, sdata->hevc_sps, &sdata->hevc_sps_size);
 }
 
-static int get_hevc_vps(source_context_struct *sdata, uint8_t *buffer, int buffer_size)
+static int get_hevc_pps(source_context_struct *sdata, sorted_frame_struct *frame)
 {
-    int i;
-    uint8_t *vps_buffer = buffer;
-    int vps_size = 0;
-    int parsing_vps = 0;
-
-    for (i = 0; i < buffer_size - 3; i++) {
-        if (buffer[i+0] == 0x00 &&
-            buffer[i+1] == 0x00 &&
-            buffer[i+2] == 0x01) {
-            int nal_type = (buffer[i+3] & 0x7f) >> 1;
-            if (parsing_vps) {
-                vps_size = buffer + i - vps_buffer;
-                sdata->hevc_vps_size = vps_size;
-                memcpy(sdata->hevc_vps, vps_buffer, vps_size);
-                return 0;
-            }
-            if (nal_type == 32) {
-                vps_buffer = buffer + i + 3;
-                parsing_vps = 1;
-            }
-        }
-    }
-    return 0;
+    return save_parameter_set(frame, 34, sdata->hevc_pps, &sdata->hevc_pps_size);
 }
 
-static int get_h264_sps(source_context_struct *sdata, uint8_t *buffer, int buffer_size)
+static int get_hevc_vps(source_context_struct *sdata, sorted_frame_struct *frame)
 {
-    int i;
-    uint8_t *sps_buffer = buffer;
-    int sps_size = 0;
-    int parsing_sps = 0;
-
-    for (i = 0; i < buffer_size - 3; i++) {
-        if (buffer[i+0] == 0x00 &&
-            buffer[i+1] == 0x00 &&
-            buffer[i+2] == 0x01) {
-            int nal_type = buffer[i+3] & 0x1f;
-            if (parsing_sps) {
-                sps_size = buffer + i - sps_buffer;
-                sdata->h264_sps_size = sps_size;
-                memcpy(sdata->h264_sps, sps_buffer, sps_size);
-                return 0;
-            }
-            if (nal_type == 7) {
-                sps_buffer = buffer + i + 3;
-                parsing_sps = 1;
-            }
-        }
-    }
-    return 0;
+    return save_parameter_set(frame, 32, sdata->hevc_vps, &sdata->hevc_vps_size);
 }
 
-static int get_h264_pps(source_context_struct *sdata, uint8_t *buffer, int buffer_size)
+static int get_h264_sps(source_context_struct *sdata, sorted_frame_struct *frame)
 {
-    int i;
-    uint8_t *pps_buffer = buffer;
-    int pps_size = 0;
-    int parsing_pps = 0;
-
-    for (i = 0; i < buffer_size - 3; i++) {
-        if (buffer[i+0] == 0x00 &&
-            buffer[i+1] == 0x00 &&
-            buffer[i+2] == 0x01) {
-            int nal_type = buffer[i+3] & 0x1f;
-            if (parsing_pps) {
-                pps_size = buffer + i - pps_buffer;
-                sdata->h264_pps_size = pps_size;
-                memcpy(sdata->h264_pps, pps_buffer, pps_size);
-                return 0;
-            }
-            if (nal_type == 8) {
-                pps_buffer = buffer + i + 3;
-                parsing_pps = 1;
-            }
-        }
-    }
-    return 0;
+    return save_parameter_set(frame, 7, sdata->h264_sps, &sdata->h264_sps_size);
 }
 
-static int find_and_decode_h264_sps(source_context_struct *sdata, uint8_t *buffer, int buffer_size)
+static int get_h264_pps(source_context_struct *sdata, sorted_frame_struct *frame)
 {
-    int i;
+    return save_parameter_set(frame, 8, sdata->h264_pps, &sdata->h264_pps_size);
+}
+
+static int find_and_decode_h264_sps(source_context_struct *sdata, sorted_frame_struct *frame)
+{
+    nal_unit_struct *unit;
     int m;
 
-    for (i = 0; i < buffer_size - 3; i++) {
-        if (buffer[i+0] == 0x00 &&
-            buffer[i+1] == 0x00 &&
-            buffer[i+2] == 0x01) {
-            int nal_type = buffer[i+3] & 0x1f;
-
-            if (nal_type == 7) {
-                decode_struct d;
-                int crop_left = 0;
-                int crop_right = 0;
-                int crop_top = 0;
-                int crop_bottom = 0;
-                int profile_idc;
-                int level_idc;
-                int width_mb1;
-                int height_mb1;
-                int frame_mb;
-                int cropping = 0;
-                int poc = 0;
-                int decoded_width = 0;
-                int decoded_height;
-                int midbyte;
-
-                fprintf(stderr,"STATUS: FOUND H.264 SPS - DECODING\n");
-
-                d.start = buffer+i+4;
-                d.cb = 0;
-
-                profile_idc = getbits(&d, 8);
-                fprintf(stderr,"PROFILE: %d\n", profile_idc);
-
-                midbyte = getbits(&d, 8);
-
-                level_idc = getbits(&d, 8);
-
-                getegc(&d); // sps_id
-
-                fprintf(stderr,"LEVELIDC: %d\n", level_idc);
-
-                if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
-                    profile_idc == 244 || profile_idc == 44  || profile_idc == 83  ||
-                    profile_idc == 86  || profile_idc == 118) {
-                    int chroma_format = getegc(&d); // chroma format
-                    int scaling_matrix;
-
-                    if (chroma_format == 3) {
-                        getbit(&d);  // color_transform_flag
-                    }
-                    getegc(&d); // luma bit depth
-                    getegc(&d); // chroma bit depth
-                    getbit(&d); // transform_bypass_flag
-                    scaling_matrix = getbit(&d);
-                    if (scaling_matrix) {
-                        for (m = 0; m < 8; m++) {
-                            int scaling_list = getbit(&d);
-                            if (scaling_list) {
-                                int list_size = (m < 6) ? 16 : 64;
-                                int ls = 8;
-                                int ns = 8;
-                                int ds;
-                                int k;
-                                for (k = 0; k < list_size; k++) {
-                                    if (ns) {
-                                        ds = getse(&d);
-                                        ns = (ls + ds + 256) % 256;
-                                    }
-                                    ls = (ns == 0) ? ls : ns;
-                                }
+    unit = find_nal_unit(&frame->nal_index, 7);
+    if (unit) {
+        decode_struct d;
+        int crop_left = 0;
+        int crop_right = 0;
+        int crop_top = 0;
+        int crop_bottom = 0;
+        int profile_idc;
+        int level_idc;
+        int width_mb1;
+        int height_mb1;
+        int frame_mb;
+        int cropping = 0;
+        int poc = 0;
+        int decoded_width = 0;
+        int decoded_height;
+        int midbyte;
+
+        fprintf(stderr,"STATUS: FOUND H.264 SPS - DECODING\n");
+
+        d.start = frame->buffer + unit->offset + 1;
+        d.cb = 0;
+
+        profile_idc = getbits(&d, 8);
+        fprintf(stderr,"PROFILE: %d\n", profile_idc);
+
+        midbyte = getbits(&d, 8);
+
+        level_idc = getbits(&d, 8);
+
+        getegc(&d); // sps_id
+
+        fprintf(stderr,"LEVELIDC: %d\n", level_idc);
+
+        if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
+            profile_idc == 244 || profile_idc == 44  || profile_idc == 83  ||
+            profile_idc == 86  || profile_idc == 118) {
+            int chroma_format = getegc(&d); // chroma format
+            int scaling_matrix;
+
+            if (chroma_format == 3) {
+                getbit(&d);  // color_transform_flag
+            }
+            getegc(&d); // luma bit depth
+            getegc(&d); // chroma bit depth
+            getbit(&d); // transform_bypass_flag
+            scaling_matrix = getbit(&d);
+            if (scaling_matrix) {
+                for (m = 0; m < 8; m++) {
+                    int scaling_list = getbit(&d);
+                    if (scaling_list) {
+                        int list_size = (m < 6) ? 16 : 64;
+                        int ls = 8;
+                        int ns = 8;
+                        int ds;
+                        int k;
+                        for (k = 0; k < list_size; k++) {
+                            if (ns) {
+                                ds = getse(&d);
+                                ns = (ls + ds + 256) % 256;
                             }
+                            ls = (ns == 0) ? ls : ns;
                         }
                     }
                 }
-                getegc(&d); // max_frame_num...
-                poc = getegc(&d); // poc
-                if (poc == 0) {
-                    getegc(&d); // max_pic_orer_cnt...
-                } else if (poc == 1) {
-                    int refs;
-
-                    getbit(&d); // delta_pic_order
-                    getse(&d); // offset_non_ref_pic
-                    getse(&d); // offset_top_bottom_field
-                    refs = getegc(&d);
-                    for (m = 0; m < refs; m++) {
-                        getse(&d);
-                    }
-                }
-                getegc(&d); // ref frames
-                getbit(&d); // gaps_allowed;
-                width_mb1 = getegc(&d);
-                height_mb1 = getegc(&d);
-                frame_mb = getbit(&d);
-                if (!frame_mb) {
-                    getbit(&d); // mbaff?
-                }
-                getbit(&d); // direct_8x8
-                cropping = getbit(&d); // cropping
-                if (cropping) {
-                    crop_left = getegc(&d);
-                    crop_right = getegc(&d);
-                    crop_top = getegc(&d);
-                    crop_bottom = getegc(&d);
-                }
-                getbit(&d); // vui present
-
-                decoded_width = ((width_mb1 + 1) * 16) - (crop_right*4) - (crop_left*4);
-                decoded_height = ((2 - frame_mb) * (height_mb1 + 1) * 16) - (crop_bottom*4) - (crop_top*4);
+            }
+        }
+        getegc(&d); // max_frame_num...
+        poc = getegc(&d); // poc
+        if (poc == 0) {
+            getegc(&d); // max_pic_orer_cnt...
+        } else if (poc == 1) {
+            int refs;
+
+            getbit(&d); // delta_pic_order
+            getse(&d); // offset_non_ref_pic
+            getse(&d); // offset_top_bottom_field
+            refs = getegc(&d);
+            for (m = 0; m < refs; m++) {
+                getse(&d);
+            }
+        }
+        getegc(&d); // ref frames
+        getbit(&d); // gaps_allowed;
+        width_mb1 = getegc(&d);
+        height_mb1 = getegc(&d);
+        frame_mb = getbit(&d);
+        if (!frame_mb) {
+            getbit(&d); // mbaff?
+        }
+        getbit(&d); // direct_8x8
+        cropping = getbit(&d); // cropping
+        if (cropping) {
+            crop_left = getegc(&d);
+            crop_right = getegc(&d);
+            crop_top = getegc(&d);
+            crop_bottom = getegc(&d);
+        }
+        getbit(&d); // vui present
 
-                fprintf(stderr,"crop_bottom:%d crop_top:%d  crop_right:%d crop_left:%d  wmb:%d hmb:%d\n",
-                        crop_bottom, crop_top, crop_right, crop_left,
-                        width_mb1,
-                        height_mb1);
+        decoded_width = ((width_mb1 + 1) * 16) - (crop_right*4) - (crop_left*4);
+        decoded_height = ((2 - frame_mb) * (height_mb1 + 1) * 16) - (crop_bottom*4) - (crop_top*4);
 
-                fprintf(stderr,"STREAM RESOLUTION: %d x %d\n", decoded_width, decoded_height);
+        fprintf(stderr,"crop_bottom:%d crop_top:%d  crop_right:%d crop_left:%d  wmb:%d hmb:%d\n",
+                crop_bottom, crop_top, crop_right, crop_left,
+                width_mb1,
+                height_mb1);
 
-                sdata->h264_sps_decoded = 1;
-                sdata->h264_profile = profile_idc;
-                sdata->h264_level = level_idc;
-                sdata->width = decoded_width;
-                sdata->height = decoded_height;
-                sdata->midbyte = midbyte;
+        fprintf(stderr,"STREAM RESOLUTION: %d x %d\n", decoded_width, decoded_height);
 
-                break;
-            }
-        }
+        sdata->h264_sps_decoded = 1;
+        sdata->h264_profile = profile_idc;
+        sdata->h264_level = level_idc;
+        sdata->width = decoded_width;
+        sdata->height = decoded_height;
+        sdata->midbyte = midbyte;
     }
     return 0;
 }
@@ -462,13 +358,55 @@ void *hlsmux_create(fillet_app_struct *core)
     }
 
     memset(hlsmux, 0, sizeof(hlsmux_struct));
-    hlsmux->input_queue = dataqueue_create();
+    // only the frame sync thread feeds the muxer
+    hlsmux->input_queue = dataqueue_create_spsc(SPSC_QUEUE_ENTRIES);
     core->hlsmux = hlsmux;
     pthread_create(&hlsmux->hlsmux_thread_id, NULL, mux_pump_thread, (void*)core);
 
     return (void*)hlsmux;
 }
 
+static void add_stream_memory(stream_struct *stream, hlsmux_memory_struct *usage)
+{
+    int mux_packets = __atomic_load_n(&stream->mux_packets, __ATOMIC_RELAXED);
+
+    if (mux_packets > 0) {
+        usage->mux_buffers += MUX_HEADER_BUFFER_SIZE(mux_packets) + sizeof(struct iovec)*MUX_IOV_COUNT(mux_packets);
+        usage->mux_streams++;
+    }
+    // the workers and the mux pump thread set these, a stale pointer only skews the count
+    if (__atomic_load_n(&stream->output_ts_writer, __ATOMIC_RELAXED)) {
+        usage->segment_writers += SEGMENT_WRITER_CHUNK_SIZE * SEGMENT_WRITER_CHUNKS;
+        usage->segment_writer_count++;
+    }
+    if (__atomic_load_n(&stream->fmp4, __ATOMIC_RELAXED)) {
+        // the fragment buffer itself is only resident as far as the fragments have filled it
+        usage->fmp4 += sizeof(fragment_file_struct);
+        usage->fmp4_count++;
+    }
+}
+
+int hlsmux_memory(void *hlsmux, hlsmux_memory_struct *usage)
+{
+    hlsmux_struct *hlsmux1 = (hlsmux_struct*)hlsmux;
+    int i;
+    int j;
+
+    if (!hlsmux1 || !usage) {
+        return -1;
+    }
+    memset(usage, 0, sizeof(hlsmux_memory_struct));
+    usage->streams = sizeof(hlsmux_struct);
+    for (i = 0; i < MAX_VIDEO_SOURCES; i++) {
+        add_stream_memory(&hlsmux1->video[i], usage);
+        add_stream_memory(&hlsmux1->muxed_audio[i], usage);
+        for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
+            add_stream_memory(&hlsmux1->audio[i][j], usage);
+        }
+    }
+    return 0;
+}
+
 void hlsmux_destroy(void *hlsmux)
 {
     hlsmux_struct *hlsmux1 = (hlsmux_struct*)hlsmux;
@@ -621,8 +559,7 @@ static int muxpatsample(fillet_app_struct *core, stream_struct *stream, uint8_t
     pat[0] = 0x47;
     pat[1] = 0x40;
     pat[2] = 0x00;
-    pat[3] = (stream->pat_cnt & 0x0f) | 0x10;
-    stream->pat_cnt = (stream->pat_cnt + 1) & 0x0f;
+    pat[3] = 0x10;  // continuity counter is filled in by muxpsi()
     pat[4] = 0x00;
     pat[5] = 0x00;  // PAT table id
 
@@ -651,12 +588,14 @@ static int muxpatsample(fillet_app_struct *core, stream_struct *stream, uint8_t
     return 0;
 }
 
-static int muxpmtsample(fillet_app_struct *core, stream_struct *stream, uint8_t *pmt, int pid, int codec_type)
+// audio_codec_type adds the default audio on AUDIO_BASE_PID next to pid, 0 leaves it out
+static int muxpmtsample(fillet_app_struct *core, stream_struct *stream, uint8_t *pmt, int pid, int codec_type, int audio_codec_type)
 {
     uint16_t *save16;
     uint32_t *save32;
     uint32_t calculated_crc;
     int crcsize = 17;
+    int widx;
 
     if (!pmt) {
         return -1;
@@ -668,18 +607,20 @@ static int muxpmtsample(fillet_app_struct *core, stream_struct *stream, uint8_t
     save16 = (uint16_t*)&pmt[1];
     *save16 = htons(0x4000 | PMT_PID);  // pmt pid
 
-    pmt[3] = stream->pmt_cnt | 0x10;
-    stream->pmt_cnt = (stream->pmt_cnt + 1) & 0x0f;
+    pmt[3] = 0x10;  // continuity counter is filled in by muxpsi()
 
     pmt[4] = 0x00;
     pmt[5] = 0x02; // PMT table id
 
+    if (audio_codec_type) {
+        crcsize += 5;
+    }
     save16 = (uint16_t*)&pmt[6];
-    *save16 = htons(0xb000 | 18);
+    *save16 = htons(0xb000 | (crcsize + 1));
 
     save16 = (uint16_t*)&pmt[8];
     *save16 = htons(1); // program number
-    pmt[10] = 0xc3;
+    pmt[10] = 0xc1 | (((stream->psi_version + 1) & 0x1f) << 1);
     pmt[11] = 0x00;
     pmt[12] = 0x00;
 
@@ -693,8 +634,18 @@ static int muxpmtsample(fillet_app_struct *core, stream_struct *stream, uint8_t
     *save16 = htons(0xe000 | pid);  // actual video pid
     pmt[20] = 0xf0;
     pmt[21] = 0x00;
+    widx = 22;
+
+    if (audio_codec_type) {
+        pmt[widx++] = audio_codec_type;
+        save16 = (uint16_t*)&pmt[widx];
+        *save16 = htons(0xe000 | AUDIO_BASE_PID);
+        widx += 2;
+        pmt[widx++] = 0xf0;
+        pmt[widx++] = 0x00;
+    }
 
-    save32 = (uint32_t*)&pmt[22];
+    save32 = (uint32_t*)&pmt[widx];
 
     calculated_crc = getcrc32(&pmt[5], crcsize);
     calculated_crc = htonl(calculated_crc);
@@ -704,81 +655,154 @@ static int muxpmtsample(fillet_app_struct *core, stream_struct *stream, uint8_t
     return 0;
 }
 
-static int muxvideosample(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame)
+// writes pat/pmt at the start of each segment, after a timestamp jump and then every psi_interval,
+// returns the number of packets written
+static int muxpsi(fillet_app_struct *core, stream_struct *stream, int pid, int codec_type, int audio_codec_type, int64_t timestamp)
+{
+    int64_t interval = (int64_t)core->cd->psi_interval * 90;
+
+    if (stream->psi_codec_type != codec_type || stream->psi_audio_codec_type != audio_codec_type) {
+        if (stream->psi_codec_type) {
+            // the program changed under an open segment
+            stream->psi_version++;
+        }
+        muxpatsample(core, stream, stream->pat_packet);
+        muxpmtsample(core, stream, stream->pmt_packet, pid, codec_type, audio_codec_type);
+        stream->psi_codec_type = codec_type;
+        stream->psi_audio_codec_type = audio_codec_type;
+        stream->psi_due = 1;
+    }
+    if (!stream->psi_due &&
+        timestamp >= stream->last_psi_time &&
+        timestamp - stream->last_psi_time < interval) {
+        return 0;
+    }
+
+    // the crc only covers the section, so patching the counter leaves it valid
+    stream->pat_packet[3] = (stream->pat_cnt & 0x0f) | 0x10;
+    stream->pat_cnt = (stream->pat_cnt + 1) & 0x0f;
+    stream->pmt_packet[3] = (stream->pmt_cnt & 0x0f) | 0x10;
+    stream->pmt_cnt = (stream->pmt_cnt + 1) & 0x0f;
+    segment_writer_write(stream->output_ts_writer, stream->pat_packet, 188);
+    segment_writer_write(stream->output_ts_writer, stream->pmt_packet, 188);
+
+    stream->last_psi_time = timestamp;
+    stream->psi_due = 0;
+    return 2;
+}
+
+// adds payload bytes [offset, offset+size) of the pes, which is the pes header followed by the frame
+static void muxpayload(stream_struct *stream, sorted_frame_struct *frame, int offset, int size)
+{
+    struct iovec *iov;
+
+    if (offset < stream->pesheader_size) {
+        int part = stream->pesheader_size - offset;
+        if (part > size) {
+            part = size;
+        }
+        iov = &stream->muxiov[stream->muxiov_count++];
+        iov->iov_base = stream->pesheader + offset;
+        iov->iov_len = part;
+        offset += part;
+        size -= part;
+    }
+    if (size > 0) {
+        iov = &stream->muxiov[stream->muxiov_count++];
+        iov->iov_base = frame->buffer + offset - stream->pesheader_size;
+        iov->iov_len = size;
+    }
+}
+
+static void muxheader(stream_struct *stream, uint8_t *header, int header_size)
+{
+    struct iovec *iov = &stream->muxiov[stream->muxiov_count++];
+
+    iov->iov_base = header;
+    iov->iov_len = header_size;
+}
+
+// the mux buffers start out sized for the first frame and double when a bigger one comes along,
+// so an audio stream only ever holds what its bitrate needs and streams that are not carried hold nothing
+static int mux_reserve(stream_struct *stream, int packets)
+{
+    int capacity = stream->mux_packets;
+    uint8_t *muxbuffer;
+    struct iovec *muxiov;
+
+    if (packets <= capacity) {
+        return 0;
+    }
+    if (capacity < MIN_MUX_PACKETS) {
+        capacity = MIN_MUX_PACKETS;
+    }
+    while (capacity < packets) {
+        capacity <<= 1;
+    }
+    if (capacity > MAX_MUX_PACKETS) {
+        capacity = MAX_MUX_PACKETS;
+    }
+
+    // nothing points into the old buffers between frames
+    muxbuffer = (uint8_t*)realloc(stream->muxbuffer, MUX_HEADER_BUFFER_SIZE(capacity));
+    if (!muxbuffer) {
+        return -1;
+    }
+    stream->muxbuffer = muxbuffer;
+    muxiov = (struct iovec*)realloc(stream->muxiov, sizeof(struct iovec)*MUX_IOV_COUNT(capacity));
+    if (!muxiov) {
+        return -1;
+    }
+    stream->muxiov = muxiov;
+    // read by the memory report on the main thread
+    __atomic_store_n(&stream->mux_packets, capacity, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// packetizes stream->pesheader plus the frame into stream->muxiov without copying the frame,
+// the frame has to stay around until the list is written- an mdsize of 0 leaves out the pcr
+static int muxpes(stream_struct *stream, sorted_frame_struct *frame, uint16_t pid, int mdsize)
 {
-    int header_size;
-    uint8_t *muxbuffer = stream->muxbuffer;
-    uint8_t *pesbuffer = stream->pesbuffer;
-    uint8_t *buffer = muxbuffer;
-    packet_struct *packettable = stream->packettable;
-    packet_struct *ptable = packettable;
-    uint8_t *header = pesbuffer;
-    uint8_t *muxdata;
-    int video_size;
+    uint8_t *buffer;
+    int pes_size = stream->pesheader_size + frame->buffer_size;
+    int pes_offset = 0;
     int widx = 0;
-    uint16_t video_pid = VIDEO_PID;
     uint16_t firstdata;
     uint16_t *save16;
-    uint16_t firstflag;
     int s;
     int packetcount = 0;
 
-    header[0] = 0x00;
-    header[1] = 0x00;
-    header[2] = 0x01;        // start code
-    header[3] = 0xe0;
-    header[4] = 0x00;
-    header[5] = 0x00;
-    header[6] = 0x85;
-    if (frame->pts > 0 && frame->dts > 0) {
-        header[7] = 0xc0;    // 0xc0 (both pts+dts)
-        header[8] = 10;      // 10-bytes
-        apply_pts(&header[9], frame->pts);
-        header[9] = header[9] & 0x0f;
-        header[9] = header[9] | 0x30;
-        apply_pts(&header[14], frame->dts);
-        header[14] = header[14] & 0x0f;
-        header[14] = header[14] | 0x10;
-        header_size = 19;
-    } else {
-        header[7] = 0x80;    // 0x80 (only pts)
-        header[8] = 5;       // 5-bytes
-        apply_pts(&header[9], frame->pts);
-        header[9] = header[9] & 0x0f;
-        header[9] = header[9] | 0x20;
-        header_size = 14;
+    stream->muxiov_count = 0;
+    if (pes_size > (MAX_MUX_PACKETS - 1) * 184) {
+        syslog(LOG_ERR,"HLSMUX: FRAME TOO LARGE TO MUX: %d BYTES (PID:%d)\n", frame->buffer_size, pid);
+        return 0;
     }
-
-    memcpy(pesbuffer + header_size, frame->buffer, frame->buffer_size);
-    muxdata = pesbuffer;
-
-    video_size = header_size + frame->buffer_size;
-
-    firstdata = 0x4000 | video_pid;
-    firstflag = 0x10;
-    if (frame->sync_frame) {
-        firstflag = 0x20;
+    // one more for the pcr packet and one for a 183 byte tail split in two
+    if (mux_reserve(stream, (pes_size + 183) / 184 + 2) < 0) {
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO GROW MUX BUFFERS: %d BYTES (PID:%d)\n", frame->buffer_size, pid);
+        return 0;
     }
+    buffer = stream->muxbuffer;
 
-    while (video_size > 0) {
+    firstdata = 0x4000 | pid;
+
+    while (pes_size > 0) {
         uint8_t *sp;
 
-        widx = packetcount * 188;
         sp = buffer + widx;
 
         buffer[widx++] = 0x47;
         save16 = (uint16_t*)&buffer[widx];
         *save16 = htons(firstdata);
         widx += 2;
-        firstdata = video_pid;  // overwrite from first time
-        buffer[widx] = (stream->cnt & 0x0f) | firstflag;
-        firstflag = 0x10;
+        firstdata = pid;  // overwrite from first time
+        buffer[widx] = (stream->cnt & 0x0f) | 0x10;
         stream->prev_cnt = stream->cnt;
         stream->cnt = (stream->cnt + 1) & 0x0f;
-        if (packetcount == 0 && video_size >= MDSIZE_VIDEO) {
+        if (packetcount == 0 && mdsize > 0 && pes_size >= mdsize) {
             buffer[widx] = buffer[widx] | 0x30;
             widx++;
-            buffer[widx++] = 188 - MDSIZE_VIDEO - 5;
+            buffer[widx++] = 188 - mdsize - 5;
             buffer[widx] = 0x10;  // PCR flag
             if (frame->sync_frame) {
                 buffer[widx] = 0x50; // RAI, PCR flag
@@ -788,22 +812,17 @@ static int muxvideosample(fillet_app_struct *core, stream_struct *stream, sorted
             widx += 6; // PCR
 
             // null filler
-            for (s = 12; s < 188 - MDSIZE_VIDEO; s++) {
+            for (s = 12; s < 188 - mdsize; s++) {
                 buffer[widx++] = 0xff;
             }
-            memcpy(sp + 188 - MDSIZE_VIDEO, muxdata, MDSIZE_VIDEO);
-            widx += MDSIZE_VIDEO;           // this is the 188-byte output stream
-            muxdata += MDSIZE_VIDEO;        // this is the source data
-
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
-
-            video_size -= MDSIZE_VIDEO;
-        } else if (video_size == 183) {
+            muxheader(stream, sp, 188 - mdsize);
+            muxpayload(stream, frame, pes_offset, mdsize);
+            pes_offset += mdsize;
+
+            packetcount++;
+
+            pes_size -= mdsize;
+        } else if (pes_size == 183) {
             buffer[widx] = buffer[widx] | 0x30;
             widx++;
             buffer[widx++] = 91;
@@ -811,22 +830,16 @@ static int muxvideosample(fillet_app_struct *core, stream_struct *stream, sorted
             for (s = 6; s < 188 - 92; s++) {
                 buffer[widx++] = 0xff;
             }
-            memcpy(sp + 188 - 92, muxdata, 92);
-            widx += 92;
-            muxdata += 92;
-
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
-
-            widx = packetcount * 188;
+            muxheader(stream, sp, 188 - 92);
+            muxpayload(stream, frame, pes_offset, 92);
+            pes_offset += 92;
+
+            packetcount++;
+
             sp = buffer + widx;
             buffer[widx++] = 0x47;
             save16 = (uint16_t*)&buffer[widx];
-            *save16 = htons(video_pid);
+            *save16 = htons(pid);
             widx += 2;
 
             buffer[widx] = (stream->cnt & 0x0f) | 0x10;
@@ -840,76 +853,80 @@ static int muxvideosample(fillet_app_struct *core, stream_struct *stream, sorted
             for (s = 6; s < 188 - 91; s++) {
                 buffer[widx++] = 0xff;
             }
-            memcpy(sp + 188 - 91, muxdata, 91);
-            widx += 91;
-            muxdata += 91;
-
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
-
-            video_size = 0;
-        } else if (video_size < 184) {
+            muxheader(stream, sp, 188 - 91);
+            muxpayload(stream, frame, pes_offset, 91);
+            pes_offset += 91;
+
+            packetcount++;
+
+            pes_size = 0;
+        } else if (pes_size < 184) {
             buffer[widx] = buffer[widx] | 0x30;
             widx++;
-            buffer[widx++] = 188 - video_size - 5;
+            buffer[widx++] = 188 - pes_size - 5;
             buffer[widx++] = 0;
-            for (s = 6; s < 188 - video_size; s++) {
+            for (s = 6; s < 188 - pes_size; s++) {
                 buffer[widx++] = 0xff;
             }
-            memcpy(sp + 188 - video_size, muxdata, video_size);
-
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
+            muxheader(stream, sp, 188 - pes_size);
+            muxpayload(stream, frame, pes_offset, pes_size);
 
-            muxdata += video_size;
-            widx += video_size;
+            packetcount++;
 
-            video_size = 0;
+            pes_offset += pes_size;
+            pes_size = 0;
         } else {
-            memcpy(sp + 4, muxdata, 184);
-            muxdata += 184;
-            widx += 184;
+            widx++;
+            muxheader(stream, sp, 4);
+            muxpayload(stream, frame, pes_offset, 184);
+            pes_offset += 184;
 
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
+            packetcount++;
 
-            video_size -= 184;
+            pes_size -= 184;
         }
     }
 
     return packetcount;
 }
 
-static int muxaudiosample(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame, int audio_stream)
+static int muxvideosample(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame)
 {
-    int header_size;
-    uint8_t *muxbuffer = stream->muxbuffer;
-    uint8_t *pesbuffer = stream->pesbuffer;
-    uint8_t *buffer = muxbuffer;
-    packet_struct *packettable = stream->packettable;
-    packet_struct *ptable = packettable;
-    uint8_t *header = pesbuffer;
-    uint8_t *muxdata;
-    int audio_size;
-    int widx = 0;
-    uint16_t audio_pid = AUDIO_BASE_PID+audio_stream;
-    uint16_t firstdata;
+    uint8_t *header = stream->pesheader;
+
+    header[0] = 0x00;
+    header[1] = 0x00;
+    header[2] = 0x01;        // start code
+    header[3] = 0xe0;
+    header[4] = 0x00;
+    header[5] = 0x00;
+    header[6] = 0x85;
+    if (frame->pts > 0 && frame->dts > 0) {
+        header[7] = 0xc0;    // 0xc0 (both pts+dts)
+        header[8] = 10;      // 10-bytes
+        apply_pts(&header[9], frame->pts);
+        header[9] = header[9] & 0x0f;
+        header[9] = header[9] | 0x30;
+        apply_pts(&header[14], frame->dts);
+        header[14] = header[14] & 0x0f;
+        header[14] = header[14] | 0x10;
+        stream->pesheader_size = 19;
+    } else {
+        header[7] = 0x80;    // 0x80 (only pts)
+        header[8] = 5;       // 5-bytes
+        apply_pts(&header[9], frame->pts);
+        header[9] = header[9] & 0x0f;
+        header[9] = header[9] | 0x20;
+        stream->pesheader_size = 14;
+    }
+
+    return muxpes(stream, frame, VIDEO_PID, MDSIZE_VIDEO);
+}
+
+static int muxaudiosample(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame, int audio_stream, int pcr)
+{
+    uint8_t *header = stream->pesheader;
     uint16_t *save16;
-    uint16_t firstflag;
-    int s;
-    int packetcount = 0;
 
     header[0] = 0x00;
     header[1] = 0x00;
@@ -925,161 +942,734 @@ static int muxaudiosample(fillet_app_struct *core, stream_struct *stream, sorted
     apply_pts(&header[9], frame->pts);
     header[9] = header[9] & 0x0f;
     header[9] = header[9] | 0x20;
-    header_size = 14;
+    stream->pesheader_size = 14;
 
-    memcpy(pesbuffer + header_size, frame->buffer, frame->buffer_size);
-    muxdata = pesbuffer;
+    return muxpes(stream, frame, AUDIO_BASE_PID+audio_stream, pcr ? MDSIZE_AUDIO : 0);
+}
 
-    audio_size = header_size + frame->buffer_size;
+// with muxed ts the default audio rides inside the video segments instead of getting its own
+static int is_muxed_audio(fillet_app_struct *core, int source, int sub_stream)
+{
+    return core->cd->enable_muxed_ts && source == 0 && sub_stream == 0;
+}
 
-    firstdata = 0x4000 | audio_pid;
-    firstflag = 0x10;
-    if (frame->sync_frame) {
-        firstflag = 0x20;
+// each stream, a video rendition or an audio substream, has a worker that packetizes, builds and writes
+// its ts and fMP4 segments- the mux pump thread stays the coordinator, it decides every segment boundary,
+// renders the playlists and hands both over on the worker queue so a playlist never goes out ahead of
+// its segment
+#define MUX_JOB_OPEN          1
+#define MUX_JOB_FRAME         2
+#define MUX_JOB_CLOSE         3
+#define MUX_JOB_PLAYLIST      4
+#define MUX_JOB_RESET         5
+// buffer is the fragment handle when it is handed over, buffer_size the file sequence number
+#define MUX_JOB_FMP4_OPEN     6
+// pts is the fragment timestamp, dts the composition time and buffer_size the duration
+#define MUX_JOB_FMP4_FRAME    7
+// pts/dts are the start and length of the fragment, first_pts the segment time, buffer_size the file
+// sequence number and splice_duration the media sequence number
+#define MUX_JOB_FMP4_CLOSE    8
+#define MUX_JOB_FMP4_RESET    9
+// buffer is the caption text, pts/buffer_size as for MUX_JOB_FMP4_CLOSE
+#define MUX_JOB_WEBVTT        10
+
+// msg->flags of a MUX_JOB_FRAME, the default audio goes into this video stream (enable_muxed_ts)
+#define MUX_JOB_MUXED_AUDIO   0x01
+// msg->flags of a MUX_JOB_FMP4_FRAME, a silent frame for msg->channels goes in ahead of the audio
+#define MUX_JOB_ADD_SILENCE   0x02
+// msg->flags of a MUX_JOB_PLAYLIST, the playlist goes to the cdn as well (only the ts segments are uploaded)
+#define MUX_JOB_UPLOAD        0x04
+
+// frames a worker can have queued before new ones are dropped, a stalled writer would otherwise hold
+// on to message and frame buffers until the pools run dry- the segment jobs are never held back
+#define MAX_MUX_WORKER_FRAMES 128
+
+typedef struct _mux_worker_struct_ {
+    fillet_app_struct        *core;
+    stream_struct            *stream;
+    stream_struct            *muxed_audio;
+    int                      muxed_audio_codec_type;
+    int                      source;
+    int                      sub_stream;
+    int                      video;
+    void                     *queue;
+    // frame jobs posted and not yet written, the coordinator adds and the worker takes away
+    int                      queued_frames;
+    // video was dropped, nothing more goes out until the next sync frame (only the coordinator uses them)
+    int                      ts_drop_to_sync;
+    int                      fmp4_drop_to_sync;
+    // the fragment handle once handed over and the open segment, only the worker touches them
+    fragment_file_struct     *fmp4;
+    FILE                     *fmp4_file;
+    int                      quit;
+    pthread_t                worker_thread_id;
+} mux_worker_struct;
+
+static void release_frame(fillet_app_struct *core, sorted_frame_struct *frame)
+{
+    if (frame->frame_type == FRAME_TYPE_VIDEO) {
+        memory_return(core->compressed_video_pool, frame->buffer);
+    } else {
+        memory_return(core->compressed_audio_pool, frame->buffer);
     }
+    memory_return(core->frame_msg_pool, frame);
+}
 
-    while (audio_size > 0) {
-        uint8_t *sp;
+static void upload_file(fillet_app_struct *core, const char *filename)
+{
+    if ((strlen(core->cd->cdn_server) > 0) && (strlen(core->cd->cdn_username) > 0) && (strlen(core->cd->cdn_password) > 0)) {
+        dataqueue_message_struct *msg;
 
-        widx = packetcount * 188;
-        sp = buffer + widx;
+        msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
+        if (msg) {
+            snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", filename); // this is the directory on the local server which is what we want
+            msg->buffer = NULL;
+            msg->buffer_type = WEBDAV_UPLOAD;
+            dataqueue_put_front(core->webdav_queue, msg);
+        } else {
+            // the file is still written locally, it just is not uploaded this time
+            backpressure_count(core->backpressure, BACKPRESSURE_UPLOAD_SKIPPED);
+        }
+    }
+}
 
-        buffer[widx++] = 0x47;
-        save16 = (uint16_t*)&buffer[widx];
-        *save16 = htons(firstdata);
-        widx += 2;
-        firstdata = audio_pid;  // overwrite from first time
-        buffer[widx] = (stream->cnt & 0x0f) | firstflag;
-        firstflag = 0x10;
-        stream->prev_cnt = stream->cnt;
-        stream->cnt = (stream->cnt + 1) & 0x0f;
-        if (packetcount == 0 && audio_size >= MDSIZE_AUDIO) {
-            buffer[widx] = buffer[widx] | 0x30;
-            widx++;
-            buffer[widx++] = 188 - MDSIZE_AUDIO - 5;
-            buffer[widx] = 0x10;  // PCR flag
-            if (frame->sync_frame) {
-                buffer[widx] = 0x50; // RAI, PCR flag
-            }
-            widx++;
+static void write_playlist(fillet_app_struct *core, const char *filename, const char *playlist, uint32_t flags)
+{
+    FILE *playlist_file;
 
-            widx += 6; // PCR
+    playlist_file = fopen(filename, "w");
+    if (!playlist_file) {
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO WRITE PLAYLIST %s\n", filename);
+        return;
+    }
+    fputs(playlist, playlist_file);
+    fclose(playlist_file);
 
-            // null filler
-            for (s = 12; s < 188 - MDSIZE_AUDIO; s++) {
-                buffer[widx++] = 0xff;
-            }
-            memcpy(sp + 188 - MDSIZE_AUDIO, muxdata, MDSIZE_AUDIO);
-            widx += MDSIZE_AUDIO;           // this is the 188-byte output stream
-            muxdata += MDSIZE_AUDIO;        // this is the source data
-
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
-
-            audio_size -= MDSIZE_AUDIO;
-        } else if (audio_size == 183) {
-            buffer[widx] = buffer[widx] | 0x30;
-            widx++;
-            buffer[widx++] = 91;
-            buffer[widx++] = 0;
-            for (s = 6; s < 188 - 92; s++) {
-                buffer[widx++] = 0xff;
-            }
-            memcpy(sp + 188 - 92, muxdata, 92);
-            widx += 92;
-            muxdata += 92;
-
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
-
-            widx = packetcount * 188;
-            sp = buffer + widx;
-            buffer[widx++] = 0x47;
-            save16 = (uint16_t*)&buffer[widx];
-            *save16 = htons(audio_pid);
-            widx += 2;
+    send_signal(core, SIGNAL_MANIFEST_WRITTEN, filename);
+    if (flags & MUX_JOB_UPLOAD) {
+        upload_file(core, filename);
+    }
+}
 
-            buffer[widx] = (stream->cnt & 0x0f) | 0x10;
-            stream->prev_cnt = stream->cnt;
-            stream->cnt = (stream->cnt + 1) & 0x0f;
+static void make_manifest_directory(const char *local_dir)
+{
+    struct stat sb;
 
-            buffer[widx] = buffer[widx] | 0x30;
-            widx++;
-            buffer[widx++] = 92;
-            buffer[widx++] = 0;
-            for (s = 6; s < 188 - 91; s++) {
-                buffer[widx++] = 0xff;
+    if (stat(local_dir, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        fprintf(stderr,"STATUS: fMP4 manifest directory exists: %s\n", local_dir);
+    } else {
+        fprintf(stderr,"STATUS: fMP4 manifest directory does not exist: %s (CREATING)\n", local_dir);
+        mkdir(local_dir, 0700);
+        fprintf(stderr,"STATUS: Done creating fMP4 manifest directory\n");
+    }
+}
+
+static void mp4_stream_directory(fillet_app_struct *core, char *local_dir, int source, int sub_stream, int video)
+{
+    if (video) {
+        snprintf(local_dir, MAX_STREAM_NAME-1, "%s/video%d", core->cd->manifest_directory, source);
+    } else {
+        snprintf(local_dir, MAX_STREAM_NAME-1, "%s/audio%d_substream%d", core->cd->manifest_directory, source, sub_stream);
+    }
+}
+
+static void open_mp4_fragment(fillet_app_struct *core, FILE **output_file, int source, int sub_stream, int video, int64_t file_sequence_number)
+{
+    if (!*output_file) {
+        char stream_name[MAX_STREAM_NAME];
+        char local_dir[MAX_STREAM_NAME];
+
+        mp4_stream_directory(core, local_dir, source, sub_stream, video);
+        make_manifest_directory(local_dir);
+
+        snprintf(stream_name, MAX_STREAM_NAME-1, "%s/segment%ld.mp4", local_dir, file_sequence_number);
+        *output_file = fopen(stream_name,"w");
+    }
+}
+
+// builds the sidx/moof/mdat of the frames collected in fmp4 and writes them to the segment
+static void write_mp4_fragment(fragment_file_struct *fmp4, FILE *output_file, int source, int sub_stream, int video,
+                               int64_t start_time, int64_t frag_length, int64_t media_sequence_number)
+{
+    int64_t sidx_time = 0;
+    int64_t sidx_duration = 0;
+
+    fmp4_fragment_end(fmp4, &sidx_time, &sidx_duration, start_time, frag_length, media_sequence_number,
+                      video ? VIDEO_FRAGMENT : AUDIO_FRAGMENT);
+
+    if (!video) {
+        syslog(LOG_INFO,"HLSMUX: ENDING PREVIOUS fMP4 AUDIO FRAGMENT(%d): SIZE:%ld\n",
+               source,
+               fmp4->buffer_offset);
+    }
+
+#if defined(DEBUG_MP4)
+    if (source == 0 && (video || sub_stream == 0)) {
+        FILE **debug_mp4 = video ? &debug_video_mp4 : &debug_audio_mp4;
+
+        if (!*debug_mp4) {
+            *debug_mp4 = fopen(video ? "debugvideo.mp4" : "debugaudio.mp4","w");
+        }
+        if (*debug_mp4) {
+            fwrite(fmp4->buffer, 1, fmp4->buffer_offset, *debug_mp4);
+            fflush(*debug_mp4);
+        }
+    }
+#endif // DEBUG_MP4
+
+    if (output_file) {
+        fwrite(fmp4->buffer, 1, fmp4->buffer_offset, output_file);
+    }
+}
+
+static int end_mp4_fragment(fillet_app_struct *core, FILE **output_file, int source, int sub_stream, int video, int64_t file_sequence_number, int64_t segment_time)
+{
+    if (*output_file) {
+        fclose(*output_file);
+        *output_file = NULL;
+        {
+            char stream_name[MAX_STREAM_NAME];
+            char stream_name_link[MAX_STREAM_NAME];
+            char local_dir[MAX_STREAM_NAME];
+
+            mp4_stream_directory(core, local_dir, source, sub_stream, video);
+            snprintf(stream_name, MAX_STREAM_NAME-1, "%s/segment%ld.mp4", local_dir, file_sequence_number);
+            snprintf(stream_name_link, MAX_STREAM_NAME-1, "%s/segment%ld.mp4", local_dir, segment_time); //stream->media_sequence_number);
+            syslog(LOG_INFO,"HLSMUX: WRITING OUT %s (%s)\n", stream_name_link, stream_name);
+            symlink(stream_name, stream_name_link);
+            send_signal(core, SIGNAL_SEGMENT_WRITTEN, stream_name_link);
+
+            /*
+            if ((strlen(core->cd->cdn_server) > 0) && (strlen(core->cd->cdn_username) > 0) && (strlen(core->cd->cdn_password) > 0)) {
+                dataqueue_message_struct *msg;
+                //this is also done in the start_end_fragment
+                //send message to webdav thread for upload
+                //base url is: core->cd->cdn_server        - it doesn't need to match the manifest directory tag since it can be uploaded anywhere and we are keeping the
+                //                                           manifest in the same directory as the transport files right now. this could be changed, to accommodate archival
+                //                                           but for now we'll keep it simple and straightforward to setup
+                msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
+                if (msg) {
+                    snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", stream_name); // this is the directory on the local server which is what we want
+                    msg->buffer = NULL;
+                    msg->buffer_type = WEBDAV_UPLOAD;
+
+                    dataqueue_put_front(core->webdav_queue, msg);
+                } else {
+                    fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
+                            core->session_id);
+                    exit(0);
+                }
+            }// end checking for cdn availability
+            */
+        }
+    }
+
+    return 0;
+}
+
+// the captions of a segment go out in one piece once the segment ends
+static void write_webvtt_segment(fillet_app_struct *core, int source, int64_t file_sequence_number, int64_t segment_time, const char *text)
+{
+    FILE *webvtt_file;
+    char stream_name[MAX_STREAM_NAME];
+    char stream_name_link[MAX_STREAM_NAME];
+    char local_dir[MAX_STREAM_NAME];
+
+    snprintf(local_dir, MAX_STREAM_NAME-1, "%s/webvtt%d", core->cd->manifest_directory, source);
+    make_manifest_directory(local_dir);
+
+    snprintf(stream_name, MAX_STREAM_NAME-1, "%s/segment%ld.vtt", local_dir, file_sequence_number);
+    webvtt_file = fopen(stream_name,"w");
+    if (!webvtt_file) {
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO WRITE %s\n", stream_name);
+        return;
+    }
+    fprintf(webvtt_file, "%s", text);
+    fclose(webvtt_file);
+
+    snprintf(stream_name_link, MAX_STREAM_NAME-1, "%s/segment%ld.vtt", local_dir, segment_time);
+    syslog(LOG_INFO,"HLSMUX: WRITING OUT %s (%s)\n", stream_name_link, stream_name);
+    symlink(stream_name, stream_name_link);
+}
+
+// silent frames ahead of the first audio keep it lined up with the video
+static void add_mp4_silence(fragment_file_struct *fmp4, int audio_channels, double fragment_timestamp, int fragment_duration)
+{
+    if (audio_channels == 2) {
+        fmp4_audio_fragment_add(fmp4,
+                                aac_quiet_2,
+                                sizeof(aac_quiet_2),
+                                NULL,
+                                fragment_timestamp,
+                                fragment_duration);
+    } else if (audio_channels == 6) {
+        fmp4_audio_fragment_add(fmp4,
+                                aac_quiet_6,
+                                sizeof(aac_quiet_6),
+                                NULL,
+                                fragment_timestamp,
+                                fragment_duration);
+    }
+}
+
+static void patch_pcr(uint8_t *muxbuffer, int64_t timestamp, int64_t timestamp_base)
+{
+    int64_t base;
+    int64_t ext;
+    int64_t full;
+    int64_t total_pc;
+    int64_t offset_count;
+    int64_t timestamp_offset;
+
+    timestamp_offset = timestamp - timestamp_base;
+    if (timestamp_offset < 0) {
+        timestamp_offset += 8589934592;
+    }
+
+    offset_count = (int64_t)(((double)(timestamp_offset)*(double)300.0*(double)20.0/(double)216) - (double)10)/(double)188;
+    total_pc = offset_count;
+
+    full = (int64_t)((int64_t)total_pc * (int64_t)40608) / (int64_t)20;
+    full = full % (8589934592 * 300);
+    base = full / 300;
+    ext = full % 300;
+
+    muxbuffer[6] = (0xff & (base >> 25));
+    muxbuffer[7] = (0xff & (base >> 17));
+    muxbuffer[8] = (0xff & (base >> 9));
+    muxbuffer[9] = (0xff & (base >> 1));
+    muxbuffer[10] = ((0x01 & base) << 7) | 0x7e | ((0x100 & ext) >> 8);
+    muxbuffer[11] = (0xff & ext);
+}
+
+static void mux_worker_frame(mux_worker_struct *worker, sorted_frame_struct *frame, uint32_t flags)
+{
+    fillet_app_struct *core = worker->core;
+    stream_struct *stream = worker->stream;
+    stream_struct *packetizer = stream;
+    uint8_t *muxbuffer;
+    int64_t pc;
+
+    if (!segment_writer_is_open(stream->output_ts_writer)) {
+        return;
+    }
+
+    if (flags & MUX_JOB_MUXED_AUDIO) {
+        int audio_codec_type = CODEC_AAC;
+
+        if (frame->media_type == MEDIA_TYPE_AC3) {
+            audio_codec_type = CODEC_AC3;
+        }
+        // the pat/pmt have to be out before the first audio they describe- a new segment whose first
+        // video frame was dropped starts with audio, and a codec change needs a new pmt
+        if (stream->psi_due || audio_codec_type != worker->muxed_audio_codec_type) {
+            worker->muxed_audio_codec_type = audio_codec_type;
+            muxpsi(core, stream, VIDEO_PID, CODEC_H264, audio_codec_type, frame->full_time);
+        }
+        packetizer = worker->muxed_audio;
+        pc = muxaudiosample(core, packetizer, frame, 0, 0);
+    } else if (worker->video) {
+        muxpsi(core, stream, VIDEO_PID, CODEC_H264, worker->muxed_audio_codec_type, frame->full_time);
+        pc = muxvideosample(core, stream, frame);
+    } else {
+        if (frame->media_type == MEDIA_TYPE_AC3) {
+            muxpsi(core, stream, AUDIO_BASE_PID, CODEC_AC3, 0, frame->full_time);
+        } else {
+            muxpsi(core, stream, AUDIO_BASE_PID, CODEC_AAC, 0, frame->full_time);
+        }
+        pc = muxaudiosample(core, stream, frame, 0, 1);
+    }
+    if (pc <= 0) {
+        return;
+    }
+
+    packetizer->packet_count += pc;
+    muxbuffer = packetizer->muxbuffer;
+    if (!(flags & MUX_JOB_MUXED_AUDIO) && (muxbuffer[5] == 0x10 || muxbuffer[5] == 0x50)) {
+        if (!worker->video) {
+            patch_pcr(muxbuffer, frame->pts, AUDIO_OFFSET);
+        } else if (frame->dts > 0) {
+            patch_pcr(muxbuffer, frame->dts, VIDEO_OFFSET);
+        } else {
+            patch_pcr(muxbuffer, frame->pts, VIDEO_OFFSET);
+        }
+    }
+    segment_writer_writev(stream->output_ts_writer, packetizer->muxiov, packetizer->muxiov_count);
+}
+
+static void mux_worker_mp4_frame(mux_worker_struct *worker, sorted_frame_struct *frame, dataqueue_message_struct *msg)
+{
+    fillet_app_struct *core = worker->core;
+
+    if (!worker->fmp4 || !worker->fmp4_file) {
+        return;
+    }
+
+    if (frame->frame_type == FRAME_TYPE_VIDEO) {
+        fmp4_video_fragment_add(worker->fmp4,
+                                frame->buffer,
+                                frame->buffer_size,
+                                core->compressed_video_pool,
+                                msg->pts,
+                                (int)msg->buffer_size,
+                                msg->dts,
+                                &frame->nal_index);
+    } else {
+        if (msg->flags & MUX_JOB_ADD_SILENCE) {
+            add_mp4_silence(worker->fmp4, msg->channels, msg->pts, (int)msg->buffer_size);
+        }
+        fmp4_audio_fragment_add(worker->fmp4,
+                                frame->buffer,
+                                frame->buffer_size,
+                                core->compressed_audio_pool,
+                                msg->pts,
+                                (int)msg->buffer_size);
+    }
+}
+
+static void mux_worker_job(mux_worker_struct *worker, dataqueue_message_struct *msg)
+{
+    fillet_app_struct *core = worker->core;
+    stream_struct *stream = worker->stream;
+
+    if (msg->buffer_type == MUX_JOB_OPEN) {
+        if (!stream->output_ts_writer) {
+            // only the streams that are actually carried get buffers
+            stream->output_ts_writer = segment_writer_create();
+        }
+        if (!segment_writer_is_open(stream->output_ts_writer)) {
+            segment_writer_open(stream->output_ts_writer, msg->smallbuf);
+            // every segment has to stand on its own
+            stream->psi_due = 1;
+        }
+    } else if (msg->buffer_type == MUX_JOB_FRAME) {
+        sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
+
+        mux_worker_frame(worker, frame, msg->flags);
+        release_frame(core, frame);
+        __atomic_sub_fetch(&worker->queued_frames, 1, __ATOMIC_RELEASE);
+    } else if (msg->buffer_type == MUX_JOB_CLOSE) {
+        if (segment_writer_is_open(stream->output_ts_writer)) {
+            segment_writer_stats_struct stats;
+
+            segment_writer_close(stream->output_ts_writer, &stats);
+            syslog(LOG_INFO,"HLSMUX: WROTE %s: %ld BYTES IN %ld WRITES (%ld BYTES/WRITE)\n",
+                   msg->smallbuf, stats.bytes_written, stats.write_calls,
+                   stats.write_calls > 0 ? stats.bytes_written / stats.write_calls : 0);
+        }
+        send_signal(core, SIGNAL_SEGMENT_WRITTEN, msg->smallbuf);
+        upload_file(core, msg->smallbuf);
+    } else if (msg->buffer_type == MUX_JOB_PLAYLIST) {
+        write_playlist(core, msg->smallbuf, (char*)msg->buffer, msg->flags);
+        free(msg->buffer);
+    } else if (msg->buffer_type == MUX_JOB_RESET) {
+        segment_writer_close(stream->output_ts_writer, NULL);
+        stream->packet_count = 0;
+    } else if (msg->buffer_type == MUX_JOB_FMP4_OPEN) {
+        if (msg->buffer) {
+            // a handle left over from before a reset makes way for the new one
+            if (worker->fmp4) {
+                fmp4_file_finalize(worker->fmp4);
             }
-            memcpy(sp + 188 - 91, muxdata, 91);
-            widx += 91;
-            muxdata += 91;
-
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
-
-            audio_size = 0;
-        } else if (audio_size < 184) {
-            buffer[widx] = buffer[widx] | 0x30;
-            widx++;
-            buffer[widx++] = 188 - audio_size - 5;
-            buffer[widx++] = 0;
-            for (s = 6; s < 188 - audio_size; s++) {
-                buffer[widx++] = 0xff;
+            worker->fmp4 = (fragment_file_struct*)msg->buffer;
+        }
+        open_mp4_fragment(core, &worker->fmp4_file, worker->source, worker->sub_stream, worker->video, msg->buffer_size);
+    } else if (msg->buffer_type == MUX_JOB_FMP4_FRAME) {
+        sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
+
+        mux_worker_mp4_frame(worker, frame, msg);
+        release_frame(core, frame);
+        __atomic_sub_fetch(&worker->queued_frames, 1, __ATOMIC_RELEASE);
+    } else if (msg->buffer_type == MUX_JOB_FMP4_CLOSE) {
+        if (worker->fmp4 && worker->fmp4_file) {
+            write_mp4_fragment(worker->fmp4, worker->fmp4_file, worker->source, worker->sub_stream, worker->video,
+                               msg->pts, msg->dts, msg->splice_duration);
+        }
+        end_mp4_fragment(core, &worker->fmp4_file, worker->source, worker->sub_stream, worker->video, msg->buffer_size, msg->first_pts);
+    } else if (msg->buffer_type == MUX_JOB_FMP4_RESET) {
+        if (worker->fmp4_file) {
+            fclose(worker->fmp4_file);
+            worker->fmp4_file = NULL;
+        }
+        if (worker->fmp4) {
+            fmp4_file_finalize(worker->fmp4);
+            worker->fmp4 = NULL;
+        }
+    } else if (msg->buffer_type == MUX_JOB_WEBVTT) {
+        write_webvtt_segment(core, worker->source, msg->buffer_size, msg->pts, (char*)msg->buffer);
+        free(msg->buffer);
+    }
+    memory_return(core->fillet_msg_pool, msg);
+}
+
+static void *mux_worker_thread(void *context)
+{
+    mux_worker_struct *worker = (mux_worker_struct*)context;
+    dataqueue_message_struct *msg;
+
+    while (1) {
+        msg = dataqueue_take_back_wait(worker->queue, QUEUE_WAIT_TIMEOUT);
+        if (!msg) {
+            if (!__atomic_load_n(&worker->quit, __ATOMIC_ACQUIRE)) {
+                continue;
             }
-            memcpy(sp + 188 - audio_size, muxdata, audio_size);
+            // a job can land between the empty wait and seeing the flag
+            msg = dataqueue_take_back(worker->queue);
+            if (!msg) {
+                break;
+            }
+        }
+        mux_worker_job(worker, msg);
+    }
+    return NULL;
+}
 
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
+static mux_worker_struct *mux_worker_create(fillet_app_struct *core, stream_struct *stream, stream_struct *muxed_audio, int source, int sub_stream, int video)
+{
+    mux_worker_struct *worker;
 
-            muxdata += audio_size;
-            widx += audio_size;
+    worker = (mux_worker_struct*)malloc(sizeof(mux_worker_struct));
+    if (!worker) {
+        return NULL;
+    }
+    memset(worker, 0, sizeof(mux_worker_struct));
+    worker->core = core;
+    worker->stream = stream;
+    worker->muxed_audio = muxed_audio;
+    worker->source = source;
+    worker->sub_stream = sub_stream;
+    worker->video = video;
+    // the coordinator is the only producer
+    worker->queue = dataqueue_create_spsc(SPSC_QUEUE_ENTRIES);
+    if (!worker->queue) {
+        free(worker);
+        return NULL;
+    }
+    if (pthread_create(&worker->worker_thread_id, NULL, mux_worker_thread, (void*)worker) != 0) {
+        dataqueue_destroy(worker->queue);
+        free(worker);
+        return NULL;
+    }
+    return worker;
+}
 
-            audio_size = 0;
-        } else {
-            memcpy(sp + 4, muxdata, 184);
-            muxdata += 184;
-            widx += 184;
+static void mux_worker_destroy(void *context)
+{
+    mux_worker_struct *worker = (mux_worker_struct*)context;
 
-            ptable->pts = frame->pts;
-            ptable->dts = frame->dts;
-            ptable->sync = frame->sync_frame;
-            ptable->disflag = 0;
-            ptable->count = ++packetcount;
-            ptable++;
+    if (!worker) {
+        return;
+    }
+    __atomic_store_n(&worker->quit, 1, __ATOMIC_RELEASE);
+    pthread_join(worker->worker_thread_id, NULL);
+    dataqueue_destroy(worker->queue);
+    // a segment still open at shutdown is left unpublished
+    if (worker->fmp4_file) {
+        fclose(worker->fmp4_file);
+    }
+    if (worker->fmp4) {
+        fmp4_file_finalize(worker->fmp4);
+    }
+    free(worker);
+}
 
-            audio_size -= 184;
+static mux_worker_struct *get_mux_worker(fillet_app_struct *core, stream_struct *stream, int source, int sub_stream, int video)
+{
+    hlsmux_struct *hlsmux = (hlsmux_struct*)core->hlsmux;
+
+    if (!stream->mux_worker) {
+        stream->mux_worker = mux_worker_create(core, stream, video ? &hlsmux->muxed_audio[source] : NULL, source, sub_stream, video);
+        if (!stream->mux_worker) {
+            syslog(LOG_ERR,"HLSMUX: UNABLE TO START MUX WORKER (SOURCE:%d SUB:%d VIDEO:%d)\n", source, sub_stream, video);
         }
     }
+    return (mux_worker_struct*)stream->mux_worker;
+}
 
-    return packetcount;
+static void fill_mux_job(dataqueue_message_struct *msg, int job, const char *name, void *buffer, uint32_t flags)
+{
+    msg->buffer_type = job;
+    msg->buffer = buffer;
+    msg->flags = flags;
+    if (name) {
+        snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", name);
+    } else {
+        msg->smallbuf[0] = 0;
+    }
+}
+
+static dataqueue_message_struct *new_mux_job(fillet_app_struct *core, stream_struct *stream, int job, const char *name, void *buffer, uint32_t flags)
+{
+    dataqueue_message_struct *msg;
+
+    if (!stream->mux_worker) {
+        return NULL;
+    }
+    msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
+    if (!msg) {
+        return NULL;
+    }
+    fill_mux_job(msg, job, name, buffer, flags);
+    return msg;
+}
+
+static void put_mux_job(fillet_app_struct *core, stream_struct *stream, dataqueue_message_struct *msg)
+{
+    mux_worker_struct *worker = (mux_worker_struct*)stream->mux_worker;
+
+    if (msg->buffer_type == MUX_JOB_FRAME || msg->buffer_type == MUX_JOB_FMP4_FRAME) {
+        __atomic_add_fetch(&worker->queued_frames, 1, __ATOMIC_RELAXED);
+    }
+    dataqueue_put_front(worker->queue, msg);
+}
+
+static int post_mux_job(fillet_app_struct *core, stream_struct *stream, int job, const char *name, void *buffer, uint32_t flags)
+{
+    dataqueue_message_struct *msg;
+
+    msg = new_mux_job(core, stream, job, name, buffer, flags);
+    if (!msg) {
+        return -1;
+    }
+    put_mux_job(core, stream, msg);
+    return 0;
+}
+
+static void drop_mux_frame(fillet_app_struct *core, int *drop_to_sync, sorted_frame_struct *frame)
+{
+    if (frame->frame_type == FRAME_TYPE_VIDEO) {
+        // the rest of the gop cannot be decoded without this frame
+        *drop_to_sync = 1;
+        backpressure_count(core->backpressure, BACKPRESSURE_VIDEO_DROPPED);
+    } else {
+        backpressure_count(core->backpressure, BACKPRESSURE_AUDIO_DROPPED);
+    }
+}
+
+// takes the references the worker hands back once the frame is written, -1 when the frame is not going out-
+// the ts and fMP4 frames share the cap, each output waits for its own sync frame after a drop
+static int hold_mux_frame(fillet_app_struct *core, mux_worker_struct *worker, sorted_frame_struct *frame, int *drop_to_sync)
+{
+    void *pool = core->compressed_audio_pool;
+
+    if (frame->frame_type == FRAME_TYPE_VIDEO) {
+        pool = core->compressed_video_pool;
+        if (*drop_to_sync) {
+            if (!frame->sync_frame) {
+                drop_mux_frame(core, drop_to_sync, frame);
+                return -1;
+            }
+            *drop_to_sync = 0;
+        }
+    }
+    if (__atomic_load_n(&worker->queued_frames, __ATOMIC_ACQUIRE) >= MAX_MUX_WORKER_FRAMES) {
+        drop_mux_frame(core, drop_to_sync, frame);
+        return -1;
+    }
+    if (memory_ref(core->frame_msg_pool, frame) < 0) {
+        return -1;
+    }
+    if (memory_ref(pool, frame->buffer) < 0) {
+        memory_return(core->frame_msg_pool, frame);
+        return -1;
+    }
+    return 0;
+}
+
+static void post_ts_frame(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame, uint32_t flags)
+{
+    mux_worker_struct *worker = (mux_worker_struct*)stream->mux_worker;
+
+    if (!worker || hold_mux_frame(core, worker, frame, &worker->ts_drop_to_sync) < 0) {
+        return;
+    }
+    if (post_mux_job(core, stream, MUX_JOB_FRAME, NULL, frame, flags) < 0) {
+        drop_mux_frame(core, &worker->ts_drop_to_sync, frame);
+        release_frame(core, frame);
+    }
+}
+
+static void post_mp4_frame(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame,
+                           int64_t fragment_timestamp, int64_t fragment_composition_time, int fragment_duration,
+                           uint32_t flags, int audio_channels)
+{
+    mux_worker_struct *worker = (mux_worker_struct*)stream->mux_worker;
+    dataqueue_message_struct *msg;
+
+    if (!worker || hold_mux_frame(core, worker, frame, &worker->fmp4_drop_to_sync) < 0) {
+        return;
+    }
+    msg = new_mux_job(core, stream, MUX_JOB_FMP4_FRAME, NULL, frame, flags);
+    if (!msg) {
+        drop_mux_frame(core, &worker->fmp4_drop_to_sync, frame);
+        release_frame(core, frame);
+        return;
+    }
+    msg->pts = fragment_timestamp;
+    msg->dts = fragment_composition_time;
+    msg->buffer_size = fragment_duration;
+    msg->channels = audio_channels;
+    put_mux_job(core, stream, msg);
+}
+
+// the playlist goes out from the stream's worker behind the segment it lists, playlist is taken over
+static void publish_playlist(fillet_app_struct *core, stream_struct *stream, const char *filename, char *playlist, uint32_t flags)
+{
+    if (post_mux_job(core, stream, MUX_JOB_PLAYLIST, filename, playlist, flags) < 0) {
+        write_playlist(core, filename, playlist, flags);
+        free(playlist);
+    }
+}
+
+// a close or reset that could not be posted leaves the worker's writer open- it goes out before the next
+// segment is opened, otherwise the worker would skip that open and keep writing into the old file
+static int retry_ts_close(fillet_app_struct *core, stream_struct *stream)
+{
+    if (stream->ts_close_pending[0]) {
+        if (post_mux_job(core, stream, MUX_JOB_CLOSE, stream->ts_close_pending, NULL, 0) < 0) {
+            return -1;
+        }
+        stream->ts_close_pending[0] = 0;
+    }
+    if (stream->ts_reset_pending) {
+        if (post_mux_job(core, stream, MUX_JOB_RESET, NULL, NULL, 0) < 0) {
+            return -1;
+        }
+        stream->ts_reset_pending = 0;
+    }
+    return 0;
+}
+
+static void reset_ts_fragment(fillet_app_struct *core, stream_struct *stream)
+{
+    stream->ts_segment_open = 0;
+    if (stream->mux_worker) {
+        stream->ts_reset_pending = 1;
+        retry_ts_close(core, stream);
+    }
 }
 
 static int start_ts_fragment(fillet_app_struct *core, stream_struct *stream, int source, int sub_stream, int video)
 {
-    if (!stream->output_ts_file) {
-        char stream_name[MAX_STREAM_NAME];
+    char stream_name[MAX_STREAM_NAME];
+
+    if (!get_mux_worker(core, stream, source, sub_stream, video)) {
+        return -1;
+    }
+    if (retry_ts_close(core, stream) < 0) {
+        syslog(LOG_ERR,"HLSMUX: PREVIOUS TS SEGMENT STILL OPEN, SKIPPING SEGMENT %ld (SOURCE:%d SUB:%d VIDEO:%d)\n",
+               stream->file_sequence_number, source, sub_stream, video);
+        return -1;
+    }
+    if (!stream->ts_segment_open) {
         if (video) {
             snprintf(stream_name, MAX_STREAM_NAME-1, "%s/video_stream%d_%ld.ts", core->cd->manifest_directory, source, stream->file_sequence_number);
         } else {
             snprintf(stream_name, MAX_STREAM_NAME-1, "%s/audio_stream%d_substream_%d_%ld.ts", core->cd->manifest_directory, source, sub_stream, stream->file_sequence_number);
         }
-        stream->output_ts_file = fopen(stream_name,"w");
+        if (post_mux_job(core, stream, MUX_JOB_OPEN, stream_name, NULL, 0) == 0) {
+            stream->ts_segment_open = 1;
+        }
     }
 
     return 0;
@@ -1087,33 +1677,15 @@ static int start_ts_fragment(fillet_app_struct *core, stream_struct *stream, int
 
 static int start_init_mp4_fragment(fillet_app_struct *core, stream_struct *stream, int source, int video, int sub_stream)
 {
-    struct stat sb;
-
     if (!stream->output_fmp4_file) {
         char stream_name[MAX_STREAM_NAME];
         char local_dir[MAX_STREAM_NAME];
 
         snprintf(local_dir, MAX_STREAM_NAME-1, "%s", core->cd->manifest_directory);
-        if (stat(local_dir, &sb) == 0 && S_ISDIR(sb.st_mode)) {
-            fprintf(stderr,"STATUS: fMP4 manifest directory exists: %s\n", local_dir);
-        } else {
-            fprintf(stderr,"STATUS: fMP4 manifest directory does not exist: %s (CREATING)\n", local_dir);
-            mkdir(local_dir, 0700);
-            fprintf(stderr,"STATUS: Done creating fMP4 manifest directory\n");
-        }
+        make_manifest_directory(local_dir);
 
-        if (video) {
-            snprintf(local_dir, MAX_STREAM_NAME-1, "%s/video%d", core->cd->manifest_directory, source);
-        } else {
-            snprintf(local_dir, MAX_STREAM_NAME-1, "%s/audio%d_substream%d", core->cd->manifest_directory, source, sub_stream);
-        }
-        if (stat(local_dir, &sb) == 0 && S_ISDIR(sb.st_mode)) {
-            fprintf(stderr,"STATUS: fMP4 manifest directory exists: %s\n", local_dir);
-        } else {
-            fprintf(stderr,"STATUS: fMP4 manifest directory does not exist: %s (CREATING)\n", local_dir);
-            mkdir(local_dir, 0700);
-            fprintf(stderr,"STATUS: Done creating fMP4 manifest directory\n");
-        }
+        mp4_stream_directory(core, local_dir, source, sub_stream, video);
+        make_manifest_directory(local_dir);
 
         snprintf(stream_name, MAX_STREAM_NAME-1, "%s/init.mp4", local_dir);
         stream->output_fmp4_file = fopen(stream_name,"w");
@@ -1131,125 +1703,234 @@ static int end_init_mp4_fragment(fillet_app_struct *core, stream_struct *stream,
     return 0;
 }
 
-static int start_mp4_fragment(fillet_app_struct *core, stream_struct *stream, int source, int video, int sub_stream)
+// with youtube output the video fragment handle also collects the audio on the mux pump thread, so the
+// fMP4 segments are built and written there- otherwise they go to the stream's worker like the ts segments
+static int fmp4_on_worker(fillet_app_struct *core)
+{
+    return !core->cd->enable_youtube_output;
+}
+
+// the fragment handle goes over to the worker with the first open, the close is set aside here so a
+// segment that was opened always gets finished
+static int start_mp4_fragment(fillet_app_struct *core, stream_struct *stream, int source, int video, int sub_stream)
+{
+    dataqueue_message_struct *msg;
+    dataqueue_message_struct *close_msg;
+
+    if (!fmp4_on_worker(core)) {
+        open_mp4_fragment(core, &stream->output_fmp4_file, source, sub_stream, video, stream->file_sequence_number);
+        return 0;
+    }
+    if (stream->fmp4_segment_open || !stream->fmp4) {
+        return 0;
+    }
+    if (video) {
+        sub_stream = 0;
+    }
+    if (!get_mux_worker(core, stream, source, sub_stream, video)) {
+        return -1;
+    }
+    close_msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
+    msg = new_mux_job(core, stream, MUX_JOB_FMP4_OPEN, NULL, stream->fmp4_handed_over ? NULL : stream->fmp4, 0);
+    if (!close_msg || !msg) {
+        if (close_msg) {
+            memory_return(core->fillet_msg_pool, close_msg);
+        }
+        if (msg) {
+            memory_return(core->fillet_msg_pool, msg);
+        }
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO OPEN fMP4 SEGMENT, SKIPPING SEGMENT %ld (SOURCE:%d SUB:%d VIDEO:%d)\n",
+               stream->file_sequence_number, source, sub_stream, video);
+        return -1;
+    }
+    msg->buffer_size = stream->file_sequence_number;
+    put_mux_job(core, stream, msg);
+    stream->fmp4_handed_over = 1;
+    stream->fmp4_close_msg = close_msg;
+    stream->fmp4_segment_open = 1;
+
+    return 0;
+}
+
+// returns 0 when a segment was finished
+static int end_mp4_segment(fillet_app_struct *core, stream_struct *stream, int source, int sub_stream, int video,
+                           int64_t start_time, int64_t frag_length, int64_t segment_time)
+{
+    dataqueue_message_struct *msg;
+
+    if (!fmp4_on_worker(core)) {
+        if (!stream->fmp4) {
+            return -1;
+        }
+        write_mp4_fragment(stream->fmp4, stream->output_fmp4_file, source, sub_stream, video,
+                           start_time, frag_length, stream->media_sequence_number);
+        end_mp4_fragment(core, &stream->output_fmp4_file, source, sub_stream, video, stream->file_sequence_number, segment_time);
+        return 0;
+    }
+    if (!stream->fmp4_segment_open) {
+        return -1;
+    }
+    msg = (dataqueue_message_struct*)stream->fmp4_close_msg;
+    stream->fmp4_close_msg = NULL;
+    stream->fmp4_segment_open = 0;
+
+    fill_mux_job(msg, MUX_JOB_FMP4_CLOSE, NULL, NULL, 0);
+    msg->pts = start_time;
+    msg->dts = frag_length;
+    msg->first_pts = segment_time;
+    msg->buffer_size = stream->file_sequence_number;
+    msg->splice_duration = stream->media_sequence_number;
+    put_mux_job(core, stream, msg);
+
+    return 0;
+}
+
+static void reset_mp4_fragment(fillet_app_struct *core, stream_struct *stream)
 {
-    struct stat sb;
-
-    if (!stream->output_fmp4_file) {
-        char stream_name[MAX_STREAM_NAME];
-        char local_dir[MAX_STREAM_NAME];
-        if (video) {
-            snprintf(local_dir, MAX_STREAM_NAME-1, "%s/video%d", core->cd->manifest_directory, source);
-        } else {
-            snprintf(local_dir, MAX_STREAM_NAME-1, "%s/audio%d_substream%d", core->cd->manifest_directory, source, sub_stream);
+    if (!fmp4_on_worker(core)) {
+        if (stream->output_fmp4_file) {
+            fclose(stream->output_fmp4_file);
+            stream->output_fmp4_file = NULL;
         }
-        if (stat(local_dir, &sb) == 0 && S_ISDIR(sb.st_mode)) {
-            fprintf(stderr,"STATUS: fMP4 manifest directory exists: %s\n", local_dir);
-        } else {
-            fprintf(stderr,"STATUS: fMP4 manifest directory does not exist: %s (CREATING)\n", local_dir);
-            mkdir(local_dir, 0700);
-            fprintf(stderr,"STATUS: Done creating fMP4 manifest directory\n");
+        if (stream->fmp4) {
+            fmp4_file_finalize(stream->fmp4);
+            stream->fmp4 = NULL;
         }
-
-        snprintf(stream_name, MAX_STREAM_NAME-1, "%s/segment%ld.mp4", local_dir, stream->file_sequence_number);
-        stream->output_fmp4_file = fopen(stream_name,"w");
+        return;
     }
-    return 0;
+    if (stream->fmp4_segment_open) {
+        dataqueue_message_struct *msg = (dataqueue_message_struct*)stream->fmp4_close_msg;
+
+        stream->fmp4_close_msg = NULL;
+        stream->fmp4_segment_open = 0;
+        fill_mux_job(msg, MUX_JOB_FMP4_RESET, NULL, NULL, 0);
+        put_mux_job(core, stream, msg);
+    } else if (stream->fmp4_handed_over) {
+        // if this cannot go out the worker drops its handle when the next open hands over a new one
+        post_mux_job(core, stream, MUX_JOB_FMP4_RESET, NULL, NULL, 0);
+    } else if (stream->fmp4) {
+        fmp4_file_finalize(stream->fmp4);
+    }
+    stream->fmp4 = NULL;
+    stream->fmp4_handed_over = 0;
 }
 
-static int end_mp4_fragment(fillet_app_struct *core, stream_struct *stream, int source, int sub_stream, int video, int64_t segment_time)
+static void add_mp4_video_frame(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame)
 {
-    if (stream->output_fmp4_file) {
-        fclose(stream->output_fmp4_file);
-        stream->output_fmp4_file = NULL;
-        {
-            char stream_name[MAX_STREAM_NAME];
-            char stream_name_link[MAX_STREAM_NAME];
-            char local_dir[MAX_STREAM_NAME];
-            if (video) {
-                snprintf(local_dir, MAX_STREAM_NAME-1, "%s/video%d", core->cd->manifest_directory, source);
-            } else {
-                snprintf(local_dir, MAX_STREAM_NAME-1, "%s/audio%d_substream%d", core->cd->manifest_directory, source, sub_stream);
-            }
-            snprintf(stream_name, MAX_STREAM_NAME-1, "%s/segment%ld.mp4", local_dir, stream->file_sequence_number);
-            snprintf(stream_name_link, MAX_STREAM_NAME-1, "%s/segment%ld.mp4", local_dir, segment_time); //stream->media_sequence_number);
-            syslog(LOG_INFO,"HLSMUX: WRITING OUT %s (%s)\n", stream_name_link, stream_name);
-            symlink(stream_name, stream_name_link);
-            send_signal(core, SIGNAL_SEGMENT_WRITTEN, stream_name_link);
+    int64_t fragment_timestamp;
+    int fragment_duration;
+    int64_t fragment_composition_time;
+
+    if (frame->dts > 0) {
+        //placeholder: check for overflow issue when one goes back to zero
+        fragment_composition_time = frame->pts - frame->dts;
+        fragment_timestamp = frame->dts;
+    } else {
+        fragment_composition_time = 0;
+        fragment_timestamp = frame->pts;
+    }
 
-            /*
-            if ((strlen(core->cd->cdn_server) > 0) && (strlen(core->cd->cdn_username) > 0) && (strlen(core->cd->cdn_password) > 0)) {
-                dataqueue_message_struct *msg;
-                //this is also done in the start_end_fragment
-                //send message to webdav thread for upload
-                //base url is: core->cd->cdn_server        - it doesn't need to match the manifest directory tag since it can be uploaded anywhere and we are keeping the
-                //                                           manifest in the same directory as the transport files right now. this could be changed, to accommodate archival
-                //                                           but for now we'll keep it simple and straightforward to setup
-                msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
-                if (msg) {
-                    snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", stream_name); // this is the directory on the local server which is what we want
-                    msg->buffer = NULL;
-                    msg->buffer_type = WEBDAV_UPLOAD;
+    fragment_duration = frame->duration;
 
-                    dataqueue_put_front(core->webdav_queue, msg);
-                } else {
-                    fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                            core->session_id);
-                    exit(0);
-                }
-            }// end checking for cdn availability
-            */
+    if (fmp4_on_worker(core)) {
+        if (stream->fmp4_segment_open) {
+            post_mp4_frame(core, stream, frame, fragment_timestamp, fragment_composition_time, fragment_duration, 0, 0);
         }
+        return;
+    }
+    if (stream->output_fmp4_file != NULL && stream->fmp4) {
+        /*syslog(LOG_INFO,"HLSMUX: ADDING VIDEO FRAGMENT:%d OFFSET:%d  DURATION:%ld CTS:%ld\n",
+               stream->fmp4->fragment_count,
+               stream->fmp4->buffer_offset,
+               fragment_duration,
+               fragment_composition_time);*/
+
+        fmp4_video_fragment_add(stream->fmp4,
+                                frame->buffer,
+                                frame->buffer_size,
+                                core->compressed_video_pool,
+                                fragment_timestamp,
+                                fragment_duration,
+                                fragment_composition_time,
+                                &frame->nal_index);
     }
-
-    return 0;
 }
 
-static int start_webvtt_fragment(fillet_app_struct *core, stream_struct *stream, int source)
+static void add_mp4_audio_frame(fillet_app_struct *core, stream_struct *stream, sorted_frame_struct *frame, audio_stream_struct *astream)
 {
-    struct stat sb;
-    if (!stream->output_webvtt_file) {
-        char stream_name[MAX_STREAM_NAME];
-        char local_dir[MAX_STREAM_NAME];
+    int64_t fragment_timestamp = frame->pts;
+    int fragment_duration = frame->duration * astream->audio_samplerate / (double)AUDIO_CLOCK;
+    int add_silence = 0;
 
-        snprintf(local_dir, MAX_STREAM_NAME-1, "%s/webvtt%d", core->cd->manifest_directory, source);
+    if (fmp4_on_worker(core)) {
+        if (!stream->fmp4_segment_open) {
+            return;
+        }
+    } else if (stream->output_fmp4_file == NULL || !stream->fmp4) {
+        return;
+    }
 
-        if (stat(local_dir, &sb) == 0 && S_ISDIR(sb.st_mode)) {
-            fprintf(stderr,"STATUS: fMP4 manifest directory exists: %s\n", local_dir);
-        } else {
-            fprintf(stderr,"STATUS: fMP4 manifest directory does not exist: %s (CREATING)\n", local_dir);
-            mkdir(local_dir, 0700);
-            fprintf(stderr,"STATUS: Done creating fMP4 manifest directory\n");
+    if (astream->audio_object_type == 5) { // sbr
+        fragment_duration = fragment_duration << 1;
+    }
+
+    if (frame->media_type == MEDIA_TYPE_AAC) {
+        if (astream->audio_samples_to_add > 0) {
+            astream->audio_samples_to_add--;
+            add_silence = 1;
         }
+    } else {
+        //placeholder for adding ac3 audio silence samples 2/6 channel
+    }
 
-        snprintf(stream_name, MAX_STREAM_NAME-1, "%s/segment%ld.vtt", local_dir, stream->file_sequence_number);
-        stream->output_webvtt_file = fopen(stream_name,"w");
+    if (fmp4_on_worker(core)) {
+        post_mp4_frame(core, stream, frame, fragment_timestamp, 0, fragment_duration,
+                       add_silence ? MUX_JOB_ADD_SILENCE : 0, astream->audio_channels);
+        return;
     }
-    return 0;
+
+    if (add_silence) {
+        add_mp4_silence(stream->fmp4, astream->audio_channels, fragment_timestamp, fragment_duration);
+    }
+    /*fprintf(stderr,"\n\nMP4 AUDIO FRAGMENT ADD: SIZE:%d TIMESTAMP:%ld DURATION:%d\n\n",
+            frame->buffer_size,
+            fragment_timestamp,
+            fragment_duration);
+    */
+    fmp4_audio_fragment_add(stream->fmp4,
+                            frame->buffer,
+                            frame->buffer_size,
+                            core->compressed_audio_pool,
+                            fragment_timestamp,
+                            fragment_duration);
 }
 
-static int end_webvtt_fragment(fillet_app_struct *core, stream_struct *stream, int source, int64_t segment_time)
+// the captions follow the segment out of the worker, text is copied
+static void publish_webvtt_segment(fillet_app_struct *core, stream_struct *stream, int source, int64_t segment_time, const char *text)
 {
-    if (stream->output_webvtt_file) {
-        fclose(stream->output_webvtt_file);
-        stream->output_webvtt_file = NULL;
-        {
-            char stream_name[MAX_STREAM_NAME];
-            char stream_name_link[MAX_STREAM_NAME];
-            char local_dir[MAX_STREAM_NAME];
-            snprintf(local_dir, MAX_STREAM_NAME-1, "%s/webvtt%d", core->cd->manifest_directory, source);
-            snprintf(stream_name, MAX_STREAM_NAME-1, "%s/segment%ld.vtt", local_dir, stream->file_sequence_number);
-            snprintf(stream_name_link, MAX_STREAM_NAME-1, "%s/segment%ld.vtt", local_dir, segment_time);
-            syslog(LOG_INFO,"HLSMUX: WRITING OUT %s (%s)\n", stream_name_link, stream_name);
-            symlink(stream_name, stream_name_link);
+    if (fmp4_on_worker(core)) {
+        char *textcopy = strdup(text);
+        dataqueue_message_struct *msg = NULL;
+
+        if (textcopy) {
+            msg = new_mux_job(core, stream, MUX_JOB_WEBVTT, NULL, textcopy, 0);
+        }
+        if (msg) {
+            msg->pts = segment_time;
+            msg->buffer_size = stream->file_sequence_number;
+            put_mux_job(core, stream, msg);
+            return;
         }
+        free(textcopy);
     }
-    return 0;
+    write_webvtt_segment(core, source, stream->file_sequence_number, segment_time, text);
 }
 
 static int update_ts_video_manifest(fillet_app_struct *core, stream_struct *stream, int source, int discontinuity, source_context_struct *sdata)
 {
     FILE *video_manifest;
+    char *playlist = NULL;
+    size_t playlist_size = 0;
     char stream_name[MAX_STREAM_NAME];
     int i;
     int64_t starting_file_sequence_number;
@@ -1262,7 +1943,12 @@ static int update_ts_video_manifest(fillet_app_struct *core, stream_struct *stre
     starting_media_sequence_number = stream->media_sequence_number - core->cd->window_size;
 
     snprintf(stream_name, MAX_STREAM_NAME-1, "%s/video%d.m3u8", core->cd->manifest_directory, source);
-    video_manifest = fopen(stream_name,"w");
+    // rendered here and written by the stream's worker once the segment it lists is out
+    video_manifest = open_memstream(&playlist, &playlist_size);
+    if (!video_manifest) {
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO RENDER PLAYLIST %s\n", stream_name);
+        return -1;
+    }
 
     fprintf(video_manifest,"#EXTM3U\n");
     fprintf(video_manifest,"#EXT-X-VERSION:3\n");
@@ -1281,6 +1967,8 @@ static int update_ts_video_manifest(fillet_app_struct *core, stream_struct *stre
         } else if (sdata->discontinuity[next_sequence_number] == 3) {
             fprintf(video_manifest,"#EXT-X-DISCONTINUITY\n");
             fprintf(video_manifest,"#EXT-X-CUE-IN\n");
+        } else if (stream->segment_discontinuity[next_sequence_number]) {
+            fprintf(video_manifest,"#EXT-X-DISCONTINUITY\n");
         }
 
         fprintf(video_manifest,"#EXTINF:%.2f,\n", (float)sdata->segment_lengths_video[next_sequence_number]);
@@ -1289,22 +1977,7 @@ static int update_ts_video_manifest(fillet_app_struct *core, stream_struct *stre
 
     fclose(video_manifest);
 
-    send_signal(core, SIGNAL_MANIFEST_WRITTEN, stream_name);
-
-    if ((strlen(core->cd->cdn_server) > 0) && (strlen(core->cd->cdn_username) > 0) && (strlen(core->cd->cdn_password) > 0)) {
-        dataqueue_message_struct *msg;
-        msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
-        if (msg) {
-            snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", stream_name); // this is the directory on the local server which is what we want
-            msg->buffer = NULL;
-            msg->buffer_type = WEBDAV_UPLOAD;
-            dataqueue_put_front(core->webdav_queue, msg);
-        } else {
-            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            exit(0);
-        }
-    }// end checking for cdn availability
+    publish_playlist(core, stream, stream_name, playlist, MUX_JOB_UPLOAD);
 
     return 0;
 }
@@ -1312,6 +1985,8 @@ static int update_ts_video_manifest(fillet_app_struct *core, stream_struct *stre
 static int update_ts_audio_manifest(fillet_app_struct *core, stream_struct *stream, int source, int sub_stream, int discontinuity, source_context_struct *sdata)
 {
     FILE *audio_manifest;
+    char *playlist = NULL;
+    size_t playlist_size = 0;
     char stream_name[MAX_STREAM_NAME];
     int i;
     int64_t starting_file_sequence_number;
@@ -1324,7 +1999,12 @@ static int update_ts_audio_manifest(fillet_app_struct *core, stream_struct *stre
     starting_media_sequence_number = stream->media_sequence_number - core->cd->window_size;
 
     snprintf(stream_name, MAX_STREAM_NAME-1, "%s/audio%d_substream%d.m3u8", core->cd->manifest_directory, source, sub_stream);
-    audio_manifest = fopen(stream_name,"w");
+    // rendered here and written by the stream's worker once the segment it lists is out
+    audio_manifest = open_memstream(&playlist, &playlist_size);
+    if (!audio_manifest) {
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO RENDER PLAYLIST %s\n", stream_name);
+        return -1;
+    }
 
     fprintf(audio_manifest,"#EXTM3U\n");
     fprintf(audio_manifest,"#EXT-X-VERSION:3\n");
@@ -1351,22 +2031,7 @@ static int update_ts_audio_manifest(fillet_app_struct *core, stream_struct *stre
 
     fclose(audio_manifest);
 
-    send_signal(core, SIGNAL_MANIFEST_WRITTEN, stream_name);
-
-    if ((strlen(core->cd->cdn_server) > 0) && (strlen(core->cd->cdn_username) > 0) && (strlen(core->cd->cdn_password) > 0)) {
-        dataqueue_message_struct *msg;
-        msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
-        if (msg) {
-            snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", stream_name); // this is the directory on the local server which is what we want
-            msg->buffer = NULL;
-            msg->buffer_type = WEBDAV_UPLOAD;
-            dataqueue_put_front(core->webdav_queue, msg);
-        } else {
-            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            exit(0);
-        }
-    }// end checking for cdn availability
+    publish_playlist(core, stream, stream_name, playlist, MUX_JOB_UPLOAD);
 
     return 0;
 }
@@ -1378,10 +2043,13 @@ static int write_ts_master_manifest(fillet_app_struct *core, source_context_stru
     FILE *master_manifest;
     source_context_struct *lsdata;
     source_context_struct *origsdata;
+    hlsmux_struct *hlsmux = (hlsmux_struct*)core->hlsmux;
     int i;
     int j;
     int num_sources = core->num_sources;
     int create_dir = 0;
+    int audio_group = 0;
+    char audio_codec[MAX_STR_SIZE];
 
 #if defined(ENABLE_TRANSCODE)
     if (core->transcode_enabled) {
@@ -1413,11 +2081,36 @@ static int write_ts_master_manifest(fillet_app_struct *core, source_context_stru
 
     fprintf(master_manifest,"#EXTM3U\n");
 
+    // muxed ts only needs the audio group when there are alternate languages next to the default one
+    for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
+        if (sdata->start_time_audio[j] != -1 && !is_muxed_audio(core, 0, j)) {
+            audio_group = 1;
+        }
+    }
+    audio_codec[0] = 0;
+    if (core->cd->enable_muxed_ts) {
+        if (hlsmux->muxed_audio_codec_type == CODEC_AAC) {
+            snprintf(audio_codec, MAX_STR_SIZE-1, ",mp4a.40.2");
+        } else if (hlsmux->muxed_audio_codec_type == CODEC_AC3) {
+            snprintf(audio_codec, MAX_STR_SIZE-1, ",ac-3");
+        }
+    } else {
+        audio_group = 1;
+    }
+
     for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
         lsdata = sdata;
-        if (lsdata->start_time_audio[j] != -1) {
+        if (lsdata->start_time_audio[j] != -1 && audio_group) {
             //audio_stream_struct *astream = (audio_stream_struct*)core->source_stream[0].audio_stream[j];
             char yesno[4];
+            char uri[MAX_STR_SIZE];
+
+            // a rendition without a uri is the audio already carried in the video segments
+            if (is_muxed_audio(core, 0, j)) {
+                uri[0] = 0;
+            } else {
+                snprintf(uri, MAX_STR_SIZE-1, ",URI=\"audio0_substream%d.m3u8\"", j);
+            }
 
             // make the first audio stream the default/autoselect
             if (j == 0) {
@@ -1427,15 +2120,15 @@ static int write_ts_master_manifest(fillet_app_struct *core, source_context_stru
             }
 
             if (strlen(sdata->lang_tag) > 0) {
-                fprintf(master_manifest,"#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",LANGUAGE=\"%s\",NAME=\"%s\",AUTOSELECT=%s,DEFAULT=%s,URI=\"audio0_substream%d.m3u8\"\n",
+                fprintf(master_manifest,"#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",LANGUAGE=\"%s\",NAME=\"%s\",AUTOSELECT=%s,DEFAULT=%s%s\n",
                         sdata->lang_tag,
                         sdata->lang_tag,
                         yesno, yesno,
-                        j);
+                        uri);
             } else {
-                fprintf(master_manifest,"#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",LANGUAGE=\"eng\",NAME=\"eng\",AUTOSELECT=%s,DEFAULT=%s,URI=\"audio0_substream%d.m3u8\"\n",
+                fprintf(master_manifest,"#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",LANGUAGE=\"eng\",NAME=\"eng\",AUTOSELECT=%s,DEFAULT=%s%s\n",
                         yesno, yesno,
-                        j);
+                        uri);
             }
         }
         lsdata++;
@@ -1456,12 +2149,14 @@ static int write_ts_master_manifest(fillet_app_struct *core, source_context_stru
         video_bitrate = vstream->video_bitrate;
 #endif
 
-        fprintf(master_manifest,"#EXT-X-STREAM-INF:PROGRAM-ID=1,BANDWIDTH=%d,CODECS=\"avc1.%2x%02x%02x\",RESOLUTION=%dx%d,AUDIO=\"audio\"\n",
+        fprintf(master_manifest,"#EXT-X-STREAM-INF:PROGRAM-ID=1,BANDWIDTH=%d,CODECS=\"avc1.%2x%02x%02x%s\",RESOLUTION=%dx%d%s\n",
                 video_bitrate,
                 sdata->h264_profile, //hex
                 sdata->midbyte,
                 sdata->h264_level,
-                sdata->width, sdata->height);
+                audio_codec,
+                sdata->width, sdata->height,
+                audio_group ? ",AUDIO=\"audio\"" : "");
         fprintf(master_manifest,"video%d.m3u8\n", i);
         sdata++;
     }
@@ -1508,9 +2203,7 @@ static int write_ts_master_manifest(fillet_app_struct *core, source_context_stru
                 msg->buffer_type = WEBDAV_CREATE; //we will create the cdn_server directory
                 dataqueue_put_front(core->webdav_queue, msg);
             } else {
-                fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                        core->session_id);
-                exit(0);
+                backpressure_count(core->backpressure, BACKPRESSURE_UPLOAD_SKIPPED);
             }
         }
         msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
@@ -1520,9 +2213,7 @@ static int write_ts_master_manifest(fillet_app_struct *core, source_context_stru
             msg->buffer_type = WEBDAV_UPLOAD;
             dataqueue_put_front(core->webdav_queue, msg);
         } else {
-            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            exit(0);
+            backpressure_count(core->backpressure, BACKPRESSURE_UPLOAD_SKIPPED);
         }
     }// end checking for cdn availability
 
@@ -1532,6 +2223,8 @@ static int write_ts_master_manifest(fillet_app_struct *core, source_context_stru
 static int update_mp4_video_manifest(fillet_app_struct *core, stream_struct *stream, int source, int discontinuity, source_context_struct *sdata)
 {
     FILE *video_manifest;
+    char *playlist = NULL;
+    size_t playlist_size = 0;
     char stream_name[MAX_STREAM_NAME];
     int i;
     int64_t starting_file_sequence_number;
@@ -1544,7 +2237,12 @@ static int update_mp4_video_manifest(fillet_app_struct *core, stream_struct *str
     starting_media_sequence_number = stream->media_sequence_number - core->cd->window_size;
 
     snprintf(stream_name, MAX_STREAM_NAME-1, "%s/video%dfmp4.m3u8", core->cd->manifest_directory, source);
-    video_manifest = fopen(stream_name,"w");
+    // rendered here and written by the stream's worker once the segment it lists is out
+    video_manifest = open_memstream(&playlist, &playlist_size);
+    if (!video_manifest) {
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO RENDER PLAYLIST %s\n", stream_name);
+        return -1;
+    }
 
     fprintf(video_manifest,"#EXTM3U\n");
     fprintf(video_manifest,"#EXT-X-VERSION:6\n");
@@ -1557,7 +2255,7 @@ static int update_mp4_video_manifest(fillet_app_struct *core, stream_struct *str
         int64_t next_sequence_number;
 
         next_sequence_number = (starting_file_sequence_number + i) % core->cd->rollover_size;
-        if (sdata->discontinuity[next_sequence_number]) {
+        if (sdata->discontinuity[next_sequence_number] || stream->segment_discontinuity[next_sequence_number]) {
             fprintf(video_manifest,"#EXT-X-DISCONTINUITY\n");
         }
         fprintf(video_manifest,"#EXTINF:%.2f,\n", (float)sdata->segment_lengths_video[next_sequence_number]);
@@ -1566,7 +2264,7 @@ static int update_mp4_video_manifest(fillet_app_struct *core, stream_struct *str
 
     fclose(video_manifest);
 
-    send_signal(core, SIGNAL_MANIFEST_WRITTEN, stream_name);
+    publish_playlist(core, stream, stream_name, playlist, 0);
 
     return 0;
 }
@@ -1574,6 +2272,8 @@ static int update_mp4_video_manifest(fillet_app_struct *core, stream_struct *str
 static int update_mp4_audio_manifest(fillet_app_struct *core, stream_struct *stream, int source, int sub_stream, int discontinuity, source_context_struct *sdata)
 {
     FILE *audio_manifest;
+    char *playlist = NULL;
+    size_t playlist_size = 0;
     char stream_name[MAX_STREAM_NAME];
     int i;
     int64_t starting_file_sequence_number;
@@ -1586,7 +2286,12 @@ static int update_mp4_audio_manifest(fillet_app_struct *core, stream_struct *str
     starting_media_sequence_number = stream->media_sequence_number - core->cd->window_size;
 
     snprintf(stream_name, MAX_STREAM_NAME-1, "%s/audio%d_substream%d_fmp4.m3u8", core->cd->manifest_directory, source, sub_stream);
-    audio_manifest = fopen(stream_name,"w");
+    // rendered here and written by the stream's worker once the segment it lists is out
+    audio_manifest = open_memstream(&playlist, &playlist_size);
+    if (!audio_manifest) {
+        syslog(LOG_ERR,"HLSMUX: UNABLE TO RENDER PLAYLIST %s\n", stream_name);
+        return -1;
+    }
 
     fprintf(audio_manifest,"#EXTM3U\n");
     fprintf(audio_manifest,"#EXT-X-VERSION:6\n");
@@ -1607,7 +2312,7 @@ static int update_mp4_audio_manifest(fillet_app_struct *core, stream_struct *str
 
     fclose(audio_manifest);
 
-    send_signal(core, SIGNAL_MANIFEST_WRITTEN, stream_name);
+    publish_playlist(core, stream, stream_name, playlist, 0);
 
     return 0;
 }
@@ -2208,34 +2913,26 @@ static int end_ts_fragment(fillet_app_struct *core, stream_struct *stream, int s
         snprintf(stream_name, MAX_STREAM_NAME-1, "%s/audio_stream%d_substream_%d_%ld.ts", core->cd->manifest_directory, source, sub_stream, stream->file_sequence_number);
     }
 
-    if (stream->output_ts_file) {
-        fclose(stream->output_ts_file);
-        stream->output_ts_file = NULL;
+    if (stream->ts_segment_open) {
+        stream->ts_segment_open = 0;
         stream->fragments_published++;
+        // the worker closes the segment behind its last frame, then signals and uploads it
+        snprintf(stream->ts_close_pending, MAX_STR_SIZE-1, "%s", stream_name);
+        if (retry_ts_close(core, stream) < 0) {
+            syslog(LOG_ERR,"HLSMUX: UNABLE TO CLOSE %s, RETRYING BEFORE THE NEXT SEGMENT\n", stream_name);
+        }
+        return 0;
+    }
+    if (retry_ts_close(core, stream) == 0 &&
+        post_mux_job(core, stream, MUX_JOB_CLOSE, stream_name, NULL, 0) == 0) {
+        return 0;
     }
     send_signal(core, SIGNAL_SEGMENT_WRITTEN, stream_name);
-
-    if ((strlen(core->cd->cdn_server) > 0) && (strlen(core->cd->cdn_username) > 0) && (strlen(core->cd->cdn_password) > 0)) {
-        dataqueue_message_struct *msg;
-        //this is also done in the start_ts_fragment
-        //send message to webdav thread for upload
-        //base url is: core->cd->cdn_server        - it doesn't need to match the manifest directory tag since it can be uploaded anywhere and we are keeping the
-        //                                           manifest in the same directory as the transport files right now. this could be changed, to accommodate archival
-        //                                           but for now we'll keep it simple and straightforward to setup
-
-        msg = (dataqueue_message_struct*)memory_take(core->fillet_msg_pool, sizeof(dataqueue_message_struct));
-        if (msg) {
-            snprintf(msg->smallbuf, MAX_SMALLBUF_SIZE-1, "%s", stream_name); // this is the directory on the local server which is what we want
-            msg->buffer = NULL;
-            msg->buffer_type = WEBDAV_UPLOAD;
-
-            dataqueue_put_front(core->webdav_queue, msg);
-        } else {
-            fprintf(stderr,"SESSION:%d (MAIN) ERROR: unable to obtain message! CHECK CPU RESOURCES!!! UNRECOVERABLE ERROR!!!\n",
-                    core->session_id);
-            exit(0);
-        }
-    }// end checking for cdn availability
+    //send message to webdav thread for upload
+    //base url is: core->cd->cdn_server        - it doesn't need to match the manifest directory tag since it can be uploaded anywhere and we are keeping the
+    //                                           manifest in the same directory as the transport files right now. this could be changed, to accommodate archival
+    //                                           but for now we'll keep it simple and straightforward to setup
+    upload_file(core, stream_name);
 
     return 0;
 }
@@ -2307,13 +3004,21 @@ void *mux_pump_thread(void *context)
     for (i = 0; i < MAX_VIDEO_SOURCES; i++) {
         int j;
 
-        hlsmux->video[i].muxbuffer = (uint8_t*)malloc(MAX_VIDEO_MUX_BUFFER);
-        hlsmux->video[i].pesbuffer = (uint8_t*)malloc(MAX_VIDEO_PES_BUFFER);
-        hlsmux->video[i].packettable = (packet_struct*)malloc(sizeof(packet_struct)*(MAX_VIDEO_MUX_BUFFER/188));
+        hlsmux->video[i].muxbuffer = NULL;
+        hlsmux->video[i].muxiov = NULL;
+        hlsmux->video[i].mux_packets = 0;
         hlsmux->video[i].packet_count = 0;
-        hlsmux->video[i].output_ts_file = NULL;
+        hlsmux->video[i].output_ts_writer = NULL;
+        hlsmux->video[i].mux_worker = NULL;
+        hlsmux->video[i].ts_segment_open = 0;
+        hlsmux->video[i].ts_close_pending[0] = 0;
+        hlsmux->video[i].ts_reset_pending = 0;
+        hlsmux->video[i].rendition_discontinuity = 0;
+        memset(hlsmux->video[i].segment_discontinuity, 0, sizeof(hlsmux->video[i].segment_discontinuity));
         hlsmux->video[i].output_fmp4_file = NULL;
-        hlsmux->video[i].output_webvtt_file = NULL;
+        hlsmux->video[i].fmp4_segment_open = 0;
+        hlsmux->video[i].fmp4_close_msg = NULL;
+        hlsmux->video[i].fmp4_handed_over = 0;
         hlsmux->video[i].file_sequence_number = 0;
         hlsmux->video[i].media_sequence_number = 0;
         hlsmux->video[i].fragments_published = 0;
@@ -2329,12 +3034,19 @@ void *mux_pump_thread(void *context)
         }
 
         for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
-            hlsmux->audio[i][j].muxbuffer = (uint8_t*)malloc(MAX_VIDEO_MUX_BUFFER);
-            hlsmux->audio[i][j].pesbuffer = (uint8_t*)malloc(MAX_VIDEO_PES_BUFFER);
-            hlsmux->audio[i][j].packettable = (packet_struct*)malloc(sizeof(packet_struct)*(MAX_VIDEO_MUX_BUFFER/188));
+            hlsmux->audio[i][j].muxbuffer = NULL;
+            hlsmux->audio[i][j].muxiov = NULL;
+            hlsmux->audio[i][j].mux_packets = 0;
             hlsmux->audio[i][j].packet_count = 0;
-            hlsmux->audio[i][j].output_ts_file = NULL;
+            hlsmux->audio[i][j].output_ts_writer = NULL;
+            hlsmux->audio[i][j].mux_worker = NULL;
+            hlsmux->audio[i][j].ts_segment_open = 0;
+            hlsmux->audio[i][j].ts_close_pending[0] = 0;
+            hlsmux->audio[i][j].ts_reset_pending = 0;
             hlsmux->audio[i][j].output_fmp4_file = NULL;
+            hlsmux->audio[i][j].fmp4_segment_open = 0;
+            hlsmux->audio[i][j].fmp4_close_msg = NULL;
+            hlsmux->audio[i][j].fmp4_handed_over = 0;
             hlsmux->audio[i][j].fmp4 = NULL;
             hlsmux->audio[i][j].file_sequence_number = 0;
             hlsmux->audio[i][j].media_sequence_number = 0;
@@ -2345,12 +3057,11 @@ void *mux_pump_thread(void *context)
     }
 
     while (1) {
-        msg = dataqueue_take_back(hlsmux->input_queue);
+        msg = dataqueue_take_back_wait(hlsmux->input_queue, QUEUE_WAIT_TIMEOUT);
         if (!msg) {
             if (quit_mux_pump_thread) {
                 goto cleanup_mux_pump_thread;
             }
-            usleep(1000);
             continue;
         }
 
@@ -2429,43 +3140,15 @@ void *mux_pump_thread(void *context)
                 int j;
 
                 if (core->cd->enable_ts_output) {
-                    hlsmux->video[i].packet_count = 0;
-                    if (hlsmux->video[i].output_ts_file) {
-                        fclose(hlsmux->video[i].output_ts_file);
-                        hlsmux->video[i].output_ts_file = NULL;
-                    }
+                    reset_ts_fragment(core, &hlsmux->video[i]);
                     for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
-                        hlsmux->audio[i][j].packet_count = 0;
-                        if (hlsmux->audio[i][j].output_ts_file) {
-                            fclose(hlsmux->audio[i][j].output_ts_file);
-                            hlsmux->audio[i][j].output_ts_file = NULL;
-                        }
+                        reset_ts_fragment(core, &hlsmux->audio[i][j]);
                     }
                 }
                 if (core->cd->enable_fmp4_output) {
-                    if (hlsmux->video[i].output_fmp4_file) {
-                        fclose(hlsmux->video[i].output_fmp4_file);
-                        hlsmux->video[i].output_fmp4_file = NULL;
-                    }
-                    if (i == 0) {
-                        if (hlsmux->video[i].output_webvtt_file) {
-                            fclose(hlsmux->video[i].output_webvtt_file);
-                            hlsmux->video[i].output_webvtt_file = NULL;
-                        }
-                    }
-                    if (hlsmux->video[i].fmp4) {
-                        fmp4_file_finalize(hlsmux->video[i].fmp4);
-                        hlsmux->video[i].fmp4 = NULL;
-                    }
+                    reset_mp4_fragment(core, &hlsmux->video[i]);
                     for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
-                        if (hlsmux->audio[i][j].output_fmp4_file) {
-                            fclose(hlsmux->audio[i][j].output_fmp4_file);
-                            hlsmux->audio[i][j].output_fmp4_file = NULL;
-                        }
-                        if (hlsmux->audio[i][j].fmp4) {
-                            fmp4_file_finalize(hlsmux->audio[i][j].fmp4);
-                            hlsmux->audio[i][j].fmp4 = NULL;
-                        }
+                        reset_mp4_fragment(core, &hlsmux->audio[i][j]);
                     }
                 }
 
@@ -2494,170 +3177,171 @@ void *mux_pump_thread(void *context)
         if (frame->frame_type == FRAME_TYPE_VIDEO && core->cd->enable_webvtt) {
             if (frame->media_type == MEDIA_TYPE_H264 && frame->source == 0) {
                 // grab the sei caption message
-                int sp;
+                int n;
                 uint8_t *buffer;
 
                 buffer = frame->buffer;
-                for (sp = 0; sp < frame->buffer_size - 3; sp++) {
-                    if (buffer[sp] == 0x00 &&
-                        buffer[sp+1] == 0x00 &&
-                        buffer[sp+2] == 0x01) {
-                        int nal = buffer[sp+3] & 0x1f;
-                        int sei = buffer[sp+4];
-                        if (nal == 0x06 && sei == 4) {
-                            if (buffer[sp+ 6] == 0xb5 && buffer[sp+ 7] == 0x00 &&
-                                buffer[sp+ 8] == 0x31 && buffer[sp+ 9] == 0x47 &&
-                                buffer[sp+10] == 0x41 && buffer[sp+11] == 0x39 &&
-                                buffer[sp+12] == 0x34) {
-
-                                int read_idx = 3;
-                                uint8_t *cbuf = (uint8_t*)&buffer[sp+13];
-                                int caption_count;
-                                int current_idx;
-
-                                caption_count = (*(cbuf+1) & 0x1f);
-                                fprintf(stderr,"captions:%d\n", caption_count);
-
-                                for (current_idx = 0; current_idx < caption_count; current_idx++) {
-                                    uint8_t cc1 = *(cbuf+read_idx+1) & 0x7f;
-                                    uint8_t cc2 = *(cbuf+read_idx+2) & 0x7f;
-
-                                    int cckind = *(cbuf+read_idx) & 0x03;
-                                    int isactive = *(cbuf+read_idx) & 0x04;
-                                    int xds = (((cc1 & 0x70) == 0x00) & ((cc2 & 0x70) == 0x00));
-                                    int tab = (((cc1 & 0x77) == 0x17) & ((cc2 & 0x7c) == 0x20));
-                                    int space = (((cc1 & 0x77) == 0x11) & ((cc2 & 0x70) == 0x20));
-                                    int other = (((cc1 & 0x77) == 0x11) & ((cc2 & 0x70) == 0x30));
-                                    int ctrlcc = (((cc1 & 0x76) == 0x14) & ((cc2 & 0x70) == 0x20));
-                                    int ctrl = ((cc1 & 0x70) == 0x10);
-
-                                    if (!isactive) {
-                                        break;
-                                    }
-                                    if (xds) {
-                                        break;
-                                    }
-                                    if (tab) {
-                                        read_idx += 3;
-                                        continue;
-                                    }
-                                    if (other) {
-                                        read_idx += 3;
-                                        continue;
-                                    }
-                                    if (space && cckind == 0) {
-                                        int caption_index = source_data[0].caption_index;
-                                        if (caption_index == 0) {
-                                            source_data[0].text_start_time = frame->full_time;
-                                        }
-                                        source_data[0].caption_text[caption_index++] = ' ';
-                                        source_data[0].caption_index = caption_index;
-                                        read_idx += 3;
-                                        continue;
+                for (n = 0; n < frame->nal_index.count; n++) {
+                    int hp = frame->nal_index.nal[n].offset;
+                    int nal = frame->nal_index.nal[n].type;
+                    int sei;
+                    if (nal != 0x06 || frame->nal_index.nal[n].size < 10) {
+                        continue;
+                    }
+                    sei = buffer[hp+1];
+                    if (sei == 4) {
+                        if (buffer[hp+3] == 0xb5 && buffer[hp+4] == 0x00 &&
+                            buffer[hp+5] == 0x31 && buffer[hp+6] == 0x47 &&
+                            buffer[hp+7] == 0x41 && buffer[hp+8] == 0x39 &&
+                            buffer[hp+9] == 0x34) {
+
+                            int read_idx = 3;
+                            uint8_t *cbuf = (uint8_t*)&buffer[hp+10];
+                            int caption_count;
+                            int current_idx;
+
+                            caption_count = (*(cbuf+1) & 0x1f);
+                            fprintf(stderr,"captions:%d\n", caption_count);
+
+                            for (current_idx = 0; current_idx < caption_count; current_idx++) {
+                                uint8_t cc1 = *(cbuf+read_idx+1) & 0x7f;
+                                uint8_t cc2 = *(cbuf+read_idx+2) & 0x7f;
+
+                                int cckind = *(cbuf+read_idx) & 0x03;
+                                int isactive = *(cbuf+read_idx) & 0x04;
+                                int xds = (((cc1 & 0x70) == 0x00) & ((cc2 & 0x70) == 0x00));
+                                int tab = (((cc1 & 0x77) == 0x17) & ((cc2 & 0x7c) == 0x20));
+                                int space = (((cc1 & 0x77) == 0x11) & ((cc2 & 0x70) == 0x20));
+                                int other = (((cc1 & 0x77) == 0x11) & ((cc2 & 0x70) == 0x30));
+                                int ctrlcc = (((cc1 & 0x76) == 0x14) & ((cc2 & 0x70) == 0x20));
+                                int ctrl = ((cc1 & 0x70) == 0x10);
+
+                                if (!isactive) {
+                                    break;
+                                }
+                                if (xds) {
+                                    break;
+                                }
+                                if (tab) {
+                                    read_idx += 3;
+                                    continue;
+                                }
+                                if (other) {
+                                    read_idx += 3;
+                                    continue;
+                                }
+                                if (space && cckind == 0) {
+                                    int caption_index = source_data[0].caption_index;
+                                    if (caption_index == 0) {
+                                        source_data[0].text_start_time = frame->full_time;
                                     }
-                                    if (ctrl) {
-                                        if (ctrlcc && !cckind) {
-                                            int cm = cc2 & 0x0f;
-                                            if (cm == 0) {
-                                            } else if (cm == 1) {
-                                            } else if (cm == 4) {
-                                            } else if (cm == 5) {
-                                                //fprintf(stderr,"rollup\n");
-                                                int caption_index = source_data[0].caption_index;
-                                                if (caption_index == 0) {
-                                                    source_data[0].text_start_time = frame->full_time;
-                                                }
-                                                source_data[0].caption_text[caption_index++] = '\n';
-                                                source_data[0].caption_index = caption_index;
-                                            } else if (cm == 6) {
-                                                //fprintf(stderr,"rollup\n");
-                                                int caption_index = source_data[0].caption_index;
-                                                if (caption_index == 0) {
-                                                    source_data[0].text_start_time = frame->full_time;
-                                                }
-                                                source_data[0].caption_text[caption_index++] = '\n';
-                                                source_data[0].caption_index = caption_index;
-                                            } else if (cm == 7) {
-                                                //fprintf(stderr,"rollup\n");
-                                                int caption_index = source_data[0].caption_index;
-                                                if (caption_index == 0) {
-                                                    source_data[0].text_start_time = frame->full_time;
-                                                }
-                                                source_data[0].caption_text[caption_index++] = '\n';
-                                                source_data[0].caption_index = caption_index;
-                                            } else if (cm == 13 || cm == 15) {
-                                                char temp_text[MAX_TEXT_SIZE];
-                                                if (cm == 13) {
-                                                    fprintf(stderr,"crlf\n");
-                                                } else if (cm == 15) {
-                                                    fprintf(stderr,"end!\n");
-                                                }
-                                                fprintf(stderr,"\n\n\ncaption: %s\n\n\n",
-                                                        source_data[0].caption_text);
-                                                syslog(LOG_INFO,"CAPTION:%s\n",
-                                                       source_data[0].caption_text);
-
-                                                double seconds_at_start = ((double)source_data[0].text_start_time - source_data[0].start_time_video) / (double)VIDEO_CLOCK;
-                                                double seconds_at_end = ((double)frame->full_time - (double)source_data[0].start_time_video) / (double)VIDEO_CLOCK;
-                                                int seconds_end;
-                                                int seconds_start;
-
-                                                seconds_end = (int)seconds_at_end % 60;
-                                                seconds_start = (int)seconds_at_start % 60;
-                                                if (seconds_end < 1) {
-                                                    seconds_end = 1;
-                                                }
-                                                if (seconds_start < 0) {
-                                                    seconds_start = 0;
-                                                }
-
-                                                snprintf(temp_text, MAX_TEXT_SIZE-1, "00:00:00:%02d.000 --> 00:00:00:%02d.000\n",
-                                                         seconds_start,
-                                                         seconds_end);
-                                                strncat(hlsmux->video[0].textbuffer,
-                                                        temp_text,
-                                                        MAX_TEXT_BUFFER-1);
-
-                                                snprintf(temp_text, MAX_TEXT_SIZE-1, "%s\n\n", source_data[0].caption_text);
-                                                strncat(hlsmux->video[0].textbuffer,
-                                                        temp_text,
-                                                        MAX_TEXT_BUFFER-1);
-
-                                                memset(source_data[0].caption_text,0,MAX_TEXT_SIZE);
-                                                source_data[0].caption_index = 0;
-                                            } else {
-                                                syslog(LOG_INFO,"unhandled caption control code: %d 0x%d\n",
-                                                       cm, cm);
+                                    source_data[0].caption_text[caption_index++] = ' ';
+                                    source_data[0].caption_index = caption_index;
+                                    read_idx += 3;
+                                    continue;
+                                }
+                                if (ctrl) {
+                                    if (ctrlcc && !cckind) {
+                                        int cm = cc2 & 0x0f;
+                                        if (cm == 0) {
+                                        } else if (cm == 1) {
+                                        } else if (cm == 4) {
+                                        } else if (cm == 5) {
+                                            //fprintf(stderr,"rollup\n");
+                                            int caption_index = source_data[0].caption_index;
+                                            if (caption_index == 0) {
+                                                source_data[0].text_start_time = frame->full_time;
+                                            }
+                                            source_data[0].caption_text[caption_index++] = '\n';
+                                            source_data[0].caption_index = caption_index;
+                                        } else if (cm == 6) {
+                                            //fprintf(stderr,"rollup\n");
+                                            int caption_index = source_data[0].caption_index;
+                                            if (caption_index == 0) {
+                                                source_data[0].text_start_time = frame->full_time;
+                                            }
+                                            source_data[0].caption_text[caption_index++] = '\n';
+                                            source_data[0].caption_index = caption_index;
+                                        } else if (cm == 7) {
+                                            //fprintf(stderr,"rollup\n");
+                                            int caption_index = source_data[0].caption_index;
+                                            if (caption_index == 0) {
+                                                source_data[0].text_start_time = frame->full_time;
                                             }
+                                            source_data[0].caption_text[caption_index++] = '\n';
+                                            source_data[0].caption_index = caption_index;
+                                        } else if (cm == 13 || cm == 15) {
+                                            char temp_text[MAX_TEXT_SIZE];
+                                            if (cm == 13) {
+                                                fprintf(stderr,"crlf\n");
+                                            } else if (cm == 15) {
+                                                fprintf(stderr,"end!\n");
+                                            }
+                                            fprintf(stderr,"\n\n\ncaption: %s\n\n\n",
+                                                    source_data[0].caption_text);
+                                            syslog(LOG_INFO,"CAPTION:%s\n",
+                                                   source_data[0].caption_text);
+
+                                            double seconds_at_start = ((double)source_data[0].text_start_time - source_data[0].start_time_video) / (double)VIDEO_CLOCK;
+                                            double seconds_at_end = ((double)frame->full_time - (double)source_data[0].start_time_video) / (double)VIDEO_CLOCK;
+                                            int seconds_end;
+                                            int seconds_start;
+
+                                            seconds_end = (int)seconds_at_end % 60;
+                                            seconds_start = (int)seconds_at_start % 60;
+                                            if (seconds_end < 1) {
+                                                seconds_end = 1;
+                                            }
+                                            if (seconds_start < 0) {
+                                                seconds_start = 0;
+                                            }
+
+                                            snprintf(temp_text, MAX_TEXT_SIZE-1, "00:00:00:%02d.000 --> 00:00:00:%02d.000\n",
+                                                     seconds_start,
+                                                     seconds_end);
+                                            strncat(hlsmux->video[0].textbuffer,
+                                                    temp_text,
+                                                    MAX_TEXT_BUFFER-1);
+
+                                            snprintf(temp_text, MAX_TEXT_SIZE-1, "%s\n\n", source_data[0].caption_text);
+                                            strncat(hlsmux->video[0].textbuffer,
+                                                    temp_text,
+                                                    MAX_TEXT_BUFFER-1);
+
+                                            memset(source_data[0].caption_text,0,MAX_TEXT_SIZE);
+                                            source_data[0].caption_index = 0;
+                                        } else {
+                                            syslog(LOG_INFO,"unhandled caption control code: %d 0x%d\n",
+                                                   cm, cm);
                                         }
-                                        read_idx += 3;
-                                        continue;
                                     }
-                                    if (cckind == 0) { // field=0
-                                        /*fprintf(stderr,"(caption:%d) chars: %c %c (0x%x 0x%x)   idx:%d  type:%d  active:%d\n",
-                                                current_idx, cc1, cc2,
-                                                cc1, cc2,
-                                                source_data[0].caption_index,
-                                                cckind,
-                                                isactive);*/
-                                        if (cc1 != 0x00 && cc2 != 0x00) {
-                                            if (cc1 > 31 && cc1 < 128 &&
-                                                cc2 > 31 && cc2 < 128) {
-                                                int caption_index = source_data[0].caption_index;
-                                                if (caption_index == 0) {
-                                                    source_data[0].text_start_time = frame->full_time;
-                                                }
-                                                source_data[0].caption_text[caption_index++] = cc1;
-                                                source_data[0].caption_text[caption_index++] = cc2;
-                                                source_data[0].caption_index = caption_index;
+                                    read_idx += 3;
+                                    continue;
+                                }
+                                if (cckind == 0) { // field=0
+                                    /*fprintf(stderr,"(caption:%d) chars: %c %c (0x%x 0x%x)   idx:%d  type:%d  active:%d\n",
+                                            current_idx, cc1, cc2,
+                                            cc1, cc2,
+                                            source_data[0].caption_index,
+                                            cckind,
+                                            isactive);*/
+                                    if (cc1 != 0x00 && cc2 != 0x00) {
+                                        if (cc1 > 31 && cc1 < 128 &&
+                                            cc2 > 31 && cc2 < 128) {
+                                            int caption_index = source_data[0].caption_index;
+                                            if (caption_index == 0) {
+                                                source_data[0].text_start_time = frame->full_time;
                                             }
+                                            source_data[0].caption_text[caption_index++] = cc1;
+                                            source_data[0].caption_text[caption_index++] = cc2;
+                                            source_data[0].caption_index = caption_index;
                                         }
-                                        fprintf(stderr,"(%d)  current:%s\n",
-                                                source_data[0].caption_index,
-                                                source_data[0].caption_text);
-                                        read_idx += 3;
-                                        continue;
                                     }
+                                    fprintf(stderr,"(%d)  current:%s\n",
+                                            source_data[0].caption_index,
+                                            source_data[0].caption_text);
+                                    read_idx += 3;
+                                    continue;
                                 }
                             }
                         }
@@ -2674,15 +3358,15 @@ void *mux_pump_thread(void *context)
 
             if (frame->media_type == MEDIA_TYPE_H264) {
                 if (!source_data[source].h264_sps_decoded) {
-                    find_and_decode_h264_sps(&source_data[source], frame->buffer, frame->buffer_size);
+                    find_and_decode_h264_sps(&source_data[source], frame);
                 }
 
                 if (source_data[source].h264_sps_size == 0) {
-                    get_h264_sps(&source_data[source], frame->buffer, frame->buffer_size);
+                    get_h264_sps(&source_data[source], frame);
                     syslog(LOG_INFO,"HLSMUX: SAVING H264 SPS: SIZE:%d\n", source_data[source].h264_sps_size);
                 }
                 if (source_data[source].h264_pps_size == 0) {
-                    get_h264_pps(&source_data[source], frame->buffer, frame->buffer_size);
+                    get_h264_pps(&source_data[source], frame);
                     syslog(LOG_INFO,"HLSMUX: SAVING H264 PPS: SIZE:%d\n", source_data[source].h264_pps_size);
                 }
 
@@ -2720,15 +3404,15 @@ void *mux_pump_thread(void *context)
                         source_data[source].hevc_pps_size,
                         source_data[source].hevc_vps_size);
                 if (source_data[source].hevc_sps_size == 0) {
-                    get_hevc_sps(&source_data[source], frame->buffer, frame->buffer_size);
+                    get_hevc_sps(&source_data[source], frame);
                     syslog(LOG_INFO,"HLSMUX: SAVING HEVC SPS: SIZE:%d\n", source_data[source].hevc_sps_size);
                 }
                 if (source_data[source].hevc_pps_size == 0) {
-                    get_hevc_pps(&source_data[source], frame->buffer, frame->buffer_size);
+                    get_hevc_pps(&source_data[source], frame);
                     syslog(LOG_INFO,"HLSMUX: SAVING HEVC PPS: SIZE:%d\n", source_data[source].hevc_pps_size);
                 }
                 if (source_data[source].hevc_vps_size == 0) {
-                    get_hevc_vps(&source_data[source], frame->buffer, frame->buffer_size);
+                    get_hevc_vps(&source_data[source], frame);
                     syslog(LOG_INFO,"HLSMUX: SAVING HEVC VPS: SIZE:%d\n", source_data[source].hevc_vps_size);
                 }
 
@@ -2941,14 +3625,10 @@ void *mux_pump_thread(void *context)
                        fragment_length);*/
 
                 if (source_data[source].total_video_duration+frag_delta >= source_data[source].expected_video_duration+fragment_length) {
-                    int64_t sidx_time;
-                    int64_t sidx_duration;
                     int64_t segment_time;
                     int64_t duration_time;
                     int j;
 
-                    sidx_time = 0;
-                    sidx_duration = 0;
                     if (core->cd->enable_ts_output) {
                         end_ts_fragment(core, &hlsmux->video[source], source, 0, IS_VIDEO); // substream is 0 for video
                     } else {
@@ -2964,44 +3644,19 @@ void *mux_pump_thread(void *context)
                     hlsmux->video[source].last_segment_time = segment_time - hlsmux->video[source].discontinuity_adjustment;
                     duration_time = (int64_t)((double)frag_delta * (double)VIDEO_CLOCK);
                     if (core->cd->enable_fmp4_output) {
-                        if (hlsmux->video[source].fmp4) {
-                            fmp4_fragment_end(hlsmux->video[source].fmp4, &sidx_time, &sidx_duration,
-                                              source_data[source].total_video_duration * (double)VIDEO_CLOCK + hlsmux->video[source].discontinuity_adjustment,
-                                              frag_delta * (double)VIDEO_CLOCK,
-                                              hlsmux->video[source].media_sequence_number,
-                                              VIDEO_FRAGMENT);
-
-                            /*syslog(LOG_INFO,"HLSMUX: ENDING PREVIOUS fMP4 VIDEO FRAGMENT(%d): SIZE:%d TF:%d\n",
-                                   source,
-                                   hlsmux->video[source].fmp4->buffer_offset,
-                                   hlsmux->video[source].fmp4->fragment_count);*/
-
-#if defined(DEBUG_MP4)
-                            if (source == 0) {
-                                if (!debug_video_mp4) {
-                                    debug_video_mp4 = fopen("debugvideo.mp4","w");
-                                }
-                                if (debug_video_mp4) {
-                                    fwrite(hlsmux->video[source].fmp4->buffer, 1, hlsmux->video[source].fmp4->buffer_offset, debug_video_mp4);
-                                    fflush(debug_video_mp4);
-                                }
-                            }
-#endif // DEBUG_MP4
-
-                            fwrite(hlsmux->video[source].fmp4->buffer, 1, hlsmux->video[source].fmp4->buffer_offset, hlsmux->video[source].output_fmp4_file);
-                            end_mp4_fragment(core, &hlsmux->video[source], source, NO_SUBSTREAM, IS_VIDEO, segment_time);
-
+                        if (end_mp4_segment(core, &hlsmux->video[source], source, NO_SUBSTREAM, IS_VIDEO,
+                                            (int64_t)(source_data[source].total_video_duration * (double)VIDEO_CLOCK) + hlsmux->video[source].discontinuity_adjustment,
+                                            (int64_t)(frag_delta * (double)VIDEO_CLOCK),
+                                            segment_time) == 0) {
                             if (source == 0 && core->cd->enable_webvtt) { // webvtt
                                 if (strlen(hlsmux->video[0].textbuffer) > 8) {
                                     fprintf(stderr,"WEBVTT CAPTION DATA\n");
                                     fprintf(stderr,"%s", hlsmux->video[0].textbuffer);
                                 }
-                                fprintf(hlsmux->video[source].output_webvtt_file, "%s", hlsmux->video[0].textbuffer);
+                                publish_webvtt_segment(core, &hlsmux->video[source], source, segment_time, hlsmux->video[0].textbuffer);
                                 memset(hlsmux->video[source].textbuffer, 0, MAX_TEXT_BUFFER);
                                 snprintf(hlsmux->video[source].textbuffer, MAX_TEXT_BUFFER-1, "WEBVTT\n\n");
-                                end_webvtt_fragment(core, &hlsmux->video[source], source, segment_time);
                             }
-
                         }
                     }
 
@@ -3009,6 +3664,8 @@ void *mux_pump_thread(void *context)
 
                     source_data[source].segment_lengths_video[hlsmux->video[source].file_sequence_number] = frag_delta;
                     source_data[source].discontinuity[hlsmux->video[source].file_sequence_number] = source_data[source].source_discontinuity;
+                    hlsmux->video[source].segment_discontinuity[hlsmux->video[source].file_sequence_number] = hlsmux->video[source].rendition_discontinuity;
+                    hlsmux->video[source].rendition_discontinuity = 0;
                     source_data[source].splice_duration[hlsmux->video[source].file_sequence_number] = source_data[source].source_splice_duration;
                     source_data[source].full_time_video[hlsmux->video[source].file_sequence_number] = segment_time;
                     source_data[source].full_duration_video[hlsmux->video[source].file_sequence_number] = duration_time;
@@ -3098,10 +3755,6 @@ void *mux_pump_thread(void *context)
                     if (core->cd->enable_fmp4_output) {
                         video_stream_struct *vstream = (video_stream_struct*)core->source_stream[source].video_stream;
 
-                        if (source == 0 && core->cd->enable_webvtt) {
-                            start_webvtt_fragment(core, &hlsmux->video[source], source);
-                        }
-                        start_mp4_fragment(core, &hlsmux->video[source], source, IS_VIDEO, NO_SUBSTREAM);
                         if (hlsmux->video[source].fmp4 == NULL) {
                             if (frame->media_type == MEDIA_TYPE_H264) {
                                 int video_bitrate;
@@ -3152,6 +3805,7 @@ void *mux_pump_thread(void *context)
                                 fprintf(stderr,"HLSMUX: UNSUPPORTED MEDIA TYPE\n");
                             }
                         }
+                        start_mp4_fragment(core, &hlsmux->video[source], source, IS_VIDEO, NO_SUBSTREAM);
                     }
                 }
             }
@@ -3182,100 +3836,22 @@ void *mux_pump_thread(void *context)
                     fmp4_video_fragment_add(hlsmux->video[source].fmp4,
                                             frame->buffer,
                                             frame->buffer_size,
+                                            core->compressed_video_pool,
                                             fragment_timestamp,
                                             fragment_duration,
-                                            fragment_composition_time);
+                                            fragment_composition_time,
+                                            &frame->nal_index);
                 }
             }
             if (core->cd->enable_fmp4_output) {
-                if (hlsmux->video[source].output_fmp4_file != NULL) {
-                    if (hlsmux->video[source].fmp4) {
-                        double fragment_timestamp;
-                        int fragment_duration;
-                        int64_t fragment_composition_time;
-
-                        if (frame->dts > 0) {
-                            //placeholder: check for overflow issue when one goes back to zero
-                            fragment_composition_time = frame->pts - frame->dts;
-                            fragment_timestamp = frame->dts;
-                        } else {
-                            fragment_composition_time = 0;
-                            fragment_timestamp = frame->pts;
-                        }
-
-                        fragment_duration = frame->duration;
-
-                        /*syslog(LOG_INFO,"HLSMUX: ADDING VIDEO FRAGMENT(%d):%d OFFSET:%d  DURATION:%ld CTS:%ld\n",
-                               source,
-                               hlsmux->video[source].fmp4->fragment_count,
-                               hlsmux->video[source].fmp4->buffer_offset,
-                               fragment_duration,
-                               fragment_composition_time);*/
-
-                        fmp4_video_fragment_add(hlsmux->video[source].fmp4,
-                                                frame->buffer,
-                                                frame->buffer_size,
-                                                fragment_timestamp,
-                                                fragment_duration,
-                                                fragment_composition_time);
-                    }
-                }
+                add_mp4_video_frame(core, &hlsmux->video[source], frame);
             }
-            if (core->cd->enable_ts_output) {
-                if (hlsmux->video[source].output_ts_file != NULL) {
-                    int s;
-                    uint8_t pat[188];
-                    uint8_t pmt[188];
-                    int64_t pc;
-
-                    muxpatsample(core, &hlsmux->video[source], &pat[0]);
-                    fwrite(pat, 1, 188, hlsmux->video[source].output_ts_file);
-                    muxpmtsample(core, &hlsmux->video[source], &pmt[0], VIDEO_PID, CODEC_H264);
-                    fwrite(pmt, 1, 188, hlsmux->video[source].output_ts_file);
-
-                    pc = muxvideosample(core, &hlsmux->video[source], frame);
-
-                    hlsmux->video[source].packet_count += pc;
-                    for (s = 0; s < pc; s++) {
-                        uint8_t *muxbuffer;
-                        muxbuffer = hlsmux->video[source].muxbuffer;
-                        if (s == 0 && (muxbuffer[5] == 0x10 || muxbuffer[5] == 0x50)) {
-                            int64_t base;
-                            int64_t ext;
-                            int64_t full;
-                            int64_t total_pc = hlsmux->video[source].packet_count;
-                            int64_t offset_count;
-                            int64_t timestamp;
-                            int64_t timestamp_offset;
-
-                            if (frame->dts > 0) {
-                                timestamp = frame->dts;
-                            } else {
-                                timestamp = frame->pts;
-                            }
-                            timestamp_offset = timestamp - VIDEO_OFFSET;
-                            if (timestamp_offset < 0) {
-                                timestamp_offset += 8589934592;
-                            }
-
-                            offset_count = (int64_t)(((double)(timestamp_offset)*(double)300.0*(double)20.0/(double)216) - (double)10)/(double)188;
-                            total_pc = offset_count;
-
-                            full = (int64_t)((int64_t)total_pc * (int64_t)40608) / (int64_t)20;
-                            full = full % (8589934592 * 300);
-                            base = full / 300;
-                            ext = full % 300;
-
-                            muxbuffer[6] = (0xff & (base >> 25));
-                            muxbuffer[7] = (0xff & (base >> 17));
-                            muxbuffer[8] = (0xff & (base >> 9));
-                            muxbuffer[9] = (0xff & (base >> 1));
-                            muxbuffer[10] = ((0x01 & base) << 7) | 0x7e | ((0x100 & ext) >> 8);
-                            muxbuffer[11] = (0xff & ext);
-                        }
-                        fwrite(&muxbuffer[s*188], 1, 188, hlsmux->video[source].output_ts_file);
-                    }
-                }
+            if (frame->discontinuity) {
+                // set after any segment change above so it lands on the segment holding this frame
+                hlsmux->video[source].rendition_discontinuity = 1;
+            }
+            if (core->cd->enable_ts_output && hlsmux->video[source].ts_segment_open) {
+                post_ts_frame(core, &hlsmux->video[source], frame, 0);
             }
         } else if (frame->frame_type == FRAME_TYPE_AUDIO) {
             double frag_delta;
@@ -3439,12 +4015,10 @@ void *mux_pump_thread(void *context)
                    fragment_length);*/
 
             if (source_data[source].total_audio_duration[sub_stream]+frag_delta >= source_data[source].total_video_duration && source_data[source].video_fragment_ready[sub_stream]) {
-                int64_t sidx_time = 0;
-                int64_t sidx_duration = 0;
                 int64_t segment_time;
                 int64_t duration_time;
 
-                if (core->cd->enable_ts_output) {
+                if (core->cd->enable_ts_output && !is_muxed_audio(core, source, sub_stream)) {
                     end_ts_fragment(core, &hlsmux->audio[source][sub_stream], source, sub_stream, IS_AUDIO);
                 } else {
                     hlsmux->audio[source][sub_stream].fragments_published++;
@@ -3454,32 +4028,10 @@ void *mux_pump_thread(void *context)
                 hlsmux->audio[source][sub_stream].last_segment_time = segment_time - hlsmux->video[source].discontinuity_adjustment;
                 duration_time = (int64_t)((double)frag_delta * (double)AUDIO_CLOCK);
                 if (core->cd->enable_fmp4_output) {
-                    if (hlsmux->audio[source][sub_stream].fmp4) {
-                        fmp4_fragment_end(hlsmux->audio[source][sub_stream].fmp4, &sidx_time, &sidx_duration,
-                                          source_data[source].total_audio_duration[sub_stream] * (double)AUDIO_CLOCK + hlsmux->video[source].discontinuity_adjustment,
-                                          frag_delta * (double)AUDIO_CLOCK,
-                                          hlsmux->audio[source][sub_stream].media_sequence_number,
-                                          AUDIO_FRAGMENT);
-
-                        syslog(LOG_INFO,"HLSMUX: ENDING PREVIOUS fMP4 AUDIO FRAGMENT(%d): SIZE:%ld\n",
-                               source,
-                               hlsmux->audio[source][sub_stream].fmp4->buffer_offset);
-
-#if defined(DEBUG_MP4)
-                        if (source == 0 && sub_stream == 0) {
-                            if (!debug_audio_mp4) {
-                                debug_audio_mp4 = fopen("debugaudio.mp4","w");
-                            }
-                            if (debug_audio_mp4) {
-                                fwrite(hlsmux->audio[source][sub_stream].fmp4->buffer, 1, hlsmux->audio[source][sub_stream].fmp4->buffer_offset, debug_audio_mp4);
-                                fflush(debug_audio_mp4);
-                            }
-                        }
-#endif // DEBUG_MP4
-
-                        fwrite(hlsmux->audio[source][sub_stream].fmp4->buffer, 1, hlsmux->audio[source][sub_stream].fmp4->buffer_offset, hlsmux->audio[source][sub_stream].output_fmp4_file);
-                        end_mp4_fragment(core, &hlsmux->audio[source][sub_stream], source, sub_stream, IS_AUDIO, segment_time);
-                    }
+                    end_mp4_segment(core, &hlsmux->audio[source][sub_stream], source, sub_stream, IS_AUDIO,
+                                    (int64_t)(source_data[source].total_audio_duration[sub_stream] * (double)AUDIO_CLOCK) + hlsmux->video[source].discontinuity_adjustment,
+                                    (int64_t)(frag_delta * (double)AUDIO_CLOCK),
+                                    segment_time);
                 }
 
                 source_data[source].discontinuity[hlsmux->video[source].file_sequence_number] = source_data[source].source_discontinuity;
@@ -3492,9 +4044,11 @@ void *mux_pump_thread(void *context)
 
                 if (hlsmux->audio[source][sub_stream].fragments_published > core->cd->window_size) {
                     fprintf(stderr,"\n\n\n\n\nHLSMUX: UPDATING AUDIO MANIFEST: SOURCE:%d SUB_STREAM:%d\n\n\n\n", source, sub_stream);
-                    update_ts_audio_manifest(core, &hlsmux->audio[source][sub_stream], source, sub_stream,
-                                             source_data[source].source_discontinuity,
-                                             &source_data[source]);
+                    if (!is_muxed_audio(core, source, sub_stream)) {
+                        update_ts_audio_manifest(core, &hlsmux->audio[source][sub_stream], source, sub_stream,
+                                                 source_data[source].source_discontinuity,
+                                                 &source_data[source]);
+                    }
                     if (core->cd->enable_fmp4_output) {
                         update_mp4_audio_manifest(core, &hlsmux->audio[source][sub_stream], source,
                                                   sub_stream, source_data[source].source_discontinuity,
@@ -3528,13 +4082,12 @@ void *mux_pump_thread(void *context)
                 source_data[source].total_audio_duration[sub_stream] += frag_delta;
                 source_data[source].expected_audio_duration[sub_stream] += fragment_length;
 
-                if (core->cd->enable_ts_output) {
+                if (core->cd->enable_ts_output && !is_muxed_audio(core, source, sub_stream)) {
                     start_ts_fragment(core, &hlsmux->audio[source][sub_stream], source, sub_stream, IS_AUDIO);  // start first audio fragment
                 }
                 if (core->cd->enable_fmp4_output) {
                     audio_stream_struct *astream = (audio_stream_struct*)core->source_stream[source].audio_stream[sub_stream];
 
-                    start_mp4_fragment(core, &hlsmux->audio[source][sub_stream], source, IS_AUDIO, sub_stream);
                     if (hlsmux->audio[source][sub_stream].fmp4 == NULL) {
                         int audio_bitrate;
 
@@ -3561,6 +4114,7 @@ void *mux_pump_thread(void *context)
                                                 audio_bitrate);
 
                     }
+                    start_mp4_fragment(core, &hlsmux->audio[source][sub_stream], source, IS_AUDIO, sub_stream);
                 }
             }
 
@@ -3575,130 +4129,39 @@ void *mux_pump_thread(void *context)
                 fmp4_audio_fragment_add(hlsmux->video[source].fmp4,
                                         frame->buffer,
                                         frame->buffer_size,
+                                        core->compressed_audio_pool,
                                         fragment_timestamp,
                                         fragment_duration);
             }
 
             if (core->cd->enable_fmp4_output) {
-                if (hlsmux->audio[source][sub_stream].output_fmp4_file != NULL) {
-                    if (hlsmux->audio[source][sub_stream].fmp4) {
-                        audio_stream_struct *astream = (audio_stream_struct*)core->source_stream[source].audio_stream[sub_stream];
-                        double fragment_timestamp = frame->pts;
-                        int fragment_duration = frame->duration * astream->audio_samplerate / (double)AUDIO_CLOCK;
-
-                        if (astream->audio_object_type == 5) { // sbr
-                            fragment_duration = fragment_duration << 1;
-                        }
-
-                        /*syslog(LOG_INFO,"HLSMUX: ADDING AUDIO FRAGMENT(%d): %d  BUFFER:%p  OFFSET:%d   DURATION:%d\n",
-                               source,
-                               hlsmux->audio[source][sub_stream].fmp4->fragment_count,
-                               hlsmux->audio[source][sub_stream].fmp4->buffer,
-                               hlsmux->audio[source][sub_stream].fmp4->buffer_offset,
-                               fragment_duration);*/
-
-                        if (frame->media_type == MEDIA_TYPE_AAC) {
-                            if (astream->audio_samples_to_add > 0) {
-                                astream->audio_samples_to_add--;
-
-                                if (astream->audio_channels == 2) {
-                                    fmp4_audio_fragment_add(hlsmux->audio[source][sub_stream].fmp4,
-                                                            aac_quiet_2,
-                                                            sizeof(aac_quiet_2),
-                                                            fragment_timestamp,
-                                                            fragment_duration);
-                                } else if (astream->audio_channels == 6) {
-                                    fmp4_audio_fragment_add(hlsmux->audio[source][sub_stream].fmp4,
-                                                            aac_quiet_6,
-                                                            sizeof(aac_quiet_6),
-                                                            fragment_timestamp,
-                                                            fragment_duration);
-                                }
-                            }
-                        } else {
-                            //placeholder for adding ac3 audio silence samples 2/6 channel
-                        }
+                audio_stream_struct *astream = (audio_stream_struct*)core->source_stream[source].audio_stream[sub_stream];
 
-                        /*fprintf(stderr,"\n\nMP4 AUDIO FRAGMENT ADD (SOURCE=%d SUBSTREAM=%d): SIZE:%d TIMESTAMP:%f DURATION:%d\n\n",
-                                source,
-                                sub_stream,
-                                frame->buffer_size,
-                                fragment_timestamp,
-                                fragment_duration);
-                        */
-                        fmp4_audio_fragment_add(hlsmux->audio[source][sub_stream].fmp4,
-                                                frame->buffer,
-                                                frame->buffer_size,
-                                                fragment_timestamp,
-                                                fragment_duration);
-                    }
-                }
+                add_mp4_audio_frame(core, &hlsmux->audio[source][sub_stream], frame, astream);
             }
 
-            if (core->cd->enable_ts_output) {
-                if (hlsmux->audio[source][sub_stream].output_ts_file != NULL) {
-                    int s;
-                    uint8_t pat[188];
-                    uint8_t pmt[188];
-                    int64_t pc;
+            if (is_muxed_audio(core, source, sub_stream)) {
+                int v;
 
-                    muxpatsample(core, &hlsmux->audio[source][sub_stream], &pat[0]);
-                    fwrite(pat, 1, 188, hlsmux->audio[source][sub_stream].output_ts_file);
-                    if (frame->media_type == MEDIA_TYPE_AAC) {
-                        muxpmtsample(core, &hlsmux->audio[source][sub_stream], &pmt[0], AUDIO_BASE_PID, CODEC_AAC);
-                    } else if (frame->media_type == MEDIA_TYPE_AC3) {
-                        muxpmtsample(core, &hlsmux->audio[source][sub_stream], &pmt[0], AUDIO_BASE_PID, CODEC_AC3);
-                    }
-                    fwrite(pmt, 1, 188, hlsmux->audio[source][sub_stream].output_ts_file);
-
-                    pc = muxaudiosample(core, &hlsmux->audio[source][sub_stream], frame, 0);
-
-                    hlsmux->audio[source][sub_stream].packet_count += pc;
-                    for (s = 0; s < pc; s++) {
-                        uint8_t *muxbuffer;
-                        muxbuffer = hlsmux->audio[source][sub_stream].muxbuffer;
-                        if (s == 0 && (muxbuffer[5] == 0x10 || muxbuffer[5] == 0x50)) {
-                            int64_t base;
-                            int64_t ext;
-                            int64_t full;
-                            int64_t total_pc = hlsmux->audio[source][sub_stream].packet_count;
-                            int64_t offset_count;
-                            int64_t timestamp;
-                            int64_t timestamp_offset;
-
-                            timestamp = frame->pts;
-                            timestamp_offset = timestamp - AUDIO_OFFSET;
-                            if (timestamp_offset < 0) {
-                                timestamp_offset += 8589934592;
-                            }
-                            offset_count = (int64_t)(((double)(timestamp_offset)*(double)300.0*(double)20.0/(double)216) - (double)10)/(double)188;
-                            total_pc = offset_count;
-
-                            full = (int64_t)((int64_t)total_pc * (int64_t)40608) / (int64_t)20;
-                            full = full % (8589934592 * 300);
-                            base = full / 300;
-                            ext = full % 300;
-
-                            muxbuffer[6] = (0xff & (base >> 25));
-                            muxbuffer[7] = (0xff & (base >> 17));
-                            muxbuffer[8] = (0xff & (base >> 9));
-                            muxbuffer[9] = (0xff & (base >> 1));
-                            muxbuffer[10] = ((0x01 & base) << 7) | 0x7e | ((0x100 & ext) >> 8);
-                            muxbuffer[11] = (0xff & ext);
-                        }
-                        fwrite(&muxbuffer[s*188], 1, 188, hlsmux->audio[source][sub_stream].output_ts_file);
+                if (frame->media_type == MEDIA_TYPE_AC3) {
+                    hlsmux->muxed_audio_codec_type = CODEC_AC3;
+                } else {
+                    hlsmux->muxed_audio_codec_type = CODEC_AAC;
+                }
+                // frames come out of the sync thread in time order, so queueing each audio frame behind the video
+                // of every open segment interleaves them in dts order- the video pid carries the pcr
+                for (v = 0; v < num_sources; v++) {
+                    if (hlsmux->video[v].ts_segment_open) {
+                        post_ts_frame(core, &hlsmux->video[v], frame, MUX_JOB_MUXED_AUDIO);
                     }
                 }
+            } else if (core->cd->enable_ts_output && hlsmux->audio[source][sub_stream].ts_segment_open) {
+                post_ts_frame(core, &hlsmux->audio[source][sub_stream], frame, 0);
             }
         }
 skip_sample:
-        if (frame->frame_type == FRAME_TYPE_VIDEO) {
-            memory_return(core->compressed_video_pool, frame->buffer);
-        } else {
-            memory_return(core->compressed_audio_pool, frame->buffer);
-        }
-        frame->buffer = NULL;
-        memory_return(core->frame_msg_pool, frame);
+        // the mux workers can still be holding the frame, so it is handed back untouched
+        release_frame(core, frame);
         frame = NULL;
         memory_return(core->fillet_msg_pool, msg);
         msg = NULL;
@@ -3723,21 +4186,35 @@ cleanup_mux_pump_thread:
         msg = dataqueue_take_back(hlsmux->input_queue);
     }
 
+    // whatever was already handed to the workers still gets written, an open fMP4 segment is dropped
+    for (i = 0; i < MAX_VIDEO_SOURCES; i++) {
+        int j;
+
+        reset_mp4_fragment(core, &hlsmux->video[i]);
+        mux_worker_destroy(hlsmux->video[i].mux_worker);
+        hlsmux->video[i].mux_worker = NULL;
+        hlsmux->video[i].ts_segment_open = 0;
+        hlsmux->video[i].ts_close_pending[0] = 0;
+        hlsmux->video[i].ts_reset_pending = 0;
+        for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
+            reset_mp4_fragment(core, &hlsmux->audio[i][j]);
+            mux_worker_destroy(hlsmux->audio[i][j].mux_worker);
+            hlsmux->audio[i][j].mux_worker = NULL;
+            hlsmux->audio[i][j].ts_segment_open = 0;
+            hlsmux->audio[i][j].ts_close_pending[0] = 0;
+            hlsmux->audio[i][j].ts_reset_pending = 0;
+        }
+    }
+
     for (i = 0; i < num_sources; i++) {
         int j;
 
         if (core->cd->enable_ts_output) {
             hlsmux->video[i].packet_count = 0;
-            if (hlsmux->video[i].output_ts_file) {
-                fclose(hlsmux->video[i].output_ts_file);
-                hlsmux->video[i].output_ts_file = NULL;
-            }
+            segment_writer_close(hlsmux->video[i].output_ts_writer, NULL);
             for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
                 hlsmux->audio[i][j].packet_count = 0;
-                if (hlsmux->audio[i][j].output_ts_file) {
-                    fclose(hlsmux->audio[i][j].output_ts_file);
-                    hlsmux->audio[i][j].output_ts_file = NULL;
-                }
+                segment_writer_close(hlsmux->audio[i][j].output_ts_writer, NULL);
             }
         }
         if (core->cd->enable_fmp4_output) {
@@ -3765,25 +4242,33 @@ cleanup_mux_pump_thread:
     for (i = 0; i < MAX_VIDEO_SOURCES; i++) {
         int j;
 
-        free(hlsmux->video[i].pesbuffer);
-        hlsmux->video[i].pesbuffer = NULL;
+        free(hlsmux->video[i].muxiov);
+        hlsmux->video[i].muxiov = NULL;
         free(hlsmux->video[i].muxbuffer);
         hlsmux->video[i].muxbuffer = NULL;
-        free(hlsmux->video[i].packettable);
-        hlsmux->video[i].packettable = NULL;
+        hlsmux->video[i].mux_packets = 0;
+        segment_writer_destroy(hlsmux->video[i].output_ts_writer);
+        hlsmux->video[i].output_ts_writer = NULL;
         if (i == 0) {
             free(hlsmux->video[i].textbuffer);
             hlsmux->video[i].textbuffer = NULL;
         }
 
         for (j = 0; j < MAX_AUDIO_STREAMS; j++) {
-            free(hlsmux->audio[i][j].pesbuffer);
-            hlsmux->audio[i][j].pesbuffer = NULL;
+            free(hlsmux->audio[i][j].muxiov);
+            hlsmux->audio[i][j].muxiov = NULL;
             free(hlsmux->audio[i][j].muxbuffer);
             hlsmux->audio[i][j].muxbuffer = NULL;
-            free(hlsmux->audio[i][j].packettable);
-            hlsmux->audio[i][j].packettable = NULL;
+            hlsmux->audio[i][j].mux_packets = 0;
+            segment_writer_destroy(hlsmux->audio[i][j].output_ts_writer);
+            hlsmux->audio[i][j].output_ts_writer = NULL;
         }
+
+        free(hlsmux->muxed_audio[i].muxbuffer);
+        hlsmux->muxed_audio[i].muxbuffer = NULL;
+        free(hlsmux->muxed_audio[i].muxiov);
+        hlsmux->muxed_audio[i].muxiov = NULL;
+        hlsmux->muxed_audio[i].mux_packets = 0;
     }
 
     quit_mux_pump_thread = 0;
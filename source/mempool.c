@@ -35,134 +35,359 @@ typedef struct _memory_struct
 {
     int                        disponible;
     int                        owner;
+    // holders of a shared buffer, the last memory_return() releases it
+    int                        refcount;
     uint8_t                    *memory;
 } memory_struct;
 
+typedef struct _memory_class_info_struct
+{
+    int                        size;
+    int                        count;
+    int                        header_size;
+    int                        stride;
+    int                        first;
+    int                        free_count;
+    int                        *free_list;
+    uint8_t                    *data;
+    // rounds per thread magazine, 0 when the class is too small to cache
+    int                        magazine_size;
+    // free buffers sitting in thread magazines
+    int                        cached;
+    int                        peak;
+    int64_t                    takes;
+    int64_t                    fallbacks;
+    int64_t                    failures;
+} memory_class_info_struct;
+
 typedef struct _memory_pool_struct
 {
     int                        count;
-    int                        size;
-    int                        pos;
+    int                        class_count;
+    int                        *free_list;
     pthread_mutex_t            *reflock;
     memory_struct              *refs;
-    uint8_t                    *data;
+    memory_class_info_struct   classes[MAX_MEMORY_CLASSES];
+    int                        cache_slot;
+    // changes on reset so magazines holding old slots are dropped
+    int64_t                    generation;
 } memory_pool_struct;
 
-#define MEMORY_RESERVED      4
+// the slot header sits right in front of the buffer, small fixed size objects
+// only reserve the header itself while frame sized and malloc backed buffers
+// pad it out to keep 16 byte alignment
+#define MEMORY_HEADER_SMALL  8
+#define MEMORY_HEADER_LARGE  16
+#define MEMORY_LARGE_OBJECT  1024
+#define MEMORY_HEADER_MAGIC  0x4d50
+
+typedef struct _memory_header_struct
+{
+    uint32_t                   idx;
+    uint16_t                   class_index;
+    uint16_t                   magic;
+} memory_header_struct;
+
+#define MEMORY_ALIGN(x,a)    (((x)+(a)-1) & ~((a)-1))
+#define MEMORY_HEADER(p)     ((memory_header_struct*)((uint8_t*)(p) - sizeof(memory_header_struct)))
+
+// thread magazines, a class needs this many slots per round to be cached
+// so one thread can't sit on all of a small class
+#define MEMORY_MAGAZINE_SPREAD  16
+
+typedef struct _memory_magazine_struct
+{
+    int                        count;
+    int                        rounds[MAX_MEMORY_MAGAZINE];
+} memory_magazine_struct;
+
+typedef struct _memory_thread_cache_struct
+{
+    memory_pool_struct         *pool;
+    int64_t                    generation;
+    memory_magazine_struct     magazine[MAX_MEMORY_CLASSES];
+} memory_thread_cache_struct;
+
+static memory_pool_struct *cached_pools[MAX_CACHED_POOLS];
+static pthread_mutex_t cached_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
+static __thread memory_thread_cache_struct **thread_caches = NULL;
+static int64_t pool_generation = 0;
+
+static int64_t memory_next_generation(void)
+{
+    return __atomic_add_fetch(&pool_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void memory_refill(memory_pool_struct *memory_pool, int class_index, memory_magazine_struct *magazine)
+{
+    memory_class_info_struct *info = &memory_pool->classes[class_index];
+
+    pthread_mutex_lock(memory_pool->reflock);
+    while (magazine->count < info->magazine_size && info->free_count > 0) {
+        magazine->rounds[magazine->count++] = info->free_list[--info->free_count];
+        __atomic_add_fetch(&info->cached, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(memory_pool->reflock);
+}
+
+static void memory_flush(memory_pool_struct *memory_pool, int class_index, memory_magazine_struct *magazine, int rounds)
+{
+    memory_class_info_struct *info = &memory_pool->classes[class_index];
+
+    pthread_mutex_lock(memory_pool->reflock);
+    while (rounds > 0 && magazine->count > 0) {
+        info->free_list[info->free_count++] = magazine->rounds[--magazine->count];
+        __atomic_sub_fetch(&info->cached, 1, __ATOMIC_RELAXED);
+        rounds--;
+    }
+    pthread_mutex_unlock(memory_pool->reflock);
+}
+
+static void memory_thread_exit(void *context)
+{
+    memory_thread_cache_struct **caches = (memory_thread_cache_struct **)context;
+    int slot;
+    int c;
+
+    // hand back whatever this thread still holds, unless the pool is gone or was reset
+    pthread_mutex_lock(&cached_pools_lock);
+    for (slot = 0; slot < MAX_CACHED_POOLS; slot++) {
+        memory_thread_cache_struct *cache = caches[slot];
+
+        if (!cache) {
+            continue;
+        }
+        if (cached_pools[slot] == cache->pool &&
+            cache->pool->generation == cache->generation) {
+            for (c = 0; c < cache->pool->class_count; c++) {
+                memory_flush(cache->pool, c, &cache->magazine[c], cache->magazine[c].count);
+            }
+        }
+        free(cache);
+    }
+    pthread_mutex_unlock(&cached_pools_lock);
+    free(caches);
+}
+
+static void memory_thread_cache_init(void)
+{
+    pthread_key_create(&thread_cache_key, memory_thread_exit);
+}
+
+static memory_thread_cache_struct *memory_thread_cache(memory_pool_struct *memory_pool)
+{
+    memory_thread_cache_struct *cache;
+
+    if (memory_pool->cache_slot < 0) {
+        return NULL;
+    }
+    if (!thread_caches) {
+        pthread_once(&thread_cache_once, memory_thread_cache_init);
+        thread_caches = (memory_thread_cache_struct **)malloc(sizeof(memory_thread_cache_struct*)*MAX_CACHED_POOLS);
+        if (!thread_caches) {
+            return NULL;
+        }
+        memset(thread_caches, 0, sizeof(memory_thread_cache_struct*)*MAX_CACHED_POOLS);
+        pthread_setspecific(thread_cache_key, thread_caches);
+    }
+    cache = thread_caches[memory_pool->cache_slot];
+    if (!cache) {
+        cache = (memory_thread_cache_struct *)malloc(sizeof(memory_thread_cache_struct));
+        if (!cache) {
+            return NULL;
+        }
+        memset(cache, 0, sizeof(memory_thread_cache_struct));
+        cache->pool = memory_pool;
+        cache->generation = memory_pool->generation;
+        thread_caches[memory_pool->cache_slot] = cache;
+    }
+    if (cache->pool != memory_pool || cache->generation != memory_pool->generation) {
+        // the slot belongs to a new pool or the pool was reset, the old rounds are stale
+        memset(cache->magazine, 0, sizeof(cache->magazine));
+        cache->pool = memory_pool;
+        cache->generation = memory_pool->generation;
+    }
+    return cache;
+}
+
+static void memory_build_class(memory_pool_struct *memory_pool, int class_index)
+{
+    memory_class_info_struct *info = &memory_pool->classes[class_index];
+    int i;
+
+    // lowest index on top so the first takes walk the slab in order
+    for (i = 0; i < info->count; i++) {
+        int idx = info->first + i;
+
+        if (info->size > 0) {
+            // the header is written by memory_take(), so a slot's page is only touched once it is used
+            memory_pool->refs[idx].memory = info->data + (int64_t)i * info->stride + info->header_size;
+        } else {
+            if (memory_pool->refs[idx].memory) {
+                free(memory_pool->refs[idx].memory - info->header_size);
+            }
+            memory_pool->refs[idx].memory = NULL;
+        }
+        memory_pool->refs[idx].disponible = 1;
+        info->free_list[i] = info->first + info->count - 1 - i;
+    }
+    info->free_count = info->count;
+    info->cached = 0;
+}
 
 int memory_reset(void *pool)
 {
     memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
     if (memory_pool) {
-        uint8_t *magicptr8;
-        uint32_t *magicptr32;
-        int count = memory_pool->count;
-        int size = memory_pool->size;
-        int i;
-
-        memory_pool->pos = 0;
-        magicptr8 = memory_pool->data;
-
-        memset(magicptr8, 0, count * (size+MEMORY_RESERVED));
-
-        for (i = 0; i < count; i++) {
-            magicptr32 = (uint32_t*)magicptr8;
-            *magicptr32 = i;
-            memory_pool->refs[i].memory = (uint8_t*)magicptr8;
-            if (i != (count-1)) {
-                magicptr8 += (size+MEMORY_RESERVED);
-            }
-            memory_pool->refs[i].disponible = 1;
+        int c;
+
+        pthread_mutex_lock(memory_pool->reflock);
+        memory_pool->generation = memory_next_generation();
+        for (c = 0; c < memory_pool->class_count; c++) {
+            memory_build_class(memory_pool, c);
         }
+        pthread_mutex_unlock(memory_pool->reflock);
         return 0;
     }
     return -1;
 }
 
-void *memory_create(int count, int size)
+void *memory_create_slab(memory_class_struct *classes, int class_count)
 {
-    uint32_t chunk_size;
-    uint8_t *magicptr8;
-    uint32_t *magicptr32;
-    int i;
+    memory_class_struct sorted[MAX_MEMORY_CLASSES];
+    memory_pool_struct *memory_pool;
+    int count = 0;
+    int c;
+    int n;
 
-    memory_pool_struct *memory_pool = (memory_pool_struct *)malloc(sizeof(memory_pool_struct));
-    if (!memory_pool) {
+    if (!classes || class_count < 1 || class_count > MAX_MEMORY_CLASSES) {
         return NULL;
     }
 
-    chunk_size = count * (size+MEMORY_RESERVED);
-    memset(memory_pool, 0, sizeof(memory_pool_struct));
+    // fixed classes smallest first, malloc backed classes last
+    n = 0;
+    for (c = 0; c < class_count; c++) {
+        int pos = n;
 
-    memory_pool->refs = (memory_struct*)malloc(sizeof(memory_struct)*count);
-    if (!memory_pool->refs) {
-        free(memory_pool);
+        if (classes[c].buffer_count <= 0 || classes[c].buffer_size < 0) {
+            return NULL;
+        }
+        while (pos > 0 &&
+               (sorted[pos-1].buffer_size == 0 ||
+                (classes[c].buffer_size > 0 && sorted[pos-1].buffer_size > classes[c].buffer_size))) {
+            sorted[pos] = sorted[pos-1];
+            pos--;
+        }
+        sorted[pos] = classes[c];
+        n++;
+        count += classes[c].buffer_count;
+    }
+
+    memory_pool = (memory_pool_struct *)malloc(sizeof(memory_pool_struct));
+    if (!memory_pool) {
         return NULL;
     }
-    memset(memory_pool->refs, 0, sizeof(memory_struct)*count);
+    memset(memory_pool, 0, sizeof(memory_pool_struct));
 
-    memory_pool->count = count;
-    memory_pool->pos = 0;
-    memory_pool->size = size;
+    memory_pool->refs = (memory_struct*)malloc(sizeof(memory_struct)*count);
+    memory_pool->free_list = (int*)malloc(sizeof(int)*count);
     memory_pool->reflock = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-    if (!memory_pool->reflock) {
-        free(memory_pool->refs);
-        free(memory_pool);
-        return NULL;
+    if (!memory_pool->refs || !memory_pool->free_list || !memory_pool->reflock) {
+        goto cleanup_pool;
     }
-    if (size > 0) {
-        memory_pool->data = (uint8_t*)malloc(chunk_size);
-        if (!memory_pool->data) {
-            free(memory_pool->refs);
-            free(memory_pool->reflock);
-            free(memory_pool);
-            return NULL;
+    memset(memory_pool->refs, 0, sizeof(memory_struct)*count);
+    memory_pool->count = count;
+    memory_pool->class_count = class_count;
+    memory_pool->cache_slot = -1;
+    memory_pool->generation = memory_next_generation();
+
+    n = 0;
+    for (c = 0; c < class_count; c++) {
+        memory_class_info_struct *info = &memory_pool->classes[c];
+
+        info->size = sorted[c].buffer_size;
+        info->count = sorted[c].buffer_count;
+        info->first = n;
+        info->free_list = memory_pool->free_list + n;
+        if (info->size > 0 && info->size < MEMORY_LARGE_OBJECT) {
+            info->header_size = MEMORY_HEADER_SMALL;
+        } else {
+            info->header_size = MEMORY_HEADER_LARGE;
         }
-        memset(memory_pool->data, 0, chunk_size);
-    } else {
-        memory_pool->data = NULL;
+        if (info->size > 0) {
+            info->stride = MEMORY_ALIGN(info->size + info->header_size, info->header_size);
+            // pages are only touched once a buffer is used
+            info->data = (uint8_t*)malloc((int64_t)info->stride * info->count);
+            if (!info->data) {
+                goto cleanup_pool;
+            }
+        }
+        n += info->count;
     }
 
     pthread_mutex_init(memory_pool->reflock, NULL);
-
-    magicptr8 = memory_pool->data;
-    for (i = 0; i < count; i++) {
-        if (size > 0) {
-            magicptr32 = (uint32_t*)magicptr8;
-            *magicptr32 = i;
-            memory_pool->refs[i].memory = (uint8_t*)magicptr8;
-            magicptr8 += (size+MEMORY_RESERVED);
-        } else {
-            memory_pool->refs[i].memory = NULL;
-        }
-        memory_pool->refs[i].disponible = 1;
+    for (c = 0; c < class_count; c++) {
+        memory_build_class(memory_pool, c);
     }
 
     return memory_pool;
+
+cleanup_pool:
+    for (c = 0; c < class_count; c++) {
+        free(memory_pool->classes[c].data);
+    }
+    free(memory_pool->reflock);
+    free(memory_pool->free_list);
+    free(memory_pool->refs);
+    free(memory_pool);
+    return NULL;
+}
+
+void *memory_create(int count, int size)
+{
+    memory_class_struct single_class;
+
+    single_class.buffer_count = count;
+    single_class.buffer_size = size;
+
+    return memory_create_slab(&single_class, 1);
 }
 
 int memory_destroy(void *pool)
 {
     int i;
+    int c;
     memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
 
     if (!memory_pool) {
         return -1;
     }
 
-    free(memory_pool->data);
+    if (memory_pool->cache_slot >= 0) {
+        pthread_mutex_lock(&cached_pools_lock);
+        cached_pools[memory_pool->cache_slot] = NULL;
+        pthread_mutex_unlock(&cached_pools_lock);
+    }
     pthread_mutex_destroy(memory_pool->reflock);
     free(memory_pool->reflock);
     memory_pool->reflock = NULL;
-
-    for (i = 0; i < memory_pool->count; i++)
-    {
-        if (memory_pool->size > 0) {
-            free(memory_pool->refs[i].memory);
+    for (c = 0; c < memory_pool->class_count; c++) {
+        memory_class_info_struct *info = &memory_pool->classes[c];
+
+        // fixed size entries point into the slab, only malloc backed ones are allocations
+        if (info->size == 0) {
+            for (i = info->first; i < info->first + info->count; i++) {
+                if (memory_pool->refs[i].memory) {
+                    free(memory_pool->refs[i].memory - info->header_size);
+                }
+            }
         }
-        memory_pool->refs[i].memory = NULL;
+        free(info->data);
+        info->data = NULL;
     }
-
+    free(memory_pool->free_list);
     free(memory_pool->refs);
     free(memory_pool);
     memory_pool = NULL;
@@ -170,48 +395,133 @@ int memory_destroy(void *pool)
     return 0;
 }
 
+static int memory_take_slot(memory_pool_struct *memory_pool, int class_index, memory_thread_cache_struct *cache)
+{
+    memory_class_info_struct *info = &memory_pool->classes[class_index];
+    int pos = -1;
+
+    if (cache && info->magazine_size > 0) {
+        memory_magazine_struct *magazine = &cache->magazine[class_index];
+
+        if (magazine->count == 0) {
+            memory_refill(memory_pool, class_index, magazine);
+        }
+        if (magazine->count > 0) {
+            pos = magazine->rounds[--magazine->count];
+            __atomic_sub_fetch(&info->cached, 1, __ATOMIC_RELAXED);
+        }
+        return pos;
+    }
+
+    pthread_mutex_lock(memory_pool->reflock);
+    if (info->free_count > 0) {
+        pos = info->free_list[--info->free_count];
+    }
+    pthread_mutex_unlock(memory_pool->reflock);
+    return pos;
+}
+
+static void memory_release_slot(memory_pool_struct *memory_pool, int class_index, int pos, memory_thread_cache_struct *cache)
+{
+    memory_class_info_struct *info = &memory_pool->classes[class_index];
+
+    if (cache && info->magazine_size > 0) {
+        memory_magazine_struct *magazine = &cache->magazine[class_index];
+
+        // keep half so a thread that both takes and returns doesn't bounce on the lock
+        if (magazine->count >= info->magazine_size) {
+            memory_flush(memory_pool, class_index, magazine, info->magazine_size / 2);
+        }
+        magazine->rounds[magazine->count++] = pos;
+        __atomic_add_fetch(&info->cached, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    pthread_mutex_lock(memory_pool->reflock);
+    info->free_list[info->free_count++] = pos;
+    pthread_mutex_unlock(memory_pool->reflock);
+}
+
 void *memory_take(void *pool, int owner)
 {
-    uint8_t *taken = NULL;
-    int pos;
-    int count = 0;
-    int i;
+    memory_thread_cache_struct *cache;
+    memory_class_info_struct *info = NULL;
+    memory_header_struct *header;
+    uint8_t *buffer;
+    int preferred = -1;
+    int class_index = -1;
+    int in_use;
+    int pos = -1;
+    int c;
     memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
 
     if (!memory_pool) {
         return NULL;
     }
 
-    pthread_mutex_lock(memory_pool->reflock);
-    count = memory_pool->count;
-    for (i = 0; i < count; i++) {
-        pos = memory_pool->pos;
-        if (memory_pool->refs[pos].disponible) {
-            memory_pool->refs[pos].disponible = 0;
-            memory_pool->pos = (memory_pool->pos + 1) % count;
-            memory_pool->refs[pos].owner = owner;
-
-            if (memory_pool->size > 0) {
-                taken = memory_pool->refs[pos].memory + MEMORY_RESERVED;
-            } else {
-                taken = (uint8_t*)malloc(owner);
-                memory_pool->refs[pos].memory = taken;
+    cache = memory_thread_cache(memory_pool);
+    for (c = 0; c < memory_pool->class_count; c++) {
+        int size = memory_pool->classes[c].size;
+        if (size == 0 || size >= owner || memory_pool->class_count == 1) {
+            if (preferred < 0) {
+                preferred = c;
             }
-            pthread_mutex_unlock(memory_pool->reflock);
+            pos = memory_take_slot(memory_pool, c, cache);
+            if (pos >= 0) {
+                class_index = c;
+                break;
+            }
+        }
+    }
+    if (class_index < 0) {
+        if (preferred < 0) {
+            preferred = memory_pool->class_count - 1;
+        }
+        __atomic_add_fetch(&memory_pool->classes[preferred].failures, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
 
-            return taken;
+    info = &memory_pool->classes[class_index];
+    memory_pool->refs[pos].disponible = 0;
+    memory_pool->refs[pos].owner = owner;
+    memory_pool->refs[pos].refcount = 1;
+    __atomic_add_fetch(&info->takes, 1, __ATOMIC_RELAXED);
+    if (class_index != preferred) {
+        __atomic_add_fetch(&info->fallbacks, 1, __ATOMIC_RELAXED);
+    }
+    // a racing update can only lose a peak that another thread is about to raise again
+    in_use = info->count - __atomic_load_n(&info->free_count, __ATOMIC_RELAXED) - __atomic_load_n(&info->cached, __ATOMIC_RELAXED);
+    if (in_use > __atomic_load_n(&info->peak, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&info->peak, in_use, __ATOMIC_RELAXED);
+    }
+    if (info->size > 0) {
+        buffer = memory_pool->refs[pos].memory;
+    } else {
+        // the slot is reserved, so the malloc happens outside the lock
+        buffer = (uint8_t*)malloc(owner + info->header_size);
+        if (!buffer) {
+            memory_pool->refs[pos].disponible = 1;
+            memory_release_slot(memory_pool, class_index, pos, cache);
+            __atomic_add_fetch(&info->failures, 1, __ATOMIC_RELAXED);
+            return NULL;
         }
-        memory_pool->pos = (memory_pool->pos + 1) % count;
+        buffer += info->header_size;
+        memory_pool->refs[pos].memory = buffer;
     }
-    pthread_mutex_unlock(memory_pool->reflock);
-    return NULL;
+    header = MEMORY_HEADER(buffer);
+    header->idx = pos;
+    header->class_index = class_index;
+    header->magic = MEMORY_HEADER_MAGIC;
+
+    return buffer;
 }
 
 int memory_return(void *pool, void *memory)
 {
-    uint8_t *returned;
-    uint32_t *magicptr32;
+    memory_class_info_struct *info;
+    memory_header_struct *header;
     uint32_t idx;
+    int class_index;
     memory_pool_struct *memory_pool;
 
     if (!memory) {
@@ -223,60 +533,76 @@ int memory_return(void *pool, void *memory)
         return -1;
     }
 
-    if (memory_pool->size > 0) {
-        returned = (uint8_t*)memory - MEMORY_RESERVED;
-        magicptr32 = (uint32_t*)returned;
-        idx = *magicptr32;
+    header = MEMORY_HEADER(memory);
+    idx = header->idx;
 
-        pthread_mutex_lock(memory_pool->reflock);
-        if (idx > memory_pool->count) {
-            pthread_mutex_unlock(memory_pool->reflock);
-            return -1;
-        }
-
-        if (memory_pool->refs[idx].disponible != 0) {
-            pthread_mutex_unlock(memory_pool->reflock);
-            return -1;
-        } else {
-            memory_pool->refs[idx].disponible = 1;
-        }
+    if (header->magic == MEMORY_HEADER_MAGIC &&
+        idx < memory_pool->count &&
+        memory_pool->refs[idx].memory == (uint8_t*)memory &&
+        __atomic_sub_fetch(&memory_pool->refs[idx].refcount, 1, __ATOMIC_ACQ_REL) > 0) {
+        // another holder still has it
+        return 0;
+    }
 
-        pthread_mutex_unlock(memory_pool->reflock);
-    } else {
-        int found_buffer = 0;
-        pthread_mutex_lock(memory_pool->reflock);
-        for (idx = 0; idx < memory_pool->count; idx++) {
-            if (memory_pool->refs[idx].memory == memory) {
-                free(memory);
-                memory_pool->refs[idx].memory = NULL;
-                memory_pool->refs[idx].disponible = 1;
-                found_buffer = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(memory_pool->reflock);
-        if (!found_buffer) {
+    // the caller owns the slot until it is released, only a double return can race here
+    if (header->magic != MEMORY_HEADER_MAGIC ||
+        header->class_index >= memory_pool->class_count ||
+        idx >= memory_pool->count ||
+        memory_pool->refs[idx].memory != (uint8_t*)memory ||
+        __atomic_exchange_n(&memory_pool->refs[idx].disponible, 1, __ATOMIC_ACQ_REL)) {
+        // a stray malloc backed buffer would leak or be freed twice, fixed slots just refuse it
+        if (memory_pool->classes[memory_pool->class_count-1].size == 0) {
             fprintf(stderr,"FATAL ERROR: returning invalid buffer to pool!\n");
             exit(0);
         }
+        return -1;
+    }
+    class_index = header->class_index;
+    info = &memory_pool->classes[class_index];
+    if (info->size == 0) {
+        memory_pool->refs[idx].memory = NULL;
+        header->magic = 0;
+        free((uint8_t*)memory - info->header_size);
     }
+    memory_release_slot(memory_pool, class_index, idx, memory_thread_cache(memory_pool));
 
     return 0;
 }
 
-int memory_unused(void *pool)
+int memory_ref(void *pool, void *memory)
 {
     memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
+    memory_header_struct *header;
+    uint32_t idx;
+
+    if (!memory_pool || !memory) {
+        return -1;
+    }
+
+    header = MEMORY_HEADER(memory);
+    idx = header->idx;
+    if (header->magic != MEMORY_HEADER_MAGIC ||
+        idx >= memory_pool->count ||
+        memory_pool->refs[idx].memory != (uint8_t*)memory ||
+        memory_pool->refs[idx].disponible) {
+        return -1;
+    }
+    __atomic_add_fetch(&memory_pool->refs[idx].refcount, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
 
+int memory_unused(void *pool)
+{
+    memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
     if (memory_pool) {
-        int count;
         int unused = 0;
-        int i;
+        int c;
 
         pthread_mutex_lock(memory_pool->reflock);
-        count = memory_pool->count;
-        for (i = 0; i < count; i++) {
-            unused += memory_pool->refs[i].disponible;
+        for (c = 0; c < memory_pool->class_count; c++) {
+            // magazines only change cached outside the lock when a buffer is really taken or returned
+            unused += memory_pool->classes[c].free_count + __atomic_load_n(&memory_pool->classes[c].cached, __ATOMIC_RELAXED);
         }
         pthread_mutex_unlock(memory_pool->reflock);
 
@@ -284,3 +610,101 @@ int memory_unused(void *pool)
     }
     return 0;
 }
+
+int memory_unused_estimate(void *pool)
+{
+    memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
+    int unused = 0;
+    int c;
+
+    if (!memory_pool) {
+        return 0;
+    }
+    // no lock, a buffer moving between the free list and a magazine can be counted twice or missed
+    for (c = 0; c < memory_pool->class_count; c++) {
+        unused += __atomic_load_n(&memory_pool->classes[c].free_count, __ATOMIC_RELAXED) +
+                  __atomic_load_n(&memory_pool->classes[c].cached, __ATOMIC_RELAXED);
+    }
+    return unused;
+}
+
+int memory_class_count(void *pool)
+{
+    memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
+    if (memory_pool) {
+        return memory_pool->class_count;
+    }
+    return 0;
+}
+
+int memory_stats(void *pool, int class_index, memory_stats_struct *stats)
+{
+    memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
+    memory_class_info_struct *info;
+
+    if (!memory_pool || !stats ||
+        class_index < 0 || class_index >= memory_pool->class_count) {
+        return -1;
+    }
+
+    pthread_mutex_lock(memory_pool->reflock);
+    info = &memory_pool->classes[class_index];
+    stats->buffer_size = info->size;
+    stats->buffer_count = info->count;
+    stats->unused = info->free_count + __atomic_load_n(&info->cached, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&info->peak, __ATOMIC_RELAXED);
+    stats->takes = __atomic_load_n(&info->takes, __ATOMIC_RELAXED);
+    stats->fallbacks = __atomic_load_n(&info->fallbacks, __ATOMIC_RELAXED);
+    stats->failures = __atomic_load_n(&info->failures, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(memory_pool->reflock);
+
+    return 0;
+}
+
+int memory_cache_enable(void *pool, int magazine_size)
+{
+    memory_pool_struct *memory_pool = (memory_pool_struct *)pool;
+    int slot;
+    int c;
+
+    if (!memory_pool) {
+        return -1;
+    }
+    if (magazine_size > MAX_MEMORY_MAGAZINE) {
+        magazine_size = MAX_MEMORY_MAGAZINE;
+    }
+    if (magazine_size < 2) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&cached_pools_lock);
+    if (memory_pool->cache_slot >= 0) {
+        pthread_mutex_unlock(&cached_pools_lock);
+        return 0;
+    }
+    for (slot = 0; slot < MAX_CACHED_POOLS; slot++) {
+        if (!cached_pools[slot]) {
+            break;
+        }
+    }
+    if (slot == MAX_CACHED_POOLS) {
+        pthread_mutex_unlock(&cached_pools_lock);
+        return -1;
+    }
+    for (c = 0; c < memory_pool->class_count; c++) {
+        memory_class_info_struct *info = &memory_pool->classes[c];
+
+        info->magazine_size = info->count / MEMORY_MAGAZINE_SPREAD;
+        if (info->magazine_size > magazine_size) {
+            info->magazine_size = magazine_size;
+        }
+        if (info->magazine_size < 2) {
+            info->magazine_size = 0;
+        }
+    }
+    cached_pools[slot] = memory_pool;
+    memory_pool->cache_slot = slot;
+    pthread_mutex_unlock(&cached_pools_lock);
+
+    return 0;
+}
@@ -22,6 +22,7 @@
 
 #include "fillet.h"
 #include "mp4core.h"
+#include "nalscan.h"
 
 static int output8_raw(uint8_t *data, uint8_t code)
 {
@@ -1156,6 +1157,17 @@ static int output_fmp4_moof(fragment_file_struct *fmp4, double start_time, track
     return buffer_offset;
 }
 
+static void release_fragment(fragment_struct *fragment)
+{
+    if (fragment->fragment_pool) {
+        memory_return(fragment->fragment_pool, fragment->fragment_buffer);
+    } else {
+        free(fragment->fragment_buffer);
+    }
+    fragment->fragment_buffer = NULL;
+    fragment->fragment_pool = NULL;
+}
+
 static int output_fmp4_mdat(fragment_file_struct *fmp4, track_struct *track_data)
 {
     uint8_t *data;
@@ -1169,13 +1181,25 @@ static int output_fmp4_mdat(fragment_file_struct *fmp4, track_struct *track_data
     buffer_offset += output_fmp4_4cc(fmp4,"mdat");
 
     for (frag = 0; frag < track_data->fragment_count; frag++) {
-        //uint32_t *fragsize = (uint32_t*)fmp4->fragments[frag].fragment_buffer;
-        //fprintf(stderr,"writing frag size: %u\n", ntohl(*fragsize));
-        //total_fragsize += ntohl(*fragsize);
-        buffer_offset += output_raw_data(fmp4, track_data->fragments[frag].fragment_buffer, track_data->fragments[frag].fragment_buffer_size);
-        total_fragsize += track_data->fragments[frag].fragment_buffer_size;
-        free(track_data->fragments[frag].fragment_buffer);
+        fragment_struct *fragment = &track_data->fragments[frag];
+
+        if (fragment->nal_count > 0) {
+            int n;
+
+            // annex-b to length prefixed on the way out, the source frame stays untouched
+            for (n = fragment->first_nal; n < fragment->first_nal + fragment->nal_count; n++) {
+                nal_unit_struct *unit = &track_data->nal_units[n];
+
+                buffer_offset += output32(fmp4, unit->size);
+                buffer_offset += output_raw_data(fmp4, fragment->fragment_buffer + unit->offset, unit->size);
+            }
+        } else {
+            buffer_offset += output_raw_data(fmp4, fragment->fragment_buffer + fragment->fragment_offset, fragment->fragment_buffer_size);
+        }
+        total_fragsize += fragment->fragment_buffer_size;
+        release_fragment(fragment);
     }
+    track_data->nal_unit_count = 0;
     fprintf(stderr,"writing fmp4 data: %ld\n", total_fragsize);
 
     output32_raw(data, buffer_offset);
@@ -1201,7 +1225,6 @@ fragment_file_struct *fmp4_file_create(int media_type, int timescale, int lang_c
         free(fmp4);
         return NULL;
     }
-    memset(fmp4->buffer, 0, MAX_MP4_SIZE);
 
     fmp4->buffer_offset = 0;
     fmp4->next_track_id = 2;
@@ -1236,7 +1259,6 @@ fragment_file_struct *fmp4_file_create_youtube(int video_media_type, int audio_m
         free(fmp4);
         return NULL;
     }
-    memset(fmp4->buffer, 0, MAX_MP4_SIZE);
 
     fmp4->buffer_offset = 0;
     fmp4->next_track_id = 3;
@@ -1252,10 +1274,23 @@ fragment_file_struct *fmp4_file_create_youtube(int video_media_type, int audio_m
 
 int fmp4_file_finalize(fragment_file_struct *fmp4)
 {
+    int t;
+    int frag;
+
     if (!fmp4) {
         return -1;
     }
 
+    // drop the frames of a fragment that never got written
+    for (t = 0; t < MAX_TRACKS; t++) {
+        track_struct *track_data = &fmp4->track_data[t];
+        for (frag = 0; frag < track_data->fragment_count; frag++) {
+            release_fragment(&track_data->fragments[frag]);
+        }
+        track_data->fragment_count = 0;
+        free(track_data->nal_units);
+        track_data->nal_units = NULL;
+    }
     free(fmp4->buffer);
     fmp4->buffer = NULL;
     free(fmp4);
@@ -1437,212 +1472,139 @@ int fmp4_audio_track_create(fragment_file_struct *fmp4, int audio_channels, int
 
 #define NALSIZE_SIZE 4
 
-static int replace_startcode_with_size_hevc(uint8_t *input_buffer, int input_buffer_size, uint8_t *output_buffer, int max_output_buffer_size)
-{
-    int parsing_sample = 0;
-    uint8_t *sample_buffer = output_buffer;
-    int saved_position = 0;
-    int sample_size;
-    int read_pos = 0;
-    int write_pos = 0;
-    int nal_type;
-
-    while (read_pos < input_buffer_size) {
-        if (input_buffer[read_pos+0] == 0x00 &&
-            input_buffer[read_pos+1] == 0x00 &&
-            input_buffer[read_pos+2] == 0x00 &&
-            input_buffer[read_pos+3] == 0x01) {
-
-            nal_type = (input_buffer[read_pos+4] & 0x7f) >> 1;
-            if (parsing_sample) {
-                sample_size = write_pos - saved_position - NALSIZE_SIZE;
-                *(sample_buffer+saved_position+0) = (sample_size >> 24) & 0xff;
-                *(sample_buffer+saved_position+1) = (sample_size >> 16) & 0xff;
-                *(sample_buffer+saved_position+2) = (sample_size >> 8) & 0xff;
-                *(sample_buffer+saved_position+3) = sample_size & 0xff;
-                parsing_sample = 0;
-            }
+// access unit delimiters are not carried in the mp4 sample
+static int keep_nal_unit(int nal_type, int write_pos, int is_hevc)
+{
+    if (is_hevc) {
+        if (nal_type == 35) {//aud
+            return 0;
+        }
+        if (nal_type == 32 || nal_type == 33 || nal_type == 34) {
+            fprintf(stderr,"STARTING NAL TYPE: 0x%x  SAVING POS:%d\n", nal_type, write_pos);
+        }
+    } else {
+        if (nal_type == 9) {
+            return 0;
+        }
+        if (nal_type == 7 || nal_type == 8 || nal_type == 5) {
+            fprintf(stderr,"STARTING NAL TYPE: 0x%x  SAVING POS:%d\n", nal_type, write_pos);
+        }
+    }
+    return 1;
+}
 
-            if (nal_type == 35) {//aud
-                parsing_sample = 0;
-                read_pos += 4;
-                continue;
-            }
+static int add_nal_unit(track_struct *track_data, int offset, int size)
+{
+    nal_unit_struct *unit;
 
-            if (nal_type == 32 || nal_type == 33 || nal_type == 34) {  // nal_type == 20
-                fprintf(stderr,"STARTING NAL TYPE: 0x%x  SAVING POS:%d\n", nal_type, write_pos);
-            }
+    if (track_data->nal_unit_count >= track_data->nal_unit_capacity) {
+        int capacity = track_data->nal_unit_capacity ? track_data->nal_unit_capacity * 2 : MAX_FRAGMENTS * 4;
+        nal_unit_struct *units = (nal_unit_struct*)realloc(track_data->nal_units, sizeof(nal_unit_struct)*capacity);
+        if (!units) {
+            return -1;
+        }
+        track_data->nal_units = units;
+        track_data->nal_unit_capacity = capacity;
+    }
+    unit = &track_data->nal_units[track_data->nal_unit_count++];
+    unit->offset = offset;
+    unit->size = size;
+    return 0;
+}
 
-            saved_position = write_pos;
-            *(sample_buffer+write_pos+0) = 0xf0;
-            *(sample_buffer+write_pos+1) = 0x0d;
-            *(sample_buffer+write_pos+2) = 0xf0;
-            *(sample_buffer+write_pos+3) = 0x0d;
-            parsing_sample = 1;
-            read_pos += 4;
-            write_pos += NALSIZE_SIZE;
-        } else if (input_buffer[read_pos+0] == 0x00 &&
-                   input_buffer[read_pos+1] == 0x00 &&
-                   input_buffer[read_pos+2] == 0x01) {
-
-            nal_type = (input_buffer[read_pos+3] & 0x7f) >> 1;
-            if (parsing_sample) {
-                sample_size = write_pos - saved_position - NALSIZE_SIZE;
-                *(sample_buffer+saved_position+0) = (sample_size >> 24) & 0xff;
-                *(sample_buffer+saved_position+1) = (sample_size >> 16) & 0xff;
-                *(sample_buffer+saved_position+2) = (sample_size >> 8) & 0xff;
-                *(sample_buffer+saved_position+3) = sample_size & 0xff;
-                parsing_sample = 0;
-            }
+// list the nal units of an annex-b access unit that go into the mp4 sample,
+// returns the sample size once each unit carries a length instead of a start code
+static int collect_nal_units(track_struct *track_data, uint8_t *input_buffer, int input_buffer_size, int scan_from, int is_hevc)
+{
+    int sample_size = 0;
+    int start_code_pos = 0;
+    int nal_start;
 
-            if (nal_type == 35) {//aud
-                parsing_sample = 0;
-                read_pos += 3;
-                continue;
-            }
+    nal_start = find_next_nal(input_buffer, scan_from, input_buffer_size, &start_code_pos);
+    while (nal_start >= 0 && nal_start < input_buffer_size) {
+        int next_nal;
+        int nal_end;
+        int nal_type;
 
-            if (nal_type == 32 || nal_type == 33 || nal_type == 34) {
-                fprintf(stderr,"STARTING NAL TYPE: 0x%x  SAVING POS:%d\n", nal_type, write_pos);
-            }
-            saved_position = write_pos;
-            *(sample_buffer+write_pos+0) = 0xf0;
-            *(sample_buffer+write_pos+1) = 0x0d;
-            *(sample_buffer+write_pos+2) = 0xf0;
-            *(sample_buffer+write_pos+3) = 0x0d;
-            parsing_sample = 1;
-            read_pos += 3;
-            write_pos += NALSIZE_SIZE;
+        next_nal = find_next_nal(input_buffer, nal_start, input_buffer_size, &start_code_pos);
+        if (next_nal >= 0) {
+            nal_end = start_code_pos;
+        } else {
+            nal_end = input_buffer_size;
+        }
+
+        if (is_hevc) {
+            nal_type = (input_buffer[nal_start] & 0x7f) >> 1;
         } else {
-            if (parsing_sample) {
-                sample_buffer[write_pos] = input_buffer[read_pos];
-                write_pos++;
+            nal_type = input_buffer[nal_start] & 0x1f;
+        }
+        if (keep_nal_unit(nal_type, sample_size, is_hevc)) {
+            if (add_nal_unit(track_data, nal_start, nal_end - nal_start) < 0) {
+                break;
             }
-            read_pos++;
+            sample_size += NALSIZE_SIZE + nal_end - nal_start;
         }
+        nal_start = next_nal;
     }
-    if (parsing_sample) {
-        sample_size = write_pos - saved_position - NALSIZE_SIZE;
-        *(sample_buffer+saved_position+0) = ((uint32_t)sample_size >> 24) & 0xff;
-        *(sample_buffer+saved_position+1) = ((uint32_t)sample_size >> 16) & 0xff;
-        *(sample_buffer+saved_position+2) = ((uint32_t)sample_size >> 8) & 0xff;
-        *(sample_buffer+saved_position+3) = (uint32_t)sample_size & 0xff;
-    }
-    return write_pos;
-}
-
-static int replace_startcode_with_size_h264(uint8_t *input_buffer, int input_buffer_size, uint8_t *output_buffer, int max_output_buffer_size)
-{
-    int parsing_sample = 0;
-    uint8_t *sample_buffer = output_buffer;
-    int saved_position = 0;
-    int sample_size;
-    int read_pos = 0;
-    int write_pos = 0;
-
-    while (read_pos < input_buffer_size) {
-        if (input_buffer[read_pos+0] == 0x00 &&
-            input_buffer[read_pos+1] == 0x00 &&
-            input_buffer[read_pos+2] == 0x00 &&
-            input_buffer[read_pos+3] == 0x01) {
-            int nal_type = input_buffer[read_pos+4] & 0x1f;
-            if (parsing_sample) {
-                sample_size = write_pos - saved_position - NALSIZE_SIZE;
-                *(sample_buffer+saved_position+0) = (sample_size >> 24) & 0xff;
-                *(sample_buffer+saved_position+1) = (sample_size >> 16) & 0xff;
-                *(sample_buffer+saved_position+2) = (sample_size >> 8) & 0xff;
-                *(sample_buffer+saved_position+3) = sample_size & 0xff;
-                parsing_sample = 0;
-            }
-            if (nal_type == 9) {
-                parsing_sample = 0;
-                read_pos += 4;
-                continue;
-            }
+    return sample_size;
+}
 
-            // enable this code to skip including sps/pps inline with the content- it doesn't hurt to have it there
-            /*if (nal_type == 7 || nal_type == 8) {  // skip out on the sps/pps
-                parsing_sample = 0;
-                read_pos += 4;
-                continue;
-            }*/
+// same list driven by the nal index that came with the frame, no rescan
+static int collect_indexed_nal_units(track_struct *track_data, uint8_t *input_buffer, int input_buffer_size, nal_index_struct *nal_index, int is_hevc)
+{
+    int sample_size = 0;
+    int n;
 
-            if (nal_type == 7 || nal_type == 8 || nal_type == 5) {
-                fprintf(stderr,"STARTING NAL TYPE: 0x%x  SAVING POS:%d\n", nal_type, write_pos);
-            }
-            saved_position = write_pos;
-            *(sample_buffer+write_pos+0) = 0x00;
-            *(sample_buffer+write_pos+1) = 0x00;
-            *(sample_buffer+write_pos+2) = 0x00;
-            *(sample_buffer+write_pos+3) = 0x01;
-            parsing_sample = 1;
-            read_pos += 4;
-            write_pos += NALSIZE_SIZE;
-        } else if (input_buffer[read_pos+0] == 0x00 &&
-                   input_buffer[read_pos+1] == 0x00 &&
-                   input_buffer[read_pos+2] == 0x01) {
-            int nal_type = input_buffer[read_pos+3] & 0x1f;
-            if (parsing_sample) {
-                sample_size = write_pos - saved_position - NALSIZE_SIZE;
-                *(sample_buffer+saved_position+0) = (sample_size >> 24) & 0xff;
-                *(sample_buffer+saved_position+1) = (sample_size >> 16) & 0xff;
-                *(sample_buffer+saved_position+2) = (sample_size >> 8) & 0xff;
-                *(sample_buffer+saved_position+3) = sample_size & 0xff;
-                parsing_sample = 0;
-            }
+    for (n = 0; n < nal_index->count; n++) {
+        nal_unit_struct *unit = &nal_index->nal[n];
 
-            if (nal_type == 9) {
-                parsing_sample = 0;
-                read_pos += 3;
-                continue;
-            }
+        if (!keep_nal_unit(unit->type, sample_size, is_hevc)) {
+            continue;
+        }
+        if (add_nal_unit(track_data, unit->offset, unit->size) < 0) {
+            return sample_size;
+        }
+        sample_size += NALSIZE_SIZE + unit->size;
+    }
+    if (nal_index->truncated && nal_index->count > 0) {
+        // the units past MAX_NAL_UNITS were never indexed, pick them up from the next start code
+        nal_unit_struct *last = &nal_index->nal[nal_index->count - 1];
 
-            // enable this code to skip including sps/pps inline with the content- it doesn't hurt to have it there
-            /*if (nal_type == 7 || nal_type == 8) {  // skip out on the sps/pps
-                parsing_sample = 0;
-                read_pos += 3;
-                continue;
-            }*/
+        sample_size += collect_nal_units(track_data, input_buffer, input_buffer_size, last->offset + last->size, is_hevc);
+    }
+    return sample_size;
+}
 
-            if (nal_type == 7 || nal_type == 8 || nal_type == 5) {
-                fprintf(stderr,"STARTING NAL TYPE: 0x%x  SAVING POS:%d\n", nal_type, write_pos);
-            }
-            saved_position = write_pos;
-            *(sample_buffer+write_pos+0) = 0x00;
-            *(sample_buffer+write_pos+1) = 0x00;
-            *(sample_buffer+write_pos+2) = 0x00;
-            *(sample_buffer+write_pos+3) = 0x01;
-            parsing_sample = 1;
-            read_pos += 3;
-            write_pos += NALSIZE_SIZE;
-        } else {
-            if (parsing_sample) {
-                sample_buffer[write_pos] = input_buffer[read_pos];
-                write_pos++;
-            }
-            read_pos++;
-        }
+// hold on to the frame, or copy it when it doesn't come from a pool
+static uint8_t *keep_fragment_buffer(uint8_t *fragment_buffer, int fragment_buffer_size, void *buffer_pool)
+{
+    uint8_t *kept;
+
+    if (buffer_pool && memory_ref(buffer_pool, fragment_buffer) == 0) {
+        return fragment_buffer;
     }
-    if (parsing_sample) {
-        sample_size = write_pos - saved_position - NALSIZE_SIZE;
-        *(sample_buffer+saved_position+0) = ((uint32_t)sample_size >> 24) & 0xff;
-        *(sample_buffer+saved_position+1) = ((uint32_t)sample_size >> 16) & 0xff;
-        *(sample_buffer+saved_position+2) = ((uint32_t)sample_size >> 8) & 0xff;
-        *(sample_buffer+saved_position+3) = (uint32_t)sample_size & 0xff;
+    kept = (uint8_t*)malloc(fragment_buffer_size);
+    if (kept) {
+        memcpy(kept, fragment_buffer, fragment_buffer_size);
     }
-    return write_pos;
+    return kept;
 }
 
 int fmp4_video_fragment_add(fragment_file_struct *fmp4,
                             uint8_t *fragment_buffer,
                             int fragment_buffer_size,
+                            void *buffer_pool,
                             double fragment_timestamp,
                             int fragment_duration,
-                            int64_t fragment_composition_time)
+                            int64_t fragment_composition_time,
+                            nal_index_struct *nal_index)
 {
     int vtid = fmp4->video_track_id-1;
     track_struct *track_data = (track_struct*)&fmp4->track_data[vtid];
     int frag = track_data->fragment_count;
-    uint8_t *new_frag;
+    int is_hevc = (fmp4->video_media_type == MEDIA_TYPE_HEVC);
+    fragment_struct *fragment;
+    uint8_t *kept;
     int updated_fragment_buffer_size;
 
     if (frag >= MAX_FRAGMENTS) {
@@ -1650,37 +1612,32 @@ int fmp4_video_fragment_add(fragment_file_struct *fmp4,
         exit(0);
     }
 
+    kept = keep_fragment_buffer(fragment_buffer, fragment_buffer_size, buffer_pool);
+    if (!kept) {
+        fprintf(stderr,"MP4CORE: ERROR - UNABLE TO KEEP VIDEO FRAGMENT: %d!  VTID:%d\n", frag, vtid);
+        return -1;
+    }
+
     if (frag == 0) {
         track_data->fragment_start_timestamp = fragment_timestamp * fmp4->timescale;
     }
 
-    new_frag = (uint8_t*)malloc(fragment_buffer_size*2);
-
-    memset(new_frag,0,fragment_buffer_size*2); // debugging
-
-    if (fmp4->video_media_type == MEDIA_TYPE_HEVC) {
-        updated_fragment_buffer_size = replace_startcode_with_size_hevc(fragment_buffer, fragment_buffer_size, new_frag, fragment_buffer_size*2);
+    fragment = &track_data->fragments[frag];
+    fragment->first_nal = track_data->nal_unit_count;
+    if (nal_index && nal_index->count > 0) {
+        updated_fragment_buffer_size = collect_indexed_nal_units(track_data, kept, fragment_buffer_size, nal_index, is_hevc);
     } else {
-        updated_fragment_buffer_size = replace_startcode_with_size_h264(fragment_buffer, fragment_buffer_size, new_frag, fragment_buffer_size*2);
-    }
-
-    /*
-    static FILE *temp = NULL;
-    if (!temp) {
-        temp = fopen("debug.264","w");
-    }
-    if (temp) {
-        fwrite(new_frag, 1, updated_fragment_buffer_size, temp);
-        //fwrite(fragment_buffer, 1, fragment_buffer_size, temp);
-        fflush(temp);
+        updated_fragment_buffer_size = collect_nal_units(track_data, kept, fragment_buffer_size, 0, is_hevc);
     }
-    */
+    fragment->nal_count = track_data->nal_unit_count - fragment->first_nal;
 
-    track_data->fragments[frag].fragment_buffer = new_frag;
-    track_data->fragments[frag].fragment_buffer_size = updated_fragment_buffer_size;
-    track_data->fragments[frag].fragment_duration = fragment_duration;
-    track_data->fragments[frag].fragment_timestamp = fragment_timestamp * fmp4->timescale;
-    track_data->fragments[frag].fragment_composition_time = fragment_composition_time;
+    fragment->fragment_buffer = kept;
+    fragment->fragment_pool = (kept == fragment_buffer) ? buffer_pool : NULL;
+    fragment->fragment_buffer_size = updated_fragment_buffer_size;
+    fragment->fragment_offset = 0;
+    fragment->fragment_duration = fragment_duration;
+    fragment->fragment_timestamp = fragment_timestamp * fmp4->timescale;
+    fragment->fragment_composition_time = fragment_composition_time;
 
     track_data->fragment_count++;
 
@@ -1690,10 +1647,12 @@ int fmp4_video_fragment_add(fragment_file_struct *fmp4,
 int fmp4_audio_fragment_add(fragment_file_struct *fmp4,
                             uint8_t *fragment_buffer,
                             int fragment_buffer_size,
+                            void *buffer_pool,
                             double fragment_timestamp,
                             int fragment_duration)
 {
-    uint8_t *new_frag;
+    fragment_struct *fragment;
+    uint8_t *kept;
     int header_size;
 #define ADTS_HEADER_SIZE 7
 
@@ -1706,24 +1665,28 @@ int fmp4_audio_fragment_add(fragment_file_struct *fmp4,
         exit(0);
     }
 
+    kept = keep_fragment_buffer(fragment_buffer, fragment_buffer_size, buffer_pool);
+    if (!kept) {
+        fprintf(stderr,"MP4CORE: ERROR - UNABLE TO KEEP AUDIO FRAGMENT: %d!  ATID:%d\n", frag, atid);
+        return -1;
+    }
+
     if (frag == 0) {
         track_data->fragment_start_timestamp = fragment_timestamp * fmp4->timescale; // should this be sampling rate instead?
     }
 
-    new_frag = (uint8_t*)malloc(fragment_buffer_size*2);
-
-    memset(new_frag,0,fragment_buffer_size*2);  // debugging
-
     header_size = ADTS_HEADER_SIZE + ((fragment_buffer[1] & 0x01) ? 0 : 2);  // check for crc
 
-    fragment_buffer_size -= header_size;
-    memcpy(new_frag, fragment_buffer + header_size, fragment_buffer_size);
-
-    track_data->fragments[frag].fragment_buffer = new_frag;
-    track_data->fragments[frag].fragment_buffer_size = fragment_buffer_size;
-    track_data->fragments[frag].fragment_duration = fragment_duration;
-    track_data->fragments[frag].fragment_timestamp = fragment_timestamp * fmp4->timescale;  // should this be sampling rate?
-    track_data->fragments[frag].fragment_composition_time = 0;
+    fragment = &track_data->fragments[frag];
+    fragment->fragment_buffer = kept;
+    fragment->fragment_pool = (kept == fragment_buffer) ? buffer_pool : NULL;
+    fragment->fragment_buffer_size = fragment_buffer_size - header_size;
+    fragment->fragment_offset = header_size;
+    fragment->first_nal = 0;
+    fragment->nal_count = 0;
+    fragment->fragment_duration = fragment_duration;
+    fragment->fragment_timestamp = fragment_timestamp * fmp4->timescale;  // should this be sampling rate?
+    fragment->fragment_composition_time = 0;
 
     track_data->fragment_count++;
 
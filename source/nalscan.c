@@ -0,0 +1,271 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NALSCAN_X86
+#endif
+
+#include "nalscan.h"
+
+typedef int (*START_CODE_SCANNER)(uint8_t *buffer, int offset, int size);
+
+static int find_start_code_scalar(uint8_t *buffer, int offset, int size)
+{
+    int pos;
+
+    for (pos = offset; pos + 2 < size; pos++) {
+        if (buffer[pos+2] > 1) {
+            // neither of the next two positions can start a start code
+            pos += 2;
+            continue;
+        }
+        if (buffer[pos] == 0x00 &&
+            buffer[pos+1] == 0x00 &&
+            buffer[pos+2] == 0x01) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+#if defined(NALSCAN_X86)
+// compare three shifted loads so every lane tests buffer[i..i+2] == 00 00 01
+static int find_start_code_sse2(uint8_t *buffer, int offset, int size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    int pos = offset;
+
+    while (pos + 18 <= size) {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(buffer + pos));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(buffer + pos + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i*)(buffer + pos + 2));
+        __m128i match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+                                                    _mm_cmpeq_epi8(b1, zero)),
+                                      _mm_cmpeq_epi8(b2, one));
+        int mask = _mm_movemask_epi8(match);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+    return find_start_code_scalar(buffer, pos, size);
+}
+
+__attribute__((target("avx2")))
+static int find_start_code_avx2(uint8_t *buffer, int offset, int size)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    int pos = offset;
+
+    while (pos + 34 <= size) {
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(buffer + pos));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(buffer + pos + 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i*)(buffer + pos + 2));
+        __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                                                          _mm256_cmpeq_epi8(b1, zero)),
+                                         _mm256_cmpeq_epi8(b2, one));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(match);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+    return find_start_code_sse2(buffer, pos, size);
+}
+#endif
+
+static START_CODE_SCANNER start_code_scanner = NULL;
+static const char *start_code_scanner_label = "scalar";
+
+static START_CODE_SCANNER select_start_code_scanner(void)
+{
+    // every thread resolves to the same function, so a racing first call is harmless
+    if (!start_code_scanner) {
+        START_CODE_SCANNER scanner = find_start_code_scalar;
+        const char *label = "scalar";
+#if defined(NALSCAN_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            scanner = find_start_code_avx2;
+            label = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            scanner = find_start_code_sse2;
+            label = "sse2";
+        }
+#endif
+        start_code_scanner_label = label;
+        start_code_scanner = scanner;
+    }
+    return start_code_scanner;
+}
+
+int find_start_code(uint8_t *buffer, int offset, int size)
+{
+    if (!buffer || offset < 0 || offset + 3 > size) {
+        return -1;
+    }
+    return select_start_code_scanner()(buffer, offset, size);
+}
+
+int find_next_nal(uint8_t *buffer, int offset, int size, int *start_code_pos)
+{
+    int pos = find_start_code(buffer, offset, size);
+
+    if (pos < 0) {
+        return -1;
+    }
+    if (start_code_pos) {
+        // a zero in front of 00 00 01 makes it a 4 byte start code
+        if (pos > offset && buffer[pos-1] == 0x00) {
+            *start_code_pos = pos - 1;
+        } else {
+            *start_code_pos = pos;
+        }
+    }
+    return pos + 3;
+}
+
+const char *start_code_scanner_name(void)
+{
+    select_start_code_scanner();
+    return start_code_scanner_label;
+}
+
+int build_nal_index(uint8_t *buffer, int size, int is_hevc, nal_index_struct *index)
+{
+    int start_code_pos = 0;
+    int nal_start;
+
+    if (!index) {
+        return 0;
+    }
+    index->count = 0;
+    index->truncated = 0;
+
+    nal_start = find_next_nal(buffer, 0, size, &start_code_pos);
+    while (nal_start >= 0 && nal_start < size) {
+        nal_unit_struct *unit;
+        int next_nal;
+
+        if (index->count >= MAX_NAL_UNITS) {
+            index->truncated = 1;
+            break;
+        }
+        unit = &index->nal[index->count++];
+        unit->offset = nal_start;
+        unit->start_code_size = nal_start - start_code_pos;
+        if (is_hevc) {
+            unit->type = (buffer[nal_start] & 0x7f) >> 1;
+        } else {
+            unit->type = buffer[nal_start] & 0x1f;
+        }
+
+        next_nal = find_next_nal(buffer, nal_start, size, &start_code_pos);
+        if (next_nal >= 0) {
+            unit->size = start_code_pos - nal_start;
+        } else {
+            unit->size = size - nal_start;
+        }
+        nal_start = next_nal;
+    }
+    return index->count;
+}
+
+nal_unit_struct *find_nal_unit(nal_index_struct *index, int type)
+{
+    int i;
+
+    if (!index) {
+        return NULL;
+    }
+    for (i = 0; i < index->count; i++) {
+        if (index->nal[i].type == type) {
+            return &index->nal[i];
+        }
+    }
+    return NULL;
+}
+
+int nal_index_max_temporal_id(uint8_t *buffer, nal_index_struct *index)
+{
+    int i;
+
+    if (!buffer || !index) {
+        return -1;
+    }
+    for (i = 0; i < index->count; i++) {
+        nal_unit_struct *unit = &index->nal[i];
+
+        // sps: 2 byte nal header, then sps_video_parameter_set_id(4) sps_max_sub_layers_minus1(3)
+        if (unit->type == 33 && unit->size >= 3) {
+            return (buffer[unit->offset+2] >> 1) & 0x07;
+        }
+    }
+    return -1;
+}
+
+int nal_index_is_reference(uint8_t *buffer, nal_index_struct *index, int is_hevc, int max_temporal_id)
+{
+    int slices = 0;
+    int i;
+
+    if (!buffer || !index) {
+        return 1;
+    }
+    for (i = 0; i < index->count; i++) {
+        nal_unit_struct *unit = &index->nal[i];
+
+        if (is_hevc) {
+            // vcl types 0-31, the even ones below 16 are the sub-layer non-reference pictures
+            if (unit->type > 31) {
+                continue;
+            }
+            if (unit->type >= 16 || (unit->type & 1)) {
+                return 1;
+            }
+            // a sub-layer non-reference picture can still be referenced from a higher sub-layer,
+            // so it only goes when it sits on the highest one
+            if (max_temporal_id < 0 || unit->size < 2 ||
+                (buffer[unit->offset+1] & 0x07) - 1 < max_temporal_id) {
+                return 1;
+            }
+        } else {
+            if (unit->type != 1 && unit->type != 5) {
+                continue;
+            }
+            // nal_ref_idc
+            if (unit->type == 5 || (buffer[unit->offset] & 0x60)) {
+                return 1;
+            }
+        }
+        slices++;
+    }
+    return slices > 0 ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+/*****************************************************************************
+  Copyright (C) 2018-2020 John William
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111, USA.
+
+  This program is also available with customization/support packages.
+  For more information, please contact me at cannonbeachgoonie@gmail.com
+
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/uio.h>
+
+#include "segwriter.h"
+
+typedef struct _segment_writer_struct
+{
+    int                        fd;
+    uint8_t                    *chunk[SEGMENT_WRITER_CHUNKS];
+    // bytes buffered over all chunks, they fill in order
+    int                        buffered;
+    int                        error;
+    segment_writer_stats_struct stats;
+} segment_writer_struct;
+
+void *segment_writer_create(void)
+{
+    segment_writer_struct *sw;
+    int c;
+
+    sw = (segment_writer_struct*)malloc(sizeof(segment_writer_struct));
+    if (!sw) {
+        return NULL;
+    }
+    memset(sw, 0, sizeof(segment_writer_struct));
+    sw->fd = -1;
+    for (c = 0; c < SEGMENT_WRITER_CHUNKS; c++) {
+        if (posix_memalign((void**)&sw->chunk[c], 4096, SEGMENT_WRITER_CHUNK_SIZE) != 0) {
+            sw->chunk[c] = NULL;
+            segment_writer_destroy(sw);
+            return NULL;
+        }
+    }
+    return (void*)sw;
+}
+
+int segment_writer_destroy(void *writer)
+{
+    segment_writer_struct *sw = (segment_writer_struct*)writer;
+    int c;
+
+    if (!sw) {
+        return -1;
+    }
+    if (sw->fd >= 0) {
+        segment_writer_close(sw, NULL);
+    }
+    for (c = 0; c < SEGMENT_WRITER_CHUNKS; c++) {
+        free(sw->chunk[c]);
+    }
+    free(sw);
+    return 0;
+}
+
+int segment_writer_open(void *writer, const char *filename)
+{
+    segment_writer_struct *sw = (segment_writer_struct*)writer;
+
+    if (!sw || !filename || sw->fd >= 0) {
+        return -1;
+    }
+    sw->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (sw->fd < 0) {
+        syslog(LOG_ERR,"SEGWRITER: UNABLE TO OPEN %s (%s)\n", filename, strerror(errno));
+        return -1;
+    }
+    sw->buffered = 0;
+    sw->error = 0;
+    memset(&sw->stats, 0, sizeof(segment_writer_stats_struct));
+    return 0;
+}
+
+int segment_writer_is_open(void *writer)
+{
+    segment_writer_struct *sw = (segment_writer_struct*)writer;
+
+    if (!sw) {
+        return 0;
+    }
+    return sw->fd >= 0;
+}
+
+int segment_writer_flush(void *writer)
+{
+    segment_writer_struct *sw = (segment_writer_struct*)writer;
+    struct iovec iov[SEGMENT_WRITER_CHUNKS];
+    int iov_count = 0;
+    int first = 0;
+    int remaining;
+
+    if (!sw || sw->fd < 0) {
+        return -1;
+    }
+    remaining = sw->buffered;
+    while (remaining > 0) {
+        int size = remaining > SEGMENT_WRITER_CHUNK_SIZE ? SEGMENT_WRITER_CHUNK_SIZE : remaining;
+        iov[iov_count].iov_base = sw->chunk[iov_count];
+        iov[iov_count].iov_len = size;
+        iov_count++;
+        remaining -= size;
+    }
+
+    while (first < iov_count && !sw->error) {
+        ssize_t written = writev(sw->fd, &iov[first], iov_count - first);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // same as the stdio path, a failed segment is dropped and the muxer carries on
+            syslog(LOG_ERR,"SEGWRITER: WRITE FAILED (%s)\n", strerror(errno));
+            sw->error = 1;
+            break;
+        }
+        sw->stats.write_calls++;
+        sw->stats.bytes_written += written;
+        while (first < iov_count && written >= (ssize_t)iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if (first < iov_count) {
+            iov[first].iov_base = (uint8_t*)iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+    sw->buffered = 0;
+    return sw->error ? -1 : 0;
+}
+
+int segment_writer_write(void *writer, uint8_t *data, int size)
+{
+    segment_writer_struct *sw = (segment_writer_struct*)writer;
+
+    if (!sw || sw->fd < 0 || !data || size < 0) {
+        return -1;
+    }
+    while (size > 0) {
+        int chunk = sw->buffered / SEGMENT_WRITER_CHUNK_SIZE;
+        int offset = sw->buffered % SEGMENT_WRITER_CHUNK_SIZE;
+        int copy = SEGMENT_WRITER_CHUNK_SIZE - offset;
+
+        if (copy > size) {
+            copy = size;
+        }
+        memcpy(sw->chunk[chunk] + offset, data, copy);
+        sw->buffered += copy;
+        data += copy;
+        size -= copy;
+        if (sw->buffered == SEGMENT_WRITER_CHUNK_SIZE * SEGMENT_WRITER_CHUNKS) {
+            segment_writer_flush(sw);
+        }
+    }
+    return sw->error ? -1 : 0;
+}
+
+int segment_writer_writev(void *writer, const struct iovec *iov, int iov_count)
+{
+    int i;
+
+    if (!writer || !iov || iov_count < 0) {
+        return -1;
+    }
+    for (i = 0; i < iov_count; i++) {
+        if (segment_writer_write(writer, (uint8_t*)iov[i].iov_base, iov[i].iov_len) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int segment_writer_close(void *writer, segment_writer_stats_struct *stats)
+{
+    segment_writer_struct *sw = (segment_writer_struct*)writer;
+    int retval;
+
+    if (!sw || sw->fd < 0) {
+        return -1;
+    }
+    retval = segment_writer_flush(sw);
+    if (close(sw->fd) < 0) {
+        retval = -1;
+    }
+    sw->fd = -1;
+    if (stats) {
+        *stats = sw->stats;
+    }
+    return retval;
+}
@@ -93,6 +93,7 @@ void *audio_encode_thread(void *context)
     int source_size;
     int64_t encoded_frame_count = 0;
     int output_size;
+    int restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
 #define MAX_SOURCE_BUFFER_SIZE 65535
 #define MAX_OUTPUT_BUFFER_SIZE 65535
 
@@ -106,8 +107,7 @@ void *audio_encode_thread(void *context)
     while (audio_encode_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodeaudio[audio_stream]->input_queue);
         while (!msg && audio_encode_thread_running) {
-            usleep(1000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodeaudio[audio_stream]->input_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->encodeaudio[audio_stream]->input_queue, QUEUE_WAIT_TIMEOUT);
         }
 
         if (!audio_encode_thread_running) {
@@ -124,6 +124,24 @@ void *audio_encode_thread(void *context)
             goto cleanup_audio_encode_thread;
         }
 
+        if (msg->source_discontinuity) {
+            // the new timeline got here first, so nothing from before it is left to drop
+            restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
+        } else if (restart_count != __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE)) {
+            // pcm still queued from before the sync recovery is on the old timeline, drop it
+            // up to the first buffer the decoder sent after re-anchoring
+            restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
+            while (msg && !msg->source_discontinuity) {
+                memory_return(core->raw_audio_pool, msg->buffer);
+                msg->buffer = NULL;
+                memory_return(core->fillet_msg_pool, msg);
+                msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodeaudio[audio_stream]->input_queue);
+            }
+            if (!msg) {
+                continue;
+            }
+        }
+
         channels = msg->channels;
         if (core->cd->enable_stereo) {
             output_channels = 2;
@@ -134,6 +152,14 @@ void *audio_encode_thread(void *context)
         if (first_pts == -1) {
             first_pts = msg->first_pts;
         }
+        if (msg->source_discontinuity) {
+            // the decoder re-anchored after a sync recovery, samples still waiting
+            // for a full aac frame belong to the old timeline
+            first_pts = msg->first_pts;
+            encoded_frame_count = 0;
+            current_duration = 0;
+            source_buffer_size = 0;
+        }
 
         if (!audio_encoder_ready) {
             int audio_object_type;
@@ -237,6 +263,18 @@ cleanup_audio_encode_thread:
     return NULL;
 }
 
+static void return_decode_message(fillet_app_struct *core, dataqueue_message_struct *msg)
+{
+    sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
+
+    if (frame) {
+        memory_return(core->compressed_audio_pool, frame->buffer);
+        frame->buffer = NULL;
+        memory_return(core->frame_msg_pool, frame);
+    }
+    memory_return(core->fillet_msg_pool, msg);
+}
+
 void *audio_decode_thread(void *context)
 {
     startup_buffer_struct *startup = (startup_buffer_struct*)context;
@@ -269,6 +307,8 @@ void *audio_decode_thread(void *context)
     int64_t last_audio_pts = -1;
     int64_t last_data_amount = 0;
     int first_sync_sample = 1;
+    int restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
+    int source_discontinuity = 0;
 
     free(startup);
     startup = NULL;
@@ -278,25 +318,39 @@ void *audio_decode_thread(void *context)
     while (audio_decode_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->transaudio[audio_stream]->input_queue);
         while (!msg && audio_decode_thread_running) {
-            usleep(1000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->transaudio[audio_stream]->input_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->transaudio[audio_stream]->input_queue, QUEUE_WAIT_TIMEOUT);
         }
 
         if (!audio_decode_thread_running) {
             if (msg) {
-                sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
-                if (frame) {
-                    memory_return(core->compressed_audio_pool, frame->buffer);
-                    frame->buffer = NULL;
-                    memory_return(core->frame_msg_pool, frame);
-                    frame = NULL;
-                }
-                memory_return(core->fillet_msg_pool, msg);
+                return_decode_message(core, msg);
                 msg = NULL;
             }
             goto cleanup_audio_decoder_thread;
         }
 
+        if (restart_count != __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE)) {
+            // the sync thread was restarted, throw out the backlog and start the
+            // audio timeline over from the next frame like we do at startup
+            restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
+            while (msg) {
+                return_decode_message(core, msg);
+                msg = (dataqueue_message_struct*)dataqueue_take_back(core->transaudio[audio_stream]->input_queue);
+            }
+            if (audio_decoder_ready) {
+                avcodec_flush_buffers(decode_avctx);
+            }
+            first_decoded_pts = -1;
+            expected_audio_data = 0;
+            actual_audio_data = 0;
+            previous_delta_time = -1;
+            last_audio_pts = -1;
+            first_sync_sample = 1;
+            source_discontinuity = 1;
+            fprintf(stderr,"status: audio decoder flushed for sync recovery (%d)\n", restart_count);
+            continue;
+        }
+
         if (msg) {
             sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
             if (frame) {
@@ -442,7 +496,12 @@ void *audio_decode_thread(void *context)
                         last_full_time = full_time;
                         pts = decode_av_frame->pts;
                         if (first_decoded_pts == -1) {
-                            first_decoded_pts = pts;
+                            if (source_discontinuity) {
+                                // past a timestamp wrap the pts no longer lines up with the video timeline
+                                first_decoded_pts = full_time;
+                            } else {
+                                first_decoded_pts = pts;
+                            }
                         }
 
                         if (swr) {
@@ -601,6 +660,8 @@ void *audio_decode_thread(void *context)
                                 encode_msg->channels = decode_avctx->channels;
                                 encode_msg->sample_rate = decode_avctx->sample_rate;
                                 encode_msg->first_pts = first_decoded_pts;
+                                encode_msg->source_discontinuity = source_discontinuity;
+                                source_discontinuity = 0;
                                 dataqueue_put_front(core->encodeaudio[audio_stream]->input_queue, encode_msg);
                             } else {
                                 send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Message Buffers (RAW) - Restarting Service");
@@ -636,6 +697,8 @@ void *audio_decode_thread(void *context)
                                 encode_msg->channels = decode_avctx->channels;
                                 encode_msg->sample_rate = decode_avctx->sample_rate;
                                 encode_msg->first_pts = first_decoded_pts;
+                                encode_msg->source_discontinuity = source_discontinuity;
+                                source_discontinuity = 0;
                                 dataqueue_put_front(core->encodeaudio[audio_stream]->input_queue, encode_msg);
                             } else {
                                 send_direct_error(core, SIGNAL_DIRECT_ERROR_MSGPOOL, "Out of Message Buffers - Restarting Service");
@@ -77,6 +77,8 @@ typedef struct _x264_encoder_struct_ {
     int              height;
     int64_t          frame_count_pts;
     int64_t          frame_count_dts;
+    // frames skipped at the last sync recovery, the dts count catches up when that frame comes out
+    int64_t          reanchor_skip;
 } x264_encoder_struct;
 
 typedef struct _x265_encoder_struct_ {
@@ -92,6 +94,8 @@ typedef struct _x265_encoder_struct_ {
     x265_nal         *p_current_nal;
     int64_t          frame_count_pts;
     int64_t          frame_count_dts;
+    int64_t          reanchor_frame_count;
+    int64_t          reanchor_skip;
 } x265_encoder_struct;
 
 typedef struct _scale_struct_ {
@@ -112,6 +116,7 @@ typedef struct _encoder_opaque_struct_ {
     int64_t          splice_duration;
     int64_t          splice_duration_remaining;
     int64_t          frame_count_pts;
+    int              reanchor;
 } encoder_opaque_struct;
 
 typedef struct _signal_struct_ {
@@ -129,6 +134,56 @@ typedef struct _thread_start_struct_ {
 #define THUMBNAIL_WIDTH   176
 #define THUMBNAIL_HEIGHT  144
 
+// frame count that puts this frame back on the source timeline after a sync recovery,
+// the same mapping the encoder started out with
+static int64_t reanchor_frame_count(fillet_app_struct *core, dataqueue_message_struct *msg, int fps_num, int fps_den, int64_t current_frame_count)
+{
+    video_stream_struct *vstream = (video_stream_struct*)core->source_stream[0].video_stream;  // only one source stream
+    double ticks_per_frame_double = (double)90000.0/((double)30000.0/(double)1001.0);
+    int64_t frame_count;
+
+    if (fps_num > 0 && fps_den > 0) {
+        ticks_per_frame_double = (double)90000.0 * (double)fps_den / (double)fps_num;
+    }
+    frame_count = (int64_t)(((double)msg->dts - (double)vstream->first_timestamp) / ticks_per_frame_double + 0.5);
+    // a source whose timestamps were reset lands behind the output, which just carries on where it was
+    if (frame_count < current_frame_count) {
+        frame_count = current_frame_count;
+    }
+    return frame_count;
+}
+
+// after a sync recovery the frames still queued for a thread are from the old timeline- they are dropped
+// up to the one flagged with source_discontinuity, which starts the new timeline and is handed back
+static dataqueue_message_struct *flush_recovery_backlog(fillet_app_struct *core, void *queue, dataqueue_message_struct *msg, int *restart_count)
+{
+    int current_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
+    int dropped = 0;
+
+    if (msg && msg->source_discontinuity) {
+        // the new timeline got here first, so nothing from before it is left to drop
+        *restart_count = current_count;
+        return msg;
+    }
+    if (*restart_count == current_count) {
+        return msg;
+    }
+    *restart_count = current_count;
+    while (msg && !msg->source_discontinuity) {
+        if (msg->caption_buffer) {
+            free(msg->caption_buffer);
+            msg->caption_buffer = NULL;
+        }
+        memory_return(core->raw_video_pool, msg->buffer);
+        msg->buffer = NULL;
+        memory_return(core->fillet_msg_pool, msg);
+        dropped++;
+        msg = (dataqueue_message_struct*)dataqueue_take_back(queue);
+    }
+    fprintf(stderr,"status: dropped %d queued video frames for sync recovery (%d)\n", dropped, current_count);
+    return msg;
+}
+
 int video_sink_frame_callback(fillet_app_struct *core, uint8_t *new_buffer, int sample_size, int64_t pts, int64_t dts, int source, int splice_point, int64_t splice_duration, int64_t splice_duration_remaining);
 
 int save_frame_as_jpeg(fillet_app_struct *core, AVFrame *pFrame)
@@ -172,8 +227,7 @@ void *video_thumbnail_thread(void *context)
     while (video_thumbnail_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodevideo->thumbnail_queue);
         while (!msg && video_thumbnail_thread_running) {
-            usleep(10000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodevideo->thumbnail_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->encodevideo->thumbnail_queue, QUEUE_WAIT_TIMEOUT);
         }
 
         scale_struct *thumbnail_output = (scale_struct*)msg->buffer;
@@ -232,6 +286,7 @@ void *video_encode_thread_x265(void *context)
     fillet_app_struct *core = (fillet_app_struct*)start->core;
     dataqueue_message_struct *msg;
     int current_encoder = start->index;
+    int restart_count;
     x265_encoder_struct x265_data[MAX_TRANS_OUTPUTS];
 
     free(start);
@@ -244,14 +299,16 @@ void *video_encode_thread_x265(void *context)
     x265_data[current_encoder].p_current_nal = NULL;
     x265_data[current_encoder].frame_count_pts = 1;
     x265_data[current_encoder].frame_count_dts = 0;
+    x265_data[current_encoder].reanchor_frame_count = -1;
+    x265_data[current_encoder].reanchor_skip = 0;
+    restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
 
     while (video_encode_thread_running) {
         // loop across the input queues and feed the encoders
         {
             msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodevideo->input_queue[current_encoder]);
             while (!msg && video_encode_thread_running) {
-                usleep(100);
-                msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodevideo->input_queue[current_encoder]);
+                msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->encodevideo->input_queue[current_encoder], QUEUE_WAIT_TIMEOUT);
             }
 
             int output_width = core->cd->transvideo_info[current_encoder].width;
@@ -430,6 +487,11 @@ void *video_encode_thread_x265(void *context)
                 goto cleanup_video_encode_thread;
             }
 
+            msg = flush_recovery_backlog(core, core->encodevideo->input_queue[current_encoder], msg, &restart_count);
+            if (!msg) {
+                continue;
+            }
+
             uint8_t *video;
             int output_size;
             int64_t pts;
@@ -464,6 +526,21 @@ void *video_encode_thread_x265(void *context)
             x265_data[current_encoder].pic_in->planes[0] = video;
             x265_data[current_encoder].pic_in->planes[1] = video + (output_width * output_height);
             x265_data[current_encoder].pic_in->planes[2] = x265_data[current_encoder].pic_in->planes[1] + (owhalf*ohhalf);
+            if (msg->source_discontinuity) {
+                int64_t frame_count = reanchor_frame_count(core, msg,
+                                                           x265_data[current_encoder].param->fpsNum,
+                                                           x265_data[current_encoder].param->fpsDenom,
+                                                           x265_data[current_encoder].frame_count_pts);
+
+                x265_data[current_encoder].reanchor_skip = frame_count - x265_data[current_encoder].frame_count_pts;
+                x265_data[current_encoder].reanchor_frame_count = frame_count;
+                x265_data[current_encoder].frame_count_pts = frame_count;
+                x265_data[current_encoder].pic_in->sliceType = X265_TYPE_IDR;
+                syslog(LOG_INFO,"SYNC RECOVERY(%d)- INSERTING IDR FRAME, SKIPPING %ld FRAMES\n",
+                       current_encoder, x265_data[current_encoder].reanchor_skip);
+            } else {
+                x265_data[current_encoder].pic_in->sliceType = X265_TYPE_AUTO;
+            }
             x265_data[current_encoder].pic_in->pts = x265_data[current_encoder].frame_count_pts;
 
             nal_count = 0;
@@ -559,6 +636,13 @@ void *video_encode_thread_x265(void *context)
                 */
 
                 double opaque_double = (double)x265_data[current_encoder].pic_recon->pts;
+                // the idr closes off everything queued before it, so it is the first frame on the new timeline
+                if (x265_data[current_encoder].reanchor_frame_count != -1 &&
+                    x265_data[current_encoder].pic_recon->pts == x265_data[current_encoder].reanchor_frame_count) {
+                    x265_data[current_encoder].frame_count_dts += x265_data[current_encoder].reanchor_skip;
+                    x265_data[current_encoder].reanchor_frame_count = -1;
+                    x265_data[current_encoder].reanchor_skip = 0;
+                }
                 pts = (int64_t)((double)opaque_double * (double)ticks_per_frame_double) + (int64_t)vstream->first_timestamp;
                 dts = (int64_t)((double)x265_data[current_encoder].frame_count_dts * (double)ticks_per_frame_double) + (int64_t)vstream->first_timestamp;
 
@@ -600,6 +684,7 @@ void *video_encode_thread_x264(void *context)
     fillet_app_struct *core = (fillet_app_struct*)start->core;
     dataqueue_message_struct *msg;
     int current_encoder = start->index;
+    int restart_count;
     x264_encoder_struct x264_data[MAX_TRANS_OUTPUTS];
 #define MAX_SEI_PAYLOAD_SIZE 512
 
@@ -607,14 +692,15 @@ void *video_encode_thread_x264(void *context)
     x264_data[current_encoder].h = NULL;
     x264_data[current_encoder].frame_count_pts = 1;
     x264_data[current_encoder].frame_count_dts = 0;
+    x264_data[current_encoder].reanchor_skip = 0;
+    restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
 
     while (video_encode_thread_running) {
         // loop across the input queues and feed the encoders
         {
             msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodevideo->input_queue[current_encoder]);
             while (!msg && video_encode_thread_running) {
-                usleep(100);
-                msg = (dataqueue_message_struct*)dataqueue_take_back(core->encodevideo->input_queue[current_encoder]);
+                msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->encodevideo->input_queue[current_encoder], QUEUE_WAIT_TIMEOUT);
             }
 
             if (!x264_data[current_encoder].h) {
@@ -790,6 +876,11 @@ void *video_encode_thread_x264(void *context)
                 goto cleanup_video_encode_thread;
             }
 
+            msg = flush_recovery_backlog(core, core->encodevideo->input_queue[current_encoder], msg, &restart_count);
+            if (!msg) {
+                continue;
+            }
+
             uint8_t *video;
             int output_size;
             int64_t pts;
@@ -811,7 +902,20 @@ void *video_encode_thread_x264(void *context)
                     splice_duration,
                     splice_duration_remaining);
 
-            x264_data[current_encoder].pic.i_pts = msg->pts;
+            if (msg->source_discontinuity) {
+                int64_t frame_count = reanchor_frame_count(core, msg,
+                                                           x264_data[current_encoder].param.i_fps_num,
+                                                           x264_data[current_encoder].param.i_fps_den,
+                                                           x264_data[current_encoder].frame_count_pts);
+
+                x264_data[current_encoder].reanchor_skip = frame_count - x264_data[current_encoder].frame_count_pts;
+                x264_data[current_encoder].frame_count_pts = frame_count;
+                syslog(LOG_INFO,"SYNC RECOVERY(%d)- INSERTING IDR FRAME, SKIPPING %ld FRAMES\n",
+                       current_encoder, x264_data[current_encoder].reanchor_skip);
+            }
+
+            // the encoder needs increasing pts - the source pts can jump back on a sync recovery
+            x264_data[current_encoder].pic.i_pts = x264_data[current_encoder].frame_count_pts;
             x264_data[current_encoder].pic.i_dts = msg->dts;
 
             encoder_opaque_struct *opaque_data = (encoder_opaque_struct*)malloc(sizeof(encoder_opaque_struct));
@@ -820,6 +924,7 @@ void *video_encode_thread_x264(void *context)
                 opaque_data->splice_duration = splice_duration;
                 opaque_data->splice_duration_remaining = splice_duration_remaining;
                 opaque_data->frame_count_pts = x264_data[current_encoder].frame_count_pts;
+                opaque_data->reanchor = msg->source_discontinuity;
             }
 
             x264_data[current_encoder].pic.opaque = (void*)opaque_data;
@@ -882,6 +987,8 @@ void *video_encode_thread_x264(void *context)
                 syslog(LOG_INFO,"SCTE35(%d)- INSERTING IDR FRAME DURING SPLICE POINT: %d\n",
                        current_encoder, splice_point);
                 x264_data[current_encoder].pic.i_type = X264_TYPE_IDR;
+            } else if (msg->source_discontinuity) {
+                x264_data[current_encoder].pic.i_type = X264_TYPE_IDR;
             } else {
                 x264_data[current_encoder].pic.i_type = X264_TYPE_AUTO;
             }
@@ -938,6 +1045,10 @@ void *video_encode_thread_x264(void *context)
                     splice_duration_remaining = opaque_output->splice_duration_remaining;
                     opaque_int64 = opaque_output->frame_count_pts;
                     //int64_t opaque_int64 = (int64_t)x264_data[current_encoder].pic_out.opaque;
+                    if (opaque_output->reanchor) {
+                        x264_data[current_encoder].frame_count_dts += x264_data[current_encoder].reanchor_skip;
+                        x264_data[current_encoder].reanchor_skip = 0;
+                    }
                 }
                 double opaque_double = (double)opaque_int64;
 
@@ -1008,6 +1119,7 @@ void *video_scale_thread(void *context)
     int current_output;
     AVFrame *deinterlaced_frame = NULL;
     int i;
+    int restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
 
     deinterlaced_frame = av_frame_alloc();
 
@@ -1019,8 +1131,7 @@ void *video_scale_thread(void *context)
     while (video_scale_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->scalevideo->input_queue);
         while (!msg && video_scale_thread_running) {
-            usleep(1000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->scalevideo->input_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->scalevideo->input_queue, QUEUE_WAIT_TIMEOUT);
         }
 
         if (!video_scale_thread_running) {
@@ -1036,6 +1147,8 @@ void *video_scale_thread(void *context)
             goto cleanup_video_scale_thread;
         }
 
+        msg = flush_recovery_backlog(core, core->scalevideo->input_queue, msg, &restart_count);
+
         if (msg) {
             uint8_t *deinterlaced_input = msg->buffer;
             uint8_t *deinterlaced_buffer;
@@ -1129,6 +1242,7 @@ void *video_scale_thread(void *context)
                 encode_msg->buffer_size = video_frame_size;
                 encode_msg->pts = msg->pts;
                 encode_msg->dts = msg->dts;
+                encode_msg->source_discontinuity = msg->source_discontinuity;
                 encode_msg->interlaced = 0;
                 encode_msg->tff = 1;
                 encode_msg->fps_num = msg->fps_num;
@@ -1212,9 +1326,14 @@ void *video_prepare_thread(void *context)
     scale_struct *thumbnail_output = NULL;
     int64_t deinterlaced_frame_count = 0;
     int64_t sync_frame_count = 0;
+    // the a/v sync check counts frames from here, the start of the video until a recovery moves it
+    int64_t anchor_pts = -1;
+    int64_t anchor_frame_count = 0;
+    int64_t reanchor_pts = -1;
     double fps = 30.0;
     opaque_struct *opaque_data = NULL;
     int thumbnail_count = 0;
+    int restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
 
     params->pixel_fmts = pix_fmts;
 
@@ -1228,8 +1347,7 @@ void *video_prepare_thread(void *context)
     while (video_prepare_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->preparevideo->input_queue);
         while (!msg && video_prepare_thread_running) {
-            usleep(1000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->preparevideo->input_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->preparevideo->input_queue, QUEUE_WAIT_TIMEOUT);
         }
 
         if (!video_prepare_thread_running) {
@@ -1245,6 +1363,8 @@ void *video_prepare_thread(void *context)
             goto cleanup_video_prepare_thread;
         }
 
+        msg = flush_recovery_backlog(core, core->preparevideo->input_queue, msg, &restart_count);
+
         if (msg) {
             int width = msg->width;
             int height = msg->height;
@@ -1353,6 +1473,10 @@ void *video_prepare_thread(void *context)
             source_frame->pts = msg->pts;
             source_frame->pkt_dts = msg->dts;
             source_frame->pkt_pts = msg->pts;
+            if (msg->source_discontinuity) {
+                // the deinterlacer still holds frames from before the recovery
+                reanchor_pts = msg->pts;
+            }
             source_frame->width = width;
             source_frame->height = height;
             source_frame->interlaced_frame = msg->interlaced;
@@ -1491,9 +1615,20 @@ void *video_prepare_thread(void *context)
 
                         video_stream_struct *vstream = (video_stream_struct*)core->source_stream[0].video_stream;  // only one source stream
                         int64_t sync_diff;
+                        int source_discontinuity = 0;
+
+                        if (anchor_pts == -1) {
+                            anchor_pts = vstream->first_timestamp;
+                        }
+                        if (reanchor_pts != -1 && deinterlaced_frame->pkt_pts == reanchor_pts) {
+                            anchor_pts = reanchor_pts;
+                            anchor_frame_count = deinterlaced_frame_count;
+                            reanchor_pts = -1;
+                            source_discontinuity = 1;
+                        }
 
                         deinterlaced_frame_count++;  // frames since the video start time
-                        sync_frame_count = (int64_t)(((((double)deinterlaced_frame->pkt_pts-(double)vstream->first_timestamp) / (double)90000.0))*(double)fps);
+                        sync_frame_count = anchor_frame_count + (int64_t)(((((double)deinterlaced_frame->pkt_pts-(double)anchor_pts) / (double)90000.0))*(double)fps);
                         av_sync_offset = (((double)deinterlaced_frame_count - (double)sync_frame_count)/(double)fps)*(double)1000.0;
                         sync_diff = (int64_t)deinterlaced_frame_count - (int64_t)sync_frame_count;
 
@@ -1542,6 +1677,7 @@ void *video_prepare_thread(void *context)
                                 scale_msg->stream_index = -1;
                                 scale_msg->caption_buffer = NULL;
                                 scale_msg->caption_size = 0;
+                                scale_msg->source_discontinuity = 0;
 
                                 /*
                                   bug here- needs to be set if during commercial break
@@ -1576,6 +1712,7 @@ void *video_prepare_thread(void *context)
                         scale_msg->buffer_size = video_frame_size;
                         scale_msg->pts = deinterlaced_frame->pkt_pts;  // or pkt_pts?
                         scale_msg->dts = deinterlaced_frame->pkt_dts;
+                        scale_msg->source_discontinuity = source_discontinuity;
                         scale_msg->interlaced = 0;
                         scale_msg->tff = 1;
                         scale_msg->fps_num = msg->fps_num;
@@ -1674,6 +1811,18 @@ cleanup_video_prepare_thread:
     return NULL;
 }
 
+static void return_decode_message(fillet_app_struct *core, dataqueue_message_struct *msg)
+{
+    sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
+
+    if (frame) {
+        memory_return(core->compressed_video_pool, frame->buffer);
+        frame->buffer = NULL;
+        memory_return(core->frame_msg_pool, frame);
+    }
+    memory_return(core->fillet_msg_pool, msg);
+}
+
 void *video_decode_thread(void *context)
 {
     fillet_app_struct *core = (fillet_app_struct*)context;
@@ -1692,6 +1841,9 @@ void *video_decode_thread(void *context)
     int source_stride[4];
     int output_stride[4];
     int last_video_frame_size = -1;
+    int restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
+    int wait_for_sync_frame = 0;
+    int source_discontinuity = 0;
 
 #define MAX_SIGNAL_WINDOW 30
     signal_struct signal_data[MAX_SIGNAL_WINDOW];
@@ -1704,25 +1856,44 @@ void *video_decode_thread(void *context)
     while (video_decode_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->transvideo->input_queue);
         while (!msg && video_decode_thread_running) {
-            usleep(1000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->transvideo->input_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->transvideo->input_queue, QUEUE_WAIT_TIMEOUT);
         }
 
         if (!video_decode_thread_running) {
             if (msg) {
-                sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
-                if (frame) {
-                    memory_return(core->compressed_video_pool, frame->buffer);
-                    frame->buffer = NULL;
-                    memory_return(core->frame_msg_pool, frame);
-                    frame = NULL;
-                }
-                memory_return(core->fillet_msg_pool, msg);
+                return_decode_message(core, msg);
                 msg = NULL;
             }
             goto cleanup_video_decoder_thread;
         }
 
+        if (restart_count != __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE)) {
+            // the sync thread was restarted, throw out the backlog and the reference
+            // frames and pick up again at the next sync frame on a new timeline
+            restart_count = __atomic_load_n(&core->sync_thread_restart_count, __ATOMIC_ACQUIRE);
+            while (msg) {
+                return_decode_message(core, msg);
+                msg = (dataqueue_message_struct*)dataqueue_take_back(core->transvideo->input_queue);
+            }
+            if (video_decoder_ready) {
+                avcodec_flush_buffers(decode_avctx);
+            }
+            wait_for_sync_frame = 1;
+            fprintf(stderr,"status: video decoder flushed for sync recovery (%d)\n", restart_count);
+            continue;
+        }
+
+        if (msg && wait_for_sync_frame) {
+            sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
+            if (!frame || !frame->sync_frame) {
+                return_decode_message(core, msg);
+                msg = NULL;
+                continue;
+            }
+            wait_for_sync_frame = 0;
+            source_discontinuity = 1;
+        }
+
         if (msg) {
             sorted_frame_struct *frame = (sorted_frame_struct*)msg->buffer;
             if (frame) {
@@ -1941,6 +2112,9 @@ void *video_decode_thread(void *context)
                         prepare_msg->buffer_size = video_frame_size;
                         prepare_msg->pts = decode_av_frame->pts;
                         prepare_msg->dts = decode_av_frame->pkt_dts;  // full time
+                        // the first frame after a recovery re-anchors everything downstream
+                        prepare_msg->source_discontinuity = source_discontinuity;
+                        source_discontinuity = 0;
                         /*fprintf(stderr,"DECODED VIDEO FRAME: PTS:%ld PKT_DTS:%ld PKT_PTS:%ld\n",
                                 decode_av_frame->pts,
                                 decode_av_frame->pkt_dts,
@@ -42,62 +42,134 @@
 #include "mempool.h"
 #include "fgetopt.h"
 #include "crc.h"
+#include "nalscan.h"
 #include "tsdecode.h"
 
-static uint64_t total_input_packets = 0;
-
-typedef int (*MYCALLBACK)(int p1, int64_t p2, int64_t p3, int64_t p4, int64_t p5, int source, void *context);
-typedef int (*SAMPLE_CALLBACK)(uint8_t *sample, int sample_size, int sample_type, uint32_t sample_flags, int64_t pts, int64_t dts, int64_t last_pcr, int source, int sub_source, char *lang_tag, void *context);
-
-static MYCALLBACK backup_caller = NULL;
-static void *backup_context = NULL;
-
-static SAMPLE_CALLBACK send_frame_func = NULL;
-static void *send_frame_context = NULL;
-
-static pthread_mutex_t pmt_lock = PTHREAD_MUTEX_INITIALIZER;
-
-void register_frame_callback(int (*cbfn)(uint8_t *sample, int sample_size, int sample_type, uint32_t sample_flags, int64_t pts, int64_t dts, int64_t last_pcr, int source, int sub_source, char *lang_tag, void *context), void *context)
+struct _transport_data_struct_ {
+     tsdemux_callbacks_struct callbacks;
+     void *context;
+     int stream_select;
+     int64_t total_input_packets;
+     // nal units of the video frame being delivered
+     nal_index_struct nal_index;
+
+     pat_table_struct master_pat_table;
+     pmt_table_struct *master_pmt_table;
+     int pmt_table_allocated;
+     packet_table_struct master_packet_table[MAX_PIDS];
+
+     int64_t received_ts_packets;
+     // timing fields are in microseconds on the monotonic demux clock
+     int64_t pid_start_time;
+     int64_t pid_stop_time;
+     int64_t initial_pcr_base[MAX_PID_INDEX];
+     int64_t initial_pcr_ext;
+     int64_t pcr_start_time;
+     int64_t pcr_stop_time;
+     int64_t pcr_update_start_time;
+     int tvct_decoded;
+     int tvct_version[MAX_PMT_PIDS];
+     unsigned long last_tvct_crc[MAX_PMT_PIDS];
+     unsigned char tvct_data[MAX_TABLE_SIZE];
+     int tvct_data_size;
+     int tvct_table_acquired;
+     int tvct_table_expected;
+     int pmt_position;
+     int pmt_data_size;
+     int pmt_table_acquired;
+     int pmt_table_expected;
+     int pmt_pid_count;
+     int pmt_pid_index[MAX_PMT_PIDS];
+     int pmt_decoded[MAX_PMT_PIDS];
+     int pmt_version[MAX_PMT_PIDS];
+     unsigned long last_pmt_crc[MAX_PMT_PIDS];
+     unsigned char pmt_data[MAX_TABLE_SIZE];
+     int pat_program_count;
+     int pat_version_number;
+     int pat_position;
+     int pat_transport_stream_id;
+     int eit0_present;
+     int eit1_present;
+     int eit2_present;
+     int eit3_present;
+     int first_frame_intra;
+     int source;
+
+     // direct pid lookup, rebuilt when the pat/pmt or stream selection changes
+     pid_index_struct pid_index[MAX_PID_INDEX];
+     int pid_index_select;
+     int pid_index_valid;
+     int packet_table_count;
+     int batch_pid_count;
+     int batch_pid_list[MAX_PID_INDEX];
+};
+
+int64_t demux_clock_now(void)
 {
-    send_frame_func = cbfn;
-    send_frame_context = context;
+     struct timespec now;
+
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return ((int64_t)now.tv_sec * 1000000) + (int64_t)(now.tv_nsec / 1000);
 }
 
-void register_message_callback(int (*cbfn)(int p1,int64_t p2,int64_t p3,int64_t p4, int64_t p5, int source, void* context), void*context)
+static int decode_tvct_table(unsigned char *tvct_data, int tvct_data_size, int current_pid)
 {
-    backup_caller = cbfn;
-    backup_context = context;
+     return 0;
 }
 
-int64_t get_time_difference(struct timeval *stoptime, struct timeval *starttime)
+// pmt storage grows with the programs actually carried in the stream
+static pmt_table_struct *add_pmt_table(transport_data_struct *tsdata)
 {
-     int64_t delta_sec;
-     int64_t delta_usec;
-     int64_t temp_delta_sec;
-     int64_t temp_delta_usec;
-     int64_t final_time;
-
-     delta_sec = stoptime->tv_sec - starttime->tv_sec;
-     delta_usec = stoptime->tv_usec - starttime->tv_usec;
-     if (delta_usec < 0) {
-          temp_delta_sec = delta_sec - 1;
-          temp_delta_usec = 1000000 + delta_usec;
-     } else {
-          temp_delta_sec = delta_sec;
-          temp_delta_usec = delta_usec;
+     int entries = tsdata->master_pat_table.pmt_table_entries;
+     int allocated;
+     pmt_table_struct *pmt_tables;
+
+     if (entries >= MAX_PMT_PIDS) {
+          return NULL;
+     }
+     if (entries < tsdata->pmt_table_allocated) {
+          return tsdata->master_pmt_table;
+     }
+
+     allocated = tsdata->pmt_table_allocated ? tsdata->pmt_table_allocated * 2 : 1;
+     if (allocated > MAX_PMT_PIDS) {
+          allocated = MAX_PMT_PIDS;
+     }
+     pmt_tables = (pmt_table_struct*)realloc(tsdata->master_pmt_table, allocated * sizeof(pmt_table_struct));
+     if (!pmt_tables) {
+          return NULL;
      }
-     final_time = (temp_delta_sec * 1000000) + temp_delta_usec;
+     memset(&pmt_tables[tsdata->pmt_table_allocated], 0, (allocated - tsdata->pmt_table_allocated) * sizeof(pmt_table_struct));
+     tsdata->master_pmt_table = pmt_tables;
+     tsdata->pmt_table_allocated = allocated;
 
-     return final_time;
+     return pmt_tables;
 }
 
-static int decode_tvct_table(unsigned char *tvct_data, int tvct_data_size, int current_pid)
+// per-pid demux state only exists for streams listed in the pmt
+static int reserve_data_engines(pmt_table_struct *pmt_table, int stream_count)
 {
+     data_engine_struct *data_engine;
+
+     if (stream_count <= pmt_table->data_engine_count) {
+          return 0;
+     }
+
+     data_engine = (data_engine_struct*)realloc(pmt_table->data_engine, stream_count * sizeof(data_engine_struct));
+     if (!data_engine) {
+          return -1;
+     }
+     memset(&data_engine[pmt_table->data_engine_count], 0, (stream_count - pmt_table->data_engine_count) * sizeof(data_engine_struct));
+     pmt_table->data_engine = data_engine;
+     pmt_table->data_engine_count = stream_count;
+
      return 0;
 }
 
-static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct *master_pmt_table, unsigned char *pmt_data, int pmt_data_size, int current_pid)
+static int decode_pmt_table(transport_data_struct *tsdata, unsigned char *pmt_data, int pmt_data_size, int current_pid)
 {
+     pat_table_struct *master_pat_table = &tsdata->master_pat_table;
+     pmt_table_struct *master_pmt_table;
      unsigned char *pdata = (unsigned char *)pmt_data;
      int pmt_program = (*(pdata+4) << 8) + *(pdata+5);
      int pmt_version = (*(pdata+6) & 0x1e) >> 1;
@@ -114,19 +186,20 @@ static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct
      int pmt_found = 0;
      pmt_table_struct *current_pmt_table = NULL;
 
-     pthread_mutex_lock(&pmt_lock);
-     for (pmt_count = 0; pmt_count < MAX_PMT_PIDS; pmt_count++) {
+     master_pmt_table = tsdata->master_pmt_table;
+     for (pmt_count = 0; pmt_count < master_pat_table->pmt_table_entries; pmt_count++) {
          if (master_pmt_table[pmt_count].pmt_pid == current_pid) {
              current_pmt_index = pmt_count;
              pmt_found = 1;
              break;
          }
-         if (master_pmt_table[pmt_count].pmt_pid == 0) {
-             break;
-         }
      }
      if (!pmt_found) {
-         current_pmt_index = pmt_count;
+         master_pmt_table = add_pmt_table(tsdata);
+         if (!master_pmt_table) {
+             return -1;
+         }
+         current_pmt_index = master_pat_table->pmt_table_entries;
          master_pat_table->pmt_table_entries++;
      }
 
@@ -142,6 +215,7 @@ static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct
      current_pmt_table->program_info_length = program_info_length;
      current_pmt_table->pmt_version = pmt_version;
      current_pmt_table->audio_stream_count = 0;
+     current_pmt_table->stream_count = 0;
 
      if (pmt_data_size <= MAX_TABLE_SIZE) {
          memcpy(current_pmt_table->pmt_data, pmt_data, pmt_data_size);
@@ -156,9 +230,8 @@ static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct
 
          syslog(LOG_ERR,"PMT TABLE ERROR: TABLE SIZE INVALID: %d\n", pmt_remaining);
 
-         //backup_caller(2000, 503, 0, 0, 0, 0, backup_context);
+         //tsdata->callbacks.message_callback(2000, 503, 0, 0, 0, 0, tsdata->context);
 
-         pthread_mutex_unlock(&pmt_lock);
          return -1;
      }
 
@@ -171,9 +244,8 @@ static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct
 
           if (descriptor_size < 0 ||
               descriptor_size > program_info_length) {
-              backup_caller(2000, 504, 0, 0, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 504, 0, 0, 0, 0, tsdata->context);
 
-              pthread_mutex_unlock(&pmt_lock);
               return -1;
           }
 
@@ -183,18 +255,18 @@ static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct
           descriptor_count++;
 
           if (descriptor == PMT_DESCRIPTOR_PRIVATE1) {
-              backup_caller(2000, 601, descriptor, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 601, descriptor, current_pid, 0, 0, tsdata->context);
           } else if (descriptor == PMT_DESCRIPTOR_PRIVATE2) {
-              backup_caller(2000, 602, descriptor, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 602, descriptor, current_pid, 0, 0, tsdata->context);
           } else if (descriptor == PMT_DESCRIPTOR_REGISTRATION) {
-              backup_caller(2000, 610, descriptor, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 610, descriptor, current_pid, 0, 0, tsdata->context);
           } else if (descriptor == PMT_DESCRIPTOR_MAX_BITRATE) {
               int max_bitrate = ((int)pdata[3] << 8) + (int)pdata[4];
-              backup_caller(2000, 611, descriptor, max_bitrate, current_pid, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 611, descriptor, max_bitrate, current_pid, 0, tsdata->context);
           } else if (descriptor == PMT_DESCRIPTOR_MUX_BUFFER) {
-              backup_caller(2000, 612, descriptor, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 612, descriptor, current_pid, 0, 0, tsdata->context);
           } else {
-              backup_caller(2000, 600, descriptor, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 600, descriptor, current_pid, 0, 0, tsdata->context);
           }
 
           pdata += (descriptor_size + 2);
@@ -203,12 +275,11 @@ static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct
      }
 
      if (pmt_remaining < 0 || program_info_length < 0) {
-         backup_caller(2000, 504, 0, 0, 0, 0, backup_context);
-         pthread_mutex_unlock(&pmt_lock);
+         tsdata->callbacks.message_callback(2000, 504, 0, 0, 0, 0, tsdata->context);
          return -1;
      }
 
-     while (pmt_remaining > 2) {
+     while (pmt_remaining > 2 && stream_count < MAX_STREAMS) {
           int current_stream_type = *(pdata+0);
           int current_stream_pid = (int)(*(pdata+1) << 8) | (int)*(pdata+2);
           int pmt_info_length;
@@ -234,54 +305,54 @@ static int decode_pmt_table(pat_table_struct *master_pat_table, pmt_table_struct
 
           current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_UNKNOWN; // default to unknown
           if (current_stream_type == 0x02) {
-              backup_caller(2000, 800, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 800, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_MPEG2;
           } else if (current_stream_type == 0x1b) {
-              backup_caller(2000, 801, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 801, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_H264;
           } else if (current_stream_type == 0x24) {
-              backup_caller(2000, 814, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 814, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_HEVC;
           } else if (current_stream_type == 0x01) {
-              backup_caller(2000, 802, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 802, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_MPEG;
               current_pmt_table->audio_stream_index[stream_count] = current_pmt_table->audio_stream_count;
               current_pmt_table->audio_stream_count++;
           } else if (current_stream_type == 0x03) {
-              backup_caller(2000, 803, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 803, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_MPEG;
               current_pmt_table->audio_stream_index[stream_count] = current_pmt_table->audio_stream_count;
               current_pmt_table->audio_stream_count++;
           } else if (current_stream_type == 0x04) {
-              backup_caller(2000, 804, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 804, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_MPEG;
               current_pmt_table->audio_stream_index[stream_count] = current_pmt_table->audio_stream_count;
               current_pmt_table->audio_stream_count++;
           } else if (current_stream_type == 0x0f) {
-              backup_caller(2000, 805, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 805, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_AAC;
               current_pmt_table->audio_stream_index[stream_count] = current_pmt_table->audio_stream_count;
               current_pmt_table->audio_stream_count++;
           } else if (current_stream_type == 0x81) {
-              backup_caller(2000, 806, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 806, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_AC3;
               current_pmt_table->audio_stream_index[stream_count] = current_pmt_table->audio_stream_count;
               current_pmt_table->audio_stream_count++;
           } else if (current_stream_type == 0x27) {
-              backup_caller(2000, 807, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 807, current_stream_pid, current_pid, 0, 0, tsdata->context);
           } else if (current_stream_type == 0x06) {
               waiting_for_descriptor = 0x06;
           } else if (current_stream_type == 0x05) {
-              backup_caller(2000, 809, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 809, current_stream_pid, current_pid, 0, 0, tsdata->context);
           } else if (current_stream_type == 0x0b) {
-              backup_caller(2000, 810, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 810, current_stream_pid, current_pid, 0, 0, tsdata->context);
           } else if (current_stream_type == 0x82) {
-              backup_caller(2000, 811, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 811, current_stream_pid, current_pid, 0, 0, tsdata->context);
           } else if (current_stream_type == 0x86) { // scte35
-              backup_caller(2000, 812, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 812, current_stream_pid, current_pid, 0, 0, tsdata->context);
               current_pmt_table->decoded_stream_type[stream_count] = STREAM_TYPE_SCTE35;
           } else if (current_stream_type == 0xC0) {
-              backup_caller(2000, 813, current_stream_pid, current_pid, 0, 0, backup_context);
+              tsdata->callbacks.message_callback(2000, 813, current_stream_pid, current_pid, 0, 0, tsdata->context);
           }
 
           current_pmt_table->stream_count++;
@@ -330,7 +401,7 @@ _redo_decode:
                     } else {
                          alignment_type = 0;
                     }
-                    backup_caller(2000, 709, local_tag, alignment_type, 0, 0, backup_context);
+                    tsdata->callbacks.message_callback(2000, 709, local_tag, alignment_type, 0, 0, tsdata->context);
                } else if (local_tag == STREAM_DESCRIPTOR_MAX_BITRATE) {
                     for (h = 0; h < local_tag_size; h++) {
                          // do something with the data here
@@ -341,37 +412,37 @@ _redo_decode:
                          // do something with the data here
                          tag_index++;
                     }
-                    backup_caller(2000, 711, local_tag, 0, 0, 0, backup_context);
+                    tsdata->callbacks.message_callback(2000, 711, local_tag, 0, 0, 0, tsdata->context);
                } else if (local_tag == STREAM_DESCRIPTOR_SUBTITLE1 ||
                           local_tag == STREAM_DESCRIPTOR_SUBTITLE2) {
                     if (waiting_for_descriptor) {
-                        backup_caller(2000, 808, current_stream_pid, current_pid, 0, 0, backup_context);
+                        tsdata->callbacks.message_callback(2000, 808, current_stream_pid, current_pid, 0, 0, tsdata->context);
                         waiting_for_descriptor = 0;
                         goto _redo_decode;
                     } else {
-                        backup_caller(2000, 712, local_tag, 0, 0, 0, backup_context);
+                        tsdata->callbacks.message_callback(2000, 712, local_tag, 0, 0, 0, tsdata->context);
                     }
                     tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_EAC3) {
                     if (waiting_for_descriptor) {
-                        backup_caller(2000, 814, current_stream_pid, current_pid, 0, 0, backup_context);
+                        tsdata->callbacks.message_callback(2000, 814, current_stream_pid, current_pid, 0, 0, tsdata->context);
                         waiting_for_descriptor = 0;
                         goto _redo_decode;
                     } else {
-                        backup_caller(2000, 713, local_tag, 0, 0, 0, backup_context);
+                        tsdata->callbacks.message_callback(2000, 713, local_tag, 0, 0, 0, tsdata->context);
                     }
                     tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_STD) {
-                   backup_caller(2000, 714, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 714, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_SMOOTH) {
-                   backup_caller(2000, 715, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 715, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_CAPTION) {
-                   backup_caller(2000, 716, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 716, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_REGISTRATION) {
-                   backup_caller(2000, 717, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 717, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_AC3) {
                    if (waiting_for_descriptor) {
@@ -382,7 +453,7 @@ _redo_decode:
                        current_pmt_table->audio_stream_count++;
                        goto _redo_decode;
                    }
-                   backup_caller(2000, 718, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 718, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_LANGUAGE) {
                    uint8_t l1 = *(pdata+tag_index+0);
@@ -394,13 +465,13 @@ _redo_decode:
                    current_pmt_table->decoded_language_tag[stream_count - 1].lang_tag[2] = (char)l3;
                    current_pmt_table->decoded_language_tag[stream_count - 1].lang_tag[3] = '\0';
 
-                   backup_caller(2000, 719, local_tag, l1, l2, l3, backup_context);
+                   tsdata->callbacks.message_callback(2000, 719, local_tag, l1, l2, l3, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_APPLICATION) {
-                   backup_caller(2000, 720, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 720, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_MPEGAUDIO) {
-                   backup_caller(2000, 721, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 721, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else if (local_tag == STREAM_DESCRIPTOR_AC3_2) {
                    if (waiting_for_descriptor) {
@@ -413,12 +484,12 @@ _redo_decode:
                        current_pmt_table->audio_stream_count++;
                        goto _redo_decode;
                    }
-                   backup_caller(2000, 722, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 722, local_tag, 0, 0, 0, tsdata->context);
                    tag_index += local_tag_size;
                } else {
                    // the catch-all
                    tag_index += local_tag_size;
-                   backup_caller(2000, 799, local_tag, 0, 0, 0, backup_context);
+                   tsdata->callbacks.message_callback(2000, 799, local_tag, 0, 0, 0, tsdata->context);
                }
           }
 
@@ -429,15 +500,343 @@ _redo_decode:
           pmt_remaining -= (pmt_info_length + 5);
           pdata += (pmt_info_length + 5);
      }
-     pthread_mutex_unlock(&pmt_lock);
+
+     if (reserve_data_engines(current_pmt_table, current_pmt_table->stream_count) < 0) {
+          syslog(LOG_ERR,"PMT TABLE ERROR: UNABLE TO ALLOCATE STREAM STATE (%d STREAMS)\n", current_pmt_table->stream_count);
+          current_pmt_table->stream_count = current_pmt_table->data_engine_count;
+     }
      return 0;
 }
 
-int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_data_struct *tsdata, int stream_select)
+void *tsdemux_create(tsdemux_callbacks_struct *callbacks, void *context, int source, int stream_select)
+{
+     transport_data_struct *tsdata;
+     int pid;
+
+     if (!callbacks || !callbacks->frame_callback || !callbacks->message_callback) {
+          return NULL;
+     }
+
+     tsdata = (transport_data_struct*)malloc(sizeof(transport_data_struct));
+     if (!tsdata) {
+          return NULL;
+     }
+     memset(tsdata, 0, sizeof(transport_data_struct));
+
+     for (pid = 0; pid < MAX_PID_INDEX; pid++) {
+          tsdata->initial_pcr_base[pid] = -1;
+     }
+     tsdata->pat_program_count = -1;
+     tsdata->pat_version_number = -1;
+     tsdata->pat_transport_stream_id = -1;
+     tsdata->source = source;
+     tsdata->stream_select = stream_select;
+     tsdata->callbacks = *callbacks;
+     tsdata->context = context;
+     memset(tsdata->pmt_version, -1, sizeof(tsdata->pmt_version));
+
+     return tsdata;
+}
+
+int64_t tsdemux_state_size(void)
+{
+     return (int64_t)sizeof(transport_data_struct);
+}
+
+void tsdemux_destroy(void *demux)
+{
+     transport_data_struct *tsdata = (transport_data_struct*)demux;
+     int each_pmt;
+     int each_stream;
+
+     if (!tsdata) {
+          return;
+     }
+
+     for (each_pmt = 0; each_pmt < tsdata->pmt_table_allocated; each_pmt++) {
+          pmt_table_struct *pmt_table = &tsdata->master_pmt_table[each_pmt];
+          for (each_stream = 0; each_stream < pmt_table->data_engine_count; each_stream++) {
+               free(pmt_table->data_engine[each_stream].buffer);
+          }
+          free(pmt_table->data_engine);
+     }
+     free(tsdata->master_pmt_table);
+     free(tsdata);
+}
+
+static void init_pid_index(transport_data_struct *tsdata)
+{
+     int pid;
+
+     for (pid = 0; pid < MAX_PID_INDEX; pid++) {
+          tsdata->pid_index[pid].packet_table_index = -1;
+          tsdata->pid_index[pid].pmt_index = -1;
+          tsdata->pid_index[pid].stream_index = -1;
+          tsdata->pid_index[pid].batch_packets = 0;
+     }
+     tsdata->packet_table_count = 0;
+     tsdata->batch_pid_count = 0;
+     tsdata->pid_index_select = -2;
+     tsdata->pid_index_valid = 1;
+}
+
+static void build_pid_index(transport_data_struct *tsdata, int stream_select)
+{
+     int pid;
+     int pid_count;
+
+     for (pid = 0; pid < MAX_PID_INDEX; pid++) {
+          tsdata->pid_index[pid].pmt_index = -1;
+          tsdata->pid_index[pid].stream_index = -1;
+     }
+
+     // first match wins, same as the linear scans this replaces
+     for (pid_count = tsdata->pmt_pid_count - 1; pid_count >= 0; pid_count--) {
+          pid = tsdata->pmt_pid_index[pid_count] & 0x1fff;
+          tsdata->pid_index[pid].pmt_index = pid_count;
+     }
+
+     if (stream_select >= 0 &&
+         stream_select < tsdata->master_pat_table.pmt_table_entries) {
+          int stream_count = tsdata->master_pmt_table[stream_select].stream_count;
+          for (pid_count = stream_count - 1; pid_count >= 0; pid_count--) {
+               pid = tsdata->master_pmt_table[stream_select].stream_pid[pid_count] & 0x1fff;
+               tsdata->pid_index[pid].stream_index = pid_count;
+          }
+     }
+
+     tsdata->pid_index_select = stream_select;
+}
+
+static void update_pid_statistics(transport_data_struct *tsdata, int64_t receive_time)
+{
+     int batch_index;
+
+     if (!tsdata->batch_pid_count) {
+          return;
+     }
+
+     for (batch_index = 0; batch_index < tsdata->batch_pid_count; batch_index++) {
+          int pid = tsdata->batch_pid_list[batch_index];
+          pid_index_struct *pid_entry = &tsdata->pid_index[pid];
+          int table_index = pid_entry->packet_table_index;
+
+          if (table_index < 0 && tsdata->packet_table_count < MAX_PIDS) {
+               // SEND MESSAGE INDICATING A NEW PID WAS FOUND
+               // tsdata->callbacks.message_callback();
+               table_index = tsdata->packet_table_count++;
+               pid_entry->packet_table_index = table_index;
+               tsdata->master_packet_table[table_index].valid = 1;
+               tsdata->master_packet_table[table_index].input_packets = 0;
+               tsdata->master_packet_table[table_index].pid = pid;
+          }
+          if (table_index >= 0) {
+               tsdata->master_packet_table[table_index].input_packets += pid_entry->batch_packets;
+               tsdata->master_packet_table[table_index].last_seen = receive_time;
+          }
+          pid_entry->batch_packets = 0;
+     }
+     tsdata->batch_pid_count = 0;
+     tsdata->pid_stop_time = receive_time;
+}
+
+// hand a completed pes payload to the frame callback and reset the assembly state
+static void send_pes_frame(transport_data_struct *tsdata, int each_pmt, int pid_count, int current_pid, int video_frame_size, int64_t receive_time)
+{
+     unsigned char *video_frame;
+     int is_intra = 0;
+     int core_modified = 0;
+     int video_bitrate = 0;
+     int video_framerate = 0;
+     int stream_type = 0;
+     int aspect_ratio = 0;
+     int seqtype = 0;
+
+     stream_type = tsdata->master_pmt_table[each_pmt].stream_type[pid_count];
+
+     if (stream_type == 0x02 || stream_type == 0x80) {
+         int64_t delta_data_time;
+
+         video_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
+         if (video_frame[0] == 0x00 && video_frame[1] == 0x00 &&
+             video_frame[2] == 0x01 && video_frame[3] == 0xb3) {
+             is_intra = 1;
+         }
+         if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count == 0) {
+             tsdata->master_pmt_table[each_pmt].data_engine[pid_count].start_data_time = receive_time;
+         }
+         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count++;
+
+         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].end_data_time = receive_time;
+         delta_data_time = tsdata->master_pmt_table[each_pmt].data_engine[pid_count].end_data_time - tsdata->master_pmt_table[each_pmt].data_engine[pid_count].start_data_time;
+
+         if (delta_data_time > 30000000) {
+             float measured_fps = (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count * 1000000.0);
+             measured_fps = measured_fps / delta_data_time * 1000.0;
+             tsdata->master_pmt_table[each_pmt].data_engine[pid_count].start_data_time = receive_time;
+             tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count = 0;
+             tsdata->callbacks.message_callback(2000, 1004, (long long)measured_fps, current_pid, 0, 0, tsdata->context);
+         }
+
+         if (core_modified & 32) {
+             tsdata->callbacks.message_callback(2000, 1000, video_framerate, current_pid, 0, 0, tsdata->context);
+             tsdata->callbacks.message_callback(2000, 1001, video_bitrate, current_pid, 0, 0, tsdata->context);
+         }
+         if (core_modified & 8) {
+             tsdata->callbacks.message_callback(2000, 1002,
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].width,
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].height,
+                           current_pid, 0, tsdata->context);
+         }
+         if (core_modified & 2) {
+             tsdata->callbacks.message_callback(2000, 1003,
+                           aspect_ratio,
+                           seqtype,
+                           current_pid,
+                           0,
+                           tsdata->context);
+         }
+         tsdata->callbacks.frame_callback(video_frame, video_frame_size, STREAM_TYPE_MPEG2, is_intra,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
+                         0, // PCR
+                         tsdata->source,
+                         0, // sub-source is 0 for video
+                         (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
+                         NULL,
+                         tsdata->context);
+     } else if (stream_type == 0x0f) {
+         uint8_t *audio_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
+         tsdata->callbacks.frame_callback(audio_frame, video_frame_size, STREAM_TYPE_AAC, 1,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
+                         0, // PCR
+                         tsdata->source,
+                         tsdata->master_pmt_table[each_pmt].audio_stream_index[pid_count],  //sub-source
+                         (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
+                         NULL,
+                         tsdata->context);
+     } else if (stream_type == 0x81) {
+         uint8_t *audio_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
+         tsdata->callbacks.frame_callback(audio_frame, video_frame_size, STREAM_TYPE_AC3, 1,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
+                         0, // PCR
+                         tsdata->source,
+                         tsdata->master_pmt_table[each_pmt].audio_stream_index[pid_count], //sub-source
+                         (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
+                         NULL,
+                         tsdata->context);
+     } else if (stream_type == 0x04) {
+         uint8_t *audio_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
+         tsdata->callbacks.frame_callback(audio_frame, video_frame_size, STREAM_TYPE_MPEG, 1,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
+                         0, // PCR
+                         tsdata->source,
+                         tsdata->master_pmt_table[each_pmt].audio_stream_index[pid_count], //sub-source
+                         (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
+                         NULL,
+                         tsdata->context);
+     } else if (stream_type == 0x86) {
+         // do nothing- scte35 handled elsewhere
+     } else if (stream_type == 0x24) {
+         int n;
+         int nal_type;
+         int is_intra = 0;
+         video_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
+         build_nal_index(video_frame, video_frame_size, 1, &tsdata->nal_index);
+         for (n = 0; n < tsdata->nal_index.count; n++) {
+             nal_type = tsdata->nal_index.nal[n].type;
+             if (nal_type == 20 || nal_type == 19) {
+                 is_intra = 1;
+                 if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count == 0) {
+                     tsdata->first_frame_intra = 1;
+                     is_intra = 1;
+                 }
+                 break;
+             }
+         }
+
+         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count++;
+
+         tsdata->callbacks.frame_callback(video_frame, video_frame_size, STREAM_TYPE_HEVC, is_intra,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
+                         0, // PCR
+                         tsdata->source,
+                         0, // sub-source is 0 for video
+                         (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
+                         &tsdata->nal_index,
+                         tsdata->context);
+     } else if (stream_type == 0x1b) {
+         int n;
+         int nal_type;
+         int is_intra = 0;
+         video_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
+         build_nal_index(video_frame, video_frame_size, 0, &tsdata->nal_index);
+         for (n = 0; n < tsdata->nal_index.count; n++) {
+             nal_type = tsdata->nal_index.nal[n].type;
+             //fprintf(stderr,"nal_type:0x%x\n", nal_type);
+             if (nal_type == 0x05 || nal_type == 0x07 || nal_type == 0x08) {
+                 is_intra = 1;
+                 if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count == 0) {
+                     tsdata->first_frame_intra = 1;
+                     is_intra = 1;
+                 }
+                 break;
+             }
+         }
+
+         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count++;
+
+         tsdata->callbacks.frame_callback(video_frame, video_frame_size, STREAM_TYPE_H264, is_intra,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
+                         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
+                         0, // PCR
+                         tsdata->source,
+                         0, // sub-source is 0 for video
+                         (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
+                         &tsdata->nal_index,
+                         tsdata->context);
+     }
+     tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index = 0;
+     tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = 0;
+     tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = 0;
+     tsdata->master_pmt_table[each_pmt].data_engine[pid_count].wanted_data_size = 0;
+}
+
+// a pes with a non-zero PES_packet_length is delivered as soon as its payload is in,
+// unbounded (length 0) video pes still waits for the next payload_unit_start
+static void check_pes_complete(transport_data_struct *tsdata, int each_pmt, int pid_count, int current_pid, int64_t receive_time)
+{
+     int wanted_data_size = tsdata->master_pmt_table[each_pmt].data_engine[pid_count].wanted_data_size;
+
+     if (wanted_data_size > 0 &&
+         tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index >= wanted_data_size) {
+          send_pes_frame(tsdata, each_pmt, pid_count, current_pid, wanted_data_size, receive_time);
+     }
+}
+
+static int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_data_struct *tsdata, int stream_select, int64_t receive_time)
 {
      int packet_num;
      int each_pmt;
 
+     if (!receive_time) {
+          receive_time = demux_clock_now();
+     }
+
+     if (!tsdata->pid_index_valid) {
+          init_pid_index(tsdata);
+     }
+     if (tsdata->pid_index_select != stream_select) {
+          build_pid_index(tsdata, stream_select);
+     }
+     if (tsdata->received_ts_packets == 0) {
+          tsdata->pid_start_time = receive_time;
+     }
+
      for (packet_num = 0; packet_num < packet_count; packet_num++) {
           unsigned char *pdata = (unsigned char *)transport_packet_data + (packet_num * 188);
           unsigned char *pdata_initial = pdata + 4;
@@ -452,50 +851,21 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
 
                int discontinuity_flag;
                int random_access_point = 0;
-               int pid_counter;
                int64_t current_ext;
                int64_t current_pcr;
                int64_t received_pcr;
                int64_t offset_pcr;
-               int pid_in_list = 0;
-               int new_pid = 0;
-               int64_t update_pid_time = 0;
 
                pdata += 4;
                tsdata->received_ts_packets++;
                pdata_initial = pdata;
 
-               if (total_input_packets == 0) {
-                    gettimeofday(&tsdata->pid_start_time, NULL);
-               }
-               gettimeofday(&tsdata->pid_stop_time, NULL);
-               update_pid_time = (int64_t)get_time_difference(&tsdata->pid_stop_time, &tsdata->pid_start_time);
-
-               for (pid_counter = 0; pid_counter < MAX_PIDS; pid_counter++) {
-                    if (tsdata->master_packet_table[pid_counter].pid == current_pid &&
-                        tsdata->master_packet_table[pid_counter].valid) {
-                        tsdata->master_packet_table[pid_counter].input_packets++;
-                        gettimeofday(&tsdata->master_packet_table[pid_counter].last_seen, NULL);
-                        pid_in_list = 1;
-                        break;
-                    }
-                    if (!tsdata->master_packet_table[pid_counter].valid) {
-
-                        // SEND MESSAGE INDICATING A NEW PID WAS FOUND
-                        // backup_caller();
-
-                        new_pid = pid_counter;
-                        break;
-                    }
-               }
-               if (!pid_in_list) {
-                   tsdata->master_packet_table[new_pid].valid = 1;
-                   tsdata->master_packet_table[new_pid].input_packets = 1;
-                   tsdata->master_packet_table[new_pid].pid = current_pid;
-                   gettimeofday(&tsdata->master_packet_table[new_pid].last_seen, NULL);
+               if (!tsdata->pid_index[current_pid].batch_packets) {
+                    tsdata->batch_pid_list[tsdata->batch_pid_count++] = current_pid;
                }
+               tsdata->pid_index[current_pid].batch_packets++;
 
-               total_input_packets++;
+               tsdata->total_input_packets++;
 
                if (afc & 2) {
                     if (afc == 2) {
@@ -506,7 +876,7 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                     if (adaptation_size > 0) {
                          discontinuity_flag = !!(*(pdata+1) & 0x80);
                          if (discontinuity_flag) {
-                             backup_caller(2000, 502, 0, 0, 0, 0, backup_context);
+                             tsdata->callbacks.message_callback(2000, 502, 0, 0, 0, 0, tsdata->context);
                          }
                          random_access_point = !!(*(pdata+1) & 0x40);
                          pcr_flag = !!(*(pdata+1) & 0x10);
@@ -527,21 +897,21 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                               if (tsdata->initial_pcr_base[current_pid] == -1) {
                                   tsdata->initial_pcr_base[current_pid] = received_pcr;
                                   tsdata->initial_pcr_ext = 0;
-                                  gettimeofday(&tsdata->pcr_start_time, NULL);
-                                  gettimeofday(&tsdata->pcr_update_start_time, NULL);
+                                  tsdata->pcr_start_time = receive_time;
+                                  tsdata->pcr_update_start_time = receive_time;
                               } else {
                                   int64_t pcr_update_delta_time;
                                   int check_mux_rate;
 
-                                  gettimeofday(&tsdata->pcr_stop_time, NULL);
+                                  tsdata->pcr_stop_time = receive_time;
                                   offset_pcr = received_pcr - tsdata->initial_pcr_base[current_pid];
-                                  pcr_update_delta_time = (int64_t)get_time_difference(&tsdata->pcr_stop_time, &tsdata->pcr_update_start_time);
+                                  pcr_update_delta_time = tsdata->pcr_stop_time - tsdata->pcr_update_start_time;
 
                                   check_mux_rate = (27000000 * ((((double)tsdata->received_ts_packets*188.0)+10)*8.0))/(double)offset_pcr;
 
-                                  backup_caller(2000, 400, current_pid, check_mux_rate, 0, 0, backup_context);
+                                  tsdata->callbacks.message_callback(2000, 400, current_pid, check_mux_rate, 0, 0, tsdata->context);
                                   if (pcr_update_delta_time > 1000000) {
-                                      gettimeofday(&tsdata->pcr_update_start_time, NULL);
+                                      tsdata->pcr_update_start_time = receive_time;
                                   }
                               }
                          }
@@ -560,7 +930,7 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                        int scte35_pid = 0;
                        int pid_loop;
 
-                       if (tsdata->pmt_pid_count > 0) {
+                       if (tsdata->pmt_pid_count > 0 && tsdata->master_pat_table.pmt_table_entries > 0) {
                            pmt_table_struct *current_pmt_table = (pmt_table_struct *)&tsdata->master_pmt_table[0];
                            for (pid_loop = 0; pid_loop < current_pmt_table->stream_count; pid_loop++) {
                                if (current_pmt_table->decoded_stream_type[pid_loop] == STREAM_TYPE_SCTE35) {
@@ -717,14 +1087,15 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                                        scte35_data->cancel = cancel_indicator;
                                        scte35_data->out_of_network_indicator = out_of_network_indicator;
 
-                                       send_frame_func((uint8_t*)scte35_data, sizeof(scte35_data_struct), STREAM_TYPE_SCTE35, 1,
+                                       tsdata->callbacks.frame_callback((uint8_t*)scte35_data, sizeof(scte35_data_struct), STREAM_TYPE_SCTE35, 1,
                                                        0, //pts
                                                        0, //dts
                                                        0, // PCR
                                                        tsdata->source,
                                                        0,
                                                        NULL,
-                                                       send_frame_context);
+                                                       NULL,
+                                                       tsdata->context);
 
                                        free(scte35_data);
                                        scte35_data = NULL;
@@ -733,439 +1104,256 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                            }
                        }
 
-                       for (pid_count = 0; pid_count < tsdata->pmt_pid_count; pid_count++) {
-                           if (tsdata->pmt_pid_index[pid_count] == current_pid) {
-                               int acquired_data_so_far = pdata - pdata_initial;
-                               int unit_size = pdata[0];
-                               unsigned short section_size;
-                               int pmt_version_input;
-                               int table_id;
-                               pdata += unit_size;
-                               table_id = pdata[1];
-
-                               section_size = ((*(pdata+2) << 8) + *(pdata+3)) & 0x0fff;
-                               pmt_version_input = (*(pdata+6) & 0x1e) >> 1;
-
-                               if (table_id != 0x02) {
-                                   goto continue_packet_processing;
-                               }
+                       pid_count = tsdata->pid_index[current_pid].pmt_index;
+                       if (pid_count >= 0) {
+                           int acquired_data_so_far = pdata - pdata_initial;
+                           int unit_size = pdata[0];
+                           unsigned short section_size;
+                           int pmt_version_input;
+                           int table_id;
+                           pdata += unit_size;
+                           table_id = pdata[1];
+
+                           section_size = ((*(pdata+2) << 8) + *(pdata+3)) & 0x0fff;
+                           pmt_version_input = (*(pdata+6) & 0x1e) >> 1;
+
+                           if (table_id != 0x02) {
+                               goto continue_packet_processing;
+                           }
 
-                               for (each_pmt = 0; each_pmt < tsdata->master_pat_table.pmt_table_entries; each_pmt++)  {
-                                   if (each_pmt == stream_select && stream_select != -1) {
-                                       if (tsdata->master_pmt_table[each_pmt].pmt_pid == current_pid) {
-                                           if (tsdata->master_pmt_table[each_pmt].max_pmt_time == 0) {
-                                               tsdata->master_pmt_table[each_pmt].min_pmt_time = 999999999;
-                                               gettimeofday(&tsdata->master_pmt_table[each_pmt].start_pmt_time, NULL);
-                                               tsdata->master_pmt_table[each_pmt].max_pmt_time = 1;
-                                           } else {
-                                               int64_t delta_pmt_time;
-                                               gettimeofday(&tsdata->master_pmt_table[each_pmt].end_pmt_time, NULL);
-                                               delta_pmt_time = (int64_t)get_time_difference(&tsdata->master_pmt_table[each_pmt].end_pmt_time,
-                                                                                             &tsdata->master_pmt_table[each_pmt].start_pmt_time);
-
-                                               if (delta_pmt_time > tsdata->master_pmt_table[each_pmt].max_pmt_time) {
-                                                   tsdata->master_pmt_table[each_pmt].max_pmt_time = delta_pmt_time;
-                                                   // SIGNAL NEW MAX PMT TIME TO GUI
-                                                   // backup_caller(2000, 505, delta_pmt_time, current_pid, 0, backup_context);
-                                               }
-                                               if (delta_pmt_time < tsdata->master_pmt_table[each_pmt].min_pmt_time) {
-                                                   tsdata->master_pmt_table[each_pmt].min_pmt_time = delta_pmt_time;
-                                                   // SIGNAL NEW MIN PMT TIME TO GUI
-                                                   // backup_caller(2000, 506, delta_pmt_time, current_pid, 0, backup_context);
-                                               }
-                                               //backup_caller(2000, 505, delta_pmt_time / 1000, current_pid, 0, backup_context);
-                                               tsdata->master_pmt_table[each_pmt].avg_pmt_time += delta_pmt_time;
-                                               tsdata->master_pmt_table[each_pmt].avg_pmt_time /= 2;
-                                               gettimeofday(&tsdata->master_pmt_table[each_pmt].start_pmt_time, NULL);
+                           for (each_pmt = 0; each_pmt < tsdata->master_pat_table.pmt_table_entries; each_pmt++)  {
+                               if (each_pmt == stream_select && stream_select != -1) {
+                                   if (tsdata->master_pmt_table[each_pmt].pmt_pid == current_pid) {
+                                       if (tsdata->master_pmt_table[each_pmt].max_pmt_time == 0) {
+                                           tsdata->master_pmt_table[each_pmt].min_pmt_time = 999999999;
+                                           tsdata->master_pmt_table[each_pmt].start_pmt_time = receive_time;
+                                           tsdata->master_pmt_table[each_pmt].max_pmt_time = 1;
+                                       } else {
+                                           int64_t delta_pmt_time;
+                                           tsdata->master_pmt_table[each_pmt].end_pmt_time = receive_time;
+                                           delta_pmt_time = tsdata->master_pmt_table[each_pmt].end_pmt_time - tsdata->master_pmt_table[each_pmt].start_pmt_time;
+
+                                           if (delta_pmt_time > tsdata->master_pmt_table[each_pmt].max_pmt_time) {
+                                               tsdata->master_pmt_table[each_pmt].max_pmt_time = delta_pmt_time;
+                                               // SIGNAL NEW MAX PMT TIME TO GUI
+                                               // tsdata->callbacks.message_callback(2000, 505, delta_pmt_time, current_pid, 0, tsdata->context);
                                            }
+                                           if (delta_pmt_time < tsdata->master_pmt_table[each_pmt].min_pmt_time) {
+                                               tsdata->master_pmt_table[each_pmt].min_pmt_time = delta_pmt_time;
+                                               // SIGNAL NEW MIN PMT TIME TO GUI
+                                               // tsdata->callbacks.message_callback(2000, 506, delta_pmt_time, current_pid, 0, tsdata->context);
+                                           }
+                                           //tsdata->callbacks.message_callback(2000, 505, delta_pmt_time / 1000, current_pid, 0, tsdata->context);
+                                           tsdata->master_pmt_table[each_pmt].avg_pmt_time += delta_pmt_time;
+                                           tsdata->master_pmt_table[each_pmt].avg_pmt_time /= 2;
+                                           tsdata->master_pmt_table[each_pmt].start_pmt_time = receive_time;
                                        }
                                    }
                                }
+                           }
 
-                               if (pmt_version_input != tsdata->pmt_version[pid_count] ||
-                                   tsdata->pmt_version[pid_count] == -1) {
-                                   tsdata->pmt_table_acquired = 184 - acquired_data_so_far;
-                                   tsdata->pmt_table_expected = section_size;
-                                   if (tsdata->pmt_position == 0) {
-                                       tsdata->pmt_position = total_input_packets;
+                           if (pmt_version_input != tsdata->pmt_version[pid_count] ||
+                               tsdata->pmt_version[pid_count] == -1) {
+                               tsdata->pmt_table_acquired = 184 - acquired_data_so_far;
+                               tsdata->pmt_table_expected = section_size;
+                               if (tsdata->pmt_position == 0) {
+                                   tsdata->pmt_position = tsdata->total_input_packets;
+                               }
+                               if ((section_size+4) > tsdata->pmt_table_acquired) {
+                                   if (tsdata->pmt_table_acquired < 0 ||
+                                       tsdata->pmt_table_acquired > MAX_TABLE_SIZE ||
+                                       tsdata->pmt_table_expected > MAX_TABLE_SIZE ||
+                                       tsdata->pmt_table_expected < 0) {
+                                       tsdata->pmt_table_acquired = 0;
+                                       tsdata->pmt_table_expected = 0;
+                                   } else {
+                                       memcpy(tsdata->pmt_data, pdata, tsdata->pmt_table_acquired);
                                    }
-                                   if ((section_size+4) > tsdata->pmt_table_acquired) {
-                                       if (tsdata->pmt_table_acquired < 0 ||
-                                           tsdata->pmt_table_acquired > MAX_TABLE_SIZE ||
-                                           tsdata->pmt_table_expected > MAX_TABLE_SIZE ||
-                                           tsdata->pmt_table_expected < 0) {
-                                           tsdata->pmt_table_acquired = 0;
-                                           tsdata->pmt_table_expected = 0;
-                                       } else {
-                                           memcpy(tsdata->pmt_data, pdata, tsdata->pmt_table_acquired);
-                                       }
+                               } else {
+                                   if (tsdata->pmt_table_acquired < 0 ||
+                                       tsdata->pmt_table_acquired > MAX_TABLE_SIZE ||
+                                       tsdata->pmt_table_expected > MAX_TABLE_SIZE ||
+                                       tsdata->pmt_table_expected < 0) {
+                                       tsdata->pmt_table_acquired = 0;
+                                       tsdata->pmt_table_expected = 0;
                                    } else {
-                                       if (tsdata->pmt_table_acquired < 0 ||
-                                           tsdata->pmt_table_acquired > MAX_TABLE_SIZE ||
-                                           tsdata->pmt_table_expected > MAX_TABLE_SIZE ||
-                                           tsdata->pmt_table_expected < 0) {
-                                           tsdata->pmt_table_acquired = 0;
-                                           tsdata->pmt_table_expected = 0;
-                                       } else {
-                                           unsigned short crc_position;
-                                           unsigned long crc32_length;
-                                           uint32_t *pmt_crc1;
-                                           uint32_t calculated_crc;
-
-                                           memcpy(tsdata->pmt_data, pdata, tsdata->pmt_table_acquired);
-                                           tsdata->pmt_data_size = tsdata->pmt_table_expected;
-                                           crc_position = ((int)(tsdata->pmt_data[2] << 8) + (int)tsdata->pmt_data[3]) & 0x0fff;
-                                           crc32_length = crc_position - 1;
-                                           if (crc_position > 4 && crc_position < 1020) {
-                                               uint32_t pmt_crc2;
-                                               uint8_t *crcdata = (uint8_t*)&tsdata->pmt_data[crc_position];
-
-                                               pmt_crc1 = (uint32_t*)crcdata;
-
-                                               calculated_crc = getcrc32(&tsdata->pmt_data[1], crc32_length);
-                                               calculated_crc ^= 0xffffffff;
-                                               calculated_crc = htonl(calculated_crc);
-
-                                               pmt_crc2 = (uint32_t)*pmt_crc1;
-                                               pmt_crc2 ^= 0xffffffff;
-
-                                               if (pmt_crc2 == calculated_crc) {
-                                                   tsdata->pmt_version[pid_count] = pmt_version_input;
-                                                   decode_pmt_table(&tsdata->master_pat_table, tsdata->master_pmt_table, tsdata->pmt_data, tsdata->pmt_data_size, current_pid);
-                                                   tsdata->pmt_decoded[pid_count] = 1;
-                                               } else {
-                                                   backup_caller(2000, 201, calculated_crc, 0, 0, 0, backup_context);
-                                               }
+                                       unsigned short crc_position;
+                                       unsigned long crc32_length;
+                                       uint32_t *pmt_crc1;
+                                       uint32_t calculated_crc;
+
+                                       memcpy(tsdata->pmt_data, pdata, tsdata->pmt_table_acquired);
+                                       tsdata->pmt_data_size = tsdata->pmt_table_expected;
+                                       crc_position = ((int)(tsdata->pmt_data[2] << 8) + (int)tsdata->pmt_data[3]) & 0x0fff;
+                                       crc32_length = crc_position - 1;
+                                       if (crc_position > 4 && crc_position < 1020) {
+                                           uint32_t pmt_crc2;
+                                           uint8_t *crcdata = (uint8_t*)&tsdata->pmt_data[crc_position];
+
+                                           pmt_crc1 = (uint32_t*)crcdata;
+
+                                           calculated_crc = getcrc32(&tsdata->pmt_data[1], crc32_length);
+                                           calculated_crc ^= 0xffffffff;
+                                           calculated_crc = htonl(calculated_crc);
+
+                                           pmt_crc2 = (uint32_t)*pmt_crc1;
+                                           pmt_crc2 ^= 0xffffffff;
+
+                                           if (pmt_crc2 == calculated_crc) {
+                                               tsdata->pmt_version[pid_count] = pmt_version_input;
+                                               decode_pmt_table(tsdata, tsdata->pmt_data, tsdata->pmt_data_size, current_pid);
+                                               build_pid_index(tsdata, stream_select);
+                                               tsdata->pmt_decoded[pid_count] = 1;
+                                           } else {
+                                               tsdata->callbacks.message_callback(2000, 201, calculated_crc, 0, 0, 0, tsdata->context);
                                            }
-                                           tsdata->pmt_table_acquired = 0;
-                                           tsdata->pmt_table_expected = 0;
                                        }
+                                       tsdata->pmt_table_acquired = 0;
+                                       tsdata->pmt_table_expected = 0;
                                    }
                                }
                            }
                        }
 
-                       for (each_pmt = 0; each_pmt < tsdata->master_pat_table.pmt_table_entries; each_pmt++)  {
-                           if (each_pmt == stream_select && stream_select != -1) {
-                               int stream_count = tsdata->master_pmt_table[each_pmt].stream_count;
-                               for (pid_count = 0; pid_count < stream_count; pid_count++) {
-                                   if (tsdata->master_pmt_table[each_pmt].stream_pid[pid_count] == current_pid) {
-                                       int last_cc;
-                                       int pes_length;
-                                       int check0 = *(pdata+6);
-                                       int check1 = *(pdata+7);
-
-                                       if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index > 0) {
-                                           unsigned char *video_frame;
-                                           int is_intra = 0;
-                                           int core_modified = 0;
-                                           int video_frame_size = tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index;
-                                           int video_bitrate = 0;
-                                           int video_framerate = 0;
-                                           int stream_type = 0;
-                                           int aspect_ratio = 0;
-                                           int seqtype = 0;
-
-                                           stream_type = tsdata->master_pmt_table[each_pmt].stream_type[pid_count];
-
-                                           if (stream_type == 0x02 || stream_type == 0x80) {
-                                               int64_t delta_data_time;
-
-                                               video_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
-                                               if (video_frame[0] == 0x00 && video_frame[1] == 0x00 &&
-                                                   video_frame[2] == 0x01 && video_frame[3] == 0xb3) {
-                                                   is_intra = 1;
-                                               }
-                                               if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count == 0) {
-                                                   gettimeofday(&tsdata->master_pmt_table[each_pmt].data_engine[pid_count].start_data_time, NULL);
-                                               }
-                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count++;
-
-                                               gettimeofday(&tsdata->master_pmt_table[each_pmt].data_engine[pid_count].end_data_time, NULL);
-                                               delta_data_time = (int64_t)get_time_difference(&tsdata->master_pmt_table[each_pmt].data_engine[pid_count].end_data_time,
-                                                                                              &tsdata->master_pmt_table[each_pmt].data_engine[pid_count].start_data_time);
-
-                                               if (delta_data_time > 30000000) {
-                                                   float measured_fps = (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count * 1000000.0);
-                                                   measured_fps = measured_fps / delta_data_time * 1000.0;
-                                                   gettimeofday(&tsdata->master_pmt_table[each_pmt].data_engine[pid_count].start_data_time, NULL);
-                                                   tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count = 0;
-                                                   backup_caller(2000, 1004, (long long)measured_fps, current_pid, 0, 0, backup_context);
-                                               }
-
-                                               if (core_modified & 32) {
-                                                   backup_caller(2000, 1000, video_framerate, current_pid, 0, 0, backup_context);
-                                                   backup_caller(2000, 1001, video_bitrate, current_pid, 0, 0, backup_context);
-                                               }
-                                               if (core_modified & 8) {
-                                                   backup_caller(2000, 1002,
-                                                                 tsdata->master_pmt_table[each_pmt].data_engine[pid_count].width,
-                                                                 tsdata->master_pmt_table[each_pmt].data_engine[pid_count].height,
-                                                                 current_pid, 0, backup_context);
-                                               }
-                                               if (core_modified & 2) {
-                                                   backup_caller(2000, 1003,
-                                                                 aspect_ratio,
-                                                                 seqtype,
-                                                                 current_pid,
-                                                                 0,
-                                                                 backup_context);
-                                               }
-                                               send_frame_func(video_frame, video_frame_size, STREAM_TYPE_MPEG2, is_intra,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
-                                                               0, // PCR
-                                                               tsdata->source,
-                                                               0, // sub-source is 0 for video
-                                                               (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
-                                                               send_frame_context);
-                                           } else if (stream_type == 0x0f) {
-                                               uint8_t *audio_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
-                                               send_frame_func(audio_frame, video_frame_size, STREAM_TYPE_AAC, 1,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
-                                                               0, // PCR
-                                                               tsdata->source,
-                                                               tsdata->master_pmt_table[each_pmt].audio_stream_index[pid_count],  //sub-source
-                                                               (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
-                                                               send_frame_context);
-                                           } else if (stream_type == 0x81) {
-                                               uint8_t *audio_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
-                                               send_frame_func(audio_frame, video_frame_size, STREAM_TYPE_AC3, 1,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
-                                                               0, // PCR
-                                                               tsdata->source,
-                                                               tsdata->master_pmt_table[each_pmt].audio_stream_index[pid_count], //sub-source
-                                                               (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
-                                                               send_frame_context);
-                                           } else if (stream_type == 0x04) {
-                                               uint8_t *audio_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
-                                               send_frame_func(audio_frame, video_frame_size, STREAM_TYPE_MPEG, 1,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
-                                                               0, // PCR
-                                                               tsdata->source,
-                                                               tsdata->master_pmt_table[each_pmt].audio_stream_index[pid_count], //sub-source
-                                                               (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
-                                                               send_frame_context);
-                                           } else if (stream_type == 0x86) {
-                                               // do nothing- scte35 handled elsewhere
-                                           } else if (stream_type == 0x24) {
-                                               int vf;
-                                               int nal_type;
-                                               int is_intra = 0;
-                                               video_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
-                                               for (vf = 0; vf < video_frame_size - 4; vf++) {
-                                                   if (video_frame[vf] == 0x00 &&
-                                                       video_frame[vf+1] == 0x00 &&
-                                                       video_frame[vf+2] == 0x01) {
-                                                       nal_type = (video_frame[vf+3] & 0x7f) >> 1;
-                                                       if (nal_type == 20 || nal_type == 19) {
-                                                           is_intra = 1;
-                                                           if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count == 0) {
-                                                               tsdata->first_frame_intra = 1;
-                                                               is_intra = 1;
-                                                           }
-                                                           break;
-                                                       }
-                                                   }
-                                               }
-
-                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count++;
-
-                                               send_frame_func(video_frame, video_frame_size, STREAM_TYPE_HEVC, is_intra,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
-                                                               0, // PCR
-                                                               tsdata->source,
-                                                               0, // sub-source is 0 for video
-                                                               (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
-                                                               send_frame_context);
-                                           } else if (stream_type == 0x1b) {
-                                               int vf;
-                                               int nal_type;
-                                               int is_intra = 0;
-                                               video_frame = (unsigned char*)tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer;
-                                               for (vf = 0; vf < video_frame_size - 4; vf++) {
-                                                   if (video_frame[vf] == 0x00 &&
-                                                       video_frame[vf+1] == 0x00 &&
-                                                       video_frame[vf+2] == 0x01) {
-                                                       nal_type = video_frame[vf+3] & 0x1f;
-                                                       //fprintf(stderr,"nal_type:0x%x\n", nal_type);
-                                                       if (nal_type == 0x05 || nal_type == 0x07 || nal_type == 0x08) {
-                                                           is_intra = 1;
-                                                           if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count == 0) {
-                                                               tsdata->first_frame_intra = 1;
-                                                               is_intra = 1;
-                                                           }
-                                                           break;
-                                                       }
-                                                   }
-                                               }
-
-                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].video_frame_count++;
-
-                                               send_frame_func(video_frame, video_frame_size, STREAM_TYPE_H264, is_intra,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts,
-                                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts,
-                                                               0, // PCR
-                                                               tsdata->source,
-                                                               0, // sub-source is 0 for video
-                                                               (char*)&tsdata->master_pmt_table[each_pmt].decoded_language_tag[pid_count].lang_tag[0],
-                                                               send_frame_context);
-                                           }
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index = 0;
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = 0;
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = 0;
-                                       }
+                       each_pmt = stream_select;
+                       pid_count = tsdata->pid_index[current_pid].stream_index;
+                       if (pid_count >= 0) {
+                           int last_cc;
+                           int pes_length;
+                           int check0 = *(pdata+6);
+                           int check1 = *(pdata+7);
+
+                           if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index > 0) {
+                               send_pes_frame(tsdata, each_pmt, pid_count, current_pid,
+                                              tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index,
+                                              receive_time);
+                           }
 
-                                       last_cc = tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc;
-                                       if (last_cc == -1) {
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
-                                       } else {
-                                           int expected_continuity;
-
-                                           expected_continuity = (last_cc + 1) % 16;
-                                           if (expected_continuity != cc) {
-                                               backup_caller(2000, 900+cc,
-                                                             expected_continuity, current_pid,
-                                                             total_input_packets, 0, backup_context);
-                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].corruption_count++;
-                                           }
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
-                                       }
-                                       pes_length = (*(pdata+4) << 8) + *(pdata+5);
-                                       if (pes_length) {
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].wanted_data_size = pes_length;
-                                       }
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].actual_data_size = 0;
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].context = NULL;
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = 0;
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = 0;
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index = 0;
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].flags = 0;
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pes_aligned = 0;
-
-                                       int pes_header_size;
-                                       int pes_aligned;
-                                       int timestamp_present;
-                                       int remaining_samples = 0;
-
-                                       pes_header_size = *(pdata+8);
-                                       if (pes_header_size > 184) {
-                                           backup_caller(2000, 916, current_pid, 0, 0, 0, backup_context);
-                                           goto continue_packet_processing;
-                                       }
-                                       pes_aligned = (check0 & 0x04) >> 3;
-                                       tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pes_aligned = pes_aligned;
-                                       pdata += 9;
-                                       timestamp_present = (check1 & 0xc0) >> 6;
-                                       if (timestamp_present == 1) {
-                                           backup_caller(2000, 917, current_pid, 0, 0, 0, backup_context);
-                                           goto continue_packet_processing;
-                                       } else if (timestamp_present == 2) {
-                                           int64_t current_pts;
-                                           int stream_count;
-                                           int pid_index;
-
-                                           current_pts = (*(pdata+0) >> 1) & 0x07;
-                                           current_pts <<= 8;
-                                           current_pts |= *(pdata+1);
-                                           current_pts <<= 7;
-                                           current_pts |= (*(pdata+2) >> 1) & 0x7f;
-                                           current_pts <<= 8;
-                                           current_pts |= *(pdata+3);
-                                           current_pts <<= 7;
-                                           current_pts |= (*(pdata+4) >> 1) & 0x7f;
-
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = current_pts;
-
-                                           stream_count = tsdata->master_pmt_table[each_pmt].stream_count;
-                                           for (pid_index = 0; pid_index < stream_count; pid_index++) {
-                                               if (tsdata->master_pmt_table[each_pmt].stream_pid[pid_index] == current_pid) {
-                                                   tsdata->master_pmt_table[each_pmt].last_pts[pid_index] = current_pts;
-                                                   if (tsdata->master_pmt_table[each_pmt].first_pts[pid_index] == -1) {
-                                                       tsdata->master_pmt_table[each_pmt].first_pts[pid_index] = current_pts;
-                                                       break;
-                                                   }
-                                               }
-                                           }
-                                       } else if (timestamp_present == 3) {
-                                           int64_t current_pts;
-                                           int64_t current_dts;
-                                           int stream_count;
-                                           int pid_index;
-
-                                           current_pts = (*(pdata+0) >> 1) & 0x07;
-                                           current_pts <<= 8;
-                                           current_pts |= *(pdata+1);
-                                           current_pts <<= 7;
-                                           current_pts |= (*(pdata+2) >> 1) & 0x7f;
-                                           current_pts <<= 8;
-                                           current_pts |= *(pdata+3);
-                                           current_pts <<= 7;
-                                           current_pts |= (*(pdata+4) >> 1) & 0x7f;
-
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = current_pts;
-
-                                           stream_count = tsdata->master_pmt_table[each_pmt].stream_count;
-                                           for (pid_index = 0; pid_index < stream_count; pid_index++) {
-                                               if (tsdata->master_pmt_table[each_pmt].stream_pid[pid_index] == current_pid) {
-                                                   tsdata->master_pmt_table[each_pmt].last_pts[pid_index] = current_pts;
-                                                   if (tsdata->master_pmt_table[each_pmt].first_pts[pid_index] == -1) {
-                                                       tsdata->master_pmt_table[each_pmt].first_pts[pid_index] = current_pts;
-                                                       break;
-                                                   }
-                                               }
-                                           }
+                           last_cc = tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc;
+                           if (last_cc == -1) {
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
+                           } else {
+                               int expected_continuity;
+
+                               expected_continuity = (last_cc + 1) % 16;
+                               if (expected_continuity != cc) {
+                                   tsdata->callbacks.message_callback(2000, 900+cc,
+                                                 expected_continuity, current_pid,
+                                                 tsdata->total_input_packets, 0, tsdata->context);
+                                   tsdata->master_pmt_table[each_pmt].data_engine[pid_count].corruption_count++;
+                               }
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
+                           }
+                           pes_length = (*(pdata+4) << 8) + *(pdata+5);
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].wanted_data_size = 0;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].actual_data_size = 0;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].context = NULL;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = 0;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = 0;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index = 0;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].flags = 0;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pes_aligned = 0;
+
+                           int pes_header_size;
+                           int pes_aligned;
+                           int timestamp_present;
+                           int remaining_samples = 0;
+
+                           pes_header_size = *(pdata+8);
+                           if (pes_header_size > 184) {
+                               tsdata->callbacks.message_callback(2000, 916, current_pid, 0, 0, 0, tsdata->context);
+                               goto continue_packet_processing;
+                           }
+                           // bounded pes- payload is everything after the optional header fields
+                           if (pes_length > 3 + pes_header_size) {
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].wanted_data_size = pes_length - 3 - pes_header_size;
+                           }
+                           pes_aligned = (check0 & 0x04) >> 3;
+                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pes_aligned = pes_aligned;
+                           pdata += 9;
+                           timestamp_present = (check1 & 0xc0) >> 6;
+                           if (timestamp_present == 1) {
+                               tsdata->callbacks.message_callback(2000, 917, current_pid, 0, 0, 0, tsdata->context);
+                               goto continue_packet_processing;
+                           } else if (timestamp_present == 2) {
+                               int64_t current_pts;
+
+                               current_pts = (*(pdata+0) >> 1) & 0x07;
+                               current_pts <<= 8;
+                               current_pts |= *(pdata+1);
+                               current_pts <<= 7;
+                               current_pts |= (*(pdata+2) >> 1) & 0x7f;
+                               current_pts <<= 8;
+                               current_pts |= *(pdata+3);
+                               current_pts <<= 7;
+                               current_pts |= (*(pdata+4) >> 1) & 0x7f;
+
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = current_pts;
+
+                               tsdata->master_pmt_table[each_pmt].last_pts[pid_count] = current_pts;
+                               if (tsdata->master_pmt_table[each_pmt].first_pts[pid_count] == -1) {
+                                   tsdata->master_pmt_table[each_pmt].first_pts[pid_count] = current_pts;
+                               }
+                           } else if (timestamp_present == 3) {
+                               int64_t current_pts;
+                               int64_t current_dts;
+
+                               current_pts = (*(pdata+0) >> 1) & 0x07;
+                               current_pts <<= 8;
+                               current_pts |= *(pdata+1);
+                               current_pts <<= 7;
+                               current_pts |= (*(pdata+2) >> 1) & 0x7f;
+                               current_pts <<= 8;
+                               current_pts |= *(pdata+3);
+                               current_pts <<= 7;
+                               current_pts |= (*(pdata+4) >> 1) & 0x7f;
+
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = current_pts;
+
+                               tsdata->master_pmt_table[each_pmt].last_pts[pid_count] = current_pts;
+                               if (tsdata->master_pmt_table[each_pmt].first_pts[pid_count] == -1) {
+                                   tsdata->master_pmt_table[each_pmt].first_pts[pid_count] = current_pts;
+                               }
 
-                                           current_dts = (*(pdata+5) >> 1) & 0x07;
-                                           current_dts <<= 8;
-                                           current_dts |= *(pdata+6);
-                                           current_dts <<= 7;
-                                           current_dts |= (*(pdata+7) >> 1) & 0x7f;
-                                           current_dts <<= 8;
-                                           current_dts |= *(pdata+8);
-                                           current_dts <<= 7;
-                                           current_dts |= (*(pdata+9) >> 1) & 0x7f;
-
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = current_dts;
-                                           for (pid_index = 0; pid_index < stream_count; pid_index++) {
-                                               if (tsdata->master_pmt_table[each_pmt].stream_pid[pid_index] == current_pid) {
-                                                   tsdata->master_pmt_table[each_pmt].last_dts[pid_index] = current_dts;
-                                                   if (tsdata->master_pmt_table[each_pmt].first_dts[pid_index] == -1) {
-                                                       tsdata->master_pmt_table[each_pmt].first_dts[pid_index] = current_dts;
-                                                       break;
-                                                   }
-                                               }
-                                           }
-                                       } else {
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = 0;
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = 0;
-                                       }
+                               current_dts = (*(pdata+5) >> 1) & 0x07;
+                               current_dts <<= 8;
+                               current_dts |= *(pdata+6);
+                               current_dts <<= 7;
+                               current_dts |= (*(pdata+7) >> 1) & 0x7f;
+                               current_dts <<= 8;
+                               current_dts |= *(pdata+8);
+                               current_dts <<= 7;
+                               current_dts |= (*(pdata+9) >> 1) & 0x7f;
+
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = current_dts;
+                               tsdata->master_pmt_table[each_pmt].last_dts[pid_count] = current_dts;
+                               if (tsdata->master_pmt_table[each_pmt].first_dts[pid_count] == -1) {
+                                   tsdata->master_pmt_table[each_pmt].first_dts[pid_count] = current_dts;
+                               }
+                           } else {
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].dts = 0;
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].pts = 0;
+                           }
 
-                                       pdata += pes_header_size;
-                                       remaining_samples = 184 - 9 - pes_header_size - adaptation_size;
-                                       if (remaining_samples < 0) {
-                                           goto continue_packet_processing;
-                                       }
-                                       if (remaining_samples > 0) {
-                                           if (remaining_samples >= 184) {
-                                               goto continue_packet_processing;
-                                           }
-                                           if (!tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer) {
-                                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer = (unsigned char *)malloc(MAX_BUFFER_SIZE);
-                                           }
-                                           if (remaining_samples <= MAX_BUFFER_SIZE) {
-                                               memcpy(tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer, pdata, remaining_samples);
-                                           }
-                                           tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index = remaining_samples;
-                                       }
-                                       goto continue_packet_processing;
-                                   }
+                           pdata += pes_header_size;
+                           remaining_samples = 184 - 9 - pes_header_size - adaptation_size;
+                           if (remaining_samples < 0) {
+                               goto continue_packet_processing;
+                           }
+                           if (remaining_samples > 0) {
+                               if (remaining_samples >= 184) {
+                                   goto continue_packet_processing;
+                               }
+                               if (!tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer) {
+                                   tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer = (unsigned char *)malloc(MAX_BUFFER_SIZE);
+                               }
+                               if (remaining_samples <= MAX_BUFFER_SIZE) {
+                                   memcpy(tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer, pdata, remaining_samples);
                                }
+                               tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index = remaining_samples;
+                               check_pes_complete(tsdata, each_pmt, pid_count, current_pid, receive_time);
                            }
+                           goto continue_packet_processing;
                        }
 
                          if (current_pid == 0) {
@@ -1195,39 +1383,38 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
 
                               if (tsdata->master_pat_table.max_pat_time == 0) {
                                   tsdata->master_pat_table.min_pat_time = 999999999;
-                                  gettimeofday(&tsdata->master_pat_table.start_pat_time, NULL);
+                                  tsdata->master_pat_table.start_pat_time = receive_time;
                                   tsdata->master_pat_table.max_pat_time = 1;
-                                  //backup_caller(2000, 505, 1000, current_pid, 0, backup_context);
+                                  //tsdata->callbacks.message_callback(2000, 505, 1000, current_pid, 0, tsdata->context);
                               } else {
                                    int64_t delta_pat_time;
-                                   gettimeofday(&tsdata->master_pat_table.end_pat_time, NULL);
-                                   delta_pat_time = (int64_t)get_time_difference(&tsdata->master_pat_table.end_pat_time,
-                                                                                 &tsdata->master_pat_table.start_pat_time);
+                                   tsdata->master_pat_table.end_pat_time = receive_time;
+                                   delta_pat_time = tsdata->master_pat_table.end_pat_time - tsdata->master_pat_table.start_pat_time;
 
                                    if (delta_pat_time > tsdata->master_pat_table.max_pat_time) {
                                        tsdata->master_pat_table.max_pat_time = delta_pat_time;
                                        // SIGNAL NEW MAX PAT TIME TO GUI
-                                       // backup_caller(2000, 507, delta_pat_time, 0, 0, backup_context);
+                                       // tsdata->callbacks.message_callback(2000, 507, delta_pat_time, 0, 0, tsdata->context);
                                    }
                                    if (delta_pat_time < tsdata->master_pat_table.min_pat_time) {
                                        tsdata->master_pat_table.min_pat_time = delta_pat_time;
                                        // SIGNAL NEW MIN PAT TIME TO GUI
-                                       // backup_caller(2000, 508, delta_pat_time, 0, 0, backup_context);
+                                       // tsdata->callbacks.message_callback(2000, 508, delta_pat_time, 0, 0, tsdata->context);
                                    }
-                                   //backup_caller(2000, 505, delta_pmt_time / 1000, current_pid, 0, backup_context);
+                                   //tsdata->callbacks.message_callback(2000, 505, delta_pmt_time / 1000, current_pid, 0, tsdata->context);
                                    tsdata->master_pat_table.avg_pat_time += delta_pat_time;
                                    tsdata->master_pat_table.avg_pat_time /= 2;
-                                   gettimeofday(&tsdata->master_pat_table.start_pat_time, NULL);
+                                   tsdata->master_pat_table.start_pat_time = receive_time;
                               }
 
                               look_for_pmt_table = 0;
                               if (tsdata->pat_version_number == -1) {
-                                   tsdata->pat_position = total_input_packets;
+                                   tsdata->pat_position = tsdata->total_input_packets;
                                    tsdata->pat_version_number = version_number;
                                    tsdata->pat_program_count = section_entries;
                                    tsdata->pat_transport_stream_id = transport_stream_id;
                                    look_for_pmt_table = 1;
-                                   backup_caller(2000, 100, tsdata->pat_program_count, 0, 0, 0, backup_context);
+                                   tsdata->callbacks.message_callback(2000, 100, tsdata->pat_program_count, 0, 0, 0, tsdata->context);
                               }
 
                               if (version_number != tsdata->pat_version_number) {
@@ -1235,7 +1422,7 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                                    tsdata->pat_program_count = section_entries;
                                    tsdata->pat_transport_stream_id = transport_stream_id;
                                    look_for_pmt_table = 1;
-                                   backup_caller(2000, 100, tsdata->pat_program_count, 0, 0, 0, backup_context);
+                                   tsdata->callbacks.message_callback(2000, 100, tsdata->pat_program_count, 0, 0, 0, tsdata->context);
                               }
 
                               if (look_for_pmt_table == 1) {
@@ -1248,13 +1435,13 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                                                                              (unsigned long)*(pdata+entry_index+1));
 
                                         if (pat_program_number == 0) {
-                                            backup_caller(2000, 300, 0, 0, 0, 0, backup_context);
+                                            tsdata->callbacks.message_callback(2000, 300, 0, 0, 0, 0, tsdata->context);
                                         } else {
                                              pmt_pid = (unsigned short)((((unsigned long)*(pdata+entry_index+2) << 8)) |
                                                                         (unsigned long)(*(pdata+entry_index+3)));
                                              pmt_pid = pmt_pid & 0x1fff;
 
-                                             backup_caller(2000, 200, pmt_pid, 0, 0, 0, backup_context);
+                                             tsdata->callbacks.message_callback(2000, 200, pmt_pid, 0, 0, 0, tsdata->context);
                                              tsdata->pmt_pid_index[tsdata->pmt_pid_count] = pmt_pid;
                                              tsdata->pmt_pid_count++;
                                         }
@@ -1262,8 +1449,9 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
                                    }
 
                                    if (!tsdata->pmt_pid_count) {
-                                       backup_caller(2000, 202, 0, 0, 0, 0, backup_context);
+                                       tsdata->callbacks.message_callback(2000, 202, 0, 0, 0, 0, tsdata->context);
                                    }
+                                   build_pid_index(tsdata, stream_select);
                               }
                          }
                     } else { // NOT THE START
@@ -1275,98 +1463,94 @@ int decode_packets(uint8_t *transport_packet_data, int packet_count, transport_d
 
                          acquired_data_so_far = 184 - tempval;
 
-                         for (pid_count = 0; pid_count < tsdata->pmt_pid_count; pid_count++) {
-                              if (tsdata->pmt_pid_index[pid_count] == current_pid) {
-                                   if (tsdata->pmt_table_acquired > 0 &&
-                                             tsdata->pmt_table_acquired < MAX_TABLE_SIZE &&
-                                             tsdata->pmt_table_expected > 0) {
-                                        int pmt_bytes_remaining = tsdata->pmt_table_expected - tsdata->pmt_table_acquired;
+                         pid_count = tsdata->pid_index[current_pid].pmt_index;
+                         if (pid_count >= 0) {
+                              if (tsdata->pmt_table_acquired > 0 &&
+                                        tsdata->pmt_table_acquired < MAX_TABLE_SIZE &&
+                                        tsdata->pmt_table_expected > 0) {
+                                   int pmt_bytes_remaining = tsdata->pmt_table_expected - tsdata->pmt_table_acquired;
 
-                                        if (tsdata->pmt_table_acquired + acquired_data_so_far > MAX_TABLE_SIZE) {
-                                             acquired_data_so_far = pmt_bytes_remaining;
-                                        }
-                                        memcpy(&tsdata->pmt_data[tsdata->pmt_table_acquired], pdata, acquired_data_so_far);
-                                        tsdata->pmt_table_acquired += acquired_data_so_far;
-
-                                        if (tsdata->pmt_table_acquired >= tsdata->pmt_table_expected) {
-                                             unsigned short crc_position;
-                                             unsigned long crc32_length;
-                                             unsigned long *pmt_crc1;
-                                             unsigned long calculated_crc;
-
-                                             tsdata->pmt_data_size = tsdata->pmt_table_expected;
-                                             crc_position = ((tsdata->pmt_data[2] << 8) + tsdata->pmt_data[3]) & 0x0fff;
-                                             crc32_length = crc_position - 1;
-                                             if (crc_position > 4 && crc_position < 1020) {
-                                                  unsigned long pmt_crc2;
-
-                                                  pmt_crc1 = (unsigned long*)&tsdata->pmt_data[crc_position];
-                                                  calculated_crc = getcrc32(&tsdata->pmt_data[1], crc32_length);
-                                                  calculated_crc ^= 0xffffffff;
-                                                  calculated_crc = htonl(calculated_crc);
-                                                  pmt_crc2 = (unsigned long)*pmt_crc1;
-                                                  pmt_crc2 ^= 0xffffffff;
-
-                                                  if (pmt_crc2 == calculated_crc) {
-                                                       int pmt_version = ((tsdata->pmt_data[6]) & 0x1e) >> 1;
-                                                       if (pmt_version != tsdata->pmt_version[pid_count] ||
-                                                           tsdata->pmt_version[pid_count] == -1) {
-                                                           tsdata->pmt_version[pid_count] = pmt_version;
-                                                           decode_pmt_table(&tsdata->master_pat_table, tsdata->master_pmt_table, tsdata->pmt_data, tsdata->pmt_data_size, current_pid);
-                                                       }
-                                                       tsdata->pmt_decoded[pid_count] = 1;
-                                                  } else {
-                                                      backup_caller(2000, 201, calculated_crc, 0, 0, 0, backup_context);
+                                   if (tsdata->pmt_table_acquired + acquired_data_so_far > MAX_TABLE_SIZE) {
+                                        acquired_data_so_far = pmt_bytes_remaining;
+                                   }
+                                   memcpy(&tsdata->pmt_data[tsdata->pmt_table_acquired], pdata, acquired_data_so_far);
+                                   tsdata->pmt_table_acquired += acquired_data_so_far;
+
+                                   if (tsdata->pmt_table_acquired >= tsdata->pmt_table_expected) {
+                                        unsigned short crc_position;
+                                        unsigned long crc32_length;
+                                        unsigned long *pmt_crc1;
+                                        unsigned long calculated_crc;
+
+                                        tsdata->pmt_data_size = tsdata->pmt_table_expected;
+                                        crc_position = ((tsdata->pmt_data[2] << 8) + tsdata->pmt_data[3]) & 0x0fff;
+                                        crc32_length = crc_position - 1;
+                                        if (crc_position > 4 && crc_position < 1020) {
+                                             unsigned long pmt_crc2;
+
+                                             pmt_crc1 = (unsigned long*)&tsdata->pmt_data[crc_position];
+                                             calculated_crc = getcrc32(&tsdata->pmt_data[1], crc32_length);
+                                             calculated_crc ^= 0xffffffff;
+                                             calculated_crc = htonl(calculated_crc);
+                                             pmt_crc2 = (unsigned long)*pmt_crc1;
+                                             pmt_crc2 ^= 0xffffffff;
+
+                                             if (pmt_crc2 == calculated_crc) {
+                                                  int pmt_version = ((tsdata->pmt_data[6]) & 0x1e) >> 1;
+                                                  if (pmt_version != tsdata->pmt_version[pid_count] ||
+                                                      tsdata->pmt_version[pid_count] == -1) {
+                                                      tsdata->pmt_version[pid_count] = pmt_version;
+                                                      decode_pmt_table(tsdata, tsdata->pmt_data, tsdata->pmt_data_size, current_pid);
+                                                      build_pid_index(tsdata, stream_select);
                                                   }
+                                                  tsdata->pmt_decoded[pid_count] = 1;
+                                             } else {
+                                                 tsdata->callbacks.message_callback(2000, 201, calculated_crc, 0, 0, 0, tsdata->context);
                                              }
-
-                                             tsdata->pmt_table_acquired = 0;
-                                             tsdata->pmt_table_expected = 0;
                                         }
-                                        goto continue_packet_processing;
+
+                                        tsdata->pmt_table_acquired = 0;
+                                        tsdata->pmt_table_expected = 0;
                                    }
+                                   goto continue_packet_processing;
                               }
                          }
 
-                         for (each_pmt = 0; each_pmt < tsdata->master_pat_table.pmt_table_entries; each_pmt++)  {
-                             if (each_pmt == stream_select && stream_select != -1) {
-                                 int stream_count = tsdata->master_pmt_table[each_pmt].stream_count;
-                                 for (pid_count = 0; pid_count < stream_count; pid_count++) {
-                                     if (tsdata->master_pmt_table[each_pmt].stream_pid[pid_count] == current_pid) {
-                                         int last_cc;
-
-                                         last_cc = tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc;
-                                         if (last_cc == -1) {
-                                             tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
-                                         } else {
-                                             int expected_continuity;
-                                             expected_continuity = (last_cc + 1) % 16;
-                                             if (expected_continuity != cc) {
-                                                 backup_caller(2000, 900+cc,
-                                                               expected_continuity, current_pid,
-                                                               total_input_packets, 0, backup_context);
-                                                 tsdata->master_pmt_table[each_pmt].data_engine[pid_count].corruption_count++;
-                                             }
-                                             tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
-                                         }
+                         each_pmt = stream_select;
+                         pid_count = tsdata->pid_index[current_pid].stream_index;
+                         if (pid_count >= 0) {
+                             int last_cc;
+
+                             last_cc = tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc;
+                             if (last_cc == -1) {
+                                 tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
+                             } else {
+                                 int expected_continuity;
+                                 expected_continuity = (last_cc + 1) % 16;
+                                 if (expected_continuity != cc) {
+                                     tsdata->callbacks.message_callback(2000, 900+cc,
+                                                   expected_continuity, current_pid,
+                                                   tsdata->total_input_packets, 0, tsdata->context);
+                                     tsdata->master_pmt_table[each_pmt].data_engine[pid_count].corruption_count++;
+                                 }
+                                 tsdata->master_pmt_table[each_pmt].data_engine[pid_count].last_cc = cc;
+                             }
 
-                                         if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index > 0) {
-                                             int remaining_samples = 184 - adaptation_size;
-                                             if (remaining_samples < 0) {
-                                                 goto continue_packet_processing;
-                                             }
-                                             if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index + remaining_samples <= MAX_BUFFER_SIZE) {
-                                                 memcpy(tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer +
-                                                        tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index,
-                                                        pdata,
-                                                        remaining_samples);
-                                                 tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index += remaining_samples;
-                                             }
-                                         }
-                                     }
+                             if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index > 0) {
+                                 int remaining_samples = 184 - adaptation_size;
+                                 if (remaining_samples < 0) {
+                                     goto continue_packet_processing;
                                  }
-                             }  // stream select
-                         } // each pmt
+                                 if (tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index + remaining_samples <= MAX_BUFFER_SIZE) {
+                                     memcpy(tsdata->master_pmt_table[each_pmt].data_engine[pid_count].buffer +
+                                            tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index,
+                                            pdata,
+                                            remaining_samples);
+                                     tsdata->master_pmt_table[each_pmt].data_engine[pid_count].data_index += remaining_samples;
+                                 }
+                                 check_pes_complete(tsdata, each_pmt, pid_count, current_pid, receive_time);
+                             }
+                         }
                    }// end of pusi
                }
           } // end of check for 0x47
@@ -1375,5 +1559,18 @@ continue_packet_processing:
           each_pmt = 0;
 
      } // end of for loop
+
+     update_pid_statistics(tsdata, receive_time);
      return 0;
 }
+
+int tsdemux_feed(void *demux, uint8_t *transport_packet_data, int packet_count, int64_t receive_time)
+{
+     transport_data_struct *tsdata = (transport_data_struct*)demux;
+
+     if (!tsdata) {
+          return -1;
+     }
+
+     return decode_packets(transport_packet_data, packet_count, tsdata, tsdata->stream_select, receive_time);
+}
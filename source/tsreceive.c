@@ -33,10 +33,13 @@
 #include <sys/stat.h>
 #include <sys/poll.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <math.h>
 #include <syslog.h>
+#include <errno.h>
 #include "fillet.h"
 #include "tsdecode.h"
 #include "mempool.h"
@@ -48,46 +51,66 @@
 static int source_count = 0;
 static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void *udp_source_thread(void *context)
+#define MAX_UDP_BUFFER_READ  UDP_MAX_DATAGRAM*UDP_MAX_BATCH
+#define NO_SIGNAL_TIMEOUT_MS 1000
+
+typedef struct _ingest_source_struct_ {
+    int                       active_source_index;
+    int                       udp_socket;
+    int64_t                   no_signal_counter;
+    int                       signal_seen;
+    int64_t                   open_time;
+    int                       first_packet_reported;
+    void                      *demux;
+} ingest_source_struct;
+
+static long get_resident_kb(void)
 {
-    fillet_app_struct *core = (fillet_app_struct*)context;
-    transport_data_struct *tsdata;
-    int udp_socket;
-    int timeout_ms = 1000;
-    fd_set sockset;
-    uint8_t *udp_buffer;
-    int udp_buffer_size;
-    int i;
-    int active_source_index;
-    int64_t no_signal_counter = 0;
-    int scanned;
-    int num_ipaddr0;
-    int num_ipaddr1;
-    int num_ipaddr2;
-    int num_ipaddr3;
-    int mcast_flag = 0;
-    char signal_msg[MAX_STR_SIZE];
+    FILE *statm;
+    long pages_total = 0;
+    long pages_resident = 0;
 
-#define MAX_UDP_BUFFER_READ 2048
-    pthread_mutex_lock(&start_lock);
+    statm = fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return -1;
+    }
+    if (fscanf(statm, "%ld %ld", &pages_total, &pages_resident) != 2) {
+        pages_resident = -1;
+    }
+    fclose(statm);
+    if (pages_resident < 0) {
+        return -1;
+    }
 
-    udp_buffer = (uint8_t*)malloc(MAX_UDP_BUFFER_READ);
-    udp_buffer_size = MAX_UDP_BUFFER_READ;
-    tsdata = (transport_data_struct*)malloc(sizeof(transport_data_struct));
+    return pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
 
-    memset(tsdata, 0, sizeof(transport_data_struct));
+static int ingest_source_open(fillet_app_struct *core, ingest_source_struct *ingest, int source_index)
+{
+    int scanned;
+    int num_ipaddr0 = 0;
+    int num_ipaddr1 = 0;
+    int num_ipaddr2 = 0;
+    int num_ipaddr3 = 0;
+    int mcast_flag = 0;
+
+    memset(ingest, 0, sizeof(ingest_source_struct));
+    ingest->udp_socket = -1;
+    ingest->active_source_index = source_index;
 
-    for (i = 0; i< MAX_ACTUAL_PIDS; i++) {
-         tsdata->initial_pcr_base[i] = -1;
+    ingest->open_time = demux_clock_now();
+    ingest->demux = tsdemux_create(&core->demux_callbacks, (void*)core, source_index, core->cd->stream_select);
+    if (!ingest->demux) {
+        return -1;
     }
-    tsdata->pat_program_count = -1;
-    tsdata->pat_version_number = -1;
-    tsdata->pat_transport_stream_id = -1;
-    tsdata->source = source_count;
-    core->input_signal = 0;
-    core->source_interruptions = 0;
 
-    scanned = sscanf(core->fillet_input[source_count].udp_source_ipaddr,"%3d.%3d.%3d.%3d",
+    fprintf(stderr,"SESSION:%d (TSRECEIVE) STATUS: SOURCE %d DEMUX STATE %ld KB, RESIDENT %ld KB\n",
+            core->session_id,
+            source_index,
+            (long)(tsdemux_state_size() / 1024),
+            get_resident_kb());
+
+    scanned = sscanf(core->fillet_input[source_index].udp_source_ipaddr,"%3d.%3d.%3d.%3d",
                      &num_ipaddr0,
                      &num_ipaddr1,
                      &num_ipaddr2,
@@ -105,113 +128,317 @@ void *udp_source_thread(void *context)
         mcast_flag = 1;
     }
 
-    udp_socket = socket_udp_open(core->fillet_input[source_count].interface,
-                                 core->fillet_input[source_count].udp_source_ipaddr,
-                                 core->fillet_input[source_count].udp_source_port,
-                                 mcast_flag, UDP_FLAG_INPUT, 1);
-    active_source_index = source_count;
+    ingest->udp_socket = socket_udp_open(core->fillet_input[source_index].interface,
+                                         core->fillet_input[source_index].udp_source_ipaddr,
+                                         core->fillet_input[source_index].udp_source_port,
+                                         mcast_flag, UDP_FLAG_INPUT, 1);
+    if (ingest->udp_socket < 0) {
+        return -1;
+    }
+    core->source_stream[source_index].udp_source_socket = ingest->udp_socket;
+
+    return 0;
+}
+
+static void ingest_source_close(ingest_source_struct *ingest)
+{
+    if (ingest->udp_socket > 0) {
+        socket_udp_close(ingest->udp_socket);
+    }
+    ingest->udp_socket = -1;
+    tsdemux_destroy(ingest->demux);
+    ingest->demux = NULL;
+}
+
+static void ingest_source_no_signal(fillet_app_struct *core, ingest_source_struct *ingest)
+{
+    int active_source_index = ingest->active_source_index;
+    char signal_msg[MAX_STR_SIZE];
+    int audio_stream;
+
+    syslog(LOG_WARNING,"SESSION:%d (TSRECEIVE) WARNING: NO SOURCE SIGNAL PRESENT (SOCKET:%d) %s:%d:%s (%ld)\n",
+           core->session_id,
+           ingest->udp_socket,
+           core->fillet_input[active_source_index].udp_source_ipaddr,
+           core->fillet_input[active_source_index].udp_source_port,
+           core->fillet_input[active_source_index].interface,
+           ingest->no_signal_counter);
+
+    fprintf(stderr,"SESSION:%d (TSRECEIVE) WARNING: NO SOURCE SIGNAL PRESENT (SOCKET:%d) %s:%d:%s (%ld)\n",
+            core->session_id,
+            ingest->udp_socket,
+            core->fillet_input[active_source_index].udp_source_ipaddr,
+            core->fillet_input[active_source_index].udp_source_port,
+            core->fillet_input[active_source_index].interface,
+            ingest->no_signal_counter);
+
+    for (audio_stream = 0; audio_stream < MAX_AUDIO_STREAMS; audio_stream++) {
+        core->decoded_source_info.decoded_audio_channels_input[audio_stream] = 0;
+        core->decoded_source_info.decoded_audio_channels_output[audio_stream] = 0;
+        core->decoded_source_info.decoded_audio_sample_rate[audio_stream] = 0;
+    }
+
+    if (core->input_signal == 1) {
+        core->source_interruptions++;
+    }
+    core->input_signal = 0;
+    ingest->no_signal_counter++;
+
+    snprintf(signal_msg, MAX_STR_SIZE-1, "%s:%d:%s",
+             core->fillet_input[active_source_index].udp_source_ipaddr,
+             core->fillet_input[active_source_index].udp_source_port,
+             core->fillet_input[active_source_index].interface);
+    send_signal(core, SIGNAL_NO_INPUT_SIGNAL, signal_msg);
+}
+
+static void ingest_source_receive(fillet_app_struct *core, ingest_source_struct *ingest, uint8_t *udp_buffer)
+{
+    int active_source_index = ingest->active_source_index;
+    char signal_msg[MAX_STR_SIZE];
+    int datagrams = 0;
+    int bytes;
+
+    bytes = socket_udp_read_batch(ingest->udp_socket, udp_buffer, UDP_MAX_DATAGRAM, UDP_MAX_BATCH, &datagrams);
+    if (datagrams > 0) {
+        core->source_stream[active_source_index].udp_read_calls++;
+        core->source_stream[active_source_index].udp_datagrams_received += datagrams;
+    }
+    if (bytes > 0) {
+        int total_packets = bytes / 188;
+        int64_t receive_time = demux_clock_now();
+
+        ingest->no_signal_counter = 0;
+        ingest->signal_seen = 1;
+        if (total_packets > 0) {
+            if (core->input_signal == 0) {
+                snprintf(signal_msg, MAX_STR_SIZE-1, "%s:%d:%s",
+                         core->fillet_input[active_source_index].udp_source_ipaddr,
+                         core->fillet_input[active_source_index].udp_source_port,
+                         core->fillet_input[active_source_index].interface);
+
+                send_signal(core, SIGNAL_INPUT_SIGNAL_LOCKED, signal_msg);
+                if (core->video_receive_time_set == 0) {
+                    core->video_receive_time_set = 1;
+                    clock_gettime(CLOCK_MONOTONIC, &core->video_receive_time);
+                }
+            }
+            core->input_signal = 1;
+            tsdemux_feed(ingest->demux, udp_buffer, total_packets, receive_time);
+
+            if (!ingest->first_packet_reported) {
+                long resident_kb = get_resident_kb();
+
+                ingest->first_packet_reported = 1;
+                syslog(LOG_INFO,"SESSION:%d (TSRECEIVE) STATUS: SOURCE %d FIRST PACKET AFTER %ld MS, RESIDENT %ld KB\n",
+                       core->session_id,
+                       active_source_index,
+                       (long)((receive_time - ingest->open_time) / 1000),
+                       resident_kb);
+                fprintf(stderr,"SESSION:%d (TSRECEIVE) STATUS: SOURCE %d FIRST PACKET AFTER %ld MS, RESIDENT %ld KB\n",
+                        core->session_id,
+                        active_source_index,
+                        (long)((receive_time - ingest->open_time) / 1000),
+                        resident_kb);
+            }
+        }
+    }
+}
+
+void *udp_source_thread(void *context)
+{
+    fillet_app_struct *core = (fillet_app_struct*)context;
+    ingest_source_struct ingest;
+    int timeout_ms = NO_SIGNAL_TIMEOUT_MS;
+    fd_set sockset;
+    uint8_t *udp_buffer;
+    int err;
+
+    pthread_mutex_lock(&start_lock);
+
+    udp_buffer = (uint8_t*)malloc(MAX_UDP_BUFFER_READ);
+    core->input_signal = 0;
+    core->source_interruptions = 0;
 
+    err = ingest_source_open(core, &ingest, source_count);
     source_count++;
-    memset(tsdata->pmt_version, -1, sizeof(tsdata->pmt_version));
 
     pthread_mutex_unlock(&start_lock);
 
-    if (udp_socket < 0) {
+    if (err < 0 || !udp_buffer) {
         core->source_running = 0;
         goto _cleanup_udp_source_thread;
     }
 
     syslog(LOG_INFO,"SESSION:%d (TSRECEIVE) STATUS: NETWORK THREAD IS STARTING - SOCKET:%d\n",
            core->session_id,
-           udp_socket);
+           ingest.udp_socket);
 
     while (1) {
         int is_thread_running;
         int anysignal;
 
         is_thread_running = core->source_running;
-        if (!is_thread_running || udp_socket < 0) {
+        if (!is_thread_running || ingest.udp_socket < 0) {
             core->source_running = 0;
             core->video_receive_time_set = 0;
             syslog(LOG_INFO,"SESSION:%d (TSRECEIVE) STATUS: NETWORK THREAD IS EXITING: FLAG=%d SOCKET=%d\n",
                    core->session_id,
                    is_thread_running,
-                   udp_socket);
+                   ingest.udp_socket);
             goto _cleanup_udp_source_thread;
         }
 
-        anysignal = socket_udp_ready(udp_socket, timeout_ms, &sockset);
+        anysignal = socket_udp_ready(ingest.udp_socket, timeout_ms, &sockset);
         if (anysignal == 0) {
-            syslog(LOG_WARNING,"SESSION:%d (TSRECEIVE) WARNING: NO SOURCE SIGNAL PRESENT (SOCKET:%d) %s:%d:%s (%ld)\n",
-                   core->session_id,
-                   udp_socket,
-                   core->fillet_input[active_source_index].udp_source_ipaddr,
-                   core->fillet_input[active_source_index].udp_source_port,
-                   core->fillet_input[active_source_index].interface,
-                   no_signal_counter);
-
-            fprintf(stderr,"SESSION:%d (TSRECEIVE) WARNING: NO SOURCE SIGNAL PRESENT (SOCKET:%d) %s:%d:%s (%ld)\n",
-                    core->session_id,
-                    udp_socket,
-                    core->fillet_input[active_source_index].udp_source_ipaddr,
-                    core->fillet_input[active_source_index].udp_source_port,
-                    core->fillet_input[active_source_index].interface,
-                    no_signal_counter);
-
-            int audio_stream;
-            for (audio_stream = 0; audio_stream < MAX_AUDIO_STREAMS; audio_stream++) {
-                core->decoded_source_info.decoded_audio_channels_input[audio_stream] = 0;
-                core->decoded_source_info.decoded_audio_channels_output[audio_stream] = 0;
-                core->decoded_source_info.decoded_audio_sample_rate[audio_stream] = 0;
-            }
+            ingest_source_no_signal(core, &ingest);
+            continue;
+        }
 
-            if (core->input_signal == 1) {
-                core->source_interruptions++;
-            }
-            core->input_signal = 0;
-            no_signal_counter++;
+        if (FD_ISSET(ingest.udp_socket, &sockset)) {
+            ingest_source_receive(core, &ingest, udp_buffer);
+        }
+    }
 
-            snprintf(signal_msg, MAX_STR_SIZE-1, "%s:%d:%s",
-                     core->fillet_input[active_source_index].udp_source_ipaddr,
-                     core->fillet_input[active_source_index].udp_source_port,
-                     core->fillet_input[active_source_index].interface);
-            send_signal(core, SIGNAL_NO_INPUT_SIGNAL, signal_msg);
+_cleanup_udp_source_thread:
+    ingest_source_close(&ingest);
+    free(udp_buffer);
 
-            continue;
+    pthread_mutex_lock(&start_lock);
+    source_count = 0;
+    pthread_mutex_unlock(&start_lock);
+
+    return NULL;
+}
+
+// single thread that owns every source socket in one epoll set
+// no signal detection is driven by a periodic timerfd instead of the select timeout-
+// a source that has not delivered anything since the previous tick is reported as lost
+void *udp_reactor_thread(void *context)
+{
+    fillet_app_struct *core = (fillet_app_struct*)context;
+    ingest_source_struct ingest[MAX_MUX_SOURCES];
+    struct epoll_event events[MAX_MUX_SOURCES+1];
+    struct epoll_event ev;
+    struct itimerspec tick;
+    uint8_t *udp_buffer = NULL;
+    int num_sources = core->cd->active_sources;
+    int epoll_fd = -1;
+    int timer_fd = -1;
+    int opened = 0;
+    int i;
+
+    core->input_signal = 0;
+    core->source_interruptions = 0;
+
+    if (num_sources > MAX_MUX_SOURCES) {
+        num_sources = MAX_MUX_SOURCES;
+    }
+
+    udp_buffer = (uint8_t*)malloc(MAX_UDP_BUFFER_READ);
+    if (!udp_buffer) {
+        syslog(LOG_ERR,"SESSION:%d (TSRECEIVE) ERROR: UNABLE TO ALLOCATE INGEST REACTOR BUFFER\n",
+               core->session_id);
+        core->source_running = 0;
+        goto _cleanup_udp_reactor_thread;
+    }
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        syslog(LOG_ERR,"SESSION:%d (TSRECEIVE) ERROR: UNABLE TO CREATE INGEST REACTOR EPOLL (%s)\n",
+               core->session_id, strerror(errno));
+        core->source_running = 0;
+        goto _cleanup_udp_reactor_thread;
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timer_fd < 0) {
+        syslog(LOG_ERR,"SESSION:%d (TSRECEIVE) ERROR: UNABLE TO CREATE INGEST REACTOR TIMER (%s)\n",
+               core->session_id, strerror(errno));
+        core->source_running = 0;
+        goto _cleanup_udp_reactor_thread;
+    }
+
+    for (opened = 0; opened < num_sources; opened++) {
+        if (ingest_source_open(core, &ingest[opened], opened) < 0) {
+            ingest_source_close(&ingest[opened]);
+            core->source_running = 0;
+            goto _cleanup_udp_reactor_thread;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &ingest[opened];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ingest[opened].udp_socket, &ev) < 0) {
+            syslog(LOG_ERR,"SESSION:%d (TSRECEIVE) ERROR: UNABLE TO ADD SOURCE %d TO INGEST REACTOR (%s)\n",
+                   core->session_id, opened, strerror(errno));
+            ingest_source_close(&ingest[opened]);
+            core->source_running = 0;
+            goto _cleanup_udp_reactor_thread;
         }
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+        syslog(LOG_ERR,"SESSION:%d (TSRECEIVE) ERROR: UNABLE TO ADD TIMER TO INGEST REACTOR (%s)\n",
+               core->session_id, strerror(errno));
+        core->source_running = 0;
+        goto _cleanup_udp_reactor_thread;
+    }
 
-        if (FD_ISSET(udp_socket, &sockset)) {
-            int bytes = socket_udp_read(udp_socket, udp_buffer, udp_buffer_size);
-            if (bytes > 0) {
-                no_signal_counter = 0;
-                int total_packets = bytes / 188;
-                if (total_packets > 0) {
-                    if (core->input_signal == 0) {
-                        snprintf(signal_msg, MAX_STR_SIZE-1, "%s:%d:%s",
-                                 core->fillet_input[active_source_index].udp_source_ipaddr,
-                                 core->fillet_input[active_source_index].udp_source_port,
-                                 core->fillet_input[active_source_index].interface);
-
-                        send_signal(core, SIGNAL_INPUT_SIGNAL_LOCKED, signal_msg);
-                        if (core->video_receive_time_set == 0) {
-                            core->video_receive_time_set = 1;
-                            clock_gettime(CLOCK_MONOTONIC, &core->video_receive_time);
-                        }
+    tick.it_value.tv_sec = NO_SIGNAL_TIMEOUT_MS / 1000;
+    tick.it_value.tv_nsec = (NO_SIGNAL_TIMEOUT_MS % 1000) * 1000000;
+    tick.it_interval = tick.it_value;
+    if (timerfd_settime(timer_fd, 0, &tick, NULL) < 0) {
+        syslog(LOG_ERR,"SESSION:%d (TSRECEIVE) ERROR: UNABLE TO ARM INGEST REACTOR TIMER (%s)\n",
+               core->session_id, strerror(errno));
+        core->source_running = 0;
+        goto _cleanup_udp_reactor_thread;
+    }
+
+    syslog(LOG_INFO,"SESSION:%d (TSRECEIVE) STATUS: INGEST REACTOR IS STARTING - SOURCES:%d\n",
+           core->session_id,
+           num_sources);
+
+    while (core->source_running) {
+        int ready;
+
+        ready = epoll_wait(epoll_fd, events, num_sources+1, NO_SIGNAL_TIMEOUT_MS);
+        for (i = 0; i < ready; i++) {
+            ingest_source_struct *src = (ingest_source_struct*)events[i].data.ptr;
+
+            if (src) {
+                ingest_source_receive(core, src, udp_buffer);
+            } else {
+                uint64_t expirations;
+                int n;
+
+                if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                    continue;
+                }
+                for (n = 0; n < num_sources; n++) {
+                    if (!ingest[n].signal_seen) {
+                        ingest_source_no_signal(core, &ingest[n]);
                     }
-                    core->input_signal = 1;
-                    decode_packets(udp_buffer, total_packets, tsdata, core->cd->stream_select);
+                    ingest[n].signal_seen = 0;
                 }
             }
         }
     }
 
-_cleanup_udp_source_thread:
-    if (udp_socket > 0) {
-        socket_udp_close(udp_socket);
-    }
-    free(tsdata);
+    core->video_receive_time_set = 0;
+    syslog(LOG_INFO,"SESSION:%d (TSRECEIVE) STATUS: INGEST REACTOR IS EXITING\n",
+           core->session_id);
 
-    source_count = 0;
+_cleanup_udp_reactor_thread:
+    for (i = 0; i < opened; i++) {
+        ingest_source_close(&ingest[i]);
+    }
+    if (timer_fd >= 0) {
+        close(timer_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    free(udp_buffer);
 
     return NULL;
 }
@@ -20,6 +20,10 @@
 
 ******************************************************************************/
 
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -286,6 +290,56 @@ int socket_udp_read(int udp_socket, uint8_t *buf, int size)
     return (int)bytes;
 }
 
+int socket_udp_read_batch(int udp_socket, uint8_t *buf, int slot_size, int max_datagrams, int *datagrams)
+{
+    struct mmsghdr msgs[UDP_MAX_BATCH];
+    struct iovec iovecs[UDP_MAX_BATCH];
+    int received;
+    int total_bytes = 0;
+    int i;
+
+    if (max_datagrams > UDP_MAX_BATCH) {
+        max_datagrams = UDP_MAX_BATCH;
+    }
+    if (max_datagrams < 1) {
+        max_datagrams = 1;
+    }
+
+    memset(msgs, 0, sizeof(struct mmsghdr)*max_datagrams);
+    for (i = 0; i < max_datagrams; i++) {
+        iovecs[i].iov_base = buf + (i * slot_size);
+        iovecs[i].iov_len = slot_size;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // the socket is already known to be readable, so take whatever is queued
+    received = recvmmsg(udp_socket, msgs, max_datagrams, MSG_DONTWAIT, NULL);
+    if (received <= 0) {
+        if (datagrams) {
+            *datagrams = 0;
+        }
+        return received;
+    }
+
+    // pack the whole transport packets of each datagram down into one contiguous run
+    for (i = 0; i < received; i++) {
+        int bytes = msgs[i].msg_len - (msgs[i].msg_len % 188);
+        if (bytes <= 0) {
+            continue;
+        }
+        if (buf + total_bytes != iovecs[i].iov_base) {
+            memmove(buf + total_bytes, iovecs[i].iov_base, bytes);
+        }
+        total_bytes += bytes;
+    }
+
+    if (datagrams) {
+        *datagrams = received;
+    }
+    return total_bytes;
+}
+
 int socket_udp_ready(int udp_socket, int timeout, fd_set *sockset)
 {
     int retcode;
@@ -262,8 +262,7 @@ void *webdav_upload_thread(void *context)
     while (webdav_upload_thread_running) {
         msg = (dataqueue_message_struct*)dataqueue_take_back(core->webdav_queue);
         while (!msg && webdav_upload_thread_running) {
-            usleep(100000);
-            msg = (dataqueue_message_struct*)dataqueue_take_back(core->webdav_queue);
+            msg = (dataqueue_message_struct*)dataqueue_take_back_wait(core->webdav_queue, QUEUE_WAIT_TIMEOUT);
         }
         if (webdav_upload_thread_running) {
             int buffer_type = msg->buffer_type;